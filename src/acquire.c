@@ -18,37 +18,59 @@
 
 #include "acquire.h"
 #include "defines.h"
+#include "fft.h"
+#include "fft_q15.h"
 #include "input.h"
+#include "profile.h"
+#include "trace.h"
 
-#define SYMBOLS 2
+#define SYMBOLS ACQ_SYMBOLS
 #define M (BLKSZ * SYMBOLS)
 
-void acquire_process(acquire_t *st)
-{
-    float complex max_v = 0;
-    float angle, max_mag = -1.0f;
-    unsigned int samperr = 0, i, j;
-    unsigned int mink = 0, maxk = FFT;
+static int fixed_point;
 
-    if (st->idx != FFTCP * (M + 1))
-        return;
+void acquire_set_fixed_point(int on)
+{
+    fixed_point = on;
+}
 
-    memset(st->sums, 0, sizeof(float complex) * FFTCP);
-    for (i = mink; i < maxk + CP; ++i)
+// accumulate the cyclic prefix correlation of each symbol as it arrives
+static void acquire_correlate(acquire_t *st)
+{
+    // a symbol is complete once the following FFT samples have arrived
+    while ((st->corr_sym + 1) * FFTCP + FFT <= st->idx && st->corr_cnt < M)
     {
-        for (j = 0; j < M; ++j)
-            st->sums[i] += st->buffer[i + j * FFTCP] * conjf(st->buffer[i + j * FFTCP + FFT]);
+        const cint16_t *buf = &st->buffer[st->corr_sym * FFTCP];
+        for (unsigned int i = 0; i < FFTCP; ++i)
+            st->sums[i] += cq15_to_cf(buf[i]) * conjf(cq15_to_cf(buf[i + FFT]));
+        st->corr_sym++;
+        st->corr_cnt++;
     }
+}
+
+// Find the symbol timing and phase in the correlation of M symbols, and
+// track the sample rate with it.
+static void acquire_estimate(acquire_t *st)
+{
+    float complex max_v = 0;
+    float angle, max_mag = -1.0f, sum_mag = 0;
+    unsigned int samperr = 0, i;
+    unsigned int mink = 0, maxk = FFT;
+    double complex v = 0;
+
+    // running sum over the CP window, kept in double to avoid drift
+    for (i = mink; i < mink + CP; ++i)
+        v += st->sums[i];
 
     for (i = mink; i < maxk - 1; ++i)
     {
         float mag;
-        float complex v = 0;
 
-        for (j = 0; j < CP; ++j)
-            v += st->sums[(i + j) % FFTCP];
+        if (i > mink)
+            v += st->sums[i + CP - 1] - st->sums[i - 1];
 
         mag = normf(v);
+        sum_mag += mag;
         if (mag > max_mag)
         {
             max_mag = mag;
@@ -57,6 +79,10 @@ void acquire_process(acquire_t *st)
         }
     }
 
+    // about 20 with a signal, below 8 on noise
+    if (sum_mag > 0)
+        stats_set(&st->input->stats.cp_ratio, max_mag / (sum_mag / (maxk - 1 - mink)));
+
     // limited to (-pi, pi)
     angle = cargf(max_v);
     if (st->prev_angle)
@@ -68,6 +94,7 @@ void acquire_process(acquire_t *st)
         angle = 0.5 * st->prev_angle + 0.5 * angle;
     }
     st->prev_angle = angle;
+    st->offset = samperr;
 
     // compare with previous timing offset
     if (abs((int)samperr - (int)st->history[(st->history_size-1) % ACQ_HISTORY]) > FFT/2)
@@ -77,17 +104,19 @@ void acquire_process(acquire_t *st)
     }
 
     st->history[st->history_size % ACQ_HISTORY] = samperr;
-    if (++st->history_size > ACQ_HISTORY)
+    if (++st->history_size > st->min_history)
     {
+        unsigned int n = st->history_size < ACQ_HISTORY ? st->history_size : ACQ_HISTORY;
         float avgerr, slope;
         int sum = 0;
-        for (i = 0; i < ACQ_HISTORY; i++)
+        for (i = 0; i < n; i++)
             sum += st->history[i];
-        avgerr = sum / (float)ACQ_HISTORY;
-        slope = ((float)samperr - avgerr) / (ACQ_HISTORY / 2 * SYMBOLS);
+        avgerr = sum / (float)n;
+        slope = ((float)samperr - avgerr) / (n / 2 * SYMBOLS);
         st->ready = 1;
         st->samperr = avgerr;
         st->slope = slope;
+        stats_set(&st->input->stats.timing_offset, avgerr);
 
         if ((st->history_size % ACQ_HISTORY) == 0)
             log_debug("Timing offset: %f, slope: %f", avgerr, slope);
@@ -114,45 +143,217 @@ void acquire_process(acquire_t *st)
         if (samperr > 7*FFT/8)
             input_set_skip(st->input, 6*FFT/8);
     }
+}
 
-    if (st->ready)
+// Transform the first count symbols of the window, symbol first of a window
+// of M, with the timing offset and angle, and hand them to sync.
+static void acquire_transform(acquire_t *st, unsigned int offset, float angle, unsigned int first, unsigned int count, fftwf_plan fft, uint64_t t)
+{
+    timing_t *timing = &st->input->timing;
+    uint64_t span;
+    unsigned int i;
+
+    // shape window and phase rotation within a symbol, modulated by
+    // (-1)^n so that the FFT output is already shifted
+    for (i = 0; i < FFTCP; ++i)
+        st->rot[i] = ((i & 1) ? -st->shape[i] : st->shape[i]) * fast_cexpf(angle * i / FFT);
+
+    for (i = 0; i < count; ++i)
     {
-        for (i = 0; i < M; ++i)
+        const cint16_t *buf = &st->buffer[i * FFTCP + offset];
+        float complex *in = &st->fftin[i * FFT];
+        int j;
+
+        for (j = 0; j < FFT; ++j)
+            in[j] = st->rot[j] * cq15_to_cf(buf[j]);
+        // overlap the tail of the symbol onto its cyclic prefix
+        for (; j < FFTCP; ++j)
+            in[j - FFT] += st->rot[j] * cq15_to_cf(buf[j]);
+    }
+
+    t = timing_end(timing, TIMING_ACQUIRE, t);
+    span = trace_begin();
+    fftwf_execute(fft);
+    trace_end(TRACE_FFT, span);
+    timing_end(timing, TIMING_FFT, t);
+
+    for (i = 0; i < count; ++i)
+    {
+        float complex *out = &st->fftout[i * FFT];
+        // when the last sample of the symbol arrived
+        uint64_t arrival = input_arrival(st->input, st->pos + (i + 1) * FFTCP + offset);
+        int j;
+
+        // phase rotation at the start of the symbol, applied after the
+        // FFT since it is constant over the symbol
+        float complex adj = fast_cexpf(angle * (first + i) * FFTCP / FFT);
+        for (j = 0; j < FFT; ++j)
+            out[j] *= adj;
+
+        sync_push(&st->input->sync, out, arrival);
+    }
+}
+
+static inline int16_t q15_round(float x)
+{
+    return (int16_t)lrintf(fminf(fmaxf(x * 32767.0f, -32767.0f), 32767.0f));
+}
+
+// acquire_transform in fixed point: each symbol is windowed into 32-bit
+// products, normalized to at most FFT_Q15_MAX, transformed in place and
+// handed to sync before the next.
+static void acquire_transform_q15(acquire_t *st, unsigned int offset, float angle, unsigned int first, unsigned int count, uint64_t t)
+{
+    timing_t *timing = &st->input->timing;
+    uint64_t fft_ns = 0;
+    unsigned int i;
+
+    for (i = 0; i < FFTCP; ++i)
+    {
+        float complex rot = ((i & 1) ? -st->shape[i] : st->shape[i]) * fast_cexpf(angle * i / FFT);
+        st->rot_q15[i].r = q15_round(crealf(rot));
+        st->rot_q15[i].i = q15_round(cimagf(rot));
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        const cint16_t *buf = &st->buffer[i * FFTCP + offset];
+        cint32_t *work = st->work;
+        int32_t max = 0, round;
+        uint64_t arrival, span, f;
+        float complex adj;
+        int shift = 0, exp;
+        int j;
+
+        // halved products, so that the overlapped two always fit
+        for (j = 0; j < FFT; ++j)
         {
-            int j;
-            for (j = 0; j < FFTCP; ++j)
-            {
-                int n = i * FFTCP + j;
-                float complex adj = fast_cexpf(angle * n / FFT);
-                if (j < CP)
-                    st->fftin[j] = st->shape[j] * adj * st->buffer[i * FFTCP + j + samperr];
-                else if (j < FFT)
-                    st->fftin[j] = adj * st->buffer[i * FFTCP + j + samperr];
-                else
-                    st->fftin[j - FFT] += st->shape[j] * adj * st->buffer[i * FFTCP + j + samperr];
-            }
-
-            fftwf_execute(st->fft);
-            fftshift(st->fftout, FFT);
-            sync_push(&st->input->sync, st->fftout);
+            work[j].r = (st->rot_q15[j].r * buf[j].r - st->rot_q15[j].i * buf[j].i) >> 1;
+            work[j].i = (st->rot_q15[j].r * buf[j].i + st->rot_q15[j].i * buf[j].r) >> 1;
         }
+        for (; j < FFTCP; ++j)
+        {
+            work[j - FFT].r += (st->rot_q15[j].r * buf[j].r - st->rot_q15[j].i * buf[j].i) >> 1;
+            work[j - FFT].i += (st->rot_q15[j].r * buf[j].i + st->rot_q15[j].i * buf[j].r) >> 1;
+        }
+        for (j = 0; j < FFT; ++j)
+        {
+            int32_t r = abs(work[j].r), im = abs(work[j].i);
+            if (r > max)
+                max = r;
+            if (im > max)
+                max = im;
+        }
+        while (((max + (shift ? 1 << (shift - 1) : 0)) >> shift) > FFT_Q15_MAX)
+            shift++;
+        round = shift ? 1 << (shift - 1) : 0;
+        for (j = 0; j < FFT; ++j)
+        {
+            st->fftq[j].r = (work[j].r + round) >> shift;
+            st->fftq[j].i = (work[j].i + round) >> shift;
+        }
+
+        f = timing_now(timing);
+        span = trace_begin();
+        exp = fft_q15(st->fftq);
+        trace_end(TRACE_FFT, span);
+        if (f)
+            fft_ns += timing_now(timing) - f;
+
+        // the products are of two Q15 values, halved; the phase rotation at
+        // the start of the symbol is applied with the scale
+        arrival = input_arrival(st->input, st->pos + (i + 1) * FFTCP + offset);
+        adj = fast_cexpf(angle * (first + i) * FFTCP / FFT);
+        sync_push_q15(&st->input->sync, st->fftq, adj * ldexpf(2.0f / (32767.0f * 32767.0f), shift + exp), arrival);
+        // the transforms, and sync without threads, are not acquire time
+        timing_hold(timing, TIMING_ACQUIRE, f);
     }
+    timing_end(timing, TIMING_ACQUIRE, t);
+    if (t)
+        timing_add(timing, TIMING_FFT, fft_ns);
+}
 
-    memmove(&st->buffer[0], &st->buffer[st->idx - FFTCP], sizeof(float complex) * FFTCP);
-    st->idx = FFTCP;
+// Once locked, transform a group as soon as its symbols have arrived.
+static unsigned int acquire_group(acquire_t *st, uint64_t t)
+{
+    if (st->corr_cnt == M)
+    {
+        acquire_estimate(st);
+        memset(st->sums, 0, sizeof(float complex) * FFTCP);
+        st->corr_cnt = 0;
+        acquire_correlate(st);
+    }
+
+    if (st->idx < (st->group + 1) * FFTCP)
+    {
+        timing_end(&st->input->timing, TIMING_ACQUIRE, t);
+        return 0;
+    }
+
+    // Sync expects the phase of each subcarrier to change smoothly over an
+    // L1 block, so the timing only changes, and the phase starts over,
+    // every M symbols as with whole windows, which sync aligns to blocks.
+    if (st->group_sym == 0)
+    {
+        st->group_offset = st->offset;
+        st->group_angle = st->prev_angle;
+    }
+    if (st->fixed)
+        acquire_transform_q15(st, st->group_offset, st->group_angle, st->group_sym, st->group, t);
+    else
+        acquire_transform(st, st->group_offset, st->group_angle, st->group_sym, st->group, st->group_fft, t);
+    st->group_sym = (st->group_sym + st->group) % M;
+    // the correlated symbols move with the window start
+    st->corr_sym -= st->group;
+    return st->group * FFTCP;
 }
 
-unsigned int acquire_push(acquire_t *st, float complex *buf, unsigned int length)
+unsigned int acquire_process(acquire_t *st, const cint16_t *buf, unsigned int length)
 {
-    unsigned int needed = FFTCP - st->idx % FFTCP;
+    timing_t *timing = &st->input->timing;
+    uint64_t t = timing_now(timing);
+
+    st->buffer = buf;
+    st->idx = length < ACQ_WINDOW ? length : ACQ_WINDOW;
+    acquire_correlate(st);
+
+    if (st->group)
+        return acquire_group(st, t);
 
-    if (length < needed)
+    if (st->idx != ACQ_WINDOW)
+    {
+        timing_end(timing, TIMING_ACQUIRE, t);
         return 0;
+    }
+
+    acquire_estimate(st);
+    if (st->ready)
+    {
+        if (st->fixed)
+            acquire_transform_q15(st, st->offset, st->prev_angle, 0, M, t);
+        else
+            acquire_transform(st, st->offset, st->prev_angle, 0, M, st->fft, t);
+        // later windows are handed over in groups
+        st->group = st->group_len;
+        st->group_sym = 0;
+    }
+    else
+        timing_end(timing, TIMING_ACQUIRE, t);
 
-    memcpy(&st->buffer[st->idx], buf, sizeof(float complex) * needed);
-    st->idx += needed;
+    // the last symbol starts the next window
+    memset(st->sums, 0, sizeof(float complex) * FFTCP);
+    st->corr_sym = 0;
+    st->corr_cnt = 0;
+    return M * FFTCP;
+}
 
-    return needed;
+void acquire_reset(acquire_t *st)
+{
+    memset(st->sums, 0, sizeof(float complex) * FFTCP);
+    st->corr_sym = 0;
+    st->corr_cnt = 0;
+    // the timing is stale once the window moved
+    st->group = 0;
 }
 
 void acquire_init(acquire_t *st, input_t *input)
@@ -160,15 +361,19 @@ void acquire_init(acquire_t *st, input_t *input)
     int i;
 
     st->input = input;
-    st->buffer = malloc(sizeof(float complex) * FFTCP * (M + 1));
-    st->sums = malloc(sizeof(float complex) * FFTCP);
+    st->buffer = NULL;
+    st->pos = 0;
+    st->sums = input_alloc(input, sizeof(float complex) * FFTCP);
+    st->corr_sym = 0;
+    st->corr_cnt = 0;
     st->idx = 0;
+    st->offset = 0;
     st->ready = 0;
     st->samperr = 0;
     st->slope = 0;
     st->prev_angle = 0;
 
-    st->shape = malloc(sizeof(float) * FFTCP);
+    st->shape = input_alloc(input, sizeof(float) * FFTCP);
     for (i = 0; i < FFTCP; ++i)
     {
         // The first CP samples overlap with last CP samples. Due to ISI, we
@@ -183,10 +388,63 @@ void acquire_init(acquire_t *st, input_t *input)
     }
 
     st->history_size = 0;
+    st->min_history = ACQ_HISTORY;
     for (i = 0; i < ACQ_HISTORY; ++i)
         st->history[i] = 0;
 
-    st->fftin = malloc(sizeof(float complex) * FFT);
-    st->fftout = malloc(sizeof(float complex) * FFT);
-    st->fft = fftwf_plan_dft_1d(FFT, st->fftin, st->fftout, FFTW_FORWARD, 0);
+    st->fixed = fixed_point;
+    st->rot = NULL;
+    st->rot_q15 = NULL;
+    st->work = NULL;
+    st->fftq = NULL;
+    st->fftin = NULL;
+    st->fftout = NULL;
+    st->fft = NULL;
+    if (st->fixed)
+    {
+        // a symbol at a time, no plans
+        fft_q15_init();
+        st->rot_q15 = input_alloc(input, sizeof(cint16_t) * FFTCP);
+        st->work = input_alloc(input, sizeof(cint32_t) * FFT);
+        st->fftq = input_alloc(input, sizeof(cint16_t) * FFT);
+    }
+    else
+    {
+        st->rot = input_alloc(input, sizeof(float complex) * FFTCP);
+        // one plan for all M symbols of a block
+        st->fftin = input_alloc(input, sizeof(float complex) * FFT * M);
+        if (profile_get()->fft_in_place)
+            st->fftout = st->fftin;
+        else
+            st->fftout = input_alloc(input, sizeof(float complex) * FFT * M);
+        st->fft = fft_plan_many(FFT, M, st->fftin, st->fftout);
+    }
+
+    st->group = 0;
+    st->group_sym = 0;
+    st->group_offset = 0;
+    st->group_angle = 0;
+    st->group_len = profile_get()->acq_group;
+    if (st->group_len && (st->group_len >= M || M % st->group_len != 0))
+        st->group_len = 0;
+    st->group_fft = NULL;
+    if (st->group_len && !st->fixed)
+        st->group_fft = fft_plan_many(FFT, st->group_len, st->fftin, st->fftout);
+}
+
+void acquire_free(acquire_t *st)
+{
+    if (st->fft)
+        fftwf_destroy_plan(st->fft);
+    if (st->group_fft)
+        fftwf_destroy_plan(st->group_fft);
+    free(st->sums);
+    free(st->shape);
+    free(st->rot);
+    free(st->rot_q15);
+    free(st->work);
+    free(st->fftq);
+    if (st->fftout != st->fftin)
+        free(st->fftout);
+    free(st->fftin);
 }
@@ -3,27 +3,83 @@
 #include <complex.h>
 #include <fftw3.h>
 
+#include "defines.h"
+
 #define ACQ_HISTORY 16
+// L1 blocks per acquisition window
+#define ACQ_SYMBOLS 2
+// samples in a window: the symbols of ACQ_SYMBOLS blocks and one more
+#define ACQ_WINDOW (FFTCP * (BLKSZ * ACQ_SYMBOLS + 1))
 
+/*
+ * Symbol timing and OFDM demodulation.
+ *
+ * A window of ACQ_SYMBOLS blocks is correlated against its cyclic prefix to
+ * find the symbol timing, and then transformed as a whole. Once the timing
+ * is locked, a profile may hand the symbols on in smaller groups instead:
+ * windows are still correlated as a whole, but transformed a group at a
+ * time, with the timing of the window before, as soon as the symbols of a
+ * group have arrived.
+ *
+ * With acquire_set_fixed_point(), the symbols are windowed and transformed
+ * in fixed point, one at a time, with fft_q15 instead of FFTW, and handed
+ * to sync as Q15 with the scale of each. The correlation, the timing
+ * estimate and sync stay in float.
+ */
 typedef struct
 {
     struct input_t *input;
-    float complex *buffer;
+    // current window, points into the input buffer, and its position in
+    // the available samples of the input
+    const cint16_t *buffer;
+    unsigned int pos;
     float complex *sums;
+    // next symbol to correlate from the window start, and symbols in sums
+    unsigned int corr_sym;
+    unsigned int corr_cnt;
     float complex *fftin;
     float complex *fftout;
     float *shape;
+    float complex *rot;
     fftwf_plan fft;
+    // fixed-point transform, see acquire_set_fixed_point(): the window and
+    // rotation in Q15, the windowed symbol, and its transform
+    int fixed;
+    cint16_t *rot_q15;
+    cint32_t *work;
+    cint16_t *fftq;
+    // symbols per group, 0 until the timing is locked, the group size of
+    // the profile, and its transform
+    unsigned int group;
+    unsigned int group_len;
+    fftwf_plan group_fft;
+    // symbol of the next group in a window of ACQ_SYMBOLS blocks, and the
+    // timing the window is transformed with
+    unsigned int group_sym;
+    unsigned int group_offset;
+    float group_angle;
 
     float samperr;
     float slope;
+    // latest timing offset within the symbol
+    unsigned int offset;
     unsigned int idx;
     int ready;
     int history[ACQ_HISTORY];
     unsigned int history_size;
+    // windows to average before the timing is trusted, at most ACQ_HISTORY
+    unsigned int min_history;
     float prev_angle;
 } acquire_t;
 
-void acquire_process(acquire_t *st);
-unsigned int acquire_push(acquire_t *st, float complex *buf, unsigned int length);
+// Process the window at buf, of which length samples have arrived. Returns
+// the number of samples the window start may advance by.
+unsigned int acquire_process(acquire_t *st, const cint16_t *buf, unsigned int length);
+// Transform the symbols of the decoders initialized afterwards in fixed
+// point if on is set, for processors whose floating point is slow. Not
+// thread-safe, like fft_set_effort.
+void acquire_set_fixed_point(int on);
+// Start over after the window start moved, with whole windows.
+void acquire_reset(acquire_t *st);
 void acquire_init(acquire_t *st, struct input_t *input);
+void acquire_free(acquire_t *st);
@@ -0,0 +1,178 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "affinity.h"
+
+// SCHED_FIFO priority of the input threads, below the usual priority of
+// audio servers and kernel threads
+#define AFFINITY_RT_PRIORITY 40
+
+static void cpus_add(cpus_t *set, unsigned int cpu)
+{
+    set->bits[cpu / 64] |= (uint64_t)1 << (cpu % 64);
+}
+
+static int cpus_has(const cpus_t *set, unsigned int cpu)
+{
+    return (set->bits[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+int affinity_parse(const char *list, cpus_t *set)
+{
+    const char *p = list;
+
+    memset(set, 0, sizeof(*set));
+    while (*p)
+    {
+        unsigned long first, last;
+        char *end;
+
+        if (!isdigit((unsigned char)*p))
+            return -1;
+        first = last = strtoul(p, &end, 10);
+        p = end;
+        if (*p == '-')
+        {
+            if (!isdigit((unsigned char)p[1]))
+                return -1;
+            last = strtoul(p + 1, &end, 10);
+            p = end;
+        }
+        if (first > last || last >= AFFINITY_MAX_CPUS || (*p != ',' && *p != 0 && *p != '\n'))
+            return -1;
+        for (unsigned long cpu = first; cpu <= last; ++cpu)
+            cpus_add(set, cpu);
+        if (*p == '\n')
+            break;
+        if (*p == ',')
+            p++;
+    }
+    return affinity_count(set) ? 0 : -1;
+}
+
+void affinity_all(cpus_t *set)
+{
+    memset(set, 0, sizeof(*set));
+#if defined(USE_THREADS) && defined(HAVE_PTHREAD_SETAFFINITY_NP)
+    cpu_set_t cpus;
+
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+    {
+        for (unsigned int cpu = 0; cpu < AFFINITY_MAX_CPUS && cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &cpus))
+                cpus_add(set, cpu);
+        return;
+    }
+#endif
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long cpu = 0; cpu < n && cpu < AFFINITY_MAX_CPUS; ++cpu)
+        cpus_add(set, cpu);
+}
+
+unsigned int affinity_count(const cpus_t *set)
+{
+    unsigned int count = 0;
+
+    for (unsigned int i = 0; i < AFFINITY_MAX_CPUS / 64; ++i)
+        count += __builtin_popcountll(set->bits[i]);
+    return count;
+}
+
+unsigned int affinity_nodes(const cpus_t *set, cpus_t *nodes)
+{
+    unsigned int count = 0;
+
+    for (unsigned int node = 0; node < AFFINITY_MAX_NODES; ++node)
+    {
+        char name[64], list[4096];
+        FILE *fp;
+        int ok;
+
+        snprintf(name, sizeof(name), "/sys/devices/system/node/node%u/cpulist", node);
+        fp = fopen(name, "r");
+        if (fp == NULL)
+            continue;
+        ok = fgets(list, sizeof(list), fp) != NULL && affinity_parse(list, &nodes[count]) == 0;
+        fclose(fp);
+        if (!ok)
+            continue;
+
+        for (unsigned int i = 0; i < AFFINITY_MAX_CPUS / 64; ++i)
+            nodes[count].bits[i] &= set->bits[i];
+        if (affinity_count(&nodes[count]))
+            count++;
+    }
+
+    if (count == 0)
+    {
+        nodes[0] = *set;
+        count = 1;
+    }
+    return count;
+}
+
+void affinity_share(const cpus_t *set, unsigned int i, unsigned int n, cpus_t *share)
+{
+    unsigned int count = affinity_count(set), per = n ? count / n : 0, k = 0;
+
+    if (per == 0)
+    {
+        *share = *set;
+        return;
+    }
+
+    memset(share, 0, sizeof(*share));
+    for (unsigned int cpu = 0; cpu < AFFINITY_MAX_CPUS; ++cpu)
+    {
+        if (!cpus_has(set, cpu))
+            continue;
+        if (k >= i * per && k < (i + 1) * per)
+            cpus_add(share, cpu);
+        k++;
+    }
+}
+
+int affinity_set_current(const cpus_t *set)
+{
+#if defined(USE_THREADS) && defined(HAVE_PTHREAD_SETAFFINITY_NP)
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    for (unsigned int cpu = 0; cpu < AFFINITY_MAX_CPUS && cpu < CPU_SETSIZE; ++cpu)
+        if (cpus_has(set, cpu))
+            CPU_SET(cpu, &cpus);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0 ? 0 : -1;
+#else
+    return -1;
+#endif
+}
+
+#ifdef USE_THREADS
+int affinity_set_realtime(pthread_t thread)
+{
+    struct sched_param param;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = AFFINITY_RT_PRIORITY;
+    return pthread_setschedparam(thread, SCHED_FIFO, &param) == 0 ? 0 : -1;
+}
+#endif
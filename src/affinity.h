@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+/*
+ * Placement of the decoder threads on CPUs.
+ *
+ * Threads start with the affinity of the thread that creates them, and Linux
+ * places memory on the node of the CPU that first touches it, so a station
+ * initialized while the main thread runs on the CPUs of one NUMA node keeps
+ * its threads and buffers on that node. Without pthread_setaffinity_np the
+ * sets are still computed, but no thread is pinned.
+ */
+#define AFFINITY_MAX_CPUS 1024
+#define AFFINITY_MAX_NODES 64
+
+typedef struct
+{
+    uint64_t bits[AFFINITY_MAX_CPUS / 64];
+} cpus_t;
+
+// Parse a list of CPUs and ranges such as 0-3,8,10-11. Returns -1 if the
+// list is invalid or empty.
+int affinity_parse(const char *list, cpus_t *set);
+// The CPUs this process may run on.
+void affinity_all(cpus_t *set);
+unsigned int affinity_count(const cpus_t *set);
+// The CPUs of set on each NUMA node that has some, at most
+// AFFINITY_MAX_NODES. Returns the number of nodes, 1 with all of set if the
+// system does not report them.
+unsigned int affinity_nodes(const cpus_t *set, cpus_t *nodes);
+// Part i of n equal parts of set in CPU order, or all of set if it has
+// fewer than n CPUs, so that n stations do not share cores.
+void affinity_share(const cpus_t *set, unsigned int i, unsigned int n, cpus_t *share);
+// Run the calling thread, and the threads it creates afterwards, on set.
+int affinity_set_current(const cpus_t *set);
+#ifdef USE_THREADS
+// Schedule thread with SCHED_FIFO, ahead of every normal thread. Needs
+// CAP_SYS_NICE or an rtprio limit.
+int affinity_set_realtime(pthread_t thread);
+#endif
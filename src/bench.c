@@ -0,0 +1,193 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Replay a capture through the decoder as fast as possible and report the
+ * throughput and latency of each pipeline stage.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "defines.h"
+#include "fft.h"
+#include "input.h"
+#include "trace.h"
+
+// bytes handed to input_cb at a time, as when reading from a file
+#define BENCH_CHUNK (512 * 1024)
+
+#ifdef USE_THREADS
+static void log_lock(void *udata, int lock)
+{
+    pthread_mutex_t *mutex = udata;
+    if (lock)
+        pthread_mutex_lock(mutex);
+    else
+        pthread_mutex_unlock(mutex);
+}
+#endif
+
+static void help(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [-l log-level] [-n passes] [-o audio-output] [-f adts|hdc] [-t trace-output] [-x] samples-input [program]\n", progname);
+}
+
+static double seconds(uint64_t ns)
+{
+    return ns / 1e9;
+}
+
+static void report(input_t *input, uint64_t samples, uint64_t wall_ns)
+{
+    double duration = (double)samples / NRSC5_SAMPLE_RATE;
+
+    printf("samples %llu (%.1f s of signal) in %.3f s\n", (unsigned long long)samples, duration, seconds(wall_ns));
+    printf("total    %8.2f Msamples/s, %.1fx realtime\n\n", samples / (wall_ns / 1e3), duration / seconds(wall_ns));
+
+    // throughput is what each stage would achieve on its own
+    printf("%-10s %8s %9s %11s %9s %9s %9s\n", "stage", "runs", "busy (s)", "Msamples/s", "realtime", "p50 (us)", "p99 (us)");
+    for (int i = 0; i < TIMING_STAGES; ++i)
+    {
+        const timing_stage_t *s = &input->timing.stage[i];
+
+        if (s->count == 0)
+        {
+            printf("%-10s %8s\n", timing_name(i), "-");
+            continue;
+        }
+        printf("%-10s %8lu %9.3f %11.2f %8.1fx %9.1f %9.1f\n", timing_name(i), s->count,
+               seconds(s->total_ns), samples / (s->total_ns / 1e3), duration / seconds(s->total_ns),
+               timing_percentile(s, 0.5) / 1e3, timing_percentile(s, 0.99) / 1e3);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *audio_name = "/dev/null", *format_name = "adts", *trace_name = NULL;
+    unsigned int program = 0, passes = 1;
+    input_t input;
+    output_t output;
+    struct stat sb;
+    uint8_t *data;
+    uint64_t start, end;
+    size_t len;
+    int opt, fd;
+
+    log_set_level(LOG_WARN);
+    while ((opt = getopt(argc, argv, "l:n:o:f:t:x")) != -1)
+    {
+        switch (opt)
+        {
+        case 'l':
+            log_set_level(atoi(optarg));
+            break;
+        case 'n':
+            passes = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            audio_name = optarg;
+            break;
+        case 'f':
+            format_name = optarg;
+            break;
+        case 't':
+            trace_name = optarg;
+            break;
+        case 'x':
+            // fixed-point transforms
+            acquire_set_fixed_point(1);
+            break;
+        default:
+            help(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind == argc || argc - optind > 2 || passes == 0)
+    {
+        help(argv[0]);
+        return 1;
+    }
+    if (argc - optind == 2)
+        program = strtoul(argv[optind + 1], NULL, 0);
+    if (program >= MAX_PROGRAMS)
+        FATAL_EXIT("Program must be 0 to %d.", MAX_PROGRAMS - 1);
+
+#ifdef USE_THREADS
+    pthread_mutex_t log_mutex;
+    pthread_mutex_init(&log_mutex, NULL);
+    log_set_lock(log_lock);
+    log_set_udata(&log_mutex);
+#endif
+
+    // map the whole capture up front, so that reading is not measured
+    fd = open(argv[optind], O_RDONLY);
+    if (fd < 0 || fstat(fd, &sb) != 0)
+        FATAL_EXIT("Unable to open %s.", argv[optind]);
+    len = sb.st_size & ~3;
+    if (len == 0)
+        FATAL_EXIT("%s is empty.", argv[optind]);
+    data = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (data == MAP_FAILED)
+        FATAL_EXIT("Unable to map %s.", argv[optind]);
+    close(fd);
+
+    if (strcmp(format_name, "adts") == 0)
+        output_init_adts(&output, audio_name);
+    else if (strcmp(format_name, "hdc") == 0)
+        output_init_hdc(&output, audio_name);
+    else
+        FATAL_EXIT("Unknown output format.");
+    // write audio in large blocks, so the disk is not part of the measurement
+    output_set_flush(&output, 1000);
+
+    // planning is not part of the measurement, but reuse wisdom anyway
+    fft_load_wisdom(NULL);
+    math_init();
+    if (trace_name && trace_open(trace_name) != 0)
+        FATAL_EXIT("Unable to open %s.", trace_name);
+    input_init(&input, &output, 0, program, NULL);
+    input.timing.enabled = 1;
+
+    start = timing_now(&input.timing);
+    for (unsigned int pass = 0; pass < passes; ++pass)
+    {
+        for (size_t pos = 0; pos < len; pos += BENCH_CHUNK)
+        {
+            size_t cnt = len - pos < BENCH_CHUNK ? len - pos : BENCH_CHUNK;
+            // input_cb does not modify the samples
+            input_cb((uint8_t *)&data[pos], cnt, &input);
+            input_wait(&input, 0);
+        }
+    }
+    input_wait(&input, 1);
+    output_flush(&output);
+    end = timing_now(&input.timing);
+
+    // u8 IQ, two bytes per sample
+    report(&input, (uint64_t)len / 2 * passes, end - start);
+    trace_close();
+
+    input_free(&input);
+    munmap(data, len);
+    return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Viterbi decoding of one P1 frame, of a batch of frames, and the cost of
+// segmented decoding and of tail-biting warm-up windows in time and bit errors
+
+#include <math.h>
+#include <string.h>
+
+#include "conv.h"
+#include "defines.h"
+#include "microbench.h"
+
+typedef struct
+{
+    struct vdecoder *dec;
+    int8_t *in;
+    uint8_t *out;
+} conv_bench_t;
+
+static void conv_op(void *arg)
+{
+    conv_bench_t *b = arg;
+    nrsc5_conv_decode(b->dec, b->in, b->out);
+}
+
+typedef struct
+{
+    struct vdecoder *dec;
+    int8_t *in[CONV_BATCH];
+    uint8_t *out[CONV_BATCH];
+    int ret[CONV_BATCH];
+} batch_bench_t;
+
+static void batch_op(void *arg)
+{
+    batch_bench_t *b = arg;
+    nrsc5_conv_decode_batch(b->dec, (const int8_t *const *)b->in, b->out, b->ret, CONV_BATCH);
+}
+
+// deviations of the noise added to soft bits of amplitude 96
+#define NOISE_LEVELS 3
+static const float noise_sigma[NOISE_LEVELS] = { 64, 96, 128 };
+static const int segment_counts[] = { 2, 4, 8 };
+static const int window_sizes[] = { 6, 12, 24, 96, 384 };
+
+static unsigned int get_bit(const uint8_t *bits, unsigned int i)
+{
+    return (bits[i >> 3] >> (i & 7)) & 1;
+}
+
+static float gaussian(uint32_t *seed)
+{
+    float u1 = (bench_random(seed) + 1.0f) / 4294967296.0f;
+    float u2 = bench_random(seed) / 4294967296.0f;
+    return sqrtf(-2 * logf(u1)) * cosf(2 * (float)M_PI * u2);
+}
+
+// Encode bits with the tail-biting P1 code into soft bits of amplitude 96
+// plus Gaussian noise, punctured like decode.c.
+static void encode(const uint8_t *bits, int8_t *in, float sigma, uint32_t *seed)
+{
+    static const unsigned int gen[3] = { 0133, 0171, 0165 };
+    unsigned int r = 0, j = 0;
+
+    for (unsigned int i = 0; i < 6; i++)
+        r = (r >> 1) | (get_bit(bits, FRAME_LEN - 6 + i) << 6);
+    for (unsigned int i = 0; i < FRAME_LEN; i++)
+    {
+        r = (r >> 1) | (get_bit(bits, i) << 6);
+        for (unsigned int g = 0; g < 3; g++, j++)
+        {
+            float v = (__builtin_parity(r & gen[g]) ? 96 : -96) + sigma * gaussian(seed);
+            in[j] = j % 6 == 5 ? 0 : (int8_t)fmaxf(-127, fminf(127, roundf(v)));
+        }
+    }
+}
+
+static unsigned int count_errors(const uint8_t *a, const uint8_t *b)
+{
+    unsigned int errors = 0;
+    for (unsigned int i = 0; i < FRAME_LEN / 8; ++i)
+        errors += __builtin_popcount(a[i] ^ b[i]);
+    return errors;
+}
+
+int main()
+{
+    conv_bench_t b;
+    uint8_t *ref = malloc(FRAME_LEN / 8);
+    uint32_t seed = 1;
+
+    // soft bits of random strength, every sixth one punctured
+    b.in = malloc(FRAME_LEN * 3);
+    b.out = malloc(FRAME_LEN / 8);
+    for (unsigned int i = 0; i < FRAME_LEN * 3; ++i)
+        b.in[i] = i % 6 == 5 ? 0 : (int8_t)(bench_random(&seed) % 255 - 127);
+
+    for (unsigned int v = 0; v < BENCH_VARIANTS; ++v)
+    {
+        if (!bench_select(v, CPU_SSSE3 | CPU_AVX2 | CPU_NEON))
+            continue;
+
+        b.dec = nrsc5_conv_alloc();
+        bench_run("conv_decode", bench_variants[v].name, conv_op, &b, FRAME_LEN * 3);
+
+        // every kernel must match the generic one bit for bit
+        if (v == 0)
+            memcpy(ref, b.out, FRAME_LEN / 8);
+        else if (memcmp(ref, b.out, FRAME_LEN / 8) != 0)
+            printf("%-12s %-8s output differs from generic\n", "conv_decode", bench_variants[v].name);
+        nrsc5_conv_free(b.dec);
+    }
+
+    // a full batch of noisy codewords, each checked against decoding it alone
+    batch_bench_t batch;
+    uint8_t *bits = malloc(FRAME_LEN / 8);
+    for (unsigned int i = 0; i < FRAME_LEN / 8; ++i)
+        bits[i] = bench_random(&seed);
+    for (unsigned int f = 0; f < CONV_BATCH; ++f)
+    {
+        uint32_t noise_seed = f + 1;
+
+        batch.in[f] = malloc(FRAME_LEN * 3);
+        batch.out[f] = malloc(FRAME_LEN / 8);
+        encode(bits, batch.in[f], noise_sigma[f % NOISE_LEVELS], &noise_seed);
+    }
+    for (unsigned int v = 0; v < BENCH_VARIANTS; ++v)
+    {
+        unsigned int differ = 0;
+        double ns;
+
+        if (!bench_select(v, CPU_SSE2 | CPU_SSSE3 | CPU_AVX2 | CPU_NEON))
+            continue;
+
+        batch.dec = nrsc5_conv_alloc();
+        ns = bench_run("conv_batch", bench_variants[v].name, batch_op, &batch, FRAME_LEN * 3 * CONV_BATCH);
+        for (unsigned int f = 0; f < CONV_BATCH; ++f)
+        {
+            if (nrsc5_conv_decode(batch.dec, batch.in[f], ref) != batch.ret[f] ||
+                memcmp(ref, batch.out[f], FRAME_LEN / 8) != 0)
+                differ++;
+        }
+        printf("%-12s %-8s %12.1f ns/frame, %u of %u frames differ from conv_decode\n",
+               "conv_batch", bench_variants[v].name, ns / CONV_BATCH, differ, CONV_BATCH);
+        nrsc5_conv_free(batch.dec);
+    }
+    for (unsigned int f = 0; f < CONV_BATCH; ++f)
+    {
+        free(batch.in[f]);
+        free(batch.out[f]);
+    }
+
+    // segmented decoding with the last kernel selected, on the random input
+    // for the time, then on noisy codewords against a whole-frame decode
+    struct vdecoder *whole = nrsc5_conv_alloc();
+    for (unsigned int s = 0; s < sizeof(segment_counts) / sizeof(segment_counts[0]); ++s)
+    {
+        char name[16];
+
+        b.dec = nrsc5_conv_alloc();
+        nrsc5_conv_set_segments(b.dec, segment_counts[s]);
+        snprintf(name, sizeof(name), "seg%d", segment_counts[s]);
+        bench_run("conv_decode", name, conv_op, &b, FRAME_LEN * 3);
+
+        for (unsigned int n = 0; n < NOISE_LEVELS; ++n)
+        {
+            unsigned int errors_whole, errors_seg, differ;
+            uint32_t noise_seed = n + 1;
+
+            encode(bits, b.in, noise_sigma[n], &noise_seed);
+            nrsc5_conv_decode(whole, b.in, ref);
+            conv_op(&b);
+            errors_whole = count_errors(bits, ref);
+            errors_seg = count_errors(bits, b.out);
+            differ = count_errors(ref, b.out);
+            printf("%-12s %-8s sigma %3.0f: ber %.6f, whole frame %.6f, %u bits differ\n",
+                   "conv_decode", name, noise_sigma[n], (double)errors_seg / FRAME_LEN,
+                   (double)errors_whole / FRAME_LEN, differ);
+        }
+        nrsc5_conv_free(b.dec);
+    }
+
+    // warm-up windows against a second full pass, window 0
+    nrsc5_conv_set_window(whole, 0);
+    for (unsigned int w = 0; w < sizeof(window_sizes) / sizeof(window_sizes[0]); ++w)
+    {
+        char name[16];
+
+        b.dec = nrsc5_conv_alloc();
+        nrsc5_conv_set_window(b.dec, window_sizes[w]);
+        snprintf(name, sizeof(name), "win%d", window_sizes[w]);
+        bench_run("conv_decode", name, conv_op, &b, FRAME_LEN * 3);
+
+        for (unsigned int n = 0; n < NOISE_LEVELS; ++n)
+        {
+            unsigned int errors_whole, errors_win, differ;
+            uint32_t noise_seed = n + 1;
+
+            encode(bits, b.in, noise_sigma[n], &noise_seed);
+            nrsc5_conv_decode(whole, b.in, ref);
+            conv_op(&b);
+            errors_whole = count_errors(bits, ref);
+            errors_win = count_errors(bits, b.out);
+            differ = count_errors(ref, b.out);
+            printf("%-12s %-8s sigma %3.0f: ber %.6f, window 0 %.6f, %u bits differ\n",
+                   "conv_decode", name, noise_sigma[n], (double)errors_win / FRAME_LEN,
+                   (double)errors_whole / FRAME_LEN, differ);
+        }
+        nrsc5_conv_free(b.dec);
+    }
+    nrsc5_conv_free(whole);
+    free(bits);
+
+    free(ref);
+    free(b.in);
+    free(b.out);
+    return 0;
+}
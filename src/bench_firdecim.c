@@ -0,0 +1,59 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Decimation of one front-end block of u8 IQ samples
+
+#include "firdecim_q15.h"
+#include "firdes.h"
+#include "microbench.h"
+
+// decimated samples per block, as in input.c
+#define BLOCK 1024
+
+typedef struct
+{
+    firdecim_q15 filter;
+    uint8_t x[BLOCK * 4];
+    cint16_t y[BLOCK];
+} firdecim_bench_t;
+
+static void firdecim_op(void *arg)
+{
+    firdecim_bench_t *b = arg;
+    firdecim_q15_execute_block(b->filter, b->x, BLOCK, b->y);
+}
+
+int main()
+{
+    static firdecim_bench_t b;
+    float taps[FIRDECIM_NUM_TAPS];
+    uint32_t seed = 1;
+
+    for (unsigned int i = 0; i < BLOCK * 4; ++i)
+        b.x[i] = bench_random(&seed);
+    firdes_kaiser(FIRDECIM_NUM_TAPS, 0.2f, 60.0f, 0.0f, taps);
+
+    for (unsigned int v = 0; v < BENCH_VARIANTS; ++v)
+    {
+        if (!bench_select(v, CPU_SSE2 | CPU_AVX2 | CPU_NEON))
+            continue;
+
+        b.filter = firdecim_q15_create(2, taps, FIRDECIM_NUM_TAPS);
+        bench_run("firdecim", bench_variants[v].name, firdecim_op, &b, sizeof(b.x));
+        firdecim_q15_destroy(b.filter);
+    }
+
+    return 0;
+}
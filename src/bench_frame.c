@@ -0,0 +1,57 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Frame assembly of one decoded P1 frame. The bits are random, so the
+ * first header does not correct and parsing stops there: this measures
+ * the bit unpacking and one failed Reed-Solomon decode, the fixed cost of
+ * every frame.
+ */
+
+#include "defines.h"
+#include "input.h"
+#include "microbench.h"
+
+typedef struct
+{
+    frame_t frame;
+    uint8_t bits[FRAME_LEN / 8];
+} frame_bench_t;
+
+static void frame_op(void *arg)
+{
+    frame_bench_t *b = arg;
+    frame_push(&b->frame, b->bits);
+}
+
+int main()
+{
+    static frame_bench_t b;
+    // frame only reports to the input, which has no outputs or callback
+    input_t *input = calloc(1, sizeof(*input));
+    uint32_t seed = 1;
+
+    log_set_level(LOG_FATAL);
+    for (unsigned int i = 0; i < FRAME_LEN / 8; ++i)
+        b.bits[i] = bench_random(&seed);
+
+    frame_init(&b.frame, input);
+    frame_set_program(&b.frame, 0);
+    bench_run("frame_push", "generic", frame_op, &b, FRAME_LEN / 8);
+
+    frame_free(&b.frame);
+    free(input);
+    return 0;
+}
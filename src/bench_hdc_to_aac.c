@@ -0,0 +1,107 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * HDC to AAC conversion of the packets in an HDC capture. HDC packets
+ * cannot be synthesized, so the input is a file written by nrsc5 -f hdc,
+ * e.g. from the sample capture.
+ */
+
+#include <string.h>
+
+#include "bitreader.h"
+#include "bitwriter.h"
+#include "defines.h"
+#include "microbench.h"
+
+// ADTS header written in front of each packet
+#define ADTS_HEADER 7
+#define MAX_PACKETS 4096
+
+void hdc_to_aac_init(void);
+void hdc_to_aac(bitreader_t *br, bitwriter_t *bw);
+
+typedef struct
+{
+    uint8_t *data;
+    unsigned int offset[MAX_PACKETS];
+    unsigned int len[MAX_PACKETS];
+    unsigned int count;
+    unsigned int next;
+} hdc_bench_t;
+
+static void hdc_op(void *arg)
+{
+    hdc_bench_t *b = arg;
+    unsigned int i = b->next;
+    uint8_t out[1024];
+    bitreader_t br;
+    bitwriter_t bw;
+
+    br_init(&br, &b->data[b->offset[i]], b->len[i]);
+    bw_init(&bw, out);
+    hdc_to_aac(&br, &bw);
+    bw_flush(&bw);
+
+    b->next = (i + 1) % b->count;
+}
+
+int main(int argc, char *argv[])
+{
+    static hdc_bench_t b;
+    unsigned long total = 0;
+    size_t size = 0, pos;
+    FILE *fp;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s hdc-input\n", argv[0]);
+        return 1;
+    }
+
+    fp = fopen(argv[1], "rb");
+    if (fp == NULL)
+        FATAL_EXIT("Unable to open %s.", argv[1]);
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    b.data = malloc(size);
+    if (fread(b.data, 1, size, fp) != size)
+        FATAL_EXIT("Unable to read %s.", argv[1]);
+    fclose(fp);
+
+    // the 13-bit frame length includes the header
+    for (pos = 0; pos + ADTS_HEADER <= size && b.count < MAX_PACKETS; )
+    {
+        const uint8_t *hdr = &b.data[pos];
+        unsigned int len = ((hdr[3] & 3) << 11) | (hdr[4] << 3) | (hdr[5] >> 5);
+
+        if (hdr[0] != 0xFF || (hdr[1] & 0xF0) != 0xF0 || len <= ADTS_HEADER || pos + len > size)
+            FATAL_EXIT("%s is not an HDC capture.", argv[1]);
+        b.offset[b.count] = pos + ADTS_HEADER;
+        b.len[b.count] = len - ADTS_HEADER;
+        total += len - ADTS_HEADER;
+        b.count++;
+        pos += len;
+    }
+    if (b.count == 0)
+        FATAL_EXIT("%s has no packets.", argv[1]);
+
+    hdc_to_aac_init();
+    bench_run("hdc_to_aac", "generic", hdc_op, &b, total / b.count);
+
+    free(b.data);
+    return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Resampling of one decimated front-end block
+
+#include <math.h>
+
+#include "microbench.h"
+#include "resamp_q15.h"
+
+// decimated samples per block, as in input.c
+#define BLOCK 1024
+
+typedef struct
+{
+    resamp_q15 resamp;
+    cint16_t x[BLOCK];
+    // a little slack for a rate above 1
+    cint16_t y[BLOCK + 16];
+} resamp_bench_t;
+
+static void resamp_op(void *arg)
+{
+    resamp_bench_t *b = arg;
+    unsigned int nw;
+    resamp_q15_execute_block(b->resamp, b->x, BLOCK, b->y, &nw);
+}
+
+int main()
+{
+    static resamp_bench_t b;
+
+    // a tone at a tenth of the sample rate
+    for (unsigned int i = 0; i < BLOCK; ++i)
+    {
+        b.x[i].r = 16384 * cosf(2 * M_PI * i / 10);
+        b.x[i].i = 16384 * sinf(2 * M_PI * i / 10);
+    }
+
+    for (unsigned int v = 0; v < BENCH_VARIANTS; ++v)
+    {
+        if (!bench_select(v, CPU_SSE2 | CPU_AVX2 | CPU_NEON))
+            continue;
+
+        b.resamp = resamp_q15_create(RESAMP_NUM_TAPS / 2, 0.45f, 60.0f, 16);
+        // a typical clock error of the tuner
+        resamp_q15_set_rate(b.resamp, 1.00002f);
+        bench_run("resamp", bench_variants[v].name, resamp_op, &b, sizeof(b.x));
+        resamp_q15_destroy(b.resamp);
+    }
+
+    return 0;
+}
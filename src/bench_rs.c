@@ -0,0 +1,76 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Reed-Solomon decoding of a shortened audio frame header
+
+#include <string.h>
+
+#include "microbench.h"
+#include "reed-solomon.h"
+
+// header bytes, a codeword shortened from 255 bytes as in frame.c
+#define RS_HEADER 96
+#define RS_PARITY 8
+#define RS_N 255
+
+typedef struct
+{
+    uint8_t codeword[RS_N];
+    uint8_t msg[RS_N];
+} rs_bench_t;
+
+static void rs_op(void *arg)
+{
+    rs_bench_t *b = arg;
+    memcpy(b->msg, b->codeword, RS_N);
+    rs_decode(b->msg);
+}
+
+static void rs_short_op(void *arg)
+{
+    rs_bench_t *b = arg;
+    memcpy(b->msg, b->codeword, RS_HEADER);
+    rs_decode_short(b->msg, RS_HEADER);
+}
+
+int main()
+{
+    // clean, correctable and uncorrectable headers
+    static const unsigned int errors[] = { 0, 1, 4, 6 };
+    rs_bench_t b;
+    uint32_t seed = 1;
+
+    rs_init();
+    for (unsigned int e = 0; e < sizeof(errors) / sizeof(errors[0]); ++e)
+    {
+        char name[32];
+
+        // a random header, parity first, with errors in distinct bytes
+        memset(b.codeword, 0, RS_N);
+        for (unsigned int i = RS_PARITY; i < RS_HEADER; ++i)
+            b.codeword[i] = bench_random(&seed);
+        rs_encode(&b.codeword[RS_PARITY], RS_HEADER - RS_PARITY, b.codeword);
+        for (unsigned int i = 0; i < errors[e]; ++i)
+            b.codeword[i * (RS_HEADER / 8) + bench_random(&seed) % (RS_HEADER / 8)] ^= 1 + bench_random(&seed) % 255;
+
+        snprintf(name, sizeof(name), "rs_decode/%u", errors[e]);
+        bench_run(name, "generic", rs_op, &b, RS_HEADER);
+
+        snprintf(name, sizeof(name), "rs_decode_short/%u", errors[e]);
+        bench_run(name, "generic", rs_short_op, &b, RS_HEADER);
+    }
+
+    return 0;
+}
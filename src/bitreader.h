@@ -2,48 +2,83 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
 
+/*
+ * Reads bits most significant first through a 64-bit cache. While at least
+ * eight bytes remain, the cache is refilled with a single unaligned load.
+ * Bits past the end of the buffer read as zero, but may not be consumed.
+ */
 typedef struct
 {
-    unsigned int byte;
-    unsigned int bits;
+    uint64_t cache;     // next bits, starting at the most significant bit
+    unsigned int bits;  // number of valid bits in the cache
     uint8_t *buf;
     uint8_t *end;
 } bitreader_t;
 
 static inline void br_init(bitreader_t *br, uint8_t *buf, unsigned int length)
 {
-    br->byte = 0;
+    br->cache = 0;
     br->bits = 0;
     br->buf = buf;
     br->end = buf + length;
 }
 
-static inline unsigned int br_read1bit(bitreader_t *br)
+static inline void br_refill(bitreader_t *br)
 {
-    if (br->bits == 0)
+    if (br->end - br->buf >= 8)
     {
-        assert(br->buf != br->end);
-        br->byte = *br->buf++;
-        br->bits = 8;
+        uint64_t word;
+
+        // Bytes that only partly fit are loaded again by the next refill.
+        memcpy(&word, br->buf, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        br->cache |= word >> br->bits;
+        br->buf += (63 - br->bits) >> 3;
+        br->bits |= 56;
+    }
+    else
+    {
+        while (br->bits <= 56 && br->buf != br->end)
+        {
+            br->cache |= (uint64_t)*br->buf++ << (56 - br->bits);
+            br->bits += 8;
+        }
     }
-    br->byte <<= 1;
-    br->bits--;
-    return !!(br->byte & 0x100);
+}
+
+// bits must be at most 32
+static inline unsigned int br_peekbits(bitreader_t *br, unsigned int bits)
+{
+    if (br->bits < bits)
+        br_refill(br);
+    // two shifts, so that zero bits is defined
+    return (br->cache >> 1) >> (63 - bits);
+}
+
+static inline void br_skipbits(bitreader_t *br, unsigned int bits)
+{
+    assert(bits <= br->bits);
+    br->cache <<= bits;
+    br->bits -= bits;
 }
 
 static inline unsigned int br_readbits(bitreader_t *br, unsigned int bits)
 {
-    unsigned int i, val = 0;
-    for (i = 0; i < bits; ++i)
-        val = (val << 1) | br_read1bit(br);
+    unsigned int val = br_peekbits(br, bits);
+    br_skipbits(br, bits);
     return val;
 }
 
-static inline unsigned int br_peekbits(bitreader_t *br, unsigned int bits)
+static inline unsigned int br_read1bit(bitreader_t *br)
 {
-    bitreader_t tmp = *br;
-    unsigned int val = br_readbits(br, bits);
-    *br = tmp;
-    return val;
+    return br_readbits(br, 1);
+}
+
+static inline unsigned int br_remaining(bitreader_t *br)
+{
+    return br->bits + (br->end - br->buf) * 8;
 }
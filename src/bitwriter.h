@@ -2,42 +2,55 @@
 
 #include <stdint.h>
 
+/*
+ * Writes bits most significant first. Bits are collected in a 64-bit cache
+ * and stored 32 at a time; only complete bytes are ever written.
+ */
 typedef struct
 {
-    unsigned int byte;
-    unsigned int bits;
+    uint64_t cache;     // pending bits, in the least significant bits
+    unsigned int bits;  // number of pending bits
     uint8_t *buf, *begin;
 } bitwriter_t;
 
 static inline void bw_init(bitwriter_t *bw, uint8_t *buf)
 {
-    bw->byte = 0;
+    bw->cache = 0;
     bw->bits = 0;
     bw->buf = buf;
     bw->begin = buf;
 }
 
-static inline void bw_add1bit(bitwriter_t *bw, unsigned int bit)
+// bits must be at most 32
+static inline void bw_addbits(bitwriter_t *bw, unsigned int value, unsigned int bits)
 {
-    bw->byte = (bw->byte << 1) | (!!bit);
-    if (++bw->bits == 8)
+    bw->cache = (bw->cache << bits) | (value & (((uint64_t)1 << bits) - 1));
+    bw->bits += bits;
+    if (bw->bits >= 32)
     {
-        *bw->buf++ = bw->byte;
-        bw->byte = 0;
-        bw->bits = 0;
+        uint32_t word;
+
+        bw->bits -= 32;
+        word = bw->cache >> bw->bits;
+        bw->buf[0] = word >> 24;
+        bw->buf[1] = word >> 16;
+        bw->buf[2] = word >> 8;
+        bw->buf[3] = word;
+        bw->buf += 4;
     }
 }
 
-static inline void bw_addbits(bitwriter_t *bw, unsigned int value, unsigned int bits)
+static inline void bw_add1bit(bitwriter_t *bw, unsigned int bit)
 {
-    unsigned int i;
-    for (i = 0; i < bits; ++i)
-        bw_add1bit(bw, value & (1 << (bits - i - 1)));
+    bw_addbits(bw, !!bit, 1);
 }
 
-static unsigned int bw_flush(bitwriter_t *bw)
+static inline unsigned int bw_flush(bitwriter_t *bw)
 {
+    for (; bw->bits >= 8; bw->bits -= 8)
+        *bw->buf++ = bw->cache >> (bw->bits - 8);
     if (bw->bits)
-        bw_addbits(bw, 0, 8 - bw->bits);
+        *bw->buf++ = bw->cache << (8 - bw->bits);
+    bw->bits = 0;
     return bw->buf - bw->begin;
 }
@@ -0,0 +1,481 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "capture.h"
+#include "log.h"
+#include "record.h"
+#include "ring.h"
+
+// bytes per block, a multiple of 4
+#define CAPTURE_BLOCK (512 * 1024)
+// blocks read ahead of the decoder
+#define CAPTURE_DEPTH 4
+// compressed bytes per read
+#define CAPTURE_READ (64 * 1024)
+
+enum
+{
+    FORMAT_RAW,
+    FORMAT_XZ,
+    FORMAT_ZSTD
+};
+
+struct capture
+{
+    int fd;
+    int format;
+    int eof;
+
+    // samples format, and for decimated recordings the BFP block size,
+    // the next sample index and a chunk payload
+    int iq_format;
+    unsigned int iq_block;
+    uint64_t iq_index;
+    uint8_t *payload;
+    // bytes read while looking for a header, returned first
+    uint8_t peek[RECORD_HEADER_LEN];
+    unsigned int peek_len, peek_pos;
+
+    // mapped file
+    const uint8_t *map;
+    size_t map_len, map_pos;
+
+    // compressed input
+    uint8_t *in;
+#ifdef HAVE_LZMA
+    lzma_stream lz;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zs;
+    ZSTD_inBuffer zin;
+#endif
+
+    uint8_t *slot[CAPTURE_DEPTH];
+    size_t slot_len[CAPTURE_DEPTH];
+#ifdef USE_THREADS
+    ring_t ring;
+    pthread_t reader_thread;
+    // the consumer holds slot ring_tail()
+    int held;
+    atomic_int quit;
+#endif
+};
+
+static int ends_with(const char *s, const char *suffix)
+{
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+// Read up to len bytes, fewer only at the end of the file.
+static size_t read_full(capture c, uint8_t *buf, size_t len)
+{
+    size_t got = 0;
+
+    while (got < len && !c->eof)
+    {
+        ssize_t n = read(c->fd, buf + got, len - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            log_error("capture read error: %s", strerror(errno));
+        if (n <= 0)
+            c->eof = 1;
+        else
+            got += n;
+    }
+    return got;
+}
+
+#ifdef HAVE_LZMA
+static size_t read_xz(capture c, uint8_t *buf, size_t len)
+{
+    c->lz.next_out = buf;
+    c->lz.avail_out = len;
+
+    while (c->lz.avail_out > 0)
+    {
+        lzma_ret ret;
+
+        if (c->lz.avail_in == 0 && !c->eof)
+        {
+            c->lz.next_in = c->in;
+            c->lz.avail_in = read_full(c, c->in, CAPTURE_READ);
+        }
+        ret = lzma_code(&c->lz, c->eof && c->lz.avail_in == 0 ? LZMA_FINISH : LZMA_RUN);
+        if (ret == LZMA_STREAM_END)
+            break;
+        if (ret != LZMA_OK)
+        {
+            log_error("xz decoder error: %d", ret);
+            break;
+        }
+    }
+    return len - c->lz.avail_out;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static size_t read_zstd(capture c, uint8_t *buf, size_t len)
+{
+    ZSTD_outBuffer out = { buf, len, 0 };
+
+    while (out.pos < out.size)
+    {
+        size_t ret;
+
+        if (c->zin.pos == c->zin.size)
+        {
+            if (c->eof)
+                break;
+            c->zin.src = c->in;
+            c->zin.size = read_full(c, c->in, CAPTURE_READ);
+            c->zin.pos = 0;
+            if (c->zin.size == 0)
+                break;
+        }
+        ret = ZSTD_decompressStream(c->zs, &out, &c->zin);
+        if (ZSTD_isError(ret))
+        {
+            log_error("zstd decoder error: %s", ZSTD_getErrorName(ret));
+            break;
+        }
+    }
+    return out.pos;
+}
+#endif
+
+// Read len decompressed bytes, fewer only at the end of the capture.
+static size_t read_source(capture c, uint8_t *buf, size_t len)
+{
+    size_t got = 0;
+
+    if (c->peek_pos < c->peek_len)
+    {
+        got = c->peek_len - c->peek_pos < len ? c->peek_len - c->peek_pos : len;
+        memcpy(buf, c->peek + c->peek_pos, got);
+        c->peek_pos += got;
+    }
+
+    switch (c->format)
+    {
+#ifdef HAVE_LZMA
+    case FORMAT_XZ:
+        return got + read_xz(c, buf + got, len - got);
+#endif
+#ifdef HAVE_ZSTD
+    case FORMAT_ZSTD:
+        return got + read_zstd(c, buf + got, len - got);
+#endif
+    }
+    return got + read_full(c, buf + got, len - got);
+}
+
+static uint64_t get_le(const uint8_t *p, int bytes)
+{
+    uint64_t v = 0;
+    while (bytes--)
+        v = (v << 8) | p[bytes];
+    return v;
+}
+
+// Decode chunks of a decimated recording while a whole one still fits.
+static size_t fill_decimated(capture c, cint16_t *out)
+{
+    uint8_t hdr[RECORD_CHUNK_HEADER_LEN];
+    unsigned int n = 0;
+
+    while (n + RECORD_CHUNK_MAX <= CAPTURE_BLOCK / sizeof(cint16_t))
+    {
+        unsigned int cnt, len;
+        uint64_t index;
+
+        if (read_source(c, hdr, sizeof(hdr)) != sizeof(hdr))
+            break;
+        cnt = get_le(hdr, 4);
+        index = get_le(hdr + 8, 8);
+        if (cnt > RECORD_CHUNK_MAX)
+        {
+            log_error("Invalid chunk in recording.");
+            c->eof = 1;
+            break;
+        }
+        len = record_payload_len(c->iq_format, c->iq_block, cnt);
+        if (read_source(c, c->payload, len) != len)
+            break;
+
+        if (index != c->iq_index)
+            log_warn("Recording skips %lld samples.", (long long)(index - c->iq_index));
+        c->iq_index = index + cnt;
+
+        record_decode(c->iq_format, c->iq_block, c->payload, cnt, &out[n]);
+        n += cnt;
+    }
+    return n * sizeof(cint16_t);
+}
+
+// Fill buf with the next block, short only at the end of the capture.
+static size_t fill(capture c, uint8_t *buf)
+{
+    if (c->iq_format != RECORD_U8)
+        return fill_decimated(c, (cint16_t *)buf);
+
+    // drop a trailing partial sample
+    return read_source(c, buf, CAPTURE_BLOCK) & ~(size_t)3;
+}
+
+// Look for the header of a decimated recording.
+static int read_header(capture c)
+{
+    const uint8_t *h = c->peek;
+
+    c->peek_len = read_source(c, c->peek, RECORD_HEADER_LEN);
+    c->iq_format = RECORD_U8;
+    if (c->peek_len < RECORD_HEADER_LEN || memcmp(h, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0)
+        return 0;
+
+    c->peek_pos = c->peek_len;
+    c->iq_format = h[9];
+    c->iq_block = get_le(h + 10, 2);
+    if (h[8] != 1 || c->iq_format < RECORD_Q15 || c->iq_format > RECORD_BFP4 || c->iq_block == 0)
+    {
+        log_error("Unsupported recording format.");
+        return -1;
+    }
+
+    uint64_t rate = get_le(h + 16, 8), center = get_le(h + 24, 8);
+    double rate_hz, center_hz;
+    memcpy(&rate_hz, &rate, sizeof(rate_hz));
+    memcpy(&center_hz, &center, sizeof(center_hz));
+    log_info("Recording of %.0f Hz at %.1f Hz", center_hz, rate_hz);
+
+    c->payload = malloc(record_payload_len(c->iq_format, c->iq_block, RECORD_CHUNK_MAX));
+    return 0;
+}
+
+#ifdef USE_THREADS
+static void *capture_reader(void *arg)
+{
+    capture c = arg;
+
+    while (!atomic_load(&c->quit))
+    {
+        unsigned int slot;
+
+        ring_wait_space(&c->ring, NULL);
+        slot = ring_head(&c->ring);
+        c->slot_len[slot] = fill(c, c->slot[slot]);
+        if (c->slot_len[slot] == 0)
+            break;
+        ring_push(&c->ring);
+    }
+    ring_stop(&c->ring);
+
+    return NULL;
+}
+#endif
+
+static int open_decoder(capture c)
+{
+    switch (c->format)
+    {
+    case FORMAT_XZ:
+#ifdef HAVE_LZMA
+        c->lz = (lzma_stream)LZMA_STREAM_INIT;
+        if (lzma_stream_decoder(&c->lz, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+            return -1;
+        break;
+#else
+        log_error("xz support not compiled in");
+        return -1;
+#endif
+    case FORMAT_ZSTD:
+#ifdef HAVE_ZSTD
+        c->zs = ZSTD_createDStream();
+        if (c->zs == NULL)
+            return -1;
+        ZSTD_initDStream(c->zs);
+        c->zin.src = NULL;
+        c->zin.size = 0;
+        c->zin.pos = 0;
+        break;
+#else
+        log_error("zstd support not compiled in");
+        return -1;
+#endif
+    }
+    c->in = malloc(CAPTURE_READ);
+    return 0;
+}
+
+static void free_source(capture c)
+{
+    free(c->in);
+    free(c->payload);
+#ifdef HAVE_LZMA
+    if (c->format == FORMAT_XZ)
+        lzma_end(&c->lz);
+#endif
+#ifdef HAVE_ZSTD
+    if (c->format == FORMAT_ZSTD)
+        ZSTD_freeDStream(c->zs);
+#endif
+    if (c->fd != STDIN_FILENO)
+        close(c->fd);
+    free(c);
+}
+
+capture capture_open(const char *name)
+{
+    capture c = calloc(1, sizeof(*c));
+    struct stat sb;
+
+    if (ends_with(name, ".xz"))
+        c->format = FORMAT_XZ;
+    else if (ends_with(name, ".zst"))
+        c->format = FORMAT_ZSTD;
+    else
+        c->format = FORMAT_RAW;
+
+    if (strcmp(name, "-") == 0)
+        c->fd = STDIN_FILENO;
+    else
+        c->fd = open(name, O_RDONLY);
+    if (c->fd < 0)
+    {
+        free(c);
+        return NULL;
+    }
+
+    if (c->format == FORMAT_RAW)
+    {
+        if (fstat(c->fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0)
+        {
+            void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, c->fd, 0);
+            // decimated recordings are decoded on the reader thread
+            if (map != MAP_FAILED && (sb.st_size < RECORD_HEADER_LEN || memcmp(map, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0))
+            {
+                madvise(map, sb.st_size, MADV_SEQUENTIAL);
+                c->map = map;
+                c->map_len = sb.st_size;
+                return c;
+            }
+            if (map != MAP_FAILED)
+                munmap(map, sb.st_size);
+        }
+        posix_fadvise(c->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    else if (open_decoder(c) != 0)
+    {
+        free_source(c);
+        return NULL;
+    }
+
+    if (read_header(c) != 0)
+    {
+        free_source(c);
+        return NULL;
+    }
+
+#ifdef USE_THREADS
+    for (int i = 0; i < CAPTURE_DEPTH; ++i)
+        c->slot[i] = malloc(CAPTURE_BLOCK);
+    ring_init(&c->ring, CAPTURE_DEPTH);
+    atomic_init(&c->quit, 0);
+    pthread_create(&c->reader_thread, NULL, capture_reader, c);
+#ifdef HAVE_PTHREAD_SETNAME_NP
+    pthread_setname_np(c->reader_thread, "capture");
+#endif
+#else
+    c->slot[0] = malloc(CAPTURE_BLOCK);
+#endif
+    return c;
+}
+
+int capture_format(capture c)
+{
+    return c->iq_format;
+}
+
+size_t capture_read(capture c, const uint8_t **buf)
+{
+    if (c->map)
+    {
+        size_t len = c->map_len - c->map_pos;
+
+        // pages that were decoded are not needed again
+        if (c->map_pos >= CAPTURE_BLOCK)
+            madvise((void *)(c->map + c->map_pos - CAPTURE_BLOCK), CAPTURE_BLOCK, MADV_DONTNEED);
+
+        if (len > CAPTURE_BLOCK)
+            len = CAPTURE_BLOCK;
+        len &= ~(size_t)3;
+        *buf = c->map + c->map_pos;
+        c->map_pos += len;
+        return len;
+    }
+
+#ifdef USE_THREADS
+    if (c->held)
+        ring_pop(&c->ring);
+    c->held = ring_wait_data(&c->ring);
+    if (!c->held)
+        return 0;
+    *buf = c->slot[ring_tail(&c->ring)];
+    return c->slot_len[ring_tail(&c->ring)];
+#else
+    *buf = c->slot[0];
+    return fill(c, c->slot[0]);
+#endif
+}
+
+void capture_close(capture c)
+{
+    if (c->map)
+    {
+        munmap((void *)c->map, c->map_len);
+    }
+    else
+    {
+#ifdef USE_THREADS
+        // let the reader finish if the capture was not read to the end
+        atomic_store(&c->quit, 1);
+        if (c->held)
+            ring_pop(&c->ring);
+        while (ring_wait_data(&c->ring))
+            ring_pop(&c->ring);
+        pthread_join(c->reader_thread, NULL);
+        ring_destroy(&c->ring);
+#endif
+        for (int i = 0; i < CAPTURE_DEPTH; ++i)
+            free(c->slot[i]);
+    }
+    free_source(c);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * IQ capture reader for offline decoding.
+ *
+ * Regular files are mapped and returned in place. Pipes, files whose name
+ * ends in .xz or .zst, and decimated recordings (see record.h) are read,
+ * decompressed and decoded on a separate thread a few blocks ahead of the
+ * decoder.
+ */
+typedef struct capture * capture;
+
+// "-" reads stdin. Returns NULL if the file cannot be opened.
+capture capture_open(const char *name);
+// RECORD_U8 for raw captures, else the format of a decimated recording.
+int capture_format(capture c);
+// Set *buf to the next block of samples and return its length, a multiple
+// of 4 bytes, or 0 at the end of the capture. Decimated recordings return
+// cint16_t samples. The block is valid until the next call.
+size_t capture_read(capture c, const uint8_t **buf);
+void capture_close(capture c);
@@ -0,0 +1,243 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Each channel is mixed to baseband, low-pass filtered and resampled to
+ * NRSC5_SAMPLE_RATE in a single step. The output at input time t of
+ * channel c with offset w (radians per sample) is
+ *
+ *     y(t) = sum_j g(t - j) x[j] e^(-i w j)
+ *          = e^(-i w t) sum_k g(k + f) e^(i w (k + f)) x[t - f - k]
+ *
+ * where f is the fractional part of t. g is sampled on CHAN_PHASES
+ * fractional delays, and the rotated taps g(k + f) e^(i w (k + f)) are
+ * precomputed for each channel, so the mixer only runs at the output rate.
+ * The input is converted once and shared by every channel.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "channelizer.h"
+#include "firdes.h"
+#include "nrsc5.h"
+
+// fractional delays of the polyphase filter
+#define CHAN_PHASES 128
+// input samples per chunk
+#define CHAN_CHUNK 4096
+// the decoder front-end passes 120 to 200 kHz and stops from 300 kHz, so
+// that band must survive resampling without aliasing onto it
+#define CHAN_PASS 200000.0
+#define CHAN_STOP (NRSC5_SAMPLE_RATE - 300000.0)
+#define CHAN_ATTENUATION 60.0f
+
+typedef struct {
+    // rotated taps, reversed, CHAN_PHASES x ntaps
+    float complex *taps;
+    // mixer phase at the next output, in cycles, and its step per output
+    double phase;
+    double step;
+    // outputs, and one held back to keep the count even
+    cint16_t *out;
+    unsigned int held;
+} channel_t;
+
+struct channelizer {
+    unsigned int ntaps;
+    // input samples per output
+    double ratio;
+    // time of the next output, in input samples from the start of the chunk
+    double t;
+
+    // ntaps of history followed by the chunk
+    float complex *window;
+
+    channel_t *channels;
+    unsigned int nchannels;
+
+    channelizer_cb_t cb;
+    void *cb_arg;
+};
+
+static inline int16_t to_q15(float x)
+{
+    if (x > 32767.0f)
+        return 32767;
+    if (x < -32768.0f)
+        return -32768;
+    return lrintf(x);
+}
+
+static float complex dotprod(const float complex *a, const float complex *b, unsigned int n)
+{
+    // split into real and imaginary sums so the loop vectorizes
+    float rr = 0, ri = 0, ir = 0, ii = 0;
+    for (unsigned int k = 0; k < n; k++)
+    {
+        rr += crealf(a[k]) * crealf(b[k]);
+        ri += crealf(a[k]) * cimagf(b[k]);
+        ir += cimagf(a[k]) * crealf(b[k]);
+        ii += cimagf(a[k]) * cimagf(b[k]);
+    }
+    return CMPLXF(rr - ii, ri + ir);
+}
+
+channelizer channelizer_create(double sample_rate, const double *offsets, unsigned int n, channelizer_cb_t cb, void *arg)
+{
+    channelizer q;
+    unsigned int ntaps, len;
+    float *h, gain = 0;
+
+    assert(sample_rate >= NRSC5_SAMPLE_RATE);
+
+    // Kaiser estimate of the length for the transition band, rounded up
+    ntaps = ceil((CHAN_ATTENUATION - 8) / (2.285 * 2 * M_PI * (CHAN_STOP - CHAN_PASS) / sample_rate));
+    ntaps = (ntaps + 3) & ~3;
+
+    q = malloc(sizeof(*q));
+    q->ntaps = ntaps;
+    q->ratio = sample_rate / NRSC5_SAMPLE_RATE;
+    q->t = 0;
+    q->window = calloc(ntaps + CHAN_CHUNK, sizeof(float complex));
+    q->nchannels = n;
+    q->channels = calloc(n, sizeof(channel_t));
+    q->cb = cb;
+    q->cb_arg = arg;
+
+    // prototype sampled at CHAN_PHASES times the input rate, with one extra
+    // tap so that g(k + f) exists for every k and f
+    len = ntaps * CHAN_PHASES + 1;
+    h = malloc(sizeof(float) * len);
+    firdes_kaiser(len, (CHAN_PASS + CHAN_STOP) / 2 / sample_rate / CHAN_PHASES, CHAN_ATTENUATION, 0.0f, h);
+    for (unsigned int i = 0; i < len; i++)
+        gain += h[i];
+    gain = CHAN_PHASES / gain;
+
+    for (unsigned int c = 0; c < n; c++)
+    {
+        channel_t *ch = &q->channels[c];
+        double w = 2 * M_PI * offsets[c] / sample_rate;
+
+        assert(fabs(offsets[c]) + NRSC5_SAMPLE_RATE / 4 <= sample_rate / 2);
+
+        ch->taps = malloc(sizeof(float complex) * CHAN_PHASES * ntaps);
+        for (unsigned int p = 0; p < CHAN_PHASES; p++)
+        {
+            for (unsigned int k = 0; k < ntaps; k++)
+            {
+                double d = k + (double)p / CHAN_PHASES;
+                ch->taps[p * ntaps + ntaps - 1 - k] = h[k * CHAN_PHASES + p] * gain * cexp(I * w * d);
+            }
+        }
+        ch->phase = 0;
+        ch->step = -offsets[c] / NRSC5_SAMPLE_RATE;
+        ch->out = malloc(sizeof(cint16_t) * (CHAN_CHUNK + 2));
+        ch->held = 0;
+    }
+
+    free(h);
+    return q;
+}
+
+void channelizer_destroy(channelizer q)
+{
+    for (unsigned int c = 0; c < q->nchannels; c++)
+    {
+        free(q->channels[c].taps);
+        free(q->channels[c].out);
+    }
+    free(q->channels);
+    free(q->window);
+    free(q);
+}
+
+static void execute_chunk(channelizer q, unsigned int n)
+{
+    const unsigned int ntaps = q->ntaps;
+    unsigned int count = 0;
+    double t = q->t;
+    // input index and delay of each output, shared by all channels
+    int idx[CHAN_CHUNK + 2];
+    unsigned int phase[CHAN_CHUNK + 2];
+
+    while (1)
+    {
+        // newest input sample and nearest fractional delay
+        long i = (long)floor(t);
+        long m = lround((t - i) * CHAN_PHASES);
+
+        if (m == CHAN_PHASES)
+        {
+            m = 0;
+            i++;
+        }
+        if (i >= (long)n)
+            break;
+        idx[count] = i;
+        phase[count] = m;
+        count++;
+        t += q->ratio;
+    }
+    q->t = t - n;
+
+    for (unsigned int c = 0; c < q->nchannels; c++)
+    {
+        channel_t *ch = &q->channels[c];
+        cint16_t *out = &ch->out[ch->held];
+        float complex rot = cexp(-2 * M_PI * I * ch->phase);
+        float complex step = cexp(2 * M_PI * I * ch->step);
+
+        for (unsigned int k = 0; k < count; k++)
+        {
+            // window[ntaps + i] is input sample i, the taps end there
+            const float complex *x = &q->window[idx[k] + 1];
+            float complex y = rot * dotprod(x, &ch->taps[phase[k] * ntaps], ntaps);
+
+            out[k].r = to_q15(crealf(y));
+            out[k].i = to_q15(cimagf(y));
+            rot *= step;
+        }
+        ch->phase = fmod(ch->phase - ch->step * count, 1.0);
+
+        // the decoder takes pairs of samples
+        unsigned int total = ch->held + count;
+        ch->held = total & 1;
+        if (total - ch->held)
+            q->cb(q->cb_arg, c, ch->out, total - ch->held);
+        if (ch->held)
+            ch->out[0] = ch->out[total - 1];
+    }
+
+    // keep the history for the next chunk
+    memmove(&q->window[0], &q->window[n], sizeof(float complex) * ntaps);
+}
+
+void channelizer_execute(channelizer q, const uint8_t *x, unsigned int n)
+{
+    while (n > 0)
+    {
+        unsigned int chunk = n < CHAN_CHUNK ? n : CHAN_CHUNK;
+        float complex *w = &q->window[q->ntaps];
+
+        for (unsigned int i = 0; i < chunk; i++)
+            w[i] = CMPLXF(U8_Q15(x[i * 2 + 0]), U8_Q15(x[i * 2 + 1]));
+
+        execute_chunk(q, chunk);
+        x += chunk * 2;
+        n -= chunk;
+    }
+}
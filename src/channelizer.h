@@ -0,0 +1,16 @@
+#pragma once
+
+#include "defines.h"
+
+typedef struct channelizer * channelizer;
+
+// receives n (even) Q15 samples of channel c at NRSC5_SAMPLE_RATE
+typedef void (*channelizer_cb_t) (void *arg, unsigned int c, const cint16_t *x, unsigned int n);
+
+// Split a capture at sample_rate into n channels centered at offsets[c] Hz
+// from the capture center. Each channel needs NRSC5_SAMPLE_RATE / 2 of
+// bandwidth around its offset.
+channelizer channelizer_create(double sample_rate, const double *offsets, unsigned int n, channelizer_cb_t cb, void *arg);
+void channelizer_destroy(channelizer q);
+// process n pairs of interleaved u8 IQ samples
+void channelizer_execute(channelizer q, const uint8_t *x, unsigned int n);
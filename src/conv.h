@@ -28,6 +28,56 @@ struct lte_conv_code {
 	int term;
 };
 
-int nrsc5_conv_decode(const int8_t *in, uint8_t *out);
+struct vdecoder;
+
+/* Default tail-biting warm-up length in trellis steps */
+#define CONV_TB_WINDOW 96
+/* Traceback margin after each segment of a segmented decode */
+#define CONV_SEG_MARGIN 96
+#define CONV_MAX_SEGMENTS 16
+
+/*
+ * NRSC-5 P1 decoder (K=7, rate 1/3, tail-biting)
+ *
+ * The decoder object holds the trellis and the survivor paths of a whole
+ * frame. Allocate it once and reuse it for every frame; each call to
+ * nrsc5_conv_decode() only resets the accumulated path metrics.
+ *
+ * The starting metrics of the tail-biting trellis are estimated by running
+ * over the last 'window' steps of the frame. A window of 0 runs a second full
+ * pass over the frame instead.
+ *
+ * The decoded bits are packed eight to a byte, least significant bit first,
+ * so 'out' holds FRAME_LEN / 8 bytes.
+ */
+struct vdecoder *nrsc5_conv_alloc(void);
+void nrsc5_conv_free(struct vdecoder *dec);
+void nrsc5_conv_set_window(struct vdecoder *dec, int window);
+
+/*
+ * Split the frame into 'segments' parts decoded concurrently, one on the
+ * calling thread and the others on worker threads of the decoder. Each part
+ * starts from a warm-up of 'window' steps before it (CONV_TB_WINDOW if the
+ * window is 0) and is traced back from CONV_SEG_MARGIN steps after it, so
+ * the output can differ from that of a whole-frame decode on weak signals.
+ * 1 decodes the frame in one pass again. Returns 0, or a negative errno.
+ */
+int nrsc5_conv_set_segments(struct vdecoder *dec, int segments);
+int nrsc5_conv_decode(struct vdecoder *dec, const int8_t *in, uint8_t *out);
+
+/* Frames that share one pass of nrsc5_conv_decode_batch() */
+#define CONV_BATCH 16
+
+/*
+ * Decode the n frames in[i] into out[i], each as nrsc5_conv_decode() would
+ * decode it, and store what it would return in ret[i]. Up to CONV_BATCH
+ * frames go through the trellis together, the path metric of each state
+ * holding one frame in each 16-bit lane, so decoding a full batch costs a
+ * fraction of decoding its frames one at a time. Segments are not used.
+ * The buffers of the batch, about 19 MB, are allocated on the first call.
+ * Returns 0, or a negative errno.
+ */
+int nrsc5_conv_decode_batch(struct vdecoder *dec, const int8_t *const *in,
+			    uint8_t *const *out, int *ret, int n);
 
 #endif /* _CONV_H_ */
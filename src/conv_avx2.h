@@ -0,0 +1,206 @@
+/*
+ * Viterbi decoder for convolutional codes - Intel AVX2
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Results are bit-exact with the SSE and generic kernels. The including
+ * file must be compiled for AVX2; the kernel is selected at runtime.
+ */
+
+#include <stdint.h>
+#include <immintrin.h>
+
+/*
+ * 16-wide Viterbi butterfly
+ *
+ * Same operation as the SSE butterfly on 256-bit YMM registers.
+ *
+ * Input:
+ * M0 - Path metrics 0 (packed 16-bit integers)
+ * M1 - Path metrics 1 (packed 16-bit integers)
+ * M2 - Branch metrics (packed 16-bit integers)
+ *
+ * Output:
+ * M2 - Selected and accumulated path metrics 0
+ * M4 - Selected and accumulated path metrics 1
+ * M3 - Path selections 0
+ * M1 - Path selections 1
+ */
+#define AVX2_BUTTERFLY(M0,M1,M2,M3,M4) \
+{ \
+	M3 = _mm256_adds_epi16(M0, M2); \
+	M4 = _mm256_subs_epi16(M1, M2); \
+	M0 = _mm256_subs_epi16(M0, M2); \
+	M1 = _mm256_adds_epi16(M1, M2); \
+	M2 = _mm256_max_epi16(M3, M4); \
+	M3 = _mm256_cmpgt_epi16(M3, M4); \
+	M4 = _mm256_max_epi16(M0, M1); \
+	M1 = _mm256_cmpgt_epi16(M0, M1); \
+}
+
+/*
+ * Two lane deinterleaving K = 7
+ *
+ * Take 32 interleaved 16-bit integers and deinterleave to 2 packed 256-bit
+ * registers. The byte shuffle separates even and odd values within each
+ * 128-bit lane, and the permutes gather them across lanes.
+ *
+ * Input:
+ * M0:1 - Packed 16-bit integers
+ *
+ * Output:
+ * M2:3 - Deinterleaved packed 16-bit integers
+ */
+#define _I8_SHUFFLE_MASK_256 \
+	15, 14, 11, 10, 7, 6, 3, 2, 13, 12, 9, 8, 5, 4, 1, 0, \
+	15, 14, 11, 10, 7, 6, 3, 2, 13, 12, 9, 8, 5, 4, 1, 0
+
+#define AVX2_DEINTERLEAVE_K7(M0,M1,M2,M3) \
+{ \
+	M2 = _mm256_set_epi8(_I8_SHUFFLE_MASK_256); \
+	M0 = _mm256_shuffle_epi8(M0, M2); \
+	M1 = _mm256_shuffle_epi8(M1, M2); \
+	M0 = _mm256_permute4x64_epi64(M0, 0xd8); \
+	M1 = _mm256_permute4x64_epi64(M1, 0xd8); \
+	M2 = _mm256_permute2x128_si256(M0, M1, 0x20); \
+	M3 = _mm256_permute2x128_si256(M0, M1, 0x31); \
+}
+
+/*
+ * Generate branch metrics N = 4
+ *
+ * Compute 16 branch metrics from trellis outputs and input values. The
+ * horizontal adds work within 128-bit lanes, so the results are put back
+ * into state order with a cross-lane and an in-lane permute.
+ *
+ * Input:
+ * M0:3 - 16 x 4 packed 16-bit trellis outputs
+ * M4   - Expanded and packed 16-bit input value
+ *
+ * Output:
+ * M5   - 16 computed 16-bit branch metrics
+ */
+#define AVX2_BRANCH_METRIC_N4(M0,M1,M2,M3,M4,M5) \
+{ \
+	M0 = _mm256_sign_epi16(M4, M0); \
+	M1 = _mm256_sign_epi16(M4, M1); \
+	M2 = _mm256_sign_epi16(M4, M2); \
+	M3 = _mm256_sign_epi16(M4, M3); \
+	M0 = _mm256_hadds_epi16(M0, M1); \
+	M1 = _mm256_hadds_epi16(M2, M3); \
+	M5 = _mm256_hadds_epi16(M0, M1); \
+	M5 = _mm256_permute4x64_epi64(M5, 0xd8); \
+	M5 = _mm256_shuffle_epi32(M5, _MM_SHUFFLE(3, 1, 2, 0)); \
+}
+
+/*
+ * Normalize state metrics K = 7
+ *
+ * Compute 64-wide normalization by subtracting the smallest value from
+ * all values. Inputs are 4 registers of accumulated sums and 2 temporary
+ * registers. Normalized results are returned in the originating locations.
+ *
+ * Input:
+ * M0:3 - Path metrics 0:3 (packed 16-bit integers)
+ *
+ * Output:
+ * M0:3 - Normalized path metrics 0:3
+ */
+#define AVX2_NORMALIZE_K7(M0,M1,M2,M3,M4,M5) \
+{ \
+	M4 = _mm256_min_epi16(M0, M1); \
+	M5 = _mm256_min_epi16(M2, M3); \
+	M4 = _mm256_min_epi16(M4, M5); \
+	M5 = _mm256_permute2x128_si256(M4, M4, 0x01); \
+	M4 = _mm256_min_epi16(M4, M5); \
+	M5 = _mm256_shuffle_epi32(M4, _MM_SHUFFLE(1, 0, 3, 2)); \
+	M4 = _mm256_min_epi16(M4, M5); \
+	M5 = _mm256_shuffle_epi32(M4, _MM_SHUFFLE(2, 3, 0, 1)); \
+	M4 = _mm256_min_epi16(M4, M5); \
+	M5 = _mm256_shufflelo_epi16(M4, _MM_SHUFFLE(2, 3, 0, 1)); \
+	M4 = _mm256_min_epi16(M4, M5); \
+	M4 = _mm256_broadcastw_epi16(_mm256_castsi256_si128(M4)); \
+	M0 = _mm256_subs_epi16(M0, M4); \
+	M1 = _mm256_subs_epi16(M1, M4); \
+	M2 = _mm256_subs_epi16(M2, M4); \
+	M3 = _mm256_subs_epi16(M3, M4); \
+}
+
+/*
+ * Combined BMU/PMU (K=7, N=3 and N=4)
+ *
+ * Compute branch metrics followed by path metrics for the 64-state trellis.
+ * 32 butterfly operations are computed in two 16-wide passes. Trellis
+ * memory is only guaranteed 16-byte alignment, so unaligned loads and
+ * stores are used throughout. The path selections are packed to one bit
+ * per state in registers and returned, as pack_paths_k7() does.
+ */
+static inline uint64_t _avx2_metrics_k7_n4(const int16_t *val, const int16_t *out,
+					   int16_t *sums, int norm)
+{
+	__m256i m0, m1, m2, m3, m4, m5, m6, m7;
+	__m256i m8, m9, m10, m11, m12;
+
+	/* (PMU) Load accumulated path metrics */
+	m0 = _mm256_loadu_si256((__m256i *) &sums[0]);
+	m1 = _mm256_loadu_si256((__m256i *) &sums[16]);
+	m2 = _mm256_loadu_si256((__m256i *) &sums[32]);
+	m3 = _mm256_loadu_si256((__m256i *) &sums[48]);
+
+	/* (PMU) Deinterleave into even and odd packed registers */
+	AVX2_DEINTERLEAVE_K7(m0, m1, m4, m5)
+	AVX2_DEINTERLEAVE_K7(m2, m3, m6, m7)
+
+	/* (BMU) Broadcast the four 16-bit input values */
+	m12 = _mm256_broadcastq_epi64(_mm_loadl_epi64((__m128i *) val));
+
+	/* (BMU) Load and compute branch metrics */
+	m0 = _mm256_loadu_si256((__m256i *) &out[0]);
+	m1 = _mm256_loadu_si256((__m256i *) &out[16]);
+	m2 = _mm256_loadu_si256((__m256i *) &out[32]);
+	m3 = _mm256_loadu_si256((__m256i *) &out[48]);
+
+	AVX2_BRANCH_METRIC_N4(m0, m1, m2, m3, m12, m8)
+
+	m0 = _mm256_loadu_si256((__m256i *) &out[64]);
+	m1 = _mm256_loadu_si256((__m256i *) &out[80]);
+	m2 = _mm256_loadu_si256((__m256i *) &out[96]);
+	m3 = _mm256_loadu_si256((__m256i *) &out[112]);
+
+	AVX2_BRANCH_METRIC_N4(m0, m1, m2, m3, m12, m9)
+
+	/* (PMU) Butterflies: 0-15 */
+	AVX2_BUTTERFLY(m4, m5, m8, m0, m1)
+
+
+	/* (PMU) Butterflies: 16-31 */
+	AVX2_BUTTERFLY(m6, m7, m9, m2, m3)
+
+	/* (PMU) Pack selections 0-31 and 32-63, undoing the lane interleave */
+	m0 = _mm256_permute4x64_epi64(_mm256_packs_epi16(m0, m2), 0xd8);
+	m5 = _mm256_permute4x64_epi64(_mm256_packs_epi16(m5, m7), 0xd8);
+
+	if (norm)
+		AVX2_NORMALIZE_K7(m8, m9, m1, m3, m10, m11)
+
+	_mm256_storeu_si256((__m256i *) &sums[0], m8);
+	_mm256_storeu_si256((__m256i *) &sums[16], m9);
+	_mm256_storeu_si256((__m256i *) &sums[32], m1);
+	_mm256_storeu_si256((__m256i *) &sums[48], m3);
+
+	return ~((uint64_t) (uint32_t) _mm256_movemask_epi8(m0) |
+		 (uint64_t) (uint32_t) _mm256_movemask_epi8(m5) << 32);
+}
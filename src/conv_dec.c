@@ -26,16 +26,16 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#ifdef USE_THREADS
+#include <pthread.h>
+#include <stdio.h>
+#endif
 
 #include "conv.h"
-
-#if defined(HAVE_SSE3)
-#include "conv_sse.h"
-#elif defined(HAVE_NEON)
-#include "conv_neon.h"
-#else
 #include "conv_gen.h"
-#endif
+#include "cpu.h"
+#include "kernels.h"
+#include "trace.h"
 
 #define PARITY(X) __builtin_parity(X)
 
@@ -65,6 +65,30 @@ struct vtrellis {
 	uint8_t *vals;
 };
 
+struct vdecoder;
+
+/*
+ * Segment of a segmented decode
+ *
+ * start, end - Trellis steps whose bits the segment decodes
+ * sums       - Accumulated path metrics of the segment
+ * decisions  - Path selections of the current step
+ * tail       - Path selections of the traceback margin after the segment
+ * margin     - Metric difference between the two best final states
+ */
+struct vsegment {
+	struct vdecoder *dec;
+	int start;
+	int end;
+	int16_t *sums;
+	int16_t *decisions;
+	uint64_t *tail;
+	int margin;
+#ifdef USE_THREADS
+	pthread_t thread;
+#endif
+};
+
 /*
  * Viterbi Decoder
  *
@@ -75,7 +99,17 @@ struct vtrellis {
  * intrvl    - Normalization interval
  * trellis   - Trellis object
  * punc      - Puncturing sequence
- * paths     - Trellis paths
+ * window    - Tail-biting warm-up length (0 for a second full pass)
+ * paths     - Trellis paths (one bit per state)
+ * states    - States of the first tail-biting traceback
+ * decisions - Path selections of the current step from the metric function
+ * metric_func - Combined BMU/PMU kernel for the running CPU
+ * pack_func   - Path selection packing kernel for the running CPU
+ * step_func   - BMU/PMU kernel returning the packed path selections, used
+ *               instead of the other two if the running CPU has one
+ * batch_func  - BMU/PMU kernel of a step of CONV_BATCH frames
+ * batch_bfly  - Butterflies grouped by branch metric, see gen_batch_k7_n3()
+ * batch_first - Start of the group of each metric in batch_bfly
  */
 struct vdecoder {
 	int n;
@@ -83,12 +117,43 @@ struct vdecoder {
 	int len;
 	int recursive;
 	int intrvl;
+	int window;
 	struct vtrellis *trellis;
 	int *punc;
-	int16_t **paths;
+	uint64_t *paths;
+	uint8_t *states;
+	int16_t *decisions;
 
 	void (*metric_func)(const int8_t *, const int16_t *,
 			    int16_t *, int16_t *, int);
+	uint64_t (*pack_func)(const int16_t *);
+	uint64_t (*step_func)(const int8_t *, const int16_t *,
+			      int16_t *, int);
+	void (*batch_func)(const int16_t *, const uint8_t *, const uint8_t *,
+			   const int16_t *, int16_t *, uint16_t *, int);
+	uint8_t batch_bfly[32];
+	uint8_t batch_first[9];
+
+	/* Batch decoding, see nrsc5_conv_decode_batch() */
+	int16_t *batch_sums[2];
+	int16_t *batch_val;
+	uint16_t *batch_paths;
+	uint8_t *batch_states;
+
+	/* Segmented decoding, see nrsc5_conv_set_segments() */
+	int num_segs;
+	struct vsegment *segs;
+	const int8_t *seg_in;
+	uint8_t *seg_out;
+#ifdef USE_THREADS
+	pthread_mutex_t seg_mutex;
+	pthread_cond_t seg_start;
+	pthread_cond_t seg_done;
+	unsigned seg_gen;
+	int seg_threads;
+	int seg_pending;
+	int seg_stop;
+#endif
 };
 
 /*
@@ -102,7 +167,7 @@ struct vdecoder {
 
 static int16_t *vdec_malloc(size_t n)
 {
-#if defined(HAVE_SSE3) && !defined(__APPLE__)
+#ifndef __APPLE__
 	return (int16_t *) memalign(SSE_ALIGN, sizeof(int16_t) * n);
 #else
 	return (int16_t *) malloc(sizeof(int16_t) * n);
@@ -259,19 +324,158 @@ static void reset_decoder(struct vdecoder *dec, int term)
 		dec->trellis->sums[0] = INT8_MAX * dec->n * dec->k;
 }
 
-static int _traceback(struct vdecoder *dec,
-		       unsigned state, uint8_t *out, int len)
+/* Trellis step whose path selections are discarded */
+static inline void vdec_metrics(struct vdecoder *dec, const int8_t *seq,
+				int16_t *sums, int16_t *decisions, int norm)
+{
+	if (dec->step_func)
+		dec->step_func(seq, dec->trellis->outputs, sums, norm);
+	else
+		dec->metric_func(seq, dec->trellis->outputs, sums, decisions, norm);
+}
+
+/* Trellis step, returning the path selections packed one bit per state */
+static inline uint64_t vdec_step(struct vdecoder *dec, const int8_t *seq,
+				 int16_t *sums, int16_t *decisions, int norm)
+{
+	if (dec->step_func)
+		return dec->step_func(seq, dec->trellis->outputs, sums, norm);
+
+	dec->metric_func(seq, dec->trellis->outputs, sums, decisions, norm);
+	return dec->pack_func(decisions);
+}
+
+/*
+ * Trellis step of a batch (K=7, N=3)
+ *
+ * Sums hold the path metrics of the 64 states of CONV_BATCH frames, state
+ * major, one frame to a lane. As the code outputs are +1 and -1, the
+ * branch metric of a butterfly is one of the eight sign combinations of
+ * the three soft bits, numbered by the signs of the outputs; the negated
+ * metric has the complement of that number. The butterflies come grouped
+ * by metric, bfly[first[k]] to bfly[first[k + 1] - 1] having metric k, so
+ * that a kernel holds the two metrics of a group in registers. The path
+ * selections of each state are stored one bit per frame, set where the
+ * path came from the odd state, which matches acs_butterfly() lane by lane.
+ */
+static void gen_batch_k7_n3(const int16_t *val, const uint8_t *bfly,
+			    const uint8_t *first, const int16_t *sums,
+			    int16_t *new_sums, uint16_t *paths, int norm)
+{
+	int16_t m[8][CONV_BATCH];
+	int i, j, k, f;
+
+	for (f = 0; f < CONV_BATCH; f++) {
+		int a = val[f] + val[CONV_BATCH + f];
+		int b = val[f] - val[CONV_BATCH + f];
+		int c = val[2 * CONV_BATCH + f];
+
+		m[0][f] = a + c;
+		m[1][f] = a - c;
+		m[2][f] = b + c;
+		m[3][f] = b - c;
+		m[4][f] = c - b;
+		m[5][f] = -b - c;
+		m[6][f] = c - a;
+		m[7][f] = -a - c;
+	}
+
+	for (k = 0; k < 8; k++) {
+		const int16_t *mp = m[k], *mn = m[k ^ 7];
+
+		for (j = first[k]; j < first[k + 1]; j++) {
+			const int16_t *s0, *s1;
+			unsigned p0 = 0, p1 = 0;
+
+			i = bfly[j];
+			s0 = &sums[2 * i * CONV_BATCH];
+			s1 = &sums[(2 * i + 1) * CONV_BATCH];
+			for (f = 0; f < CONV_BATCH; f++) {
+				int sum0 = s0[f] + mp[f];
+				int sum1 = s1[f] + mn[f];
+				int sum2 = s0[f] + mn[f];
+				int sum3 = s1[f] + mp[f];
+
+				new_sums[i * CONV_BATCH + f] = sum0 > sum1 ? sum0 : sum1;
+				new_sums[(i + 32) * CONV_BATCH + f] = sum2 > sum3 ? sum2 : sum3;
+				p0 |= (unsigned) (sum0 <= sum1) << f;
+				p1 |= (unsigned) (sum2 <= sum3) << f;
+			}
+			paths[i] = p0;
+			paths[i + 32] = p1;
+		}
+	}
+
+	if (norm) {
+		for (f = 0; f < CONV_BATCH; f++) {
+			int16_t min = new_sums[f];
+
+			for (i = 1; i < 64; i++) {
+				if (new_sums[i * CONV_BATCH + f] < min)
+					min = new_sums[i * CONV_BATCH + f];
+			}
+			for (i = 0; i < 64; i++)
+				new_sums[i * CONV_BATCH + f] -= min;
+		}
+	}
+}
+
+/* Path selection that led to a state, stored as 0 or 1 */
+static inline unsigned get_path(struct vdecoder *dec, int i, unsigned state)
+{
+	return (dec->paths[i] >> state) & 1;
+}
+
+/* Trace back from step end - 1 to start, both multiples of 8 */
+static int _traceback_range(struct vdecoder *dec, unsigned state,
+			    uint8_t *out, int start, int end)
+{
+	int i;
+	unsigned path;
+	uint8_t byte = 0;
+
+	for (i = end - 1; i >= start; i--) {
+		dec->states[i] = state;
+		path = get_path(dec, i, state);
+		byte = (byte << 1) | dec->trellis->vals[state];
+		if ((i & 7) == 0)
+			out[i >> 3] = byte;
+		state = vstate_lshift(state, dec->k, path);
+	}
+
+	return state;
+}
+
+/*
+ * Second tail-biting traceback
+ *
+ * Trace back from the start state of the first traceback until the path
+ * merges with the first one, whose output is the same from there on. Paths
+ * are compared at byte boundaries, where the output of both is complete, and
+ * usually merge within a few constraint lengths.
+ */
+static void _traceback_merge(struct vdecoder *dec,
+			     unsigned state, uint8_t *out, int len)
 {
 	int i;
 	unsigned path;
+	uint8_t byte = 0;
 
 	for (i = len - 1; i >= 0; i--) {
-		path = dec->paths[i][state] + 1;
-		out[i] = dec->trellis->vals[state];
+		if ((i & 7) == 7 && dec->states[i] == state)
+			break;
+		path = get_path(dec, i, state);
+		byte = (byte << 1) | dec->trellis->vals[state];
+		if ((i & 7) == 0)
+			out[i >> 3] = byte;
 		state = vstate_lshift(state, dec->k, path);
 	}
+}
 
-	return state;
+static int _traceback(struct vdecoder *dec,
+		       unsigned state, uint8_t *out, int len)
+{
+	return _traceback_range(dec, state, out, 0, len);
 }
 
 static void _traceback_rec(struct vdecoder *dec,
@@ -279,10 +483,13 @@ static void _traceback_rec(struct vdecoder *dec,
 {
 	int i;
 	unsigned path;
+	uint8_t byte = 0;
 
 	for (i = len - 1; i >= 0; i--) {
-		path = dec->paths[i][state] + 1;
-		out[i] = path ^ dec->trellis->vals[state];
+		path = get_path(dec, i, state);
+		byte = (byte << 1) | (path ^ dec->trellis->vals[state]);
+		if ((i & 7) == 0)
+			out[i >> 3] = byte;
 		state = vstate_lshift(state, dec->k, path);
 	}
 }
@@ -290,6 +497,8 @@ static void _traceback_rec(struct vdecoder *dec,
 /*
  * Traceback and generate decoded output
  *
+ * Output bits are packed eight to a byte, least significant bit first.
+ *
  * For tail biting, find the largest accumulated path metric at the final state
  * followed by two trace back passes. For zero flushing the final state is
  * always zero with a single traceback path.
@@ -312,7 +521,7 @@ static int traceback(struct vdecoder *dec, uint8_t *out, int term, int len)
 			return -EPROTO;
 	} else {
 		for (i = dec->len - 1; i >= len; i--) {
-			path = dec->paths[i][state] + 1;
+			path = get_path(dec, i, state);
 			state = vstate_lshift(state, dec->k, path);
 		}
 	}
@@ -324,19 +533,28 @@ static int traceback(struct vdecoder *dec, uint8_t *out, int term, int len)
 
 	/* Don't handle the odd case of recursize tail-biting codes */
 	if (term == CONV_TERM_TAIL_BITING)
-		_traceback(dec, state, out, len);
+		_traceback_merge(dec, state, out, len);
 
 	return max - max_p;
 }
 
+static void free_segments(struct vdecoder *dec);
+
 /* Release decoder object */
 static void free_vdec(struct vdecoder *dec)
 {
 	if (!dec)
 		return;
 
-	free(dec->paths[0]);
+	free_segments(dec);
+	free(dec->batch_sums[0]);
+	free(dec->batch_sums[1]);
+	free(dec->batch_val);
+	free(dec->batch_paths);
+	free(dec->batch_states);
 	free(dec->paths);
+	free(dec->states);
+	free(dec->decisions);
 	free_trellis(dec->trellis);
 	free(dec);
 }
@@ -349,16 +567,40 @@ static void free_vdec(struct vdecoder *dec)
  */
 static struct vdecoder *alloc_vdec(const struct lte_conv_code *code)
 {
-	int i, ns;
+	int i, j, k, ns;
 	struct vdecoder *dec;
 
 	ns = NUM_STATES(code->k);
+	assert(ns <= 64);
 
 	dec = (struct vdecoder *) calloc(1, sizeof(struct vdecoder));
 	dec->n = code->n;
 	dec->k = code->k;
 	dec->recursive = code->rgen ? 1 : 0;
 	dec->intrvl = INT16_MAX / (dec->n * INT8_MAX) - dec->k;
+	dec->window = CONV_TB_WINDOW;
+	dec->metric_func = gen_metrics_k7_n3;
+	dec->pack_func = pack_paths_k7;
+	dec->batch_func = gen_batch_k7_n3;
+
+#if defined(HAVE_X86_KERNELS)
+	if (cpu_has(CPU_SSE2))
+		dec->batch_func = sse_batch_k7_n3;
+	if (cpu_has(CPU_SSSE3)) {
+		dec->metric_func = sse_metrics_k7_n3;
+		dec->pack_func = sse_pack_paths_k7;
+	}
+	if (cpu_has(CPU_AVX2)) {
+		dec->step_func = avx2_step_k7_n3;
+		dec->batch_func = avx2_batch_k7_n3;
+	}
+#elif defined(HAVE_NEON_KERNELS)
+	if (cpu_has(CPU_NEON)) {
+		dec->metric_func = neon_metrics_k7_n3;
+		dec->pack_func = neon_pack_paths_k7;
+		dec->batch_func = neon_batch_k7_n3;
+	}
+#endif
 
     assert(dec->n == 3);
     assert(dec->k == 7);
@@ -372,10 +614,22 @@ static struct vdecoder *alloc_vdec(const struct lte_conv_code *code)
 	if (!dec->trellis)
 		goto fail;
 
-	dec->paths = (int16_t **) malloc(sizeof(int16_t *) * dec->len);
-	dec->paths[0] = vdec_malloc(ns * dec->len);
-	for (i = 1; i < dec->len; i++)
-		dec->paths[i] = &dec->paths[0][i * ns];
+	/* Group the butterflies by the signs of their outputs */
+	for (k = 0, j = 0; k < 8; k++) {
+		dec->batch_first[k] = j;
+		for (i = 0; i < 32; i++) {
+			const int16_t *out = &dec->trellis->outputs[4 * i];
+			if (((out[0] < 0) << 2 | (out[1] < 0) << 1 | (out[2] < 0)) == k)
+				dec->batch_bfly[j++] = i;
+		}
+	}
+	dec->batch_first[8] = j;
+
+	dec->paths = (uint64_t *) malloc(sizeof(uint64_t) * dec->len);
+	dec->states = (uint8_t *) malloc(dec->len);
+	dec->decisions = vdec_malloc(ns);
+	if (!dec->paths || !dec->states || !dec->decisions)
+		goto fail;
 
 	return dec;
 fail:
@@ -387,8 +641,10 @@ fail:
  * Forward trellis recursion
  *
  * Generate branch metrics and path metrics with a combined function. Only
- * accumulated path metric sums and path selections are stored. Normalize on
- * the interval specified by the decoder.
+ * accumulated path metric sums and path selections are stored. The metric
+ * function writes the selections of a step as 16 bit integers, which are
+ * packed to one bit per state before being stored, unless the kernel packs
+ * them itself. Normalize on the interval specified by the decoder.
  */
 static void _conv_decode(struct vdecoder *dec, const int8_t *seq, int len)
 {
@@ -396,39 +652,431 @@ static void _conv_decode(struct vdecoder *dec, const int8_t *seq, int len)
 	struct vtrellis *trellis = dec->trellis;
 
 	for (i = 0; i < dec->len; i++) {
-		gen_metrics_k7_n3(&seq[dec->n * i],
-				 trellis->outputs,
-				 trellis->sums,
-				 dec->paths[i],
-				 !(i % dec->intrvl));
+		dec->paths[i] = vdec_step(dec, &seq[dec->n * i],
+					  trellis->sums,
+					  dec->decisions,
+					  !(i % dec->intrvl));
 	}
 }
 
-int nrsc5_conv_decode(const int8_t *in, uint8_t *out)
+/*
+ * Tail-biting warm-up
+ *
+ * The encoder of a tail-biting code starts in the state that it ends in, so
+ * running the trellis over the last steps of the block brings the path
+ * metrics close to their values at the start of the block. Path selections of
+ * the warm-up are discarded.
+ */
+static void _conv_warmup(struct vdecoder *dec, const int8_t *seq, int window)
 {
-	const struct lte_conv_code code = {
-		.n = 3,
-		.k = 7,
-		.len = 146176,
-		.gen = { 0133, 0171, 0165 },
-		.term = CONV_TERM_TAIL_BITING,
-	};
-    int rc;
+	int i;
+	struct vtrellis *trellis = dec->trellis;
 
-	struct vdecoder *vdec = alloc_vdec(&code);
-	if (!vdec)
+	for (i = dec->len - window; i < dec->len; i++) {
+		vdec_metrics(dec, &seq[dec->n * i],
+			     trellis->sums,
+			     dec->decisions,
+			     !(i % dec->intrvl));
+	}
+}
+
+/*
+ * Decode one segment
+ *
+ * The path metrics start from zero a warm-up window before the segment, and
+ * the survivors are traced back from the best state a margin after it, so the
+ * decisions of a segment match those of a full decode with high probability.
+ * The windows of the first and last segments wrap around the block, as the
+ * code is tail-biting.
+ */
+static void _conv_segment(struct vdecoder *dec, struct vsegment *seg)
+{
+	int i, j, step = 0, max = -1, max_p = -1;
+	int window = dec->window ? dec->window : CONV_TB_WINDOW;
+	unsigned path, state = 0;
+	const int8_t *seq = dec->seg_in;
+
+	memset(seg->sums, 0, sizeof(int16_t) * dec->trellis->num_states);
+
+	for (j = -window; j < 0; j++) {
+		i = (seg->start + j + dec->len) % dec->len;
+		vdec_metrics(dec, &seq[dec->n * i], seg->sums,
+			     seg->decisions, !(step++ % dec->intrvl));
+	}
+
+	for (i = seg->start; i < seg->end; i++) {
+		dec->paths[i] = vdec_step(dec, &seq[dec->n * i], seg->sums,
+					  seg->decisions, !(step++ % dec->intrvl));
+	}
+
+	for (j = 0; j < CONV_SEG_MARGIN; j++) {
+		i = (seg->end + j) % dec->len;
+		seg->tail[j] = vdec_step(dec, &seq[dec->n * i], seg->sums,
+					 seg->decisions, !(step++ % dec->intrvl));
+	}
+
+	for (i = 0; i < dec->trellis->num_states; i++) {
+		if (seg->sums[i] > max) {
+			max_p = max;
+			max = seg->sums[i];
+			state = i;
+		}
+	}
+	seg->margin = max - max_p;
+
+	for (j = CONV_SEG_MARGIN - 1; j >= 0; j--) {
+		path = (seg->tail[j] >> state) & 1;
+		state = vstate_lshift(state, dec->k, path);
+	}
+	_traceback_range(dec, state, dec->seg_out, seg->start, seg->end);
+}
+
+#ifdef USE_THREADS
+static void *segment_worker(void *arg)
+{
+	struct vsegment *seg = arg;
+	struct vdecoder *dec = seg->dec;
+	unsigned gen = 0;
+
+	pthread_mutex_lock(&dec->seg_mutex);
+	for (;;) {
+		while (dec->seg_gen == gen && !dec->seg_stop)
+			pthread_cond_wait(&dec->seg_start, &dec->seg_mutex);
+		if (dec->seg_stop)
+			break;
+		gen = dec->seg_gen;
+		pthread_mutex_unlock(&dec->seg_mutex);
+
+		uint64_t span = trace_begin();
+		_conv_segment(dec, seg);
+		trace_end(TRACE_SEGMENT, span);
+
+		pthread_mutex_lock(&dec->seg_mutex);
+		if (--dec->seg_pending == 0)
+			pthread_cond_signal(&dec->seg_done);
+	}
+	pthread_mutex_unlock(&dec->seg_mutex);
+	return NULL;
+}
+#endif
+
+/*
+ * Decode all segments, the first on the calling thread and the others on
+ * the workers. Returns the smallest metric difference of the segments.
+ */
+static int _conv_segments(struct vdecoder *dec, const int8_t *in, uint8_t *out)
+{
+	int i, margin;
+
+	dec->seg_in = in;
+	dec->seg_out = out;
+
+#ifdef USE_THREADS
+	pthread_mutex_lock(&dec->seg_mutex);
+	dec->seg_pending = dec->num_segs - 1;
+	dec->seg_gen++;
+	pthread_cond_broadcast(&dec->seg_start);
+	pthread_mutex_unlock(&dec->seg_mutex);
+
+	_conv_segment(dec, &dec->segs[0]);
+
+	pthread_mutex_lock(&dec->seg_mutex);
+	while (dec->seg_pending)
+		pthread_cond_wait(&dec->seg_done, &dec->seg_mutex);
+	pthread_mutex_unlock(&dec->seg_mutex);
+#else
+	for (i = 0; i < dec->num_segs; i++)
+		_conv_segment(dec, &dec->segs[i]);
+#endif
+
+	margin = dec->segs[0].margin;
+	for (i = 1; i < dec->num_segs; i++) {
+		if (dec->segs[i].margin < margin)
+			margin = dec->segs[i].margin;
+	}
+	return margin;
+}
+
+static void free_segments(struct vdecoder *dec)
+{
+	int i;
+
+	if (!dec->segs)
+		return;
+
+#ifdef USE_THREADS
+	pthread_mutex_lock(&dec->seg_mutex);
+	dec->seg_stop = 1;
+	pthread_cond_broadcast(&dec->seg_start);
+	pthread_mutex_unlock(&dec->seg_mutex);
+	for (i = 1; i <= dec->seg_threads; i++)
+		pthread_join(dec->segs[i].thread, NULL);
+	pthread_cond_destroy(&dec->seg_done);
+	pthread_cond_destroy(&dec->seg_start);
+	pthread_mutex_destroy(&dec->seg_mutex);
+#endif
+
+	for (i = 0; i < dec->num_segs; i++) {
+		free(dec->segs[i].sums);
+		free(dec->segs[i].decisions);
+		free(dec->segs[i].tail);
+	}
+	free(dec->segs);
+	dec->segs = NULL;
+	dec->num_segs = 0;
+}
+
+static const struct lte_conv_code nrsc5_code = {
+	.n = 3,
+	.k = 7,
+	.len = 146176,
+	.gen = { 0133, 0171, 0165 },
+	.term = CONV_TERM_TAIL_BITING,
+};
+
+struct vdecoder *nrsc5_conv_alloc(void)
+{
+	return alloc_vdec(&nrsc5_code);
+}
+
+void nrsc5_conv_free(struct vdecoder *dec)
+{
+	free_vdec(dec);
+}
+
+void nrsc5_conv_set_window(struct vdecoder *dec, int window)
+{
+	if (window < 0 || window > dec->len)
+		window = 0;
+	dec->window = window;
+}
+
+int nrsc5_conv_set_segments(struct vdecoder *dec, int segments)
+{
+	int i, size;
+
+	if (segments < 1 || segments > CONV_MAX_SEGMENTS)
+		return -EINVAL;
+
+	free_segments(dec);
+	if (segments == 1)
+		return 0;
+
+	dec->segs = (struct vsegment *) calloc(segments, sizeof(struct vsegment));
+	if (!dec->segs)
+		return -ENOMEM;
+	dec->num_segs = segments;
+#ifdef USE_THREADS
+	pthread_mutex_init(&dec->seg_mutex, NULL);
+	pthread_cond_init(&dec->seg_start, NULL);
+	pthread_cond_init(&dec->seg_done, NULL);
+	dec->seg_gen = 0;
+	dec->seg_threads = 0;
+	dec->seg_stop = 0;
+#endif
+
+	/* Whole bytes of output per segment, the remainder to the last */
+	size = dec->len / 8 / segments * 8;
+	for (i = 0; i < segments; i++) {
+		struct vsegment *seg = &dec->segs[i];
+
+		seg->dec = dec;
+		seg->start = i * size;
+		seg->end = i == segments - 1 ? dec->len : (i + 1) * size;
+		seg->sums = vdec_malloc(dec->trellis->num_states);
+		seg->decisions = vdec_malloc(dec->trellis->num_states);
+		seg->tail = (uint64_t *) malloc(sizeof(uint64_t) * CONV_SEG_MARGIN);
+		if (!seg->sums || !seg->decisions || !seg->tail)
+			goto fail;
+	}
+
+#ifdef USE_THREADS
+	for (i = 1; i < segments; i++) {
+		if (pthread_create(&dec->segs[i].thread, NULL,
+				   segment_worker, &dec->segs[i]) != 0)
+			goto fail;
+		dec->seg_threads = i;
+#ifdef HAVE_PTHREAD_SETNAME_NP
+		char name[16];
+		snprintf(name, sizeof(name), "viterbi%d", i);
+		pthread_setname_np(dec->segs[i].thread, name);
+#endif
+	}
+#endif
+
+	return 0;
+fail:
+	free_segments(dec);
+	return -ENOMEM;
+}
+
+int nrsc5_conv_decode(struct vdecoder *dec, const int8_t *in, uint8_t *out)
+{
+	if (!dec)
 		return -EFAULT;
 
-	reset_decoder(vdec, code.term);
+	if (dec->num_segs > 1)
+		return _conv_segments(dec, in, out);
+
+	reset_decoder(dec, nrsc5_code.term);
+
+	/* Estimate the starting metrics from the end of the block */
+	if (nrsc5_code.term == CONV_TERM_TAIL_BITING) {
+		if (dec->window)
+			_conv_warmup(dec, in, dec->window);
+		else
+			_conv_decode(dec, in, nrsc5_code.len);
+	}
 
 	/* Propagate through the trellis with interval normalization */
-	_conv_decode(vdec, in, code.len);
+	_conv_decode(dec, in, nrsc5_code.len);
+
+	return traceback(dec, out, nrsc5_code.term, nrsc5_code.len);
+}
+
+/*
+ * Batch buffers, allocated on the first batch: two sets of path metrics,
+ * the soft bits of a step, the path selections of every step and the states
+ * of the first traceback at the last step of each byte, where the second
+ * traceback checks for the merge.
+ */
+static int alloc_batch(struct vdecoder *dec)
+{
+	if (dec->batch_paths)
+		return 0;
+
+	dec->batch_sums[0] = vdec_malloc(64 * CONV_BATCH);
+	dec->batch_sums[1] = vdec_malloc(64 * CONV_BATCH);
+	dec->batch_val = vdec_malloc(3 * CONV_BATCH);
+	dec->batch_states = (uint8_t *) malloc((size_t) ((dec->len + 7) / 8) * CONV_BATCH);
+	dec->batch_paths = (uint16_t *) malloc(sizeof(uint16_t) * 64 * (dec->len + 1));
+	if (!dec->batch_sums[0] || !dec->batch_sums[1] || !dec->batch_val ||
+	    !dec->batch_states || !dec->batch_paths) {
+		free(dec->batch_paths);
+		dec->batch_paths = NULL;
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Forward recursion of a batch over steps start to end - 1. The path
+ * selections of step i are stored in row i, or all in the spare row after
+ * the last step if paths is 0. Returns the set of metrics holding the sums.
+ */
+static int _conv_batch(struct vdecoder *dec, const int8_t *const *in,
+		       int start, int end, int paths, int cur)
+{
+	int i, f, j;
+	int16_t *val = dec->batch_val;
+
+	for (i = start; i < end; i++) {
+		for (j = 0; j < 3; j++) {
+			for (f = 0; f < CONV_BATCH; f++)
+				val[j * CONV_BATCH + f] = in[f][3 * i + j];
+		}
+		dec->batch_func(val, dec->batch_bfly, dec->batch_first,
+				dec->batch_sums[cur], dec->batch_sums[cur ^ 1],
+				&dec->batch_paths[64 * (paths ? i : dec->len)],
+				!(i % dec->intrvl));
+		cur ^= 1;
+	}
+	return cur;
+}
+
+/*
+ * Traceback of a batch, as traceback() does for each frame. The first
+ * traceback of every frame runs in lockstep, so that each row of path
+ * selections is read once for the whole batch.
+ */
+static void _traceback_batch(struct vdecoder *dec, const int16_t *sums,
+			     uint8_t *const *out, int *ret, int n)
+{
+	unsigned state[CONV_BATCH];
+	uint8_t byte[CONV_BATCH];
+	int i, f, s;
 
-	if (code.term == CONV_TERM_TAIL_BITING)
-		_conv_decode(vdec, in, code.len);
+	for (f = 0; f < n; f++) {
+		int max = -1, max_p = -1;
 
-	rc = traceback(vdec, out, code.term, code.len);
+		state[f] = 0;
+		for (s = 0; s < 64; s++) {
+			int sum = sums[s * CONV_BATCH + f];
+			if (sum > max) {
+				max_p = max;
+				max = sum;
+				state[f] = s;
+			}
+		}
+		ret[f] = max < 0 ? -EPROTO : max - max_p;
+		byte[f] = 0;
+	}
+
+	for (i = dec->len - 1; i >= 0; i--) {
+		const uint16_t *paths = &dec->batch_paths[64 * i];
+		uint8_t *states = &dec->batch_states[CONV_BATCH * (i >> 3)];
 
-	free_vdec(vdec);
-	return rc;
+		for (f = 0; f < n; f++) {
+			unsigned path = (paths[state[f]] >> f) & 1;
+
+			if ((i & 7) == 7)
+				states[f] = state[f];
+			byte[f] = (byte[f] << 1) | dec->trellis->vals[state[f]];
+			if ((i & 7) == 0 && ret[f] >= 0)
+				out[f][i >> 3] = byte[f];
+			state[f] = vstate_lshift(state[f], dec->k, path);
+		}
+	}
+
+	/* Second traceback, until the path merges with the first */
+	for (f = 0; f < n; f++) {
+		if (ret[f] < 0)
+			continue;
+
+		byte[f] = 0;
+		for (i = dec->len - 1; i >= 0; i--) {
+			unsigned path;
+
+			if ((i & 7) == 7 &&
+			    dec->batch_states[CONV_BATCH * (i >> 3) + f] == state[f])
+				break;
+			path = (dec->batch_paths[64 * i + state[f]] >> f) & 1;
+			byte[f] = (byte[f] << 1) | dec->trellis->vals[state[f]];
+			if ((i & 7) == 0)
+				out[f][i >> 3] = byte[f];
+			state[f] = vstate_lshift(state[f], dec->k, path);
+		}
+	}
+}
+
+int nrsc5_conv_decode_batch(struct vdecoder *dec, const int8_t *const *in,
+			    uint8_t *const *out, int *ret, int n)
+{
+	const int8_t *lanes[CONV_BATCH];
+	int i, f, cur, err;
+
+	if (!dec)
+		return -EFAULT;
+	err = alloc_batch(dec);
+	if (err)
+		return err;
+
+	for (i = 0; i < n; i += CONV_BATCH) {
+		int count = n - i < CONV_BATCH ? n - i : CONV_BATCH;
+
+		/* Spare lanes repeat the first frame, and are dropped */
+		for (f = 0; f < CONV_BATCH; f++)
+			lanes[f] = in[i + (f < count ? f : 0)];
+
+		memset(dec->batch_sums[0], 0, sizeof(int16_t) * 64 * CONV_BATCH);
+		cur = 0;
+		if (dec->window)
+			cur = _conv_batch(dec, lanes, dec->len - dec->window, dec->len, 0, cur);
+		else
+			cur = _conv_batch(dec, lanes, 0, dec->len, 0, cur);
+		cur = _conv_batch(dec, lanes, 0, dec->len, 1, cur);
+
+		_traceback_batch(dec, dec->batch_sums[cur], &out[i], &ret[i], count);
+	}
+	return 0;
 }
@@ -126,7 +126,7 @@ static void _gen_path_metrics(int num_states, int16_t *sums,
 }
 
 /* 16-state branch-path metrics units (K=5) */
-static void gen_metrics_k5_n2(const int8_t *seq, const int16_t *out,
+static inline void gen_metrics_k5_n2(const int8_t *seq, const int16_t *out,
 		       int16_t *sums, int16_t *paths, int norm)
 {
 	int16_t metrics[8];
@@ -135,7 +135,7 @@ static void gen_metrics_k5_n2(const int8_t *seq, const int16_t *out,
 	_gen_path_metrics(16, sums, metrics, paths, norm);
 }
 
-static void gen_metrics_k5_n3(const int8_t *seq, const int16_t *out,
+static inline void gen_metrics_k5_n3(const int8_t *seq, const int16_t *out,
 		       int16_t *sums, int16_t *paths, int norm)
 {
 	int16_t metrics[8];
@@ -145,7 +145,7 @@ static void gen_metrics_k5_n3(const int8_t *seq, const int16_t *out,
 
 }
 
-static void gen_metrics_k5_n4(const int8_t *seq, const int16_t *out,
+static inline void gen_metrics_k5_n4(const int8_t *seq, const int16_t *out,
 		       int16_t *sums, int16_t *paths, int norm)
 {
 	int16_t metrics[8];
@@ -156,7 +156,7 @@ static void gen_metrics_k5_n4(const int8_t *seq, const int16_t *out,
 }
 
 /* 64-state branch-path metrics units (K=7) */
-static void gen_metrics_k7_n2(const int8_t *seq, const int16_t *out,
+static inline void gen_metrics_k7_n2(const int8_t *seq, const int16_t *out,
 		       int16_t *sums, int16_t *paths, int norm)
 {
 	int16_t metrics[32];
@@ -166,7 +166,7 @@ static void gen_metrics_k7_n2(const int8_t *seq, const int16_t *out,
 
 }
 
-static void gen_metrics_k7_n3(const int8_t *seq, const int16_t *out,
+static inline void gen_metrics_k7_n3(const int8_t *seq, const int16_t *out,
 		       int16_t *sums, int16_t *paths, int norm)
 {
 	int16_t metrics[32];
@@ -176,7 +176,7 @@ static void gen_metrics_k7_n3(const int8_t *seq, const int16_t *out,
 
 }
 
-static void gen_metrics_k7_n4(const int8_t *seq, const int16_t *out,
+static inline void gen_metrics_k7_n4(const int8_t *seq, const int16_t *out,
 		       int16_t *sums, int16_t *paths, int norm)
 {
 	int16_t metrics[32];
@@ -184,3 +184,21 @@ static void gen_metrics_k7_n4(const int8_t *seq, const int16_t *out,
 	_gen_branch_metrics_n4(64, seq, out, metrics);
 	_gen_path_metrics(64, sums, metrics, paths, norm);
 }
+
+/*
+ * Pack path selections (K=7)
+ *
+ * Convert 64 path selections stored as -1 and 0 into a 64-bit word with one
+ * bit per state. A set bit corresponds to a selection of 0, so the stored
+ * value is the path that led to the state.
+ */
+static inline uint64_t pack_paths_k7(const int16_t *paths)
+{
+	int i;
+	uint64_t bits = 0;
+
+	for (i = 0; i < 64; i++)
+		bits |= (uint64_t) (paths[i] + 1) << i;
+
+	return bits;
+}
@@ -179,3 +179,26 @@ static inline void gen_metrics_k7_n4(const int8_t *val, const int16_t *out,
 
 	_neon_metrics_k7_n4(_val, out, sums, paths, norm);
 }
+
+/*
+ * Pack path selections (K=7)
+ *
+ * Narrow the 64 path selections to 8 bits, weight each lane by its bit
+ * position and sum horizontally. Path selections are stored as -1 and 0, so
+ * the mask is inverted to store the path that led to each state.
+ */
+static inline uint64_t pack_paths_k7(const int16_t *paths)
+{
+    static const uint8_t weights[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x8_t w = vld1_u8(weights);
+    uint64_t bits = 0;
+
+    for (int i = 0; i < 8; i++)
+    {
+        uint8x8_t v = vmovn_u16(vreinterpretq_u16_s16(vld1q_s16(&paths[i * 8])));
+        uint64x1_t sum = vpaddl_u32(vpaddl_u16(vpaddl_u8(vand_u8(v, w))));
+        bits |= vget_lane_u64(sum, 0) << (i * 8);
+    }
+
+    return ~bits;
+}
@@ -559,7 +559,7 @@ __always_inline void _sse_metrics_k7_n4(const int16_t *val, const int16_t *out,
 	_mm_store_si128((__m128i *) &sums[56], m11);
 }
 
-static void gen_metrics_k5_n2(const int8_t *val, const int16_t *out,
+static inline void gen_metrics_k5_n2(const int8_t *val, const int16_t *out,
 			      int16_t *sums, int16_t *paths, int norm)
 {
 	const int16_t _val[4] = { val[0], val[1], val[0], val[1] };
@@ -567,7 +567,7 @@ static void gen_metrics_k5_n2(const int8_t *val, const int16_t *out,
 	_sse_metrics_k5_n2(_val, out, sums, paths, norm);
 }
 
-static void gen_metrics_k5_n3(const int8_t *val, const int16_t *out,
+static inline void gen_metrics_k5_n3(const int8_t *val, const int16_t *out,
 		       int16_t *sums, int16_t *paths, int norm)
 {
 	const int16_t _val[4] = { val[0], val[1], val[2], 0 };
@@ -575,7 +575,7 @@ static void gen_metrics_k5_n3(const int8_t *val, const int16_t *out,
 	_sse_metrics_k5_n4(_val, out, sums, paths, norm);
 }
 
-static void gen_metrics_k5_n4(const int8_t *val, const int16_t *out,
+static inline void gen_metrics_k5_n4(const int8_t *val, const int16_t *out,
 		       int16_t *sums, int16_t *paths, int norm)
 {
 	const int16_t _val[4] = { val[0], val[1], val[2], val[3] };
@@ -583,7 +583,7 @@ static void gen_metrics_k5_n4(const int8_t *val, const int16_t *out,
 	_sse_metrics_k5_n4(_val, out, sums, paths, norm);
 }
 
-static void gen_metrics_k7_n2(const int8_t *val, const int16_t *out,
+static inline void gen_metrics_k7_n2(const int8_t *val, const int16_t *out,
 		       int16_t *sums, int16_t *paths, int norm)
 {
 	const int16_t _val[4] = { val[0], val[1], val[0], val[1] };
@@ -591,7 +591,7 @@ static void gen_metrics_k7_n2(const int8_t *val, const int16_t *out,
 	_sse_metrics_k7_n2(_val, out, sums, paths, norm);
 }
 
-static void gen_metrics_k7_n3(const int8_t *val, const int16_t *out,
+static inline void gen_metrics_k7_n3(const int8_t *val, const int16_t *out,
 		       int16_t *sums, int16_t *paths, int norm)
 {
 	const int16_t _val[4] = { val[0], val[1], val[2], 0 };
@@ -599,10 +599,39 @@ static void gen_metrics_k7_n3(const int8_t *val, const int16_t *out,
 	_sse_metrics_k7_n4(_val, out, sums, paths, norm);
 }
 
-static void gen_metrics_k7_n4(const int8_t *val, const int16_t *out,
+static inline void gen_metrics_k7_n4(const int8_t *val, const int16_t *out,
 		       int16_t *sums, int16_t *paths, int norm)
 {
 	const int16_t _val[4] = { val[0], val[1], val[2], val[3] };
 
 	_sse_metrics_k7_n4(_val, out, sums, paths, norm);
 }
+
+/*
+ * Pack path selections (K=7)
+ *
+ * Saturate the 64 path selections to 8 bits and gather the sign bits. Path
+ * selections are stored as -1 and 0, so the mask is inverted to store the
+ * path that led to each state.
+ */
+static inline uint64_t pack_paths_k7(const int16_t *paths)
+{
+	__m128i m0, m1, m2, m3;
+	uint64_t bits;
+
+	m0 = _mm_packs_epi16(_mm_load_si128((__m128i *) &paths[0]),
+			     _mm_load_si128((__m128i *) &paths[8]));
+	m1 = _mm_packs_epi16(_mm_load_si128((__m128i *) &paths[16]),
+			     _mm_load_si128((__m128i *) &paths[24]));
+	m2 = _mm_packs_epi16(_mm_load_si128((__m128i *) &paths[32]),
+			     _mm_load_si128((__m128i *) &paths[40]));
+	m3 = _mm_packs_epi16(_mm_load_si128((__m128i *) &paths[48]),
+			     _mm_load_si128((__m128i *) &paths[56]));
+
+	bits = (uint64_t) (uint16_t) _mm_movemask_epi8(m0);
+	bits |= (uint64_t) (uint16_t) _mm_movemask_epi8(m1) << 16;
+	bits |= (uint64_t) (uint16_t) _mm_movemask_epi8(m2) << 32;
+	bits |= (uint64_t) (uint16_t) _mm_movemask_epi8(m3) << 48;
+
+	return ~bits;
+}
@@ -0,0 +1,61 @@
+#if defined(__linux__) && defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "cpu.h"
+#include "defines.h"
+
+static unsigned int features;
+static unsigned int mask = ~0u;
+static int probed;
+
+static unsigned int probe()
+{
+    unsigned int f = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        f |= CPU_SSE2;
+    if (__builtin_cpu_supports("ssse3"))
+        f |= CPU_SSSE3;
+    if (__builtin_cpu_supports("avx2"))
+        f |= CPU_AVX2;
+#elif defined(__aarch64__)
+    // Advanced SIMD is mandatory on AArch64
+    f |= CPU_NEON;
+#elif defined(__arm__) && defined(__linux__)
+    if (getauxval(AT_HWCAP) & HWCAP_NEON)
+        f |= CPU_NEON;
+#endif
+
+#ifndef HAVE_X86_KERNELS
+    f &= ~(CPU_SSE2 | CPU_SSSE3 | CPU_AVX2);
+#endif
+#ifndef HAVE_NEON_KERNELS
+    f &= ~CPU_NEON;
+#endif
+
+    return f;
+}
+
+unsigned int cpu_features()
+{
+    if (!probed)
+    {
+        features = probe();
+        probed = 1;
+        log_debug("CPU features:%s%s%s%s",
+                  features & CPU_SSE2 ? " sse2" : "",
+                  features & CPU_SSSE3 ? " ssse3" : "",
+                  features & CPU_AVX2 ? " avx2" : "",
+                  features & CPU_NEON ? " neon" : "");
+    }
+    return features & mask;
+}
+
+void cpu_set_mask(unsigned int m)
+{
+    mask = m;
+}
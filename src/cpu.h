@@ -0,0 +1,16 @@
+#pragma once
+
+// CPU features usable by the kernels compiled into this binary
+#define CPU_SSE2  (1 << 0)
+#define CPU_SSSE3 (1 << 1)
+#define CPU_AVX2  (1 << 2)
+#define CPU_NEON  (1 << 3)
+
+unsigned int cpu_features();
+// Hide the features outside of mask from kernels bound afterwards, so that
+// benchmarks can compare every kernel compiled in.
+void cpu_set_mask(unsigned int mask);
+static inline int cpu_has(unsigned int feature)
+{
+    return (cpu_features() & feature) == feature;
+}
@@ -13,76 +13,229 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
 #include "conv.h"
 #include "decode.h"
 #include "input.h"
+#include "profile.h"
+#include "trace.h"
+
+// decoded bits are packed eight to a byte, bit i in bit i % 8 of byte i / 8
+static inline unsigned int decoded_bit(const uint8_t *decoded, unsigned int i)
+{
+    return (decoded[i >> 3] >> (i & 7)) & 1;
+}
 
-// calculate channel bit error rate by re-encoding and comparing to the input
+// Calculate channel bit error rate by re-encoding and comparing to the
+// input. Soft bits of 0, weak ones rounded to 0 and those decode_resume()
+// erased, carry no decision and are not counted.
 static float calc_cber(int8_t *coded, uint8_t *decoded)
 {
+    static const uint8_t gen[3] = { 0133, 0171, 0165 };
     uint8_t r = 0;
-    unsigned int i, j, errors = 0;
+    unsigned int i, j, errors = 0, bits = 0;
 
     // tail biting
     for (i = 0; i < 6; i++)
-        r = (r >> 1) | (decoded[FRAME_LEN - 6 + i] << 6);
+        r = (r >> 1) | (decoded_bit(decoded, FRAME_LEN - 6 + i) << 6);
 
     for (i = 0, j = 0; i < FRAME_LEN; i++)
     {
         // shift in new bit
-        r = (r >> 1) | (decoded[i] << 6);
-
-        if ((coded[j++] > 0 ? 1 : 0) != (__builtin_popcount(r & 0133) & 1))
-            errors++;
-
-        if ((coded[j++] > 0 ? 1 : 0) != (__builtin_popcount(r & 0171) & 1))
-            errors++;
+        r = (r >> 1) | (decoded_bit(decoded, i) << 6);
 
-        if ((j % 6) == 5)
-            j++;
-        else if ((coded[j++] > 0 ? 1 : 0) != (__builtin_popcount(r & 0165) & 1))
-            errors++;
+        for (unsigned int g = 0; g < 3; g++, j++)
+        {
+            // every sixth bit is punctured
+            if ((j % 6) == 5 || coded[j] == 0)
+                continue;
+            bits++;
+            if ((coded[j] > 0 ? 1 : 0) != (__builtin_popcount(r & gen[g]) & 1))
+                errors++;
+        }
     }
 
-    return errors / (5.0 / 2.0 * FRAME_LEN);;
+    return bits ? (float)errors / bits : 0;
 }
 
-static void descramble(uint8_t *buf, unsigned int length)
+// The scrambler restarts every frame, so its output is the same for every
+// frame and descrambling is a XOR with a precomputed sequence.
+static uint8_t scrambler_seq[FRAME_LEN / 8];
+
+static void build_scrambler_seq()
 {
     const unsigned int width = 11;
     unsigned int i, val = 0x3ff;
-    for (i = 0; i < length; i += 8)
+    for (i = 0; i < FRAME_LEN; ++i)
     {
-        unsigned int j;
-        for (j = 0; j < 8; ++j)
-        {
-            int bit = ((val >> 9) ^ val) & 1;
-            val |= bit << width;
-            val >>= 1;
-            buf[i + j] ^= bit;
-        }
+        int bit = ((val >> 9) ^ val) & 1;
+        val |= bit << width;
+        val >>= 1;
+        scrambler_seq[i >> 3] |= bit << (i & 7);
+    }
+}
+
+static void descramble(uint8_t *buf)
+{
+    unsigned int i;
+    for (i = 0; i < sizeof(scrambler_seq); i += 8)
+    {
+        uint64_t x, y;
+        memcpy(&x, &buf[i], 8);
+        memcpy(&y, &scrambler_seq[i], 8);
+        x ^= y;
+        memcpy(&buf[i], &x, 8);
     }
 }
 
-static void dump_ber(float cber)
+static void dump_ber(decode_t *st, float cber)
 {
-    static float min = 1, max = 0, sum = 0, count = 0;
-    sum += cber;
-    count += 1;
-    if (cber < min) min = cber;
-    if (cber > max) max = cber;
-    log_info("BER: %f, avg: %f, min: %f, max: %f", cber, sum / count, min, max);
+    st->ber_sum += cber;
+    st->ber_count += 1;
+    if (cber < st->ber_min) st->ber_min = cber;
+    if (cber > st->ber_max) st->ber_max = cber;
+    log_info("BER: %f, avg: %f, min: %f, max: %f", cber, st->ber_sum / st->ber_count, st->ber_min, st->ber_max);
+    stats_set(&st->input->stats.ber, cber);
+    stats_set(&st->input->stats.ber_avg, st->ber_sum / st->ber_count);
+
+    nrsc5_event_t evt;
+    evt.event = NRSC5_EVENT_BER;
+    evt.ber.cber = cber;
+    input_event(st->input, &evt);
 }
 
-void decode_process(decode_t *st)
+#define P1_BITS 365440
+
+// P1 deinterleaver, source index in the decode buffer for each coded bit
+static uint32_t p1_il[P1_BITS];
+static int p1_il_ready;
+static unsigned int viterbi_segments = 1;
+static unsigned int viterbi_window = CONV_TB_WINDOW;
+static unsigned int viterbi_batch_ms;
+
+#ifdef USE_THREADS
+/*
+ * Process-wide Viterbi batcher. The decode workers of every station queue
+ * their frames, and the worker that fills a batch of CONV_BATCH, or whose
+ * wait of viterbi_batch_ms ends first, decodes the queued frames together
+ * with the shared decoder, one batch at a time. A batch costs about as
+ * much CPU as 8 (AVX2) to 12 (generic) frames decoded alone, so fewer than
+ * BATCH_MIN frames are handed back to their workers instead.
+ */
+#define BATCH_MIN 10
+
+enum
+{
+    FRAME_QUEUED,
+    FRAME_TAKEN,
+    FRAME_DONE,
+    FRAME_ALONE
+};
+
+typedef struct
+{
+    const int8_t *in;
+    uint8_t *out;
+    int state;
+} batch_frame_t;
+
+static struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    batch_frame_t *queue[CONV_BATCH];
+    unsigned int queued;
+    // a batch is being decoded with vdec
+    int busy;
+    struct vdecoder *vdec;
+    // decoders initialized with batching
+    unsigned int users;
+} batcher = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+// Decode the queued frames, with batcher.mutex held.
+static void batch_run(void)
+{
+    batch_frame_t *frames[CONV_BATCH];
+    const int8_t *in[CONV_BATCH];
+    uint8_t *out[CONV_BATCH];
+    int ret[CONV_BATCH], state;
+    unsigned int i, n = batcher.queued;
+
+    memcpy(frames, batcher.queue, sizeof(frames[0]) * n);
+    batcher.queued = 0;
+    for (i = 0; i < n; i++)
+        frames[i]->state = n < BATCH_MIN ? FRAME_ALONE : FRAME_TAKEN;
+    if (n < BATCH_MIN)
+    {
+        pthread_cond_broadcast(&batcher.cond);
+        return;
+    }
+
+    while (batcher.busy)
+        pthread_cond_wait(&batcher.cond, &batcher.mutex);
+    batcher.busy = 1;
+    pthread_mutex_unlock(&batcher.mutex);
+
+    for (i = 0; i < n; i++)
+    {
+        in[i] = frames[i]->in;
+        out[i] = frames[i]->out;
+    }
+    log_debug("Viterbi batch of %u frames", n);
+    state = nrsc5_conv_decode_batch(batcher.vdec, in, out, ret, n) == 0 ? FRAME_DONE : FRAME_ALONE;
+
+    pthread_mutex_lock(&batcher.mutex);
+    batcher.busy = 0;
+    for (i = 0; i < n; i++)
+        frames[i]->state = state;
+    pthread_cond_broadcast(&batcher.cond);
+}
+
+// Returns 0 if the frame was decoded in a batch, or -1 if it is to be
+// decoded alone.
+static int batch_decode(const int8_t *in, uint8_t *out)
+{
+    batch_frame_t frame = { in, out, FRAME_QUEUED };
+    struct timespec deadline;
+    int expired = 0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += viterbi_batch_ms / 1000;
+    deadline.tv_nsec += (long)(viterbi_batch_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&batcher.mutex);
+    batcher.queue[batcher.queued++] = &frame;
+    while (frame.state == FRAME_QUEUED || frame.state == FRAME_TAKEN)
+    {
+        if (frame.state == FRAME_QUEUED && (batcher.queued == CONV_BATCH || expired))
+            batch_run();
+        else if (frame.state == FRAME_QUEUED)
+            expired = pthread_cond_timedwait(&batcher.cond, &batcher.mutex, &deadline) == ETIMEDOUT;
+        else
+            pthread_cond_wait(&batcher.cond, &batcher.mutex);
+    }
+    pthread_mutex_unlock(&batcher.mutex);
+    return frame.state == FRAME_DONE ? 0 : -1;
+}
+#endif
+
+static void build_p1_il()
 {
     const int J = 20, B = 16, C = 36;
     const int8_t v[] = {
         10, 2, 18, 6, 14, 8, 16, 0, 12, 4,
         11, 3, 19, 7, 15, 9, 17, 1, 13, 5
     };
-    unsigned int i, out = 0;
-    for (i = 0; i < 365440; i++)
+    unsigned int i;
+    for (i = 0; i < P1_BITS; i++)
     {
         int partition = v[i % J];
         int block = ((i / J) + (partition * 7)) % B;
@@ -90,15 +243,89 @@ void decode_process(decode_t *st)
         int row = (k * 11) % 32;
         int column = (k * 11 + k / (32*9)) % C;
         // row bits are reveresed, hence the 719 - x
-        st->viterbi[out++] = st->buffer[(block * 32 + row) * 720 + 719 - (partition * C + column)];
-        if ((out % 6) == 5) // depuncture, [1, 1, 1, 1, 1, 0]
-            st->viterbi[out++] = 0;
+        p1_il[i] = (block * 32 + row) * 720 + 719 - (partition * C + column);
+    }
+    build_scrambler_seq();
+    p1_il_ready = 1;
+}
+
+static void decode_process(decode_t *st, const int8_t *buf, uint64_t arrival)
+{
+    const uint32_t *il = p1_il;
+    int8_t *out = st->viterbi;
+    timing_t *timing = &st->input->timing;
+    uint64_t t = timing_now(timing), span = trace_begin(), viterbi;
+    unsigned int i;
+    for (i = 0; i < P1_BITS; i += 5)
+    {
+        out[0] = buf[il[i]];
+        out[1] = buf[il[i + 1]];
+        out[2] = buf[il[i + 2]];
+        out[3] = buf[il[i + 3]];
+        out[4] = buf[il[i + 4]];
+        out[5] = 0; // depuncture, [1, 1, 1, 1, 1, 0]
+        out += 6;
     }
 
-    nrsc5_conv_decode(st->viterbi, st->scrambler);
-    dump_ber(calc_cber(st->viterbi, st->scrambler));
-    descramble(st->scrambler, 146176);
+    viterbi = trace_begin();
+#ifdef USE_THREADS
+    if (!st->batch || batch_decode(st->viterbi, st->scrambler) != 0)
+#endif
+        nrsc5_conv_decode(st->vdec, st->viterbi, st->scrambler);
+    trace_end(TRACE_VITERBI, viterbi);
+    dump_ber(st, calc_cber(st->viterbi, st->scrambler));
+    descramble(st->scrambler);
+    t = timing_end(timing, TIMING_VITERBI, t);
     frame_push(&st->input->frame, st->scrambler);
+    timing_end(timing, TIMING_FRAME, t);
+
+    // the audio of the frame has been handed to the outputs
+    if (arrival)
+    {
+        float latency = (timing_clock() - arrival) / 1e9f;
+        stats_set(&st->input->stats.latency, latency);
+        log_debug("Latency: %.3f s", latency);
+    }
+    trace_end(TRACE_DECODE, span);
+}
+
+// Hand the filled frame to the decode worker. Sync fills the next buffer
+// while earlier frames are decoded.
+void decode_push_frame(decode_t *st)
+{
+    // not charged to sync, which is still running
+    uint64_t t = timing_now(&st->input->timing);
+#ifdef USE_THREADS
+    st->arrivals[ring_head(&st->ring)] = st->arrival;
+    ring_push(&st->ring);
+    ring_wait_space(&st->ring, NULL);
+    st->buffer = &st->buffers[ring_head(&st->ring) * DECODE_BUF_LEN];
+#else
+    decode_process(st, st->buffer, st->arrival);
+#endif
+    timing_hold(&st->input->timing, TIMING_SYNC, t);
+}
+
+#ifdef USE_THREADS
+static void *decode_worker(void *arg)
+{
+    decode_t *st = arg;
+    while (ring_wait_data(&st->ring))
+    {
+        unsigned int slot = ring_tail(&st->ring);
+        decode_process(st, &st->buffers[slot * DECODE_BUF_LEN], st->arrivals[slot]);
+        ring_pop(&st->ring);
+    }
+
+    return NULL;
+}
+#endif
+
+void decode_wait(decode_t *st)
+{
+#ifdef USE_THREADS
+    ring_wait_empty(&st->ring);
+#endif
 }
 
 void decode_reset(decode_t *st)
@@ -106,12 +333,97 @@ void decode_reset(decode_t *st)
     st->idx = 0;
 }
 
+void decode_resume(decode_t *st, unsigned int block)
+{
+    st->idx = 720 * BLKSZ * block;
+    memset(st->buffer, 0, st->idx);
+}
+
+void decode_set_segments(unsigned int segments)
+{
+    viterbi_segments = segments;
+}
+
+void decode_set_window(unsigned int window)
+{
+    viterbi_window = window;
+}
+
+void decode_set_batch(unsigned int ms)
+{
+    viterbi_batch_ms = ms;
+}
+
 void decode_init(decode_t *st, struct input_t *input)
 {
     st->input = input;
-    st->buffer = malloc(720 * BLKSZ * 16);
-    st->viterbi = malloc(FRAME_LEN * 3);
-    st->scrambler = malloc(FRAME_LEN);
+    st->depth = profile_get()->decode_depth;
+    st->buffers = input_alloc(input, DECODE_BUF_LEN * st->depth);
+    st->buffer = st->buffers;
+    st->arrivals = input_alloc(input, sizeof(uint64_t) * st->depth);
+    st->arrival = 0;
+    st->viterbi = input_alloc(input, FRAME_LEN * 3);
+    st->scrambler = input_alloc(input, FRAME_LEN / 8);
+    st->ber_min = 1;
+    st->ber_max = 0;
+    st->ber_sum = 0;
+    st->ber_count = 0;
+    if (!p1_il_ready)
+        build_p1_il();
+    st->vdec = nrsc5_conv_alloc();
+    if (st->vdec == NULL)
+        FATAL_EXIT("Unable to allocate Viterbi decoder.");
+    nrsc5_conv_set_window(st->vdec, viterbi_window);
+    if (nrsc5_conv_set_segments(st->vdec, viterbi_segments) != 0)
+        FATAL_EXIT("Unable to start Viterbi decoder threads.");
 
     decode_reset(st);
+
+#ifdef USE_THREADS
+    st->batch = viterbi_batch_ms != 0;
+    if (st->batch)
+    {
+        pthread_mutex_lock(&batcher.mutex);
+        if (batcher.users++ == 0)
+        {
+            batcher.vdec = nrsc5_conv_alloc();
+            if (batcher.vdec != NULL)
+                nrsc5_conv_set_window(batcher.vdec, viterbi_window);
+        }
+        pthread_mutex_unlock(&batcher.mutex);
+        if (batcher.vdec == NULL)
+            FATAL_EXIT("Unable to allocate Viterbi decoder.");
+    }
+    ring_init(&st->ring, st->depth);
+    pthread_create(&st->worker_thread, NULL, decode_worker, st);
+#ifdef HAVE_PTHREAD_SETNAME_NP
+    pthread_setname_np(st->worker_thread, "decode_worker");
+#endif
+#endif
+}
+
+void decode_free(decode_t *st)
+{
+#ifdef USE_THREADS
+    // the worker decodes the remaining frame before it exits
+    ring_stop(&st->ring);
+    pthread_join(st->worker_thread, NULL);
+    ring_destroy(&st->ring);
+    if (st->batch)
+    {
+        pthread_mutex_lock(&batcher.mutex);
+        if (--batcher.users == 0)
+        {
+            nrsc5_conv_free(batcher.vdec);
+            batcher.vdec = NULL;
+        }
+        pthread_mutex_unlock(&batcher.mutex);
+    }
+#endif
+
+    nrsc5_conv_free(st->vdec);
+    free(st->buffers);
+    free(st->arrivals);
+    free(st->viterbi);
+    free(st->scrambler);
 }
@@ -2,18 +2,41 @@
 
 #include <stdint.h>
 #include "defines.h"
+#include "ring.h"
+
+// soft bits in one P1 frame
+#define DECODE_BUF_LEN (720 * BLKSZ * 16)
 
 typedef struct
 {
     struct input_t *input;
+    // frame being filled, points into buffers
     int8_t *buffer;
     unsigned int idx;
 
+    // depth frames, and when the last sample of each arrived
+    int8_t *buffers;
+    uint64_t *arrivals;
+    unsigned int depth;
+    // arrival of the block sync is pushing
+    uint64_t arrival;
+
     int8_t *viterbi;
     uint8_t *scrambler;
+    struct vdecoder *vdec;
+
+    // bit error rate statistics
+    float ber_min, ber_max, ber_sum, ber_count;
+
+#ifdef USE_THREADS
+    pthread_t worker_thread;
+    ring_t ring;
+    // frames go through the Viterbi batcher, see decode_set_batch
+    int batch;
+#endif
 } decode_t;
 
-void decode_process(decode_t *st);
+void decode_push_frame(decode_t *st);
 static inline unsigned int decode_get_block(decode_t *st)
 {
     return st->idx / (720 * BLKSZ);
@@ -21,11 +44,28 @@ static inline unsigned int decode_get_block(decode_t *st)
 static inline void decode_push(decode_t *st, int8_t sbit)
 {
     st->buffer[st->idx] = sbit;
-    if (++st->idx == 720 * BLKSZ * 16)
+    if (++st->idx == DECODE_BUF_LEN)
     {
-        decode_process(st);
+        decode_push_frame(st);
         st->idx = 0;
     }
 }
 void decode_reset(decode_t *st);
+// Continue a frame at block, with the soft bits of the earlier blocks erased.
+void decode_resume(decode_t *st, unsigned int block);
+void decode_wait(decode_t *st);
+// Segments each frame is split into for Viterbi decoding on as many
+// threads, 1 to CONV_MAX_SEGMENTS, for the decoders initialized afterwards.
+// Not thread-safe, like fft_set_effort.
+void decode_set_segments(unsigned int segments);
+// Steps of the tail-biting warm-up of the Viterbi decoders initialized
+// afterwards, 0 to FRAME_LEN, CONV_TB_WINDOW by default; 0 runs a second
+// full pass over each frame instead. Not thread-safe, like decode_set_segments.
+void decode_set_window(unsigned int window);
+// Decode the frames of every decoder initialized afterwards together in
+// batches, each frame waiting up to ms milliseconds for a batch to fill; 0
+// decodes each frame alone. Frames of a batch are not split into segments.
+// Batching needs threads. Not thread-safe, like decode_set_segments.
+void decode_set_batch(unsigned int ms);
 void decode_init(decode_t *st, struct input_t *input);
+void decode_free(decode_t *st);
@@ -9,6 +9,22 @@
 
 #define FATAL_EXIT(x,...) do { log_fatal(x, ##__VA_ARGS__); exit(1); } while (0)
 
+// pipeline queue depths: OFDM blocks for sync, P1 frames for decode and
+// PCM frames for audio output, which arrive 32 at a time with each P1 frame
+#ifndef SYNC_DEPTH
+#define SYNC_DEPTH 4
+#endif
+#ifndef DECODE_DEPTH
+#define DECODE_DEPTH 2
+#endif
+#ifndef AUDIO_DEPTH
+#define AUDIO_DEPTH 40
+#endif
+// PCM frames of playout delay, the jitter the audio output absorbs
+#ifndef AUDIO_TARGET
+#define AUDIO_TARGET 4
+#endif
+
 // FFT length in samples
 #define FFT 2048
 // cyclic preflex length in samples
@@ -40,6 +56,10 @@ typedef struct {
     int16_t r, i;
 } cint16_t;
 
+typedef struct {
+    int32_t r, i;
+} cint32_t;
+
 static inline cint16_t cf_to_cq15(float complex x)
 {
     cint16_t cq15;
@@ -0,0 +1,127 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "defines.h"
+#include "fft.h"
+
+static int effort = FFT_PLAN_MEASURE;
+// set when a plan was made without wisdom
+static int dirty;
+
+// $XDG_CACHE_HOME/nrsc5/fftw-wisdom or ~/.cache/nrsc5/fftw-wisdom. With
+// create set, the directories are created as needed.
+static int default_path(char *path, size_t size, int create)
+{
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int n;
+
+    if (cache && cache[0])
+        n = snprintf(path, size, "%s/nrsc5", cache);
+    else if (home && home[0])
+        n = snprintf(path, size, "%s/.cache/nrsc5", home);
+    else
+        return 1;
+    if (n < 0 || (size_t)n >= size)
+        return 1;
+
+    if (create)
+    {
+        // each component after the first
+        for (char *p = strchr(path + 1, '/'); ; p = strchr(p + 1, '/'))
+        {
+            if (p)
+                *p = 0;
+            if (mkdir(path, 0755) != 0 && errno != EEXIST)
+                return 1;
+            if (p == NULL)
+                break;
+            *p = '/';
+        }
+    }
+
+    n = strlen(path);
+    if (snprintf(path + n, size - n, "/fftw-wisdom") >= (int)(size - n))
+        return 1;
+    return 0;
+}
+
+void fft_set_effort(int e)
+{
+    effort = e;
+}
+
+int fft_load_wisdom(const char *path)
+{
+    char buf[PATH_MAX];
+
+    if (path == NULL)
+    {
+        if (default_path(buf, sizeof(buf), 0) != 0)
+            return 1;
+        path = buf;
+    }
+
+    if (fftwf_import_wisdom_from_filename(path) == 0)
+        return 1;
+    log_debug("Loaded FFTW wisdom from %s", path);
+    return 0;
+}
+
+int fft_save_wisdom(const char *path)
+{
+    char buf[PATH_MAX];
+
+    if (!dirty)
+        return 0;
+
+    if (path == NULL)
+    {
+        if (default_path(buf, sizeof(buf), 1) != 0)
+            return 1;
+        path = buf;
+    }
+
+    if (fftwf_export_wisdom_to_filename(path) == 0)
+    {
+        log_warn("Unable to save FFTW wisdom to %s", path);
+        return 1;
+    }
+    log_debug("Saved FFTW wisdom to %s", path);
+    dirty = 0;
+    return 0;
+}
+
+fftwf_plan fft_plan_many(int n, int howmany, float complex *in, float complex *out)
+{
+    unsigned flags = effort == FFT_PLAN_EXHAUSTIVE ? FFTW_EXHAUSTIVE : FFTW_MEASURE;
+    fftwf_plan plan;
+
+    plan = fftwf_plan_many_dft(1, &n, howmany, in, NULL, 1, n, out, NULL, 1, n, FFTW_FORWARD, flags | FFTW_WISDOM_ONLY);
+    if (plan)
+        return plan;
+
+    if (effort == FFT_PLAN_FAST)
+        return fftwf_plan_many_dft(1, &n, howmany, in, NULL, 1, n, out, NULL, 1, n, FFTW_FORWARD, FFTW_ESTIMATE);
+
+    dirty = 1;
+    return fftwf_plan_many_dft(1, &n, howmany, in, NULL, 1, n, out, NULL, 1, n, FFTW_FORWARD, flags);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <complex.h>
+#include <fftw3.h>
+
+enum
+{
+    // measure, or reuse wisdom (the default)
+    FFT_PLAN_MEASURE,
+    // reuse wisdom, otherwise estimate instead of measuring
+    FFT_PLAN_FAST,
+    // try every algorithm, for precomputing wisdom
+    FFT_PLAN_EXHAUSTIVE
+};
+
+// Set the planning effort of fft_plan_many. Not thread-safe, like the
+// FFTW planner itself.
+void fft_set_effort(int effort);
+// Import wisdom from path, or from the default cache file if path is NULL.
+// Returns 0 on success.
+int fft_load_wisdom(const char *path);
+// Export wisdom if planning produced any. Returns 0 on success.
+int fft_save_wisdom(const char *path);
+// Forward transforms of howmany contiguous blocks of n samples. Every call
+// makes a new plan, bound to in and out, so each decoder has plans of its
+// own; only the wisdom is shared, which makes every plan after the first
+// of a size cheap.
+fftwf_plan fft_plan_many(int n, int howmany, float complex *in, float complex *out);
@@ -0,0 +1,115 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "fft_q15.h"
+
+// exp(-2 pi i k / FFT) for the first half of the circle
+static cint16_t twiddle[FFT / 2];
+static uint16_t bitrev[FFT];
+static int tables_ready;
+
+void fft_q15_init(void)
+{
+    unsigned int bits = 0;
+
+    if (tables_ready)
+        return;
+
+    while ((1u << bits) < FFT)
+        bits++;
+    for (unsigned int k = 0; k < FFT / 2; ++k)
+    {
+        double angle = -2 * M_PI * k / FFT;
+        twiddle[k].r = lrint(cos(angle) * 32767);
+        twiddle[k].i = lrint(sin(angle) * 32767);
+    }
+    for (unsigned int k = 0; k < FFT; ++k)
+    {
+        unsigned int r = 0;
+        for (unsigned int b = 0; b < bits; ++b)
+            r |= ((k >> b) & 1) << (bits - 1 - b);
+        bitrev[k] = r;
+    }
+    tables_ready = 1;
+}
+
+// the larger of m and |v|
+static inline int32_t max_abs(int32_t m, int32_t v)
+{
+    v = abs(v);
+    return v > m ? v : m;
+}
+
+static inline int32_t max_component(const cint16_t *x, unsigned int n)
+{
+    int32_t m = 0;
+    for (unsigned int k = 0; k < n; ++k)
+    {
+        m = max_abs(m, x[k].r);
+        m = max_abs(m, x[k].i);
+    }
+    return m;
+}
+
+int fft_q15(cint16_t *x)
+{
+    int32_t m;
+    int exp = 0;
+
+    for (unsigned int k = 0; k < FFT; ++k)
+    {
+        unsigned int r = bitrev[k];
+        if (r > k)
+        {
+            cint16_t t = x[k];
+            x[k] = x[r];
+            x[r] = t;
+        }
+    }
+
+    m = max_component(x, FFT);
+    for (unsigned int size = 2; size <= FFT; size *= 2)
+    {
+        unsigned int half = size / 2, step = FFT / size;
+        // a butterfly output is at most (1 + sqrt 2) times its largest input
+        int shift = m <= FFT_Q15_MAX ? 0 : m <= 2 * FFT_Q15_MAX + 1 ? 1 : 2;
+        int32_t round = shift ? 1 << (shift - 1) : 0, next = 0;
+
+        for (unsigned int k = 0; k < FFT; k += size)
+        {
+            for (unsigned int j = 0; j < half; ++j)
+            {
+                cint16_t w = twiddle[j * step], *a = &x[k + j], *b = &x[k + j + half];
+                int32_t tr = (w.r * b->r - w.i * b->i + (1 << 14)) >> 15;
+                int32_t ti = (w.r * b->i + w.i * b->r + (1 << 14)) >> 15;
+                int32_t r0 = (a->r + tr + round) >> shift, i0 = (a->i + ti + round) >> shift;
+                int32_t r1 = (a->r - tr + round) >> shift, i1 = (a->i - ti + round) >> shift;
+
+                a->r = r0;
+                a->i = i0;
+                b->r = r1;
+                b->i = i1;
+                next = max_abs(max_abs(next, r0), i0);
+                next = max_abs(max_abs(next, r1), i1);
+            }
+        }
+        m = next;
+        exp += shift;
+    }
+    return exp;
+}
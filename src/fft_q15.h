@@ -0,0 +1,23 @@
+#pragma once
+
+#include "defines.h"
+
+/*
+ * Fixed-point forward FFT of FFT points, for processors without a fast FPU.
+ *
+ * The transform runs in place on Q15 samples with block floating point: a
+ * stage halves its outputs, or quarters them, only when the samples it
+ * reads are large enough to overflow, so small signals keep their
+ * precision. Twiddles are Q15 and products are rounded.
+ */
+
+// Largest sample component a transform accepts without losing precision
+// to an extra shift in its first stage.
+#define FFT_Q15_MAX 13572
+
+// Build the shared twiddle and bit reversal tables. Not thread-safe, call it
+// before the first transform.
+void fft_q15_init(void);
+// Transform x in place. Returns the exponent e of the output, whose true
+// value is x * 2^e.
+int fft_q15(cint16_t *x);
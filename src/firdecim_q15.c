@@ -1,21 +1,10 @@
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
 
-#ifdef HAVE_NEON
-#include <arm_neon.h>
-#endif
-
-#ifdef HAVE_SSE2
-#include <emmintrin.h>
-#endif
-
+#include "cpu.h"
 #include "firdecim_q15.h"
-
-#ifdef USE_FAST_MATH
-#define NUM_TAPS 16
-#else
-#define NUM_TAPS 32
-#endif
+#include "kernels.h"
 
 #define WINDOW_SIZE 2048
 
@@ -25,8 +14,31 @@ struct firdecim_q15 {
     unsigned int ntaps;
     cint16_t * window;
     unsigned int idx;
+    // n outputs, output i from the taps window at h[i * 2]
+    void (*block)(const cint16_t *h, const int16_t *taps, unsigned int n, cint16_t *y);
 };
 
+static inline cint16_t dotprod(const cint16_t *a, const int16_t *b)
+{
+    // taps are duplicated, so walk both as flat arrays to let the compiler
+    // vectorize; the int16_t result wraps the same as summing in int16_t
+    const int16_t *x = (const int16_t *)a;
+    int32_t r = 0, i = 0;
+    for (int k = 0; k < FIRDECIM_NUM_TAPS * 2; k += 2)
+    {
+        r += (x[k] * b[k]) >> 15;
+        i += (x[k + 1] * b[k + 1]) >> 15;
+    }
+    cint16_t sum = { r, i };
+    return sum;
+}
+
+static void block(const cint16_t *h, const int16_t *taps, unsigned int n, cint16_t *y)
+{
+    for (unsigned int i = 0; i < n; i++)
+        y[i] = dotprod(&h[i * 2], taps);
+}
+
 firdecim_q15 firdecim_q15_create(unsigned int decim, const float * taps, unsigned int ntaps)
 {
     firdecim_q15 q;
@@ -37,12 +49,23 @@ firdecim_q15 firdecim_q15_create(unsigned int decim, const float * taps, unsigne
     q->taps = malloc(sizeof(int16_t) * ntaps * 2);
     q->window = calloc(sizeof(cint16_t), WINDOW_SIZE);
     q->idx = ntaps - 1;
+    q->block = block;
+
+#if defined(HAVE_NEON_KERNELS)
+    if (cpu_has(CPU_NEON))
+        q->block = neon_firdecim_block;
+#elif defined(HAVE_X86_KERNELS)
+    if (cpu_has(CPU_SSE2))
+        q->block = sse_firdecim_block;
+    if (cpu_has(CPU_AVX2))
+        q->block = avx2_firdecim_block;
+#endif
 
     assert(decim == 2);
-    assert(ntaps == NUM_TAPS);
+    assert(ntaps == FIRDECIM_NUM_TAPS);
 
-    // reverse order so we can push into the window
-    // duplicate for neon
+    // reverse order so we can push into the window, and duplicate to
+    // multiply interleaved I and Q samples a vector at a time
     for (int i = 0; i < ntaps; ++i)
     {
         q->taps[i*2] = taps[ntaps - 1 - i] * 32767.0f;
@@ -52,60 +75,79 @@ firdecim_q15 firdecim_q15_create(unsigned int decim, const float * taps, unsigne
     return q;
 }
 
+void firdecim_q15_destroy(firdecim_q15 q)
+{
+    free(q->taps);
+    free(q->window);
+    free(q);
+}
+
 static void push(firdecim_q15 q, cint16_t x)
 {
     if (q->idx == WINDOW_SIZE)
     {
         for (int i = 0; i < q->ntaps - 1; i++)
-            q->window[i] = q->window[q->idx - q->ntaps + i];
+            q->window[i] = q->window[q->idx - q->ntaps + 1 + i];
         q->idx = q->ntaps - 1;
     }
     q->window[q->idx++] = x;
 }
 
-#ifdef HAVE_NEON
-static cint16_t dotprod(cint16_t *a, int16_t *b, int n)
+void firdecim_q15_execute(firdecim_q15 q, const cint16_t *x, cint16_t *y)
 {
-    int16x8_t s1 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[0]), vld1q_s16(&b[0*2]));
-    int16x8_t s2 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[4]), vld1q_s16(&b[4*2]));
-    int16x8_t s3 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[8]), vld1q_s16(&b[8*2]));
-    int16x8_t s4 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[12]), vld1q_s16(&b[12*2]));
-    int16x8_t sum = vqaddq_s16(vqaddq_s16(s1, s2), vqaddq_s16(s3, s4));
-
-#if NUM_TAPS == 32
-    s1 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[16]), vld1q_s16(&b[16*2]));
-    s2 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[20]), vld1q_s16(&b[20*2]));
-    s3 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[24]), vld1q_s16(&b[24*2]));
-    s4 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[28]), vld1q_s16(&b[28*2]));
-    sum = vqaddq_s16(vqaddq_s16(s1, s2), sum);
-    sum = vqaddq_s16(vqaddq_s16(s3, s4), sum);
-#endif
-
-    int16x4x2_t sum2 = vuzp_s16(vget_high_s16(sum), vget_low_s16(sum));
-    int16x4_t sum3 = vpadd_s16(sum2.val[0], sum2.val[1]);
-    sum3 = vpadd_s16(sum3, sum3);
-
-    cint16_t result[2];
-    vst1_s16((int16_t*)&result, sum3);
-
-    return result[0];
+    push(q, x[0]);
+    q->block(&q->window[q->idx - q->ntaps], q->taps, 1, y);
+    push(q, x[1]);
 }
-#else
-static cint16_t dotprod(cint16_t *a, int16_t *b, int n)
+
+// exactly one of x8 (interleaved u8 IQ) and x16 is set
+static void execute_block(firdecim_q15 q, const uint8_t *x8, const cint16_t *x16, unsigned int n, cint16_t *y)
 {
-    cint16_t sum = { 0 };
-    for (int i = 0; i < n; ++i)
+    const unsigned int max_chunk = (WINDOW_SIZE - (q->ntaps - 1)) / 2;
+
+    while (n > 0)
     {
-        sum.r += (a[i].r * b[i * 2]) >> 15;
-        sum.i += (a[i].i * b[i * 2]) >> 15;
+        unsigned int chunk = n < max_chunk ? n : max_chunk;
+
+        // make room for the chunk, keeping the filter history
+        if (q->idx + chunk * 2 > WINDOW_SIZE)
+        {
+            memmove(&q->window[0], &q->window[q->idx - (q->ntaps - 1)], sizeof(cint16_t) * (q->ntaps - 1));
+            q->idx = q->ntaps - 1;
+        }
+
+        cint16_t *w = &q->window[q->idx];
+        if (x8)
+        {
+            for (unsigned int i = 0; i < chunk * 2; i++)
+            {
+                w[i].r = U8_Q15(x8[i * 2 + 0]);
+                w[i].i = U8_Q15(x8[i * 2 + 1]);
+            }
+            x8 += chunk * 4;
+        }
+        else
+        {
+            memcpy(w, x16, sizeof(cint16_t) * chunk * 2);
+            x16 += chunk * 2;
+        }
+
+        // the taps window of output i ends at its first input sample, and
+        // only the kept outputs are computed
+        q->block(&q->window[q->idx + 1 - q->ntaps], q->taps, chunk, y);
+
+        q->idx += chunk * 2;
+        y += chunk;
+        n -= chunk;
     }
-    return sum;
 }
-#endif
 
-void firdecim_q15_execute(firdecim_q15 q, const cint16_t *x, cint16_t *y)
+void firdecim_q15_execute_block(firdecim_q15 q, const uint8_t *x, unsigned int n, cint16_t *y)
 {
-    push(q, x[0]);
-    *y = dotprod(&q->window[q->idx - q->ntaps], q->taps, q->ntaps);
-    push(q, x[1]);
+    execute_block(q, x, NULL, n, y);
+}
+
+void firdecim_q15_execute_block_q15(firdecim_q15 q, const cint16_t *x, unsigned int n, cint16_t *y)
+{
+    execute_block(q, NULL, x, n, y);
 }
@@ -2,7 +2,20 @@
 
 #include "defines.h"
 
+// Taps of the front-end filter. Kernels are specialized on this count and on
+// decimation by 2.
+#ifdef USE_FAST_MATH
+#define FIRDECIM_NUM_TAPS 16
+#else
+#define FIRDECIM_NUM_TAPS 32
+#endif
+
 typedef struct firdecim_q15 * firdecim_q15;
 
 firdecim_q15 firdecim_q15_create(unsigned int decim, const float * taps, unsigned int ntaps);
+void firdecim_q15_destroy(firdecim_q15 q);
 void firdecim_q15_execute(firdecim_q15 q, const cint16_t *x, cint16_t *y);
+// decimate n pairs of interleaved u8 IQ samples from x into n outputs
+void firdecim_q15_execute_block(firdecim_q15 q, const uint8_t *x, unsigned int n, cint16_t *y);
+// same for n pairs of Q15 samples, scaled like U8_Q15
+void firdecim_q15_execute_block_q15(firdecim_q15 q, const cint16_t *x, unsigned int n, cint16_t *y);
@@ -17,8 +17,10 @@
 
 #include "defines.h"
 #include "frame.h"
+#include "id3.h"
 #include "input.h"
 #include "reed-solomon.h"
+#include "trace.h"
 
 typedef struct
 {
@@ -119,22 +121,21 @@ static uint16_t fcs16(uint8_t *cp, int len)
     return (crc);
 }
 
-static int fix_header(uint8_t *buf)
+static int fix_header(frame_t *st, uint8_t *buf)
 {
-    uint8_t hdr[255];
-    int corrections;
-    memset(hdr, 0, sizeof(hdr));
-    memcpy(hdr, buf, 96);
-    corrections = (int)rs_decode(hdr);
+    int corrections = (int)rs_decode_short(buf, 96);
     if (corrections >= 0)
     {
         if (corrections)
+        {
             log_debug("RS corrected %d symbols", corrections);
-        memcpy(buf, hdr, 96);
+            stats_add(&st->input->stats.rs_corrected, corrections);
+        }
         return 1;
     }
     else
     {
+        stats_add(&st->input->stats.rs_failed, 1);
         return 0;
     }
 }
@@ -152,40 +153,57 @@ static void parse_header(uint8_t *buf, frame_header_t *hdr)
     hdr->locations = (uint16_t *)&buf[14];
 }
 
-static int find_program(uint8_t *buf, int program)
+// Fix the header of the audio frame at buf[*i] and advance *i to the next
+// frame. Returns the program number of the frame, -1 if it has none, or -2
+// if the header could not be corrected.
+static int next_frame(frame_t *st, uint8_t *buf, unsigned int *i)
+{
+    unsigned int start = *i, j;
+    frame_header_t hdr;
+    int program = -1;
+
+    if (!fix_header(st, &buf[start]))
+    {
+        log_debug("failed to fix header");
+        return -2;
+    }
+
+    parse_header(&buf[start], &hdr);
+    j = start + 14 + sizeof(uint16_t) * hdr.nop;
+
+    if (start == 0)
+    {
+        program = 0;
+    }
+    // inspect first extended header
+    else if (hdr.hef)
+    {
+        // skip class indication flag
+        if (buf[j] >> 4 == 8)
+            ++j;
+        // program id flag
+        if (((buf[j] >> 4) & 7) == 1)
+            program = (buf[j] >> 1) & 7;
+    }
+
+    // skip remaining bytes using last location
+    *i = start + hdr.locations[hdr.nop - 1] + 1;
+    return program;
+}
+
+static int find_program(frame_t *st, uint8_t *buf, int program)
 {
     unsigned int i;
 
     for (i = 0; i < 18269 - 96; )
     {
         unsigned int start = i;
-        frame_header_t hdr;
+        int found = next_frame(st, buf, &i);
 
-        if (!fix_header(&buf[i]))
-        {
-            log_debug("failed to fix header");
+        if (found == -2)
             return -1;
-        }
-
-        if (start == 0 && program == 0)
+        if (found == program)
             return start;
-
-        parse_header(&buf[i], &hdr);
-        i += 14 + sizeof(uint16_t) * hdr.nop;
-
-        // inspect first extended header
-        if (hdr.hef)
-        {
-            // skip class indication flag
-            if (buf[i] >> 4 == 8)
-                ++i;
-            // compare program id flag
-            if (((buf[i] >> 4) & 7) == 1 && program == ((buf[i] >> 1) & 7))
-                return start;
-        }
-
-        // skip remaining bytes using last location
-        i = start + hdr.locations[hdr.nop - 1] + 1;
     }
 
     return -1;
@@ -206,7 +224,40 @@ static int unescape_hdlc(uint8_t *data, int length)
     return p - data;
 }
 
-void psd_push(uint8_t* psd, int length)
+// PSD is a port, a sequence number and an ID3 tag
+static void psd_tag(frame_t *st, unsigned int program, const uint8_t *psd, unsigned int length)
+{
+    frame_program_t *pr = &st->programs[program];
+    unsigned int port, seq;
+    uint32_t hash = 2166136261u;
+    id3_t tag;
+
+    if (length < 4)
+        return;
+    port = psd[0] | psd[1] << 8;
+    seq = psd[2] | psd[3] << 8;
+    if (port != 0x5100)
+    {
+        log_warn("unknown PSD port %x %x", port, seq);
+        return;
+    }
+
+    // FNV-1a, so that an unchanged tag is not parsed again
+    for (unsigned int i = 4; i < length; i++)
+        hash = (hash ^ psd[i]) * 16777619u;
+    if (hash == pr->psd_hash)
+        return;
+    pr->psd_hash = hash;
+
+    if (id3_parse(psd + 4, length - 4, &tag) != 0)
+    {
+        log_info("invalid psd");
+        return;
+    }
+    input_id3_push(st->input, program, &tag);
+}
+
+static void psd_push(frame_t *st, unsigned int program, uint8_t* psd, int length)
 {
     length = unescape_hdlc(psd, length);
 
@@ -223,13 +274,16 @@ void psd_push(uint8_t* psd, int length)
     else
     {
         // remove protocol and fcs fields
-        input_psd_push(psd + 1, length - 2);
+        input_psd_push(st->input, program, psd + 1, length - 2);
+        // without the fcs, which changes with the sequence number
+        psd_tag(st, program, psd + 1, length - 3);
     }
 }
 
 // PSD transport uses HDLC-like framing
-void parse_psd(frame_t *st, uint8_t *data, size_t length)
+static void parse_psd(frame_t *st, unsigned int program, uint8_t *data, size_t length)
 {
+    frame_program_t *pr = &st->programs[program];
     uint8_t *p;
     int index = 0;
 
@@ -240,13 +294,13 @@ void parse_psd(frame_t *st, uint8_t *data, size_t length)
         index = p - data;
 
         // complete current psd frame
-        if (st->psd_idx)
+        if (pr->psd_idx)
         {
-            if (index + st->psd_idx > 2048)
+            if (index + pr->psd_idx > 2048)
                 goto overflow;
-            memcpy(&st->psd_buf[st->psd_idx], data, index);
-            psd_push(st->psd_buf, index + st->psd_idx);
-            st->psd_idx = 0;
+            memcpy(&pr->psd_buf[pr->psd_idx], data, index);
+            psd_push(st, program, pr->psd_buf, index + pr->psd_idx);
+            pr->psd_idx = 0;
         }
 
         // skip the flag
@@ -260,39 +314,30 @@ void parse_psd(frame_t *st, uint8_t *data, size_t length)
                 break;
 
             int cur_index = p - data;
-            psd_push(&data[index], cur_index - index);
+            psd_push(st, program, &data[index], cur_index - index);
             index = cur_index + 1;
         }
     }
 
     // store remaining bytes
-    if (length - index + st->psd_idx > 2048)
+    if (length - index + pr->psd_idx > 2048)
     {
 overflow:
         log_error("psd buffer overflow");
-        st->psd_idx = 0;
+        pr->psd_idx = 0;
         return;
     }
 
-    memcpy(&st->psd_buf[st->psd_idx], &data[index], length - index);
-    st->psd_idx += length - index;
+    memcpy(&pr->psd_buf[pr->psd_idx], &data[index], length - index);
+    pr->psd_idx += length - index;
 }
 
-void frame_process(frame_t *st)
+static void process_program(frame_t *st, unsigned int program, uint8_t *buf)
 {
-    int offset;
+    frame_program_t *pr = &st->programs[program];
     unsigned int i, j, hef, seq;
-    uint8_t *buf;
     frame_header_t hdr;
 
-    offset = find_program(st->buffer, st->program);
-    if (offset == -1)
-    {
-        log_error("unable to find program, or corrupted.");
-        return;
-    }
-
-    buf = &st->buffer[offset];
     parse_header(buf, &hdr);
 
     if (hdr.codec != 0)
@@ -305,7 +350,7 @@ void frame_process(frame_t *st)
     for (hef = hdr.hef; hef; ++i)
         hef = buf[i] >> 7;
 
-    parse_psd(st, &buf[i], hdr.la_location-i+1);
+    parse_psd(st, program, &buf[i], hdr.la_location-i+1);
     i = hdr.la_location + 1;
     seq = hdr.seq;
     for (j = 0; j < hdr.nop; ++j)
@@ -314,17 +359,18 @@ void frame_process(frame_t *st)
         if (crc8(&buf[i], cnt + 1) != 0)
         {
             log_warn("crc mismatch!");
+            stats_add(&st->input->stats.crc_errors, 1);
             i += cnt + 1;
             continue;
         }
 
         if (j == 0 && hdr.pfirst)
         {
-            if (st->pdu_idx)
+            if (pr->pdu_idx)
             {
-                memcpy(&st->pdu[st->pdu_idx], &buf[i], cnt);
-                if (st->ready)
-                    input_pdu_push(st->input, st->pdu, cnt + st->pdu_idx);
+                memcpy(&pr->pdu[pr->pdu_idx], &buf[i], cnt);
+                if (pr->ready)
+                    input_pdu_push(st->input, program, pr->pdu, cnt + pr->pdu_idx);
             }
             else
             {
@@ -333,64 +379,108 @@ void frame_process(frame_t *st)
         }
         else if (j == hdr.nop - 1 && hdr.plast)
         {
-            memcpy(st->pdu, &buf[i], cnt);
-            st->pdu_idx = cnt;
+            memcpy(pr->pdu, &buf[i], cnt);
+            pr->pdu_idx = cnt;
 
             if (seq == 0)
-                st->ready = 1;
+                pr->ready = 1;
             seq = (seq + 1) % 64;
         }
         else
         {
             if (seq == 0)
-                st->ready = 1;
+                pr->ready = 1;
             seq = (seq + 1) % 64;
-            if (st->ready)
-                input_pdu_push(st->input, &buf[i], cnt);
+            if (pr->ready)
+                input_pdu_push(st->input, program, &buf[i], cnt);
         }
         
         i += cnt + 1;
     }
+    input_pdu_end(st->input, program);
 }
 
+void frame_process(frame_t *st)
+{
+    if (st->program == NRSC5_PROGRAM_ALL)
+    {
+        // walk all headers once, routing each frame to its program
+        unsigned int i;
+        for (i = 0; i < 18269 - 96; )
+        {
+            unsigned int start = i;
+            int program = next_frame(st, st->buffer, &i);
+
+            if (program == -2)
+            {
+                log_error("corrupted audio frame.");
+                return;
+            }
+            if (program >= 0 && program < MAX_PROGRAMS)
+                process_program(st, program, &st->buffer[start]);
+        }
+        return;
+    }
+
+    int offset = find_program(st, st->buffer, st->program);
+    if (offset == -1)
+    {
+        log_error("unable to find program, or corrupted.");
+        return;
+    }
+
+    process_program(st, st->program, &st->buffer[offset]);
+}
+
+// bits are packed eight to a byte, the first bit in the most significant bit
 void frame_push(frame_t *st, uint8_t *bits)
 {
-    const unsigned int start = 146152 - 30000 + 24, offset = 1248, hbits = 24;
-    unsigned int i, j = 0, h = 0, header = 0, val = 0;
+    // one PCI header bit starts every offset bytes after start
+    const unsigned int start = (146152 - 30000 + 24) / 8, offset = 1248 / 8, hbits = 24;
+    unsigned int i, h = 0, header = 0, acc = 0, nacc = 0;
     uint8_t *ptr = st->buffer;
-    for (i = 0; i < 146176; ++i)
+
+    memcpy(ptr, bits, start);
+    ptr += start;
+    for (i = start; i < FRAME_LEN / 8; ++i)
     {
-        // swap bit order
-        uint8_t bit = bits[((i>>3)<<3) + 7 - (i & 7)];
-        if (i >= start && ((i - start) % offset) == 0 && h < hbits)
+        if (h < hbits && ((i - start) % offset) == 0)
         {
-            header |= bit << h;
+            header |= (bits[i] >> 7) << h;
             ++h;
+            acc = (acc << 7) | (bits[i] & 0x7f);
+            nacc += 7;
         }
         else
         {
-            val |= bit << (7 - j);
-            if (++j == 8)
-            {
-                *ptr++ = val;
-                val = 0;
-                j = 0;
-            }
+            acc = (acc << 8) | bits[i];
+            nacc += 8;
+        }
+        if (nacc >= 8)
+        {
+            nacc -= 8;
+            *ptr++ = acc >> nacc;
         }
     }
-    
+
     // log_debug("PCI %x", header);
 
     st->pci = header;
+    uint64_t span = trace_begin();
     frame_process(st);
+    trace_end(TRACE_FRAME, span);
 }
 
 void frame_reset(frame_t *st)
 {
-    st->pdu_idx = 0;
     st->pci = 0;
-    st->ready = 0;
-    st->psd_idx = 0;
+    for (int p = 0; p < MAX_PROGRAMS; p++)
+    {
+        st->programs[p].pdu_idx = 0;
+        st->programs[p].ready = 0;
+        st->programs[p].psd_idx = 0;
+        st->programs[p].psd_hash = 0;
+    }
 }
 
 void frame_set_program(frame_t *st, unsigned int program)
@@ -401,11 +491,24 @@ void frame_set_program(frame_t *st, unsigned int program)
 void frame_init(frame_t *st, input_t *input)
 {
     st->input = input;
-    st->buffer = malloc(146152);
-    st->pdu = malloc(0x10000);
-    st->psd_buf = malloc(2048);
+    st->buffer = input_alloc(input, 146152);
+    for (int p = 0; p < MAX_PROGRAMS; p++)
+    {
+        st->programs[p].pdu = input_alloc(input, 0x10000);
+        st->programs[p].psd_buf = input_alloc(input, 2048);
+    }
 
     rs_init();
 
     frame_reset(st);
 }
+
+void frame_free(frame_t *st)
+{
+    free(st->buffer);
+    for (int p = 0; p < MAX_PROGRAMS; p++)
+    {
+        free(st->programs[p].pdu);
+        free(st->programs[p].psd_buf);
+    }
+}
@@ -2,20 +2,33 @@
 
 #include <stdint.h>
 
+// audio programs that can be decoded (HD1 to HD4)
+#define MAX_PROGRAMS 4
+
+// per program PDU and PSD reassembly
 typedef struct
 {
-    struct input_t *input;
-    uint8_t *buffer;
     uint8_t *pdu;
     unsigned int pdu_idx;
-    unsigned int pci;
     int ready;
-    unsigned int program;
     uint8_t *psd_buf;
     unsigned int psd_idx;
+    // hash of the last ID3 tag, which stations repeat between songs
+    uint32_t psd_hash;
+} frame_program_t;
+
+typedef struct
+{
+    struct input_t *input;
+    uint8_t *buffer;
+    unsigned int pci;
+    unsigned int program;
+    frame_program_t programs[MAX_PROGRAMS];
 } frame_t;
 
 void frame_push(frame_t *st, uint8_t *bits);
 void frame_reset(frame_t *st);
+// program is a program number or NRSC5_PROGRAM_ALL
 void frame_set_program(frame_t *st, unsigned int program);
 void frame_init(frame_t *st, struct input_t *input);
+void frame_free(frame_t *st);
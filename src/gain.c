@@ -0,0 +1,64 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+
+#include "gain.h"
+
+void gain_search_init(gain_search_t *s, int count)
+{
+    s->count = count < GAIN_MAX ? count : GAIN_MAX;
+    for (int i = 0; i < s->count; i++)
+        s->snr[i] = -1;
+    s->lo = 0;
+    s->hi = s->count - 1;
+}
+
+int gain_search_next(gain_search_t *s)
+{
+    while (s->hi - s->lo > 2)
+    {
+        int d = (int)roundf((s->hi - s->lo) * 0.382f);
+        // the probes must differ, or one side is dropped unmeasured
+        if (d > (s->hi - s->lo - 1) / 2)
+            d = (s->hi - s->lo - 1) / 2;
+        int m1 = s->lo + d, m2 = s->hi - d;
+
+        if (s->snr[m1] < 0)
+            return m1;
+        if (s->snr[m2] < 0)
+            return m2;
+
+        if (s->snr[m1] < s->snr[m2])
+            s->lo = m1 + 1;
+        else
+            s->hi = m2 - 1;
+    }
+
+    for (int i = s->lo; i <= s->hi; i++)
+        if (s->snr[i] < 0)
+            return i;
+    return -1;
+}
+
+int gain_search_best(const gain_search_t *s)
+{
+    int best = 0;
+
+    for (int i = 0; i < s->count; i++)
+        if (s->snr[i] > s->snr[best])
+            best = i;
+    return best;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#define GAIN_MAX 128
+
+/*
+ * Golden-section search over the gains of a tuner, assuming the CNR rises
+ * with the gain until the signal starts to clip.
+ */
+typedef struct
+{
+    int count;
+    // CNR measured at each gain, < 0 if not measured yet
+    float snr[GAIN_MAX];
+    // range of gains the best one is known to lie in
+    int lo, hi;
+} gain_search_t;
+
+void gain_search_init(gain_search_t *s, int count);
+// Index of the next gain to measure, or -1 once the range is measured.
+int gain_search_next(gain_search_t *s);
+// Index of the best gain among the ones measured.
+int gain_search_best(const gain_search_t *s);
@@ -89,3 +89,16 @@ gf_generate_field(gf_t *gf, uint8_t r, uint32_t poly)
 
     return 0;
 }
+
+/* Generate a table of the products of every field element with c, so that
+ * multiplying by a constant is a single lookup. */
+void
+gf_generate_mul_table(const gf_t *gf, uint8_t c, uint8_t table[GF_MAX])
+{
+    uint32_t i;
+
+    for(i = 0; i < gf->len; i++)
+    {
+        table[i] = gf_mul(gf, i, c);
+    }
+}
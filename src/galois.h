@@ -57,5 +57,27 @@ typedef struct gf {
 } gf_t;
 
 int32_t gf_generate_field(gf_t *gf, uint8_t r, uint32_t poly);
+void gf_generate_mul_table(const gf_t *gf, uint8_t c, uint8_t table[GF_MAX]);
+
+/* Multiply and divide using the log tables. */
+static inline uint8_t
+gf_mul(const gf_t *gf, uint8_t a, uint8_t b)
+{
+    if(!a || !b)
+    {
+        return 0;
+    }
+    return gf->exp[(gf->log[a] + gf->log[b]) % (gf->len - 1)];
+}
+
+static inline uint8_t
+gf_div(const gf_t *gf, uint8_t a, uint8_t b)
+{
+    if(!a)
+    {
+        return 0;
+    }
+    return gf->exp[(gf->log[a] + gf->len - 1 - gf->log[b]) % (gf->len - 1)];
+}
 
 #endif /* GALOIS_H */
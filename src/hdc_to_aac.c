@@ -188,195 +188,179 @@ static hcb_bin_pair *hcb_bin_table[] = {
 
 static uint8_t hcbN[] = { 0, 5, 5, 0, 5, 0, 5, 0, 5, 0, 6, 5 };
 
-static void huffman_scale_factor(bitreader_t *br, bitwriter_t *bw)
+/* decoded codeword */
+typedef struct
 {
-    uint16_t offset = 0;
+    uint8_t bits;   /* 0 in a lookup table if the codeword is longer */
+    uint8_t cnt;    /* number of non-zero values, and sign bits */
+    int8_t x;
+    int8_t y;
+} hcb_code;
 
-    while (hcb_sf[offset][1])
-    {
-        uint8_t b = br_readbits(br, 1);
-        bw_addbits(bw, b, 1);
-        offset += hcb_sf[offset][b];
-    }
-}
+/* First level lookup tables, indexed by the next HCB_LUT_BITS bits. Entry 0
+ * is the scale factor codebook. */
+#define HCB_LUT_BITS 9
+#define SF_HCB 0
+static hcb_code hcb_lut[12][1 << HCB_LUT_BITS];
 
-static void huffman_sign_bits(bitreader_t *br, bitwriter_t *bw, uint8_t len)
-{
-    bw_addbits(bw, br_readbits(br, len), len);
-}
+/* spectral codebooks followed by sign bits */
+static const uint8_t hcb_signed[] = { 0, 0, 0, 1, 1, 0, 0, 1, 1, 1, 1, 1 };
 
-static void huffman_getescape(bitreader_t *br, bitwriter_t *bw, int16_t sp)
+/* Decode the codeword at the start of the 32 bit word w. */
+static void huffman_decode_word(uint8_t cb, uint32_t w, hcb_code *code)
 {
-    if (sp != 16)
-        return;
-    uint8_t i;
-    for (i = 4; ; i++)
+    uint16_t offset = 0;
+    uint8_t n = 0;
+
+    code->x = 0;
+    code->y = 0;
+    switch (cb)
     {
-        uint8_t b = br_readbits(br, 1);
-        bw_addbits(bw, b, 1);
-        if (b == 0)
-            break;
+    case SF_HCB:
+        while (hcb_sf[offset][1])
+            offset += hcb_sf[offset][(w >> (31 - n++)) & 1];
+        code->bits = n;
+        code->cnt = 0;
+        break;
+    case 1:
+    case 2:
+    case 4:
+    {
+        hcb_2_quad *q;
+
+        offset = hcb_table[cb][w >> (32 - hcbN[cb])].offset;
+        n = hcb_table[cb][w >> (32 - hcbN[cb])].extra_bits;
+        if (n)
+            offset += (w >> (32 - hcbN[cb] - n)) & ((1 << n) - 1);
+        q = &hcb_2_quad_table[cb][offset];
+        code->bits = q->bits;
+        code->cnt = 0;
+        if (q->x) code->cnt++;
+        if (q->y) code->cnt++;
+        if (q->v) code->cnt++;
+        if (q->w) code->cnt++;
+        break;
+    }
+    case 3:
+        while (!hcb3[offset].is_leaf)
+            offset += hcb3[offset].data[(w >> (31 - n++)) & 1];
+        code->bits = n;
+        code->cnt = 0;
+        for (n = 0; n < 4; n++)
+            if (hcb3[offset].data[n]) code->cnt++;
+        break;
+    case 5:
+    case 7:
+    case 9:
+        while (!hcb_bin_table[cb][offset].is_leaf)
+            offset += hcb_bin_table[cb][offset].data[(w >> (31 - n++)) & 1];
+        code->bits = n;
+        code->cnt = 0;
+        for (n = 0; n < 2; n++)
+            if (hcb_bin_table[cb][offset].data[n]) code->cnt++;
+        break;
+    default:
+    {
+        hcb_2_pair *p;
+
+        offset = hcb_table[cb][w >> (32 - hcbN[cb])].offset;
+        n = hcb_table[cb][w >> (32 - hcbN[cb])].extra_bits;
+        if (n)
+            offset += (w >> (32 - hcbN[cb] - n)) & ((1 << n) - 1);
+        p = &hcb_2_pair_table[cb][offset];
+        code->bits = p->bits;
+        code->cnt = 0;
+        if (p->x) code->cnt++;
+        if (p->y) code->cnt++;
+        code->x = p->x;
+        code->y = p->y;
+        break;
+    }
     }
-
-    bw_addbits(bw, br_readbits(br, i), i);
 }
 
-static uint8_t huffman_2step_quad(bitreader_t *br, bitwriter_t *bw, uint8_t cb)
+void hdc_to_aac_init(void)
 {
-    uint32_t cw;
-    uint16_t offset = 0;
-    uint8_t extra_bits;
+    static int ready;
 
-    cw = br_peekbits(br, hcbN[cb]);
-    offset = hcb_table[cb][cw].offset;
-    extra_bits = hcb_table[cb][cw].extra_bits;
+    if (ready)
+        return;
 
-    if (extra_bits)
+    for (uint8_t cb = 0; cb < 12; cb++)
     {
-        bw_addbits(bw, br_readbits(br, hcbN[cb]), hcbN[cb]);
-        offset += (uint16_t)br_peekbits(br, extra_bits);
-        bw_addbits(bw, br_readbits(br, hcb_2_quad_table[cb][offset].bits - hcbN[cb]), hcb_2_quad_table[cb][offset].bits - hcbN[cb]);
-    } else {
-        bw_addbits(bw, br_readbits(br, hcb_2_quad_table[cb][offset].bits), hcb_2_quad_table[cb][offset].bits);
+        for (uint32_t i = 0; i < (1 << HCB_LUT_BITS); i++)
+        {
+            hcb_code *code = &hcb_lut[cb][i];
+            huffman_decode_word(cb, i << (32 - HCB_LUT_BITS), code);
+            if (code->bits > HCB_LUT_BITS)
+                code->bits = 0;
+        }
     }
-
-    uint8_t cnt = 0;
-    if (hcb_2_quad_table[cb][offset].x) cnt++;
-    if (hcb_2_quad_table[cb][offset].y) cnt++;
-    if (hcb_2_quad_table[cb][offset].v) cnt++;
-    if (hcb_2_quad_table[cb][offset].w) cnt++;
-    return cnt;
+    ready = 1;
 }
 
-static void huffman_2step_quad_sign(bitreader_t *br, bitwriter_t *bw, uint8_t cb)
+/* Decode the next codeword without consuming it. */
+static inline void huffman_decode(bitreader_t *br, uint8_t cb, hcb_code *code)
 {
-    uint8_t sp = huffman_2step_quad(br, bw, cb);
-    huffman_sign_bits(br, bw, sp);
+    uint32_t w = br_peekbits(br, 32);
+
+    *code = hcb_lut[cb][w >> (32 - HCB_LUT_BITS)];
+    if (code->bits == 0)
+        huffman_decode_word(cb, w, code);
 }
 
-static uint8_t huffman_2step_pair(bitreader_t *br, bitwriter_t *bw, uint8_t cb, int16_t sp[2])
+static void copy_bits(bitreader_t *br, bitwriter_t *bw, unsigned int bits)
 {
-    uint32_t cw;
-    uint16_t offset = 0;
-    uint8_t extra_bits;
-
-    cw = br_peekbits(br, hcbN[cb]);
-    offset = hcb_table[cb][cw].offset;
-    extra_bits = hcb_table[cb][cw].extra_bits;
-
-    if (extra_bits)
-    {
-        bw_addbits(bw, br_readbits(br, hcbN[cb]), hcbN[cb]);
-        offset += (uint16_t)br_peekbits(br, extra_bits);
-        bw_addbits(bw, br_readbits(br, hcb_2_pair_table[cb][offset].bits - hcbN[cb]), hcb_2_pair_table[cb][offset].bits - hcbN[cb]);
-    } else {
-        bw_addbits(bw, br_readbits(br, hcb_2_pair_table[cb][offset].bits), hcb_2_pair_table[cb][offset].bits);
-    }
-
-    if (sp)
-    {
-        sp[0] = hcb_2_pair_table[cb][offset].x;
-        sp[1] = hcb_2_pair_table[cb][offset].y;
-    }
-
-    uint8_t cnt = 0;
-    if (hcb_2_pair_table[cb][offset].x) cnt++;
-    if (hcb_2_pair_table[cb][offset].y) cnt++;
-    return cnt;
+    for (; bits > 32; bits -= 32)
+        bw_addbits(bw, br_readbits(br, 32), 32);
+    bw_addbits(bw, br_readbits(br, bits), bits);
 }
 
-static void huffman_2step_pair_sign(bitreader_t *br, bitwriter_t *bw, uint8_t cb, int16_t sp[2])
+static void huffman_scale_factor(bitreader_t *br, bitwriter_t *bw)
 {
-    uint8_t cnt = huffman_2step_pair(br, bw, cb, sp);
-    huffman_sign_bits(br, bw, cnt);
+    hcb_code code;
+
+    huffman_decode(br, SF_HCB, &code);
+    copy_bits(br, bw, code.bits);
 }
 
-static uint8_t huffman_binary_quad(bitreader_t *br, bitwriter_t *bw, uint8_t cb)
+static void huffman_getescape(bitreader_t *br, bitwriter_t *bw, int16_t sp)
 {
-    uint16_t offset = 0;
-
-    while (!hcb3[offset].is_leaf)
+    if (sp != 16)
+        return;
+    uint8_t i;
+    for (i = 4; ; i++)
     {
+        // AAC allows at most 8 ones, for a 12-bit escape word: more is bad data
+        if (i > 12)
+            return;
         uint8_t b = br_readbits(br, 1);
         bw_addbits(bw, b, 1);
-        offset += hcb3[offset].data[b];
+        if (b == 0)
+            break;
     }
 
-    uint8_t cnt = 0;
-    if (hcb3[offset].data[0]) cnt++;
-    if (hcb3[offset].data[1]) cnt++;
-    if (hcb3[offset].data[2]) cnt++;
-    if (hcb3[offset].data[3]) cnt++;
-    return cnt;
-}
-
-static void huffman_binary_quad_sign(bitreader_t *br, bitwriter_t *bw, uint8_t cb)
-{
-    uint8_t sp = huffman_binary_quad(br, bw, cb);
-    huffman_sign_bits(br, bw, sp);
+    bw_addbits(bw, br_readbits(br, i), i);
 }
 
-static uint8_t huffman_binary_pair(bitreader_t *br, bitwriter_t *bw, uint8_t cb)
+static void huffman_spectral_data(bitreader_t *br, bitwriter_t *bw, uint8_t cb)
 {
-    uint16_t offset = 0;
+    hcb_code code;
 
-    while (!hcb_bin_table[cb][offset].is_leaf)
+    /* reserved codebook, read as codebook 11 without sign bits */
+    if (cb == 12)
     {
-        uint8_t b = br_readbits(br, 1);
-        bw_addbits(bw, b, 1);
-        offset += hcb_bin_table[cb][offset].data[b];
+        huffman_decode(br, 11, &code);
+        copy_bits(br, bw, code.bits);
+        return;
     }
 
-    uint8_t cnt = 0;
-    if (hcb_bin_table[cb][offset].data[0]) cnt++;
-    if (hcb_bin_table[cb][offset].data[1]) cnt++;
-    return cnt;
-}
-
-static void huffman_binary_pair_sign(bitreader_t *br, bitwriter_t *bw, uint8_t cb)
-{
-    uint8_t sp = huffman_binary_pair(br, bw, cb);
-    huffman_sign_bits(br, bw, sp);
-}
-
-static void huffman_spectral_data(bitreader_t *br, bitwriter_t *bw, uint8_t cb)
-{
-    switch (cb)
+    huffman_decode(br, cb, &code);
+    copy_bits(br, bw, code.bits + (hcb_signed[cb] ? code.cnt : 0));
+    if (cb == ESC_HCB)
     {
-    case 1:
-    case 2:
-         huffman_2step_quad(br, bw, cb);
-         break;
-    case 3:
-         huffman_binary_quad_sign(br, bw, cb);
-         break;
-    case 4:
-         huffman_2step_quad_sign(br, bw, cb);
-         break;
-    case 5:
-         huffman_binary_pair(br, bw, cb);
-         break;
-    case 6:
-         huffman_2step_pair(br, bw, cb, NULL);
-         break;
-    case 7:
-    case 9:
-         huffman_binary_pair_sign(br, bw, cb);
-         break;
-    case 8:
-    case 10:
-         huffman_2step_pair_sign(br, bw, cb, NULL);
-         break;
-    case 12:
-         huffman_2step_pair(br, bw, 11, NULL);
-         break;
-    case 11: {
-             int16_t sp[2];
-             huffman_2step_pair_sign(br, bw, 11, sp);
-             huffman_getescape(br, bw, sp[0]);
-             huffman_getescape(br, bw, sp[1]);
-             break;
-         }
+        huffman_getescape(br, bw, code.x);
+        huffman_getescape(br, bw, code.y);
     }
 }
 
@@ -421,9 +405,7 @@ static void parse_sbr_single_channel_element(bitreader_t *br, bitwriter_t *bw, b
     br_readbits(br, 1); // FIXME HDC specific?
 
     // XXX I'm lazy copy remaining bits verbatim
-    int remaining = br->bits + (br->end - br->buf)*8;
-    while (remaining--)
-        bw_addbits(sbrbw, br_readbits(br, 1), 1);
+    copy_bits(br, sbrbw, br_remaining(br));
 }
 
 static void parse_sbr_channel_pair_element(bitreader_t *br, bitwriter_t *bw, bitwriter_t *sbrbw)
@@ -437,9 +419,7 @@ static void parse_sbr_channel_pair_element(bitreader_t *br, bitwriter_t *bw, bit
     }
 
     // XXX I'm lazy copy remaining bits verbatim
-    int remaining = br->bits + (br->end - br->buf)*8;
-    while (remaining--)
-        bw_addbits(sbrbw, br_readbits(br, 1), 1);
+    copy_bits(br, sbrbw, br_remaining(br));
 }
 
 static void parse_sbr(bitreader_t *br, bitwriter_t *bw, ics_t *ics)
@@ -475,8 +455,7 @@ static void parse_sbr(bitreader_t *br, bitwriter_t *bw, ics_t *ics)
         bw_addbits(bw, bytes + 1 - 15, 8);
     }
 
-    for (int i = 0; i < bytes*8; ++i)
-        bw_addbits(bw, br_readbits(&sbrbr, 1), 1);
+    copy_bits(&sbrbr, bw, bytes * 8);
 }
 
 static void parse_fil(bitreader_t *br, bitwriter_t *bw, ics_t *ics)
@@ -0,0 +1,225 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "id3.h"
+
+#define ID3_HEADER_LEN 10
+#define ID3_FLAG_EXTENDED 0x40
+
+enum
+{
+    ENC_LATIN1,
+    ENC_UTF16,
+    ENC_UTF16BE,
+    ENC_UTF8
+};
+
+static unsigned int get_be32(const uint8_t *p)
+{
+    return (unsigned int)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// 7 bits per byte, so that the size never looks like a frame sync
+static unsigned int get_syncsafe(const uint8_t *p)
+{
+    return (p[0] & 0x7f) << 21 | (p[1] & 0x7f) << 14 | (p[2] & 0x7f) << 7 | (p[3] & 0x7f);
+}
+
+// Append code point c to out, or return 0 if it does not fit.
+static int put_utf8(char *out, unsigned int size, unsigned int *pos, uint32_t c)
+{
+    unsigned int n = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+
+    if (*pos + n >= size)
+        return 0;
+    if (n == 1)
+    {
+        out[(*pos)++] = c;
+        return 1;
+    }
+    out[*pos] = (0xf0 << (4 - n)) | (c >> (6 * (n - 1)));
+    for (unsigned int i = 1; i < n; i++)
+        out[*pos + i] = 0x80 | ((c >> (6 * (n - 1 - i))) & 0x3f);
+    *pos += n;
+    return 1;
+}
+
+// Decode text in encoding enc up to its terminator or len bytes into out.
+// Returns the bytes consumed, including the terminator.
+static unsigned int decode_text(int enc, const uint8_t *p, unsigned int len, char *out, unsigned int size)
+{
+    unsigned int i = 0, pos = 0, full = 0;
+    int big_endian = enc == ENC_UTF16BE;
+
+    if (enc == ENC_UTF16 && len >= 2 && (p[0] << 8 | p[1]) == 0xfeff)
+    {
+        big_endian = 1;
+        i = 2;
+    }
+    else if (enc == ENC_UTF16 && len >= 2 && (p[0] << 8 | p[1]) == 0xfffe)
+    {
+        i = 2;
+    }
+
+    if (enc == ENC_UTF16 || enc == ENC_UTF16BE)
+    {
+        while (i + 1 < len)
+        {
+            uint32_t c = big_endian ? p[i] << 8 | p[i + 1] : p[i + 1] << 8 | p[i];
+            i += 2;
+            if (c == 0)
+                break;
+            if (c >= 0xd800 && c < 0xdc00 && i + 1 < len)
+            {
+                uint32_t lo = big_endian ? p[i] << 8 | p[i + 1] : p[i + 1] << 8 | p[i];
+                if (lo >= 0xdc00 && lo < 0xe000)
+                {
+                    c = 0x10000 + ((c - 0xd800) << 10) + (lo - 0xdc00);
+                    i += 2;
+                }
+            }
+            if (!full && !put_utf8(out, size, &pos, c))
+                full = 1;
+        }
+    }
+    else
+    {
+        while (i < len)
+        {
+            uint8_t c = p[i++];
+            if (c == 0)
+                break;
+            if (full)
+                continue;
+            if (enc == ENC_LATIN1)
+            {
+                full = !put_utf8(out, size, &pos, c);
+            }
+            else if (pos + 1 < size)
+            {
+                out[pos++] = c;
+            }
+            else
+            {
+                full = 1;
+            }
+        }
+        // drop a UTF-8 character cut short by the end of out
+        if (enc == ENC_UTF8 && full)
+        {
+            unsigned int start = pos;
+            uint8_t lead;
+
+            while (start > 0 && (out[start - 1] & 0xc0) == 0x80)
+                start--;
+            if (start > 0)
+            {
+                lead = out[--start];
+                if ((lead & 0x80) && pos - start < ((lead & 0xe0) == 0xc0 ? 2u : (lead & 0xf0) == 0xe0 ? 3u : 4u))
+                    pos = start;
+            }
+        }
+    }
+
+    out[pos] = 0;
+    return i;
+}
+
+static void parse_frame(const uint8_t *id, const uint8_t *p, unsigned int len, id3_t *tag)
+{
+    char *out = NULL;
+    int enc;
+
+    if (len < 1)
+        return;
+    enc = p[0];
+    if (enc > ENC_UTF8)
+        return;
+
+    if (memcmp(id, "TIT2", 4) == 0)
+        out = tag->title;
+    else if (memcmp(id, "TPE1", 4) == 0)
+        out = tag->artist;
+    else if (memcmp(id, "TALB", 4) == 0)
+        out = tag->album;
+    else if (memcmp(id, "TCON", 4) == 0)
+        out = tag->genre;
+
+    if (out)
+    {
+        decode_text(enc, p + 1, len - 1, out, ID3_TEXT_LEN);
+    }
+    else if (memcmp(id, "COMM", 4) == 0 && len >= 4)
+    {
+        // language, then a short description before the text
+        unsigned int n = decode_text(enc, p + 4, len - 4, tag->comment, ID3_TEXT_LEN);
+        decode_text(enc, p + 4 + n, len - 4 - n, tag->comment, ID3_TEXT_LEN);
+    }
+}
+
+int id3_parse(const uint8_t *buf, unsigned int len, id3_t *tag)
+{
+    unsigned int version, size, pos = ID3_HEADER_LEN;
+
+    memset(tag, 0, sizeof(*tag));
+
+    if (len < ID3_HEADER_LEN || memcmp(buf, "ID3", 3) != 0)
+        return -1;
+    version = buf[3];
+    if (version != 3 && version != 4)
+        return -1;
+    size = get_syncsafe(&buf[6]);
+    if (size < len - ID3_HEADER_LEN)
+        len = size + ID3_HEADER_LEN;
+
+    if (buf[5] & ID3_FLAG_EXTENDED)
+    {
+        unsigned int ext;
+
+        if (pos + 4 > len)
+            return -1;
+        // v2.4 counts the size field, v2.3 does not
+        if (version == 4)
+        {
+            ext = get_syncsafe(&buf[pos]);
+            if (ext > len - pos)
+                return -1;
+        }
+        else
+        {
+            ext = get_be32(&buf[pos]);
+            if (ext > len - pos - 4)
+                return -1;
+            ext += 4;
+        }
+        pos += ext;
+    }
+
+    while (pos + ID3_HEADER_LEN <= len && buf[pos] != 0)
+    {
+        const uint8_t *id = &buf[pos];
+        unsigned int frame_len = version == 4 ? get_syncsafe(&buf[pos + 4]) : get_be32(&buf[pos + 4]);
+
+        pos += ID3_HEADER_LEN;
+        if (frame_len > len - pos)
+            break;
+        parse_frame(id, &buf[pos], frame_len, tag);
+        pos += frame_len;
+    }
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * ID3v2.3 and v2.4 tags of program service data.
+ *
+ * Only the text frames that stations send are decoded, straight from the
+ * tag into fixed buffers, so parsing a tag allocates nothing.
+ */
+#define ID3_TEXT_LEN 256
+
+typedef struct
+{
+    // UTF-8 and NUL-terminated, empty if the tag has no such frame; longer
+    // text is cut at a character boundary
+    char title[ID3_TEXT_LEN];
+    char artist[ID3_TEXT_LEN];
+    char album[ID3_TEXT_LEN];
+    char genre[ID3_TEXT_LEN];
+    char comment[ID3_TEXT_LEN];
+} id3_t;
+
+// Parse a tag of len bytes. Returns 0, or -1 if it is not an ID3v2.3 or
+// v2.4 tag.
+int id3_parse(const uint8_t *buf, unsigned int len, id3_t *tag);
@@ -18,15 +18,17 @@
 #include <string.h>
 
 #include "defines.h"
+#include "fft.h"
 #include "input.h"
+#include "profile.h"
+#include "trace.h"
 
-#define INPUT_BUF_LEN (2160 * 512)
-
-#ifdef USE_FAST_MATH
-#define RESAMP_NUM_TAPS 8
-#else
-#define RESAMP_NUM_TAPS 16
-#endif
+// decimated samples per front-end block
+#define INPUT_BLOCK 1024
+// 64-point SNR windows per FFT batch, a 128 KiB auto-gain buffer
+#define SNR_BATCH 512
+// acquisition windows of about 186 ms averaged before sync while scanning
+#define SCAN_HISTORY 2
 
 static float filter_taps[] = {
 #ifdef USE_FAST_MATH
@@ -88,66 +90,167 @@ static float filter_taps[] = {
 #endif
 };
 
-static void input_push_to_acquire(input_t *st)
+// Copy the samples in [start, start + n) of the buffer to where the ring
+// expects them: writes past the end wrap to the start, and writes near the
+// start are repeated in the mirror.
+static void input_mirror(input_t *st, unsigned int start, unsigned int n)
 {
-    // CFO is modified in sync, and is expected to be "immediately" applied
-    for (unsigned int j = st->used + st->cfo_used; j < st->avail; j++)
-        st->buffer[j] *= st->cfo_tbl[st->cfo_idx++ % FFT];
+    if (start + n > st->buf_len)
+    {
+        memcpy(&st->buffer[0], &st->buffer[st->buf_len], sizeof(st->buffer[0]) * (start + n - st->buf_len));
+        n = st->buf_len - start;
+    }
+    if (start < ACQ_WINDOW)
+    {
+        unsigned int end = start + n < ACQ_WINDOW ? start + n : ACQ_WINDOW;
+        memcpy(&st->buffer[st->buf_len + start], &st->buffer[start], sizeof(st->buffer[0]) * (end - start));
+    }
+}
 
-    if (st->skip)
+#ifdef USE_THREADS
+static void input_wake(input_t *st)
+{
+    if (atomic_load(&st->sleeping))
     {
-        if (st->skip > st->avail - st->used)
-        {
-            st->skip -= st->avail - st->used;
-            st->used = st->avail;
-        }
-        else
+        pthread_mutex_lock(&st->mutex);
+        pthread_cond_broadcast(&st->cond);
+        pthread_mutex_unlock(&st->mutex);
+    }
+}
+
+static void input_sleep(input_t *st, int (*test)(input_t *))
+{
+    atomic_fetch_add(&st->sleeping, 1);
+    pthread_mutex_lock(&st->mutex);
+    while (!test(st))
+        pthread_cond_wait(&st->cond, &st->mutex);
+    pthread_mutex_unlock(&st->mutex);
+    atomic_fetch_sub(&st->sleeping, 1);
+}
+#endif
+
+// Run acquisition on the windows available in the ring.
+static void input_process(input_t *st)
+{
+    unsigned int avail = atomic_load(&st->avail);
+    unsigned int used = atomic_load(&st->used);
+
+    while (1)
+    {
+        unsigned int skip = atomic_load(&st->skip), n;
+
+        // skipping moves the whole window, so correlation starts over
+        if (skip)
         {
-            st->used += st->skip;
-            st->skip = 0;
+            n = skip < avail - used ? skip : avail - used;
+            if (n)
+            {
+                used += n;
+                atomic_fetch_sub(&st->skip, n);
+                acquire_reset(&st->acq);
+            }
         }
+
+        st->acq.pos = used;
+        uint64_t span = trace_begin();
+        n = acquire_process(&st->acq, &st->buffer[used % st->buf_len], avail - used);
+        trace_end(TRACE_ACQUIRE, span);
+        if (n == 0)
+            break;
+        used += n;
+        atomic_store(&st->used, used);
+#ifdef USE_THREADS
+        input_wake(st);
+#endif
     }
 
-    st->used += acquire_push(&st->acq, &st->buffer[st->used], st->avail - st->used);
-    st->cfo_used = st->avail - st->used;
+    atomic_store(&st->used, used);
+    atomic_store(&st->done, avail);
+#ifdef USE_THREADS
+    input_wake(st);
+#endif
 }
 
 #ifdef USE_THREADS
+static int input_has_data(input_t *st)
+{
+    return atomic_load(&st->avail) != atomic_load(&st->done) || atomic_load(&st->stop);
+}
+
 static void *input_worker(void *arg)
 {
     input_t *st = arg;
 
     while (1)
     {
-        pthread_mutex_lock(&st->mutex);
-        while (st->avail - st->used < FFTCP)
-            pthread_cond_wait(&st->cond, &st->mutex);
-
-        input_push_to_acquire(st);
-
-        pthread_mutex_unlock(&st->mutex);
-        pthread_cond_signal(&st->cond);
+        if (!input_has_data(st))
+            input_sleep(st, input_has_data);
+        if (atomic_load(&st->stop))
+            break;
 
-        acquire_process(&st->acq);
+        input_process(st);
     }
 
     return NULL;
 }
 #endif
 
-void input_pdu_push(input_t *st, uint8_t *pdu, unsigned int len)
+void input_pdu_push(input_t *st, unsigned int program, uint8_t *pdu, unsigned int len)
 {
-    output_push(st->output, pdu, len);
+    nrsc5_event_t evt;
+
+    evt.event = NRSC5_EVENT_AUDIO;
+    evt.audio.program = program;
+    evt.audio.data = pdu;
+    evt.audio.len = len;
+    input_event(st, &evt);
+
+    if (st->output[program])
+    {
+        uint64_t t = timing_now(&st->timing), span = trace_begin();
+        output_push(st->output[program], pdu, len);
+        trace_end(TRACE_OUTPUT, span);
+        timing_end(&st->timing, TIMING_OUTPUT, t);
+        timing_hold(&st->timing, TIMING_FRAME, t);
+    }
+}
+
+void input_pdu_end(input_t *st, unsigned int program)
+{
+    if (st->output[program])
+        output_frame_end(st->output[program]);
 }
 
 void input_rate_adjust(input_t *st, float adj)
 {
-    st->resamp_rate += adj;
+    // only the worker adjusts the rate, input_cb reads it
+    st->resamp_rate = st->resamp_rate + adj;
 }
 
 void input_set_skip(input_t *st, unsigned int skip)
 {
-    st->skip += skip;
+    atomic_fetch_add(&st->skip, skip);
+}
+
+uint64_t input_arrival(input_t *st, unsigned int pos)
+{
+    unsigned int cnt = atomic_load(&st->stamp_cnt);
+    const input_stamp_t *found = NULL;
+
+    // the oldest push that reached pos; half of the table is searched, as
+    // input_cb may be overwriting the oldest entries
+    for (unsigned int i = 1; i <= cnt && i <= INPUT_STAMPS / 2; ++i)
+    {
+        const input_stamp_t *stamp = &st->stamps[(cnt - i) % INPUT_STAMPS];
+        if ((int)(stamp->avail - pos) < 0)
+            break;
+        found = stamp;
+    }
+    if (found == NULL)
+        return 0;
+    // a push holds the samples received since the previous one, so the
+    // earlier samples arrived before the push was made
+    return found->ns - (uint64_t)(found->avail - pos) * 1000000000 / (NRSC5_SAMPLE_RATE / 2);
 }
 
 void input_cfo_adjust(input_t *st, int cfo)
@@ -155,44 +258,86 @@ void input_cfo_adjust(input_t *st, int cfo)
     if (cfo == 0)
         return;
 
+#ifdef USE_THREADS
+    pthread_mutex_lock(&st->mutex);
+#endif
     st->cfo += cfo;
     float hz = st->cfo * 744187.5 / FFT;
+    stats_set(&st->stats.cfo, hz);
     log_info("CFO: %f Hz (%d ppm)", hz, (int)round(hz * 1000000.0 / st->center));
 
     for (int i = 0; i < FFT; ++i)
         st->cfo_tbl[i] *= cexpf(-I * (float)(2 * M_PI * st->cfo * i / FFT));
+    atomic_fetch_add(&st->cfo_gen, 1);
+#ifdef USE_THREADS
+    pthread_mutex_unlock(&st->mutex);
+#endif
+}
+
+#ifdef USE_THREADS
+static int input_caught_up(input_t *st)
+{
+    unsigned int backlog = st->buf_len / 2 < 256 * FFTCP ? st->buf_len / 2 : 256 * FFTCP;
+    return atomic_load(&st->avail) - atomic_load(&st->used) <= backlog;
+}
+
+static int input_idle(input_t *st)
+{
+    return atomic_load(&st->done) == atomic_load(&st->avail);
 }
 
+// input_push can write push_cnt samples
+static int input_has_space(input_t *st)
+{
+    return atomic_load(&st->avail) - atomic_load(&st->used) + st->push_cnt + INPUT_BLOCK <= st->buf_len;
+}
+#endif
+
 void input_wait(input_t *st, int flush)
 {
 #ifdef USE_THREADS
-    pthread_mutex_lock(&st->mutex);
-    while (st->avail - st->used > (flush ? 1 : 256) * FFTCP)
-        pthread_cond_wait(&st->cond, &st->mutex);
-    pthread_mutex_unlock(&st->mutex);
+    int (*test)(input_t *) = flush ? input_idle : input_caught_up;
+
+    if (!test(st))
+        input_sleep(st, test);
 
     if (flush)
     {
         sync_wait(&st->sync);
+        decode_wait(&st->decode);
     }
 #endif
 }
 
 static void measure_snr(input_t *st, uint8_t *buf, uint32_t len)
 {
-    unsigned int i, j;
+    unsigned int i, j, n, windows = len / 128;
 
-    // use a small FFT to calculate magnitude of frequency ranges
-    for (j = 64; j <= len / 2; j += 64)
+    // use small FFTs to calculate magnitude of frequency ranges
+    for (j = 0; j < windows; j += n)
     {
-        for (i = 0; i < 64; i++)
-            st->snr_fft_in[i] = CMPLXF(U8_F(buf[(i+j-64) * 2 + 0]), U8_F(buf[(i+j-64) * 2 + 1])) * pow(sinf(M_PI*i/63),2);
+        n = windows - j < SNR_BATCH ? windows - j : SNR_BATCH;
+
+        for (unsigned int w = 0; w < n; w++)
+        {
+            const uint8_t *x = &buf[(j + w) * 128];
+            float complex *in = &st->snr_fft_in[w * 64];
+            for (i = 0; i < 64; i++)
+                in[i] = CMPLXF(U8_F(x[i * 2 + 0]), U8_F(x[i * 2 + 1])) * st->snr_window[i];
+        }
+        // the last batch of a buffer may be partial
+        if (n < SNR_BATCH)
+            memset(&st->snr_fft_in[n * 64], 0, sizeof(float complex) * 64 * (SNR_BATCH - n));
         fftwf_execute(st->snr_fft);
-        fftshift(st->snr_fft_out, 64);
 
-        for (i = 0; i < 64; i++)
-            st->snr_power[i] += normf(st->snr_fft_out[i]);
-        st->snr_cnt++;
+        for (unsigned int w = 0; w < n; w++)
+        {
+            const float complex *out = &st->snr_fft_out[w * 64];
+            // accumulate in fftshift order
+            for (i = 0; i < 64; i++)
+                st->snr_power[i] += normf(out[(i + 32) & 63]);
+        }
+        st->snr_cnt += n;
     }
 
     if (st->snr_cnt > 2048)
@@ -229,119 +374,247 @@ static void measure_snr(input_t *st, uint8_t *buf, uint32_t len)
     }
 }
 
-void input_cb(uint8_t *buf, uint32_t len, void *arg)
+static void input_stats_poll(input_t *st)
 {
-    unsigned int i, new_avail, cnt = len / 4;
-    input_t *st = arg;
+    struct timespec ts;
+    uint64_t now;
 
-    if (st->outfp)
-        fwrite(buf, 1, len, st->outfp);
+    if (st->stats_fp == NULL)
+        return;
 
-    if (st->snr_cb)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    if (st->stats_next == 0)
+        st->stats_next = now + st->stats_interval;
+    else if (now >= st->stats_next)
     {
-        measure_snr(st, buf, len);
-        return;
+        stats_write_json(st, st->stats_fp);
+        st->stats_next += st->stats_interval;
+        if (st->stats_next <= now)
+            st->stats_next = now + st->stats_interval;
     }
+}
+
+// Filter and resample cnt outputs from x8 (u8 IQ) or x16 into the ring.
+// If decimated is set, x16 holds the filter output instead.
+static void input_push(input_t *st, const uint8_t *x8, const cint16_t *x16, int decimated, unsigned int cnt)
+{
+    unsigned int i, avail, stamp_cnt;
+    // before waiting for space, which delays the samples
+    uint64_t arrival = timing_clock();
+
+    input_stats_poll(st);
 
+    avail = atomic_load(&st->avail);
 #ifdef USE_THREADS
-    pthread_mutex_lock(&st->mutex);
-#endif
-    if (cnt + st->avail > INPUT_BUF_LEN)
+    if (st->backpressure && avail - atomic_load(&st->used) + cnt + INPUT_BLOCK > st->buf_len)
     {
-        if (st->avail > st->used)
-        {
-            memmove(&st->buffer[0], &st->buffer[st->used], (st->avail - st->used) * sizeof(st->buffer[0]));
-            st->avail -= st->used;
-            st->used = 0;
-        }
-        else
-        {
-            st->avail = 0;
-            st->used = 0;
-        }
+        st->push_cnt = cnt;
+        input_sleep(st, input_has_space);
     }
-    new_avail = st->avail;
-    resamp_q15_set_rate(st->resamp, st->resamp_rate);
-#ifdef USE_THREADS
-    pthread_mutex_unlock(&st->mutex);
 #endif
-
-    if (cnt + new_avail > INPUT_BUF_LEN)
+    if (avail - atomic_load(&st->used) + cnt + INPUT_BLOCK > st->buf_len)
     {
         log_error("input buffer overflow!");
+        stats_add(&st->overruns, 1);
+        stats_add(&st->stats.dropped_samples, cnt * 2);
         return;
     }
-    assert(len % 4 == 0);
+    uint64_t t = timing_now(&st->timing), span = trace_begin();
+    resamp_q15_set_rate(st->resamp, st->resamp_rate);
 
-    for (i = 0; i < cnt; i++)
+    // CFO is modified in sync, and is expected to be "immediately" applied
+    if (atomic_load(&st->cfo_gen) != st->cfo_seen)
     {
-        unsigned int nw;
-        cint16_t x[2], y;
-
-        x[0].r = U8_Q15(buf[i * 4 + 0]);
-        x[0].i = U8_Q15(buf[i * 4 + 1]);
-        x[1].r = U8_Q15(buf[i * 4 + 2]);
-        x[1].i = U8_Q15(buf[i * 4 + 3]);
+#ifdef USE_THREADS
+        pthread_mutex_lock(&st->mutex);
+#endif
+        memcpy(st->cfo_rot, st->cfo_tbl, sizeof(st->cfo_rot));
+        st->cfo_seen = atomic_load(&st->cfo_gen);
+#ifdef USE_THREADS
+        pthread_mutex_unlock(&st->mutex);
+#endif
+    }
 
-        firdecim_q15_execute(st->filter, x, &y);
-        resamp_q15_execute(st->resamp, &y, &st->buffer[new_avail], &nw);
+    for (i = 0; i < cnt; i += INPUT_BLOCK)
+    {
+        unsigned int nw, n = cnt - i < INPUT_BLOCK ? cnt - i : INPUT_BLOCK;
+        unsigned int pos = avail % st->buf_len;
+        cint16_t tmp[INPUT_BLOCK];
+        const cint16_t *y = tmp;
+
+        if (x8)
+            firdecim_q15_execute_block(st->filter, &x8[i * 4], n, tmp);
+        else if (decimated)
+            y = &x16[i];
+        else
+            firdecim_q15_execute_block_q15(st->filter, &x16[i * 2], n, tmp);
+        if (st->rec)
+            record_push_iq(st->rec, y, n);
+        resamp_q15_execute_block(st->resamp, y, n, &st->buffer[pos], &nw);
+        input_mirror(st, pos, nw);
 
-        new_avail += nw;
+        avail += nw;
     }
-
+    timing_end(&st->timing, TIMING_FRONTEND, t);
+    trace_end(TRACE_FRONTEND, span);
+
+    stamp_cnt = atomic_load(&st->stamp_cnt);
+    st->stamps[stamp_cnt % INPUT_STAMPS].avail = avail;
+    st->stamps[stamp_cnt % INPUT_STAMPS].ns = arrival;
+    atomic_store(&st->stamp_cnt, stamp_cnt + 1);
+    atomic_store(&st->avail, avail);
 #ifdef USE_THREADS
-    pthread_mutex_lock(&st->mutex);
-    st->avail = new_avail;
-    pthread_mutex_unlock(&st->mutex);
-    pthread_cond_signal(&st->cond);
+    input_wake(st);
 #else
-    st->avail = new_avail;
-    while (st->avail - st->used >= FFTCP)
+    input_process(st);
+#endif
+}
+
+void input_cb(uint8_t *buf, uint32_t len, void *arg)
+{
+    input_t *st = arg;
+
+    if (st->rec)
+        record_push_u8(st->rec, buf, len);
+
+    if (st->snr_cb)
     {
-        input_push_to_acquire(st);
-        acquire_process(&st->acq);
+        measure_snr(st, buf, len);
+        return;
     }
+
+    assert(len % 4 == 0);
+    input_push(st, buf, NULL, 0, len / 4);
+}
+
+void input_push_q15(input_t *st, const cint16_t *buf, unsigned int len)
+{
+    assert(len % 2 == 0);
+    input_push(st, NULL, buf, 0, len / 2);
+}
+
+void input_push_decimated(input_t *st, const cint16_t *buf, unsigned int cnt)
+{
+    input_push(st, NULL, buf, 1, cnt);
+}
+
+void input_set_backpressure(input_t *st, int enable)
+{
+#ifdef USE_THREADS
+    st->backpressure = enable;
 #endif
 }
 
+void *input_alloc(input_t *st, size_t size)
+{
+    void *p = calloc(1, size);
+    if (p == NULL)
+        FATAL_EXIT("Unable to allocate %zu bytes.", size);
+    st->footprint += size;
+    return p;
+}
+
+void input_set_scan(input_t *st, int enable)
+{
+    st->acq.min_history = enable ? SCAN_HISTORY : ACQ_HISTORY;
+}
+
+void input_set_output(input_t *st, unsigned int program, output_t *output)
+{
+    st->output[program] = output;
+}
+
 void input_set_snr_callback(input_t *st, input_snr_cb_t cb, void *arg)
 {
+    if (cb && st->snr_fft == NULL)
+    {
+        st->snr_fft_in = malloc(sizeof(float complex) * 64 * SNR_BATCH);
+        st->snr_fft_out = malloc(sizeof(float complex) * 64 * SNR_BATCH);
+        st->snr_fft = fft_plan_many(64, SNR_BATCH, st->snr_fft_in, st->snr_fft_out);
+    }
     st->snr_cb = cb;
     st->snr_cb_arg = arg;
 }
 
+void input_set_event_callback(input_t *st, nrsc5_callback_t cb, void *arg)
+{
+    st->event_cb = cb;
+    st->event_cb_arg = arg;
+}
+
+void input_set_stats(input_t *st, FILE *fp, unsigned int interval)
+{
+    st->stats_fp = fp;
+    st->stats_interval = (uint64_t)interval * 1000000000;
+    st->stats_next = 0;
+    if (fp)
+        st->timing.enabled = 1;
+}
+
+void input_event(input_t *st, const nrsc5_event_t *evt)
+{
+    if (st->event_cb)
+        st->event_cb(evt, st->event_cb_arg);
+}
+
 void input_reset(input_t *st)
 {
-    st->avail = 0;
-    st->used = 0;
-    st->skip = 0;
+    atomic_store(&st->avail, 0);
+    atomic_store(&st->used, 0);
+    atomic_store(&st->done, 0);
+    atomic_store(&st->skip, 0);
+    atomic_store(&st->stamp_cnt, 0);
     st->resamp_rate = 1.0f;
     st->cfo = 0;
-    st->cfo_idx = 0;
-    st->cfo_used = 0;
     for (int i = 0; i < FFT; ++i)
         st->cfo_tbl[i] = 1;
+    memcpy(st->cfo_rot, st->cfo_tbl, sizeof(st->cfo_rot));
+    atomic_store(&st->cfo_gen, 0);
+    st->cfo_seen = 0;
     for (int i = 0; i < 64; ++i)
         st->snr_power[i] = 0;
     st->snr_cnt = 0;
 }
 
-void input_init(input_t *st, output_t *output, double center, unsigned int program, FILE *outfp)
+void input_init(input_t *st, output_t *output, double center, unsigned int program, record rec)
 {
-    st->buffer = malloc(sizeof(float complex) * INPUT_BUF_LEN);
-    st->output = output;
-    st->outfp = outfp;
+    const profile_t *profile = profile_get();
+
+    st->footprint = 0;
+    // a power of two, so the free-running counters wrap with the ring
+    st->buf_len = profile->input_len;
+    st->buffer = input_alloc(st, sizeof(cint16_t) * (st->buf_len + ACQ_WINDOW));
+    for (int p = 0; p < MAX_PROGRAMS; p++)
+        st->output[p] = NULL;
+    if (program < MAX_PROGRAMS)
+        st->output[program] = output;
+    st->rec = rec;
     st->center = center;
     st->snr_cb = NULL;
     st->snr_cb_arg = NULL;
+    st->snr_fft = NULL;
+    st->snr_fft_in = NULL;
+    st->snr_fft_out = NULL;
+    for (int i = 0; i < 64; ++i)
+        st->snr_window[i] = powf(sinf(M_PI * i / 63), 2);
+    st->event_cb = NULL;
+    st->event_cb_arg = NULL;
+    atomic_init(&st->overruns, 0);
+    st->timing.enabled = 0;
+    timing_reset(&st->timing);
+    stats_reset(&st->stats);
+    st->stats_fp = NULL;
 
     st->filter = firdecim_q15_create(2, filter_taps, sizeof(filter_taps) / sizeof(filter_taps[0]));
     st->resamp = resamp_q15_create(RESAMP_NUM_TAPS / 2, 0.45f, 60.0f, 16);
-    st->snr_fft = fftwf_plan_dft_1d(64, st->snr_fft_in, st->snr_fft_out, FFTW_FORWARD, 0);
+    resamp_q15_set_rotation(st->resamp, st->cfo_rot, FFT);
 
     input_reset(st);
 
 #ifdef USE_THREADS
+    atomic_init(&st->sleeping, 0);
+    atomic_init(&st->stop, 0);
     pthread_cond_init(&st->cond, NULL);
     pthread_mutex_init(&st->mutex, NULL);
     pthread_create(&st->worker_thread, NULL, input_worker, st);
@@ -357,7 +630,56 @@ void input_init(input_t *st, output_t *output, double center, unsigned int progr
     sync_init(&st->sync, st);
 }
 
-void input_psd_push(uint8_t *psd, unsigned int len)
+void input_free(input_t *st)
+{
+#ifdef USE_THREADS
+    atomic_store(&st->stop, 1);
+    pthread_mutex_lock(&st->mutex);
+    pthread_cond_broadcast(&st->cond);
+    pthread_mutex_unlock(&st->mutex);
+    pthread_join(st->worker_thread, NULL);
+    pthread_cond_destroy(&st->cond);
+    pthread_mutex_destroy(&st->mutex);
+#endif
+
+    sync_free(&st->sync);
+    decode_free(&st->decode);
+    frame_free(&st->frame);
+    acquire_free(&st->acq);
+
+    if (st->snr_fft)
+        fftwf_destroy_plan(st->snr_fft);
+    free(st->snr_fft_in);
+    free(st->snr_fft_out);
+    resamp_q15_destroy(st->resamp);
+    firdecim_q15_destroy(st->filter);
+    free(st->buffer);
+}
+
+void input_psd_push(input_t *st, unsigned int program, uint8_t *psd, unsigned int len)
+{
+    nrsc5_event_t evt;
+
+    evt.event = NRSC5_EVENT_PSD;
+    evt.psd.program = program;
+    evt.psd.data = psd;
+    evt.psd.len = len;
+    input_event(st, &evt);
+}
+
+void input_id3_push(input_t *st, unsigned int program, const id3_t *tag)
 {
-    output_psd_push(psd, len);
+    nrsc5_event_t evt;
+
+    evt.event = NRSC5_EVENT_ID3;
+    evt.id3.program = program;
+    evt.id3.title = tag->title;
+    evt.id3.artist = tag->artist;
+    evt.id3.album = tag->album;
+    evt.id3.genre = tag->genre;
+    evt.id3.comment = tag->comment;
+    input_event(st, &evt);
+
+    if (st->output[program])
+        output_id3_push(st->output[program], tag);
 }
@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <complex.h>
+#include <stdatomic.h>
 #ifdef USE_THREADS
 #include <pthread.h>
 #endif
@@ -12,38 +13,96 @@
 #include "defines.h"
 #include "firdecim_q15.h"
 #include "frame.h"
+#include "id3.h"
+#include "nrsc5.h"
 #include "output.h"
+#include "record.h"
 #include "resamp_q15.h"
 #include "sync.h"
+#include "stats.h"
+#include "timing.h"
 
 typedef int (*input_snr_cb_t) (void *, float, float, float);
 
+// recent pushes remembered for input_arrival()
+#define INPUT_STAMPS 64
+
+typedef struct
+{
+    // avail after the push, and when the push was made
+    unsigned int avail;
+    uint64_t ns;
+} input_stamp_t;
+
 typedef struct input_t
 {
-    output_t *output;
-    FILE *outfp;
+    // audio output for each program, may be NULL
+    output_t *output[MAX_PROGRAMS];
+    // -w recording, may be NULL
+    record rec;
 
     firdecim_q15 filter;
     resamp_q15 resamp;
-    float resamp_rate;
-    float complex *buffer;
+    _Atomic float resamp_rate;
     double center;
-    unsigned int avail, used, skip;
-    int cfo, cfo_idx, cfo_used;
+
+    // Ring of buf_len samples, followed by a mirror of its first
+    // ACQ_WINDOW samples so that every window is contiguous. The counters
+    // are free-running: avail is written by input_cb, used (the start of
+    // the acquisition window) and done by the worker. Samples are stored
+    // in Q15, which is plenty for 8-bit input and half the size of float.
+    cint16_t *buffer;
+    unsigned int buf_len;
+    atomic_uint avail, used, done;
+    atomic_uint skip;
+    // written by input_cb before avail, read by the worker
+    input_stamp_t stamps[INPUT_STAMPS];
+    atomic_uint stamp_cnt;
+    // input buffers dropped because the decoder could not keep up
+    atomic_ulong overruns;
+    // bytes of buffers allocated with input_alloc()
+    size_t footprint;
+    // per-stage processing time, when enabled
+    timing_t timing;
+    stats_t stats;
+    // periodic JSON export, written from input_cb
+    FILE *stats_fp;
+    uint64_t stats_interval;
+    uint64_t stats_next;
+
+    // CFO correction: sync updates cfo_tbl and bumps cfo_gen, input_cb
+    // copies it to cfo_rot, which the resampler applies to its output
+    int cfo;
     float complex cfo_tbl[FFT];
+    float complex cfo_rot[FFT];
+    atomic_uint cfo_gen;
+    unsigned int cfo_seen;
 
+    // SNR_BATCH windows of 64 samples, allocated with the SNR callback
     fftwf_plan snr_fft;
-    float complex snr_fft_in[64];
-    float complex snr_fft_out[64];
+    float complex *snr_fft_in;
+    float complex *snr_fft_out;
+    float snr_window[64];
     float snr_power[64];
     int snr_cnt;
     input_snr_cb_t snr_cb;
     void *snr_cb_arg;
 
+    nrsc5_callback_t event_cb;
+    void *event_cb_arg;
+
 #ifdef USE_THREADS
     pthread_t worker_thread;
+    // the mutex guards cfo_tbl, and is used to sleep when the ring is
+    // empty or too full
     pthread_cond_t cond;
     pthread_mutex_t mutex;
+    atomic_int sleeping;
+    atomic_int stop;
+    // wait for room in the ring instead of dropping input, and the number
+    // of samples input_push is waiting to write
+    int backpressure;
+    unsigned int push_cnt;
 #endif
 
     acquire_t acq;
@@ -52,12 +111,44 @@ typedef struct input_t
     sync_t sync;
 } input_t;
 
-void input_init(input_t *st, output_t *output, double center, unsigned int program, FILE *outfp);
+// Buffer sizes come from the current profile (see profile.h).
+void input_init(input_t *st, output_t *output, double center, unsigned int program, record rec);
+void input_free(input_t *st);
 void input_cb(uint8_t *, uint32_t, void *);
+// Push len Q15 samples at NRSC5_SAMPLE_RATE, len must be even.
+void input_push_q15(input_t *st, const cint16_t *buf, unsigned int len);
+// Push cnt samples at NRSC5_SAMPLE_RATE / 2 that were already filtered,
+// such as a decimated recording.
+void input_push_decimated(input_t *st, const cint16_t *buf, unsigned int cnt);
+void input_set_output(input_t *st, unsigned int program, output_t *output);
 void input_set_snr_callback(input_t *st, input_snr_cb_t cb, void *);
+void input_set_event_callback(input_t *st, nrsc5_callback_t cb, void *);
+// Write a JSON line of statistics to fp every interval seconds, and time
+// the pipeline stages for it. fp NULL stops the export.
+void input_set_stats(input_t *st, FILE *fp, unsigned int interval);
+void input_event(input_t *st, const nrsc5_event_t *evt);
 void input_rate_adjust(input_t *st, float adj);
 void input_cfo_adjust(input_t *st, int cfo);
 void input_set_skip(input_t *st, unsigned int skip);
+// CLOCK_MONOTONIC time in ns at which the sample at free-running position
+// pos (see avail) was received, estimated from when the push holding it was
+// made and the sample rate. Positions older than the pushes remembered are
+// timed from the oldest one, and 0 is returned before the first push.
+uint64_t input_arrival(input_t *st, unsigned int pos);
+// When decoding offline, block input_cb and input_push_q15 while the ring is
+// full instead of dropping the samples.
+void input_set_backpressure(input_t *st, int enable);
+// Trust the symbol timing after a couple of acquisition windows instead of
+// ACQ_HISTORY, to detect a station quickly. Only for scanning, as the timing
+// and sample rate estimates are noisier.
+void input_set_scan(input_t *st, int enable);
+// Zeroed memory for a stage of the pipeline, counted in footprint. Exits
+// if it cannot be allocated.
+void *input_alloc(input_t *st, size_t size);
 void input_wait(input_t *st, int flush);
-void input_pdu_push(input_t *st, uint8_t *pdu, unsigned int len);
-void input_psd_push(uint8_t *psd, unsigned int len);
+void input_pdu_push(input_t *st, unsigned int program, uint8_t *pdu, unsigned int len);
+// The packets of program in the current P1 frame have all been pushed.
+void input_pdu_end(input_t *st, unsigned int program);
+void input_psd_push(input_t *st, unsigned int program, uint8_t *psd, unsigned int len);
+// Called with the ID3 tag of a program when it changes.
+void input_id3_push(input_t *st, unsigned int program, const id3_t *tag);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include "defines.h"
+
+/*
+ * SIMD kernels
+ *
+ * Each kernels_*.c file is compiled with the instruction set flags for its
+ * ISA, and callers bind the kernels at runtime after checking cpu_has().
+ * Signatures match the generic implementations in the calling modules.
+ */
+
+// *_batch_k7_n3: a trellis step of CONV_BATCH frames, as gen_batch_k7_n3()
+
+#ifdef HAVE_X86_KERNELS
+// kernels_sse.c (SSE2 and SSSE3)
+void sse_metrics_k7_n3(const int8_t *val, const int16_t *out,
+                       int16_t *sums, int16_t *paths, int norm);
+uint64_t sse_pack_paths_k7(const int16_t *paths);
+cint32_t sse_dotprod_q31(const cint32_t *a, const int32_t *b);
+void sse_dotprod2_q31(const cint32_t *a, const int32_t *b0, const int32_t *b1, cint32_t *y);
+void sse_firdecim_block(const cint16_t *h, const int16_t *taps, unsigned int n, cint16_t *y);
+void sse_batch_k7_n3(const int16_t *val, const uint8_t *bfly, const uint8_t *first,
+                     const int16_t *sums, int16_t *new_sums, uint16_t *paths, int norm);
+
+// kernels_avx2.c
+uint64_t avx2_step_k7_n3(const int8_t *val, const int16_t *out,
+                         int16_t *sums, int norm);
+void avx2_firdecim_block(const cint16_t *h, const int16_t *taps, unsigned int n, cint16_t *y);
+void avx2_dotprod2_q31(const cint32_t *a, const int32_t *b0, const int32_t *b1, cint32_t *y);
+void avx2_batch_k7_n3(const int16_t *val, const uint8_t *bfly, const uint8_t *first,
+                      const int16_t *sums, int16_t *new_sums, uint16_t *paths, int norm);
+#endif
+
+#ifdef HAVE_NEON_KERNELS
+// kernels_neon.c
+void neon_metrics_k7_n3(const int8_t *val, const int16_t *out,
+                        int16_t *sums, int16_t *paths, int norm);
+uint64_t neon_pack_paths_k7(const int16_t *paths);
+void neon_firdecim_block(const cint16_t *h, const int16_t *taps, unsigned int n, cint16_t *y);
+cint32_t neon_dotprod_q31(const cint32_t *a, const int32_t *b);
+void neon_dotprod2_q31(const cint32_t *a, const int32_t *b0, const int32_t *b1, cint32_t *y);
+void neon_batch_k7_n3(const int16_t *val, const uint8_t *bfly, const uint8_t *first,
+                      const int16_t *sums, int16_t *new_sums, uint16_t *paths, int norm);
+#endif
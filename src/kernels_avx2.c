@@ -0,0 +1,148 @@
+/*
+ * AVX2 kernels, compiled with -mavx2
+ */
+
+#include <immintrin.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "conv.h"
+#include "conv_avx2.h"
+#include "firdecim_q15.h"
+#include "resamp_q15.h"
+
+uint64_t avx2_step_k7_n3(const int8_t *val, const int16_t *out,
+                         int16_t *sums, int norm)
+{
+    const int16_t _val[4] = { val[0], val[1], val[2], 0 };
+
+    return _avx2_metrics_k7_n4(_val, out, sums, norm);
+}
+
+// the int16 sums of sse_firdecim_block(), sixteen products at a time
+void avx2_firdecim_block(const cint16_t *h, const int16_t *taps, unsigned int n, cint16_t *y)
+{
+    __m256i t[FIRDECIM_NUM_TAPS / 8];
+
+    // the taps stay in registers for the whole block
+    for (unsigned int k = 0; k < FIRDECIM_NUM_TAPS / 8; ++k)
+        t[k] = _mm256_loadu_si256((const __m256i *)&taps[k * 16]);
+
+    for (unsigned int i = 0; i < n; ++i)
+    {
+        const __m256i *x = (const __m256i *)&h[i * 2];
+        __m256i hi = _mm256_setzero_si256(), lo = _mm256_setzero_si256(), acc;
+        __m128i sum;
+        int32_t out;
+
+        for (unsigned int k = 0; k < FIRDECIM_NUM_TAPS / 8; ++k)
+        {
+            __m256i a = _mm256_loadu_si256(&x[k]);
+            hi = _mm256_add_epi16(hi, _mm256_mulhi_epi16(a, t[k]));
+            lo = _mm256_add_epi16(lo, _mm256_srli_epi16(_mm256_mullo_epi16(a, t[k]), 15));
+        }
+        acc = _mm256_add_epi16(_mm256_add_epi16(hi, hi), lo);
+        sum = _mm_add_epi16(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        sum = _mm_add_epi16(sum, _mm_unpackhi_epi64(sum, sum));
+        sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 4));
+        out = _mm_cvtsi128_si32(sum);
+        memcpy(&y[i], &out, sizeof(out));
+    }
+}
+
+// sse_dotprod_q31() of b0 in the low and b1 in the high half of each vector,
+// so that both sums are added in the same order as the SSE2 kernel
+static inline __m256 dotprod2_q31_block(const cint32_t *a, const int32_t *b0, const int32_t *b1, __m256 *p34)
+{
+    __m256 s[4], h[4], p[4];
+
+    for (int k = 0; k < 4; ++k)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)&a[k * 2]);
+        __m128i t0 = _mm_loadu_si128((const __m128i *)&b0[k * 4]);
+        __m128i t1 = _mm_loadu_si128((const __m128i *)&b1[k * 4]);
+
+        s[k] = _mm256_cvtepi32_ps(_mm256_broadcastsi128_si256(x));
+        h[k] = _mm256_cvtepi32_ps(_mm256_inserti128_si256(_mm256_castsi128_si256(t0), t1, 1));
+        p[k] = _mm256_mul_ps(s[k], h[k]);
+    }
+
+    *p34 = _mm256_add_ps(p[2], p[3]);
+    return _mm256_add_ps(p[0], p[1]);
+}
+
+void avx2_dotprod2_q31(const cint32_t *a, const int32_t *b0, const int32_t *b1, cint32_t *y)
+{
+    __m256 p12, p34, sum;
+    cint32_t result[4];
+
+    p12 = dotprod2_q31_block(&a[0], &b0[0], &b1[0], &p34);
+    sum = _mm256_add_ps(p12, p34);
+
+    for (int i = 8; i < RESAMP_NUM_TAPS; i += 8)
+    {
+        p12 = dotprod2_q31_block(&a[i], &b0[i * 2], &b1[i * 2], &p34);
+        sum = _mm256_add_ps(p12, sum);
+        sum = _mm256_add_ps(p34, sum);
+    }
+
+    sum = _mm256_mul_ps(sum, _mm256_set1_ps(1.0f / 2147483648.0f));
+    _mm256_storeu_si256((__m256i *)result, _mm256_cvtps_epi32(sum));
+    y[0].r = result[0].r + result[1].r;
+    y[0].i = result[0].i + result[1].i;
+    y[1].r = result[2].r + result[3].r;
+    y[1].i = result[2].i + result[3].i;
+}
+
+// a register of path metrics per state, one frame in each of the 16 lanes
+void avx2_batch_k7_n3(const int16_t *val, const uint8_t *bfly, const uint8_t *first,
+                      const int16_t *sums, int16_t *new_sums, uint16_t *paths, int norm)
+{
+    const __m256i *old = (const __m256i *)sums;
+    __m256i *sum = (__m256i *)new_sums;
+    __m256i v0 = _mm256_loadu_si256((const __m256i *)&val[0]);
+    __m256i v1 = _mm256_loadu_si256((const __m256i *)&val[CONV_BATCH]);
+    __m256i v2 = _mm256_loadu_si256((const __m256i *)&val[2 * CONV_BATCH]);
+    __m256i a = _mm256_add_epi16(v0, v1), b = _mm256_sub_epi16(v0, v1);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i m[4];
+
+    m[0] = _mm256_add_epi16(a, v2);
+    m[1] = _mm256_sub_epi16(a, v2);
+    m[2] = _mm256_add_epi16(b, v2);
+    m[3] = _mm256_sub_epi16(b, v2);
+
+    for (unsigned int k = 0; k < 8; ++k)
+    {
+        // metrics 4 to 7 are the negated metrics 3 to 0
+        __m256i mp = k < 4 ? m[k] : _mm256_sub_epi16(zero, m[7 - k]);
+        __m256i mn = _mm256_sub_epi16(zero, mp);
+
+        for (unsigned int j = first[k]; j < first[k + 1]; ++j)
+        {
+            unsigned int i = bfly[j];
+            __m256i s0 = _mm256_loadu_si256(&old[2 * i]);
+            __m256i s1 = _mm256_loadu_si256(&old[2 * i + 1]);
+            __m256i sum0 = _mm256_adds_epi16(s0, mp), sum1 = _mm256_adds_epi16(s1, mn);
+            __m256i sum2 = _mm256_adds_epi16(s0, mn), sum3 = _mm256_adds_epi16(s1, mp);
+            // set where the even state wins, so the stored bits are inverted
+            __m256i even = _mm256_packs_epi16(_mm256_cmpgt_epi16(sum0, sum1), _mm256_cmpgt_epi16(sum2, sum3));
+            uint32_t bits = ~(uint32_t)_mm256_movemask_epi8(_mm256_permute4x64_epi64(even, 0xd8));
+
+            _mm256_storeu_si256(&sum[i], _mm256_max_epi16(sum0, sum1));
+            _mm256_storeu_si256(&sum[i + 32], _mm256_max_epi16(sum2, sum3));
+            paths[i] = bits;
+            paths[i + 32] = bits >> 16;
+        }
+    }
+
+    if (norm)
+    {
+        __m256i min = _mm256_loadu_si256(&sum[0]);
+
+        for (unsigned int i = 1; i < 64; ++i)
+            min = _mm256_min_epi16(min, _mm256_loadu_si256(&sum[i]));
+        for (unsigned int i = 0; i < 64; ++i)
+            _mm256_storeu_si256(&sum[i], _mm256_sub_epi16(_mm256_loadu_si256(&sum[i]), min));
+    }
+}
@@ -0,0 +1,188 @@
+/*
+ * NEON kernels, compiled with -mfpu=neon on 32-bit ARM
+ */
+
+#include <arm_neon.h>
+
+#include "kernels.h"
+#include "conv.h"
+#include "conv_neon.h"
+#include "firdecim_q15.h"
+#include "resamp_q15.h"
+
+void neon_metrics_k7_n3(const int8_t *val, const int16_t *out,
+                        int16_t *sums, int16_t *paths, int norm)
+{
+    gen_metrics_k7_n3(val, out, sums, paths, norm);
+}
+
+uint64_t neon_pack_paths_k7(const int16_t *paths)
+{
+    return pack_paths_k7(paths);
+}
+
+// Sums in wrapping int16 lanes, like the generic and SSE filters, so that
+// a full-scale input gives the same output on every CPU.
+static inline cint16_t firdecim_dotprod(const cint16_t *a, const int16_t *b, int n)
+{
+    int16x8_t s1 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[0]), vld1q_s16(&b[0*2]));
+    int16x8_t s2 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[4]), vld1q_s16(&b[4*2]));
+    int16x8_t s3 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[8]), vld1q_s16(&b[8*2]));
+    int16x8_t s4 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[12]), vld1q_s16(&b[12*2]));
+    int16x8_t sum = vaddq_s16(vaddq_s16(s1, s2), vaddq_s16(s3, s4));
+
+    for (int i = 16; i < n; i += 16)
+    {
+        s1 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[i]), vld1q_s16(&b[i*2]));
+        s2 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[i+4]), vld1q_s16(&b[(i+4)*2]));
+        s3 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[i+8]), vld1q_s16(&b[(i+8)*2]));
+        s4 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[i+12]), vld1q_s16(&b[(i+12)*2]));
+        sum = vaddq_s16(vaddq_s16(s1, s2), sum);
+        sum = vaddq_s16(vaddq_s16(s3, s4), sum);
+    }
+
+    int16x4x2_t sum2 = vuzp_s16(vget_high_s16(sum), vget_low_s16(sum));
+    int16x4_t sum3 = vpadd_s16(sum2.val[0], sum2.val[1]);
+    sum3 = vpadd_s16(sum3, sum3);
+
+    cint16_t result[2];
+    vst1_s16((int16_t*)&result, sum3);
+
+    return result[0];
+}
+
+void neon_firdecim_block(const cint16_t *h, const int16_t *taps, unsigned int n, cint16_t *y)
+{
+    for (unsigned int i = 0; i < n; ++i)
+        y[i] = firdecim_dotprod(&h[i * 2], taps, FIRDECIM_NUM_TAPS);
+}
+
+// n must be a multiple of 8
+static inline cint32_t dotprod_q31(const cint32_t *a, const int32_t *b, int n)
+{
+    int32x4_t s1 = vqrdmulhq_s32(vld1q_s32((int32_t *)&a[0]), vld1q_s32(&b[0*2]));
+    int32x4_t s2 = vqrdmulhq_s32(vld1q_s32((int32_t *)&a[2]), vld1q_s32(&b[2*2]));
+    int32x4_t s3 = vqrdmulhq_s32(vld1q_s32((int32_t *)&a[4]), vld1q_s32(&b[4*2]));
+    int32x4_t s4 = vqrdmulhq_s32(vld1q_s32((int32_t *)&a[6]), vld1q_s32(&b[6*2]));
+    int32x4_t sum = vqaddq_s32(vqaddq_s32(s1, s2), vqaddq_s32(s3, s4));
+
+    for (int i = 8; i < n; i += 8)
+    {
+        s1 = vqrdmulhq_s32(vld1q_s32((int32_t *)&a[i]), vld1q_s32(&b[i*2]));
+        s2 = vqrdmulhq_s32(vld1q_s32((int32_t *)&a[i+2]), vld1q_s32(&b[(i+2)*2]));
+        s3 = vqrdmulhq_s32(vld1q_s32((int32_t *)&a[i+4]), vld1q_s32(&b[(i+4)*2]));
+        s4 = vqrdmulhq_s32(vld1q_s32((int32_t *)&a[i+6]), vld1q_s32(&b[(i+6)*2]));
+        sum = vqaddq_s32(vqaddq_s32(s1, s2), sum);
+        sum = vqaddq_s32(vqaddq_s32(s3, s4), sum);
+    }
+
+    cint32_t result[2];
+    vst1q_s32((int32_t*)&result, sum);
+    result[0].r += result[1].r;
+    result[0].i += result[1].i;
+
+    return result[0];
+}
+
+cint32_t neon_dotprod_q31(const cint32_t *a, const int32_t *b)
+{
+    return dotprod_q31(a, b, RESAMP_NUM_TAPS);
+}
+
+void neon_dotprod2_q31(const cint32_t *a, const int32_t *b0, const int32_t *b1, cint32_t *y)
+{
+    y[0] = dotprod_q31(a, b0, RESAMP_NUM_TAPS);
+    y[1] = dotprod_q31(a, b1, RESAMP_NUM_TAPS);
+}
+
+// one bit of each lane, set where the odd state wins, for 16 lanes
+static inline uint16x8_t batch_bits(int16x8_t even0, int16x8_t odd0, int16x8_t even1, int16x8_t odd1)
+{
+    static const uint16_t weights[16] = {
+        0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+        0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, 0x8000
+    };
+    uint16x8_t b0 = vandq_u16(vcleq_s16(even0, odd0), vld1q_u16(&weights[0]));
+    uint16x8_t b1 = vandq_u16(vcleq_s16(even1, odd1), vld1q_u16(&weights[8]));
+
+    return vorrq_u16(b0, b1);
+}
+
+// two registers of path metrics per state, one frame in each of the lanes
+void neon_batch_k7_n3(const int16_t *val, const uint8_t *bfly, const uint8_t *first,
+                      const int16_t *sums, int16_t *new_sums, uint16_t *paths, int norm)
+{
+    int16x8_t m[4][2];
+
+    for (unsigned int h = 0; h < 2; ++h)
+    {
+        int16x8_t v0 = vld1q_s16(&val[h * 8]);
+        int16x8_t v1 = vld1q_s16(&val[CONV_BATCH + h * 8]);
+        int16x8_t v2 = vld1q_s16(&val[2 * CONV_BATCH + h * 8]);
+        int16x8_t a = vaddq_s16(v0, v1), b = vsubq_s16(v0, v1);
+
+        m[0][h] = vaddq_s16(a, v2);
+        m[1][h] = vsubq_s16(a, v2);
+        m[2][h] = vaddq_s16(b, v2);
+        m[3][h] = vsubq_s16(b, v2);
+    }
+
+    for (unsigned int k = 0; k < 8; ++k)
+    {
+        int16x8_t mp[2], mn[2];
+
+        for (unsigned int h = 0; h < 2; ++h)
+        {
+            // metrics 4 to 7 are the negated metrics 3 to 0
+            mp[h] = k < 4 ? m[k][h] : vnegq_s16(m[7 - k][h]);
+            mn[h] = vnegq_s16(mp[h]);
+        }
+
+        for (unsigned int j = first[k]; j < first[k + 1]; ++j)
+        {
+            unsigned int i = bfly[j];
+            int16x8_t sum0[2], sum1[2], sum2[2], sum3[2];
+
+            for (unsigned int h = 0; h < 2; ++h)
+            {
+                int16x8_t s0 = vld1q_s16(&sums[(2 * i) * CONV_BATCH + h * 8]);
+                int16x8_t s1 = vld1q_s16(&sums[(2 * i + 1) * CONV_BATCH + h * 8]);
+
+                sum0[h] = vqaddq_s16(s0, mp[h]);
+                sum1[h] = vqaddq_s16(s1, mn[h]);
+                sum2[h] = vqaddq_s16(s0, mn[h]);
+                sum3[h] = vqaddq_s16(s1, mp[h]);
+                vst1q_s16(&new_sums[i * CONV_BATCH + h * 8], vmaxq_s16(sum0[h], sum1[h]));
+                vst1q_s16(&new_sums[(i + 32) * CONV_BATCH + h * 8], vmaxq_s16(sum2[h], sum3[h]));
+            }
+
+            // the bits of both states, summed pairwise into lanes 0 and 1
+            uint16x8_t b0 = batch_bits(sum0[0], sum1[0], sum0[1], sum1[1]);
+            uint16x8_t b1 = batch_bits(sum2[0], sum3[0], sum2[1], sum3[1]);
+            uint16x4_t t = vpadd_u16(vpadd_u16(vget_low_u16(b0), vget_high_u16(b0)),
+                                     vpadd_u16(vget_low_u16(b1), vget_high_u16(b1)));
+            t = vpadd_u16(t, t);
+            paths[i] = vget_lane_u16(t, 0);
+            paths[i + 32] = vget_lane_u16(t, 1);
+        }
+    }
+
+    if (norm)
+    {
+        int16x8_t min[2] = { vld1q_s16(&new_sums[0]), vld1q_s16(&new_sums[8]) };
+
+        for (unsigned int i = 1; i < 64; ++i)
+        {
+            for (unsigned int h = 0; h < 2; ++h)
+                min[h] = vminq_s16(min[h], vld1q_s16(&new_sums[i * CONV_BATCH + h * 8]));
+        }
+        for (unsigned int i = 0; i < 64; ++i)
+        {
+            for (unsigned int h = 0; h < 2; ++h)
+            {
+                int16_t *p = &new_sums[i * CONV_BATCH + h * 8];
+                vst1q_s16(p, vsubq_s16(vld1q_s16(p), min[h]));
+            }
+        }
+    }
+}
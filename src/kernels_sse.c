@@ -0,0 +1,210 @@
+/*
+ * SSE2 and SSSE3 kernels, compiled with -msse2 -msse3 -mssse3
+ */
+
+#include <emmintrin.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "conv.h"
+#include "conv_sse.h"
+#include "firdecim_q15.h"
+#include "resamp_q15.h"
+
+void sse_metrics_k7_n3(const int8_t *val, const int16_t *out,
+                       int16_t *sums, int16_t *paths, int norm)
+{
+    gen_metrics_k7_n3(val, out, sums, paths, norm);
+}
+
+uint64_t sse_pack_paths_k7(const int16_t *paths)
+{
+    return pack_paths_k7(paths);
+}
+
+/*
+ * The generic filter sums (a * b) >> 15 in int32 and keeps the low 16 bits.
+ * As (a * b) >> 15 is twice the high half of the product plus bit 15 of the
+ * low half, the same sum is kept in wrapping int16 lanes, without widening.
+ */
+void sse_firdecim_block(const cint16_t *h, const int16_t *taps, unsigned int n, cint16_t *y)
+{
+    __m128i t[FIRDECIM_NUM_TAPS / 4];
+
+    // the taps stay in registers for the whole block
+    for (unsigned int k = 0; k < FIRDECIM_NUM_TAPS / 4; ++k)
+        t[k] = _mm_loadu_si128((const __m128i *)&taps[k * 8]);
+
+    for (unsigned int i = 0; i < n; ++i)
+    {
+        const __m128i *x = (const __m128i *)&h[i * 2];
+        __m128i hi = _mm_setzero_si128(), lo = _mm_setzero_si128(), sum;
+        int32_t out;
+
+        for (unsigned int k = 0; k < FIRDECIM_NUM_TAPS / 4; ++k)
+        {
+            __m128i a = _mm_loadu_si128(&x[k]);
+            hi = _mm_add_epi16(hi, _mm_mulhi_epi16(a, t[k]));
+            lo = _mm_add_epi16(lo, _mm_srli_epi16(_mm_mullo_epi16(a, t[k]), 15));
+        }
+        // I and Q alternate, so fold down to the first pair
+        sum = _mm_add_epi16(_mm_add_epi16(hi, hi), lo);
+        sum = _mm_add_epi16(sum, _mm_unpackhi_epi64(sum, sum));
+        sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 4));
+        out = _mm_cvtsi128_si32(sum);
+        memcpy(&y[i], &out, sizeof(out));
+    }
+}
+
+/*
+ * Products of four complex samples of a and taps of b. The samples and taps
+ * are left unscaled and only the sum is scaled by 2^-31: a power of two that
+ * rounds the same as scaling each of them to [-1, 1) first.
+ */
+static inline __m128 dotprod_q31_block(const __m128 s[4], const int32_t *b, __m128 *p34)
+{
+    __m128 h1, h2, h3, h4, p1, p2, p3, p4;
+
+    h1 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)&b[0*2]));
+    h2 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)&b[2*2]));
+    h3 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)&b[4*2]));
+    h4 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)&b[6*2]));
+    p1 = _mm_mul_ps(s[0], h1);
+    p2 = _mm_mul_ps(s[1], h2);
+    p3 = _mm_mul_ps(s[2], h3);
+    p4 = _mm_mul_ps(s[3], h4);
+
+    *p34 = _mm_add_ps(p3, p4);
+    return _mm_add_ps(p1, p2);
+}
+
+static inline void load_q31_block(const cint32_t *a, __m128 s[4])
+{
+    s[0] = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)&a[0]));
+    s[1] = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)&a[2]));
+    s[2] = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)&a[4]));
+    s[3] = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)&a[6]));
+}
+
+static inline cint32_t finish_q31(__m128 sum)
+{
+    cint32_t result[2];
+
+    sum = _mm_mul_ps(sum, _mm_set1_ps(1.0f / 2147483648.0f));
+    _mm_storeu_si128((__m128i*)result, _mm_cvtps_epi32(sum));
+    result[0].r += result[1].r;
+    result[0].i += result[1].i;
+    return result[0];
+}
+
+cint32_t sse_dotprod_q31(const cint32_t *a, const int32_t *b)
+{
+    __m128 s[4], p12, p34, sum;
+
+    load_q31_block(&a[0], s);
+    p12 = dotprod_q31_block(s, &b[0], &p34);
+    sum = _mm_add_ps(p12, p34);
+
+    for (int i = 8; i < RESAMP_NUM_TAPS; i += 8)
+    {
+        load_q31_block(&a[i], s);
+        p12 = dotprod_q31_block(s, &b[i * 2], &p34);
+        sum = _mm_add_ps(p12, sum);
+        sum = _mm_add_ps(p34, sum);
+    }
+
+    return finish_q31(sum);
+}
+
+// sse_dotprod_q31() of b0 and b1, converting the samples once
+void sse_dotprod2_q31(const cint32_t *a, const int32_t *b0, const int32_t *b1, cint32_t *y)
+{
+    __m128 s[4], p12, p34, sum0, sum1;
+
+    load_q31_block(&a[0], s);
+    p12 = dotprod_q31_block(s, &b0[0], &p34);
+    sum0 = _mm_add_ps(p12, p34);
+    p12 = dotprod_q31_block(s, &b1[0], &p34);
+    sum1 = _mm_add_ps(p12, p34);
+
+    for (int i = 8; i < RESAMP_NUM_TAPS; i += 8)
+    {
+        load_q31_block(&a[i], s);
+        p12 = dotprod_q31_block(s, &b0[i * 2], &p34);
+        sum0 = _mm_add_ps(p12, sum0);
+        sum0 = _mm_add_ps(p34, sum0);
+        p12 = dotprod_q31_block(s, &b1[i * 2], &p34);
+        sum1 = _mm_add_ps(p12, sum1);
+        sum1 = _mm_add_ps(p34, sum1);
+    }
+
+    y[0] = finish_q31(sum0);
+    y[1] = finish_q31(sum1);
+}
+
+// two registers of path metrics per state, one frame in each of the lanes
+void sse_batch_k7_n3(const int16_t *val, const uint8_t *bfly, const uint8_t *first,
+                     const int16_t *sums, int16_t *new_sums, uint16_t *paths, int norm)
+{
+    const __m128i *old = (const __m128i *)sums;
+    __m128i *sum = (__m128i *)new_sums;
+    __m128i zero = _mm_setzero_si128();
+    __m128i m[4][2];
+
+    for (unsigned int h = 0; h < 2; ++h)
+    {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)&val[h * 8]);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)&val[CONV_BATCH + h * 8]);
+        __m128i v2 = _mm_loadu_si128((const __m128i *)&val[2 * CONV_BATCH + h * 8]);
+        __m128i a = _mm_add_epi16(v0, v1), b = _mm_sub_epi16(v0, v1);
+
+        m[0][h] = _mm_add_epi16(a, v2);
+        m[1][h] = _mm_sub_epi16(a, v2);
+        m[2][h] = _mm_add_epi16(b, v2);
+        m[3][h] = _mm_sub_epi16(b, v2);
+    }
+
+    for (unsigned int k = 0; k < 8; ++k)
+    {
+        __m128i mp[2], mn[2];
+
+        for (unsigned int h = 0; h < 2; ++h)
+        {
+            // metrics 4 to 7 are the negated metrics 3 to 0
+            mp[h] = k < 4 ? m[k][h] : _mm_sub_epi16(zero, m[7 - k][h]);
+            mn[h] = _mm_sub_epi16(zero, mp[h]);
+        }
+
+        for (unsigned int j = first[k]; j < first[k + 1]; ++j)
+        {
+            unsigned int i = bfly[j];
+            __m128i even[2][2];
+
+            for (unsigned int h = 0; h < 2; ++h)
+            {
+                __m128i s0 = _mm_loadu_si128(&old[4 * i + h]);
+                __m128i s1 = _mm_loadu_si128(&old[4 * i + 2 + h]);
+                __m128i sum0 = _mm_adds_epi16(s0, mp[h]), sum1 = _mm_adds_epi16(s1, mn[h]);
+                __m128i sum2 = _mm_adds_epi16(s0, mn[h]), sum3 = _mm_adds_epi16(s1, mp[h]);
+
+                // set where the even state wins, so the stored bits are inverted
+                even[0][h] = _mm_cmpgt_epi16(sum0, sum1);
+                even[1][h] = _mm_cmpgt_epi16(sum2, sum3);
+                _mm_storeu_si128(&sum[2 * i + h], _mm_max_epi16(sum0, sum1));
+                _mm_storeu_si128(&sum[2 * (i + 32) + h], _mm_max_epi16(sum2, sum3));
+            }
+            paths[i] = ~_mm_movemask_epi8(_mm_packs_epi16(even[0][0], even[0][1]));
+            paths[i + 32] = ~_mm_movemask_epi8(_mm_packs_epi16(even[1][0], even[1][1]));
+        }
+    }
+
+    if (norm)
+    {
+        __m128i min[2] = { _mm_loadu_si128(&sum[0]), _mm_loadu_si128(&sum[1]) };
+
+        for (unsigned int i = 2; i < 128; ++i)
+            min[i & 1] = _mm_min_epi16(min[i & 1], _mm_loadu_si128(&sum[i]));
+        for (unsigned int i = 0; i < 128; ++i)
+            _mm_storeu_si128(&sum[i], _mm_sub_epi16(_mm_loadu_si128(&sum[i]), min[i & 1]));
+    }
+}
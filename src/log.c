@@ -25,9 +25,19 @@
 #include <stdarg.h>
 #include <string.h>
 #include <time.h>
+#ifdef USE_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
 
 #include "log.h"
 
+/* records per thread, and the longest message kept */
+#define LOG_RECORDS 256
+#define LOG_MSG_LEN 256
+/* how often the background thread writes out buffered messages */
+#define LOG_DRAIN_MS 20
+
 static struct {
   void *udata;
   log_LockFn lock;
@@ -36,6 +46,9 @@ static struct {
   int quiet;
 } L;
 
+/* effective level: nothing is written when quiet without a file */
+int log_level;
+
 
 static const char *level_names[] = {
   "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"
@@ -62,6 +75,11 @@ static void unlock(void) {
 }
 
 
+static void update_level(void) {
+  log_level = L.quiet && !L.fp ? LOG_FATAL + 1 : L.level;
+}
+
+
 void log_set_udata(void *udata) {
   L.udata = udata;
 }
@@ -74,67 +92,293 @@ void log_set_lock(log_LockFn fn) {
 
 void log_set_fp(FILE *fp) {
   L.fp = fp;
+  update_level();
 }
 
 
 void log_set_level(int level) {
   L.level = level;
+  update_level();
 }
 
 
 void log_set_quiet(int enable) {
   L.quiet = enable ? 1 : 0;
+  update_level();
 }
 
 
-void log_log(int level, const char *file, int line, const char *fmt, ...) {
-  if (level < L.level) {
-    return;
-  }
-
-  /* awesie: cut off everything besides file name */
-  size_t slash;
-  while (slash = strcspn(file, "/\\"), file[slash] != 0) {
-    file += slash + 1;
-  }
-
-  /* Acquire lock */
-  lock();
-
-  /* Get current time */
-  time_t t = time(NULL);
-  struct tm *lt = localtime(&t);
+static void write_message(int level, const char *file, int line, time_t t, const char *msg) {
+  struct tm tm;
+  struct tm *lt = localtime_r(&t, &tm);
 
   /* Log to stderr */
   if (!L.quiet) {
-    va_list args;
     char buf[16];
     buf[strftime(buf, sizeof(buf), "%H:%M:%S", lt)] = '\0';
 #ifdef LOG_USE_COLOR
     fprintf(
-      stderr, "%s %s%-5s\x1b[0m \x1b[90m%s:%d:\x1b[0m ",
-      buf, level_colors[level], level_names[level], file, line);
+      stderr, "%s %s%-5s\x1b[0m \x1b[90m%s:%d:\x1b[0m %s\n",
+      buf, level_colors[level], level_names[level], file, line, msg);
 #else
-    fprintf(stderr, "%s %-5s %s:%d: ", buf, level_names[level], file, line);
+    fprintf(stderr, "%s %-5s %s:%d: %s\n", buf, level_names[level], file, line, msg);
 #endif
-    va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
-    va_end(args);
-    fprintf(stderr, "\n");
   }
 
   /* Log to file */
   if (L.fp) {
-    va_list args;
     char buf[32];
     buf[strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", lt)] = '\0';
-    fprintf(L.fp, "%s %-5s %s:%d: ", buf, level_names[level], file, line);
-    va_start(args, fmt);
-    vfprintf(L.fp, fmt, args);
-    va_end(args);
-    fprintf(L.fp, "\n");
+    fprintf(L.fp, "%s %-5s %s:%d: %s\n", buf, level_names[level], file, line, msg);
+  }
+}
+
+
+#ifdef USE_THREADS
+/*
+ * Each thread formats its messages into its own single-producer
+ * single-consumer ring, so producers never wait for each other or for the
+ * output. When a ring is full the message is dropped and counted.
+ */
+typedef struct {
+  int level;
+  int line;
+  const char *file;
+  struct timespec ts;
+  char msg[LOG_MSG_LEN];
+} log_record_t;
+
+typedef struct log_buffer {
+  struct log_buffer *next;
+  atomic_uint head, tail;
+  atomic_ulong dropped;
+  log_record_t records[LOG_RECORDS];
+} log_buffer_t;
+
+static atomic_int async;
+/* every thread's ring; changed and walked with drain_mutex held */
+static log_buffer_t *buffers;
+static __thread log_buffer_t *local;
+/* only one thread drains at a time */
+static pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t drain_thread;
+/* frees the ring of a thread when it exits */
+static pthread_key_t buffer_key;
+static pthread_once_t buffer_once = PTHREAD_ONCE_INIT;
+
+
+static void drain(void);
+
+
+/*
+ * When a thread exits, whatever it still has buffered is written out and
+ * its ring leaves the list, so that threads come and go without leaking.
+ */
+static void free_buffer(void *arg) {
+  log_buffer_t *b = arg, **p;
+
+  pthread_mutex_lock(&drain_mutex);
+  drain();
+  for (p = &buffers; *p != b; p = &(*p)->next)
+    ;
+  *p = b->next;
+  pthread_mutex_unlock(&drain_mutex);
+  free(b);
+  local = NULL;
+}
+
+
+static void make_key(void) {
+  pthread_key_create(&buffer_key, free_buffer);
+}
+
+
+static log_buffer_t *local_buffer(void) {
+  if (local == NULL) {
+    pthread_once(&buffer_once, make_key);
+    local = calloc(1, sizeof(*local));
+    if (local == NULL) {
+      return NULL;
+    }
+    pthread_mutex_lock(&drain_mutex);
+    local->next = buffers;
+    buffers = local;
+    pthread_mutex_unlock(&drain_mutex);
+    pthread_setspecific(buffer_key, local);
+  }
+  return local;
+}
+
+
+static int record_before(const log_record_t *a, const log_record_t *b) {
+  return a->ts.tv_sec < b->ts.tv_sec || (a->ts.tv_sec == b->ts.tv_sec && a->ts.tv_nsec < b->ts.tv_nsec);
+}
+
+
+/* Write out buffered messages, oldest first. Called with drain_mutex. */
+static void drain(void) {
+  log_buffer_t *b;
+  int written = 0;
+
+  lock();
+  for (;;) {
+    log_buffer_t *oldest = NULL;
+
+    for (b = buffers; b; b = b->next) {
+      unsigned int tail = atomic_load_explicit(&b->tail, memory_order_relaxed);
+      if (tail == atomic_load_explicit(&b->head, memory_order_acquire)) {
+        continue;
+      }
+      if (oldest == NULL || record_before(&b->records[tail % LOG_RECORDS],
+                                          &oldest->records[atomic_load(&oldest->tail) % LOG_RECORDS])) {
+        oldest = b;
+      }
+    }
+    if (oldest == NULL) {
+      break;
+    }
+
+    unsigned int tail = atomic_load_explicit(&oldest->tail, memory_order_relaxed);
+    log_record_t *r = &oldest->records[tail % LOG_RECORDS];
+    write_message(r->level, r->file, r->line, r->ts.tv_sec, r->msg);
+    atomic_store_explicit(&oldest->tail, tail + 1, memory_order_release);
+    written = 1;
+  }
+
+  for (b = buffers; b; b = b->next) {
+    unsigned long dropped = atomic_exchange(&b->dropped, 0);
+    if (dropped) {
+      fprintf(stderr, "%lu log messages dropped\n", dropped);
+      written = 1;
+    }
+  }
+  if (written) {
+    fflush(stderr);
+    if (L.fp) {
+      fflush(L.fp);
+    }
+  }
+  unlock();
+}
+
+
+static void *drain_worker(void *arg) {
+  struct timespec delay = { 0, LOG_DRAIN_MS * 1000000 };
+  (void)arg;
+
+  while (atomic_load(&async)) {
+    nanosleep(&delay, NULL);
+    pthread_mutex_lock(&drain_mutex);
+    drain();
+    pthread_mutex_unlock(&drain_mutex);
+  }
+  return NULL;
+}
+
+
+void log_flush(void) {
+  pthread_mutex_lock(&drain_mutex);
+  drain();
+  pthread_mutex_unlock(&drain_mutex);
+}
+
+
+void log_set_async(int enable) {
+  static int started;
+
+  if (enable && !started) {
+    atomic_store(&async, 1);
+    if (pthread_create(&drain_thread, NULL, drain_worker, NULL) != 0) {
+      atomic_store(&async, 0);
+      return;
+    }
+#ifdef HAVE_PTHREAD_SETNAME_NP
+    pthread_setname_np(drain_thread, "log");
+#endif
+    atexit(log_flush);
+    started = 1;
+  } else if (!enable && started) {
+    atomic_store(&async, 0);
+    pthread_join(drain_thread, NULL);
+    log_flush();
+    started = 0;
   }
+}
 
+
+/* Returns 0 if the message could not be buffered */
+static int log_async(int level, const char *file, int line, const char *fmt, va_list args) {
+  log_buffer_t *b = local_buffer();
+  unsigned int head;
+  log_record_t *r;
+
+  if (b == NULL) {
+    return 0;
+  }
+  head = atomic_load_explicit(&b->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&b->tail, memory_order_acquire) == LOG_RECORDS) {
+    atomic_fetch_add_explicit(&b->dropped, 1, memory_order_relaxed);
+    return 1;
+  }
+
+  r = &b->records[head % LOG_RECORDS];
+  r->level = level;
+  r->file = file;
+  r->line = line;
+  clock_gettime(CLOCK_REALTIME, &r->ts);
+  vsnprintf(r->msg, sizeof(r->msg), fmt, args);
+  atomic_store_explicit(&b->head, head + 1, memory_order_release);
+  return 1;
+}
+#else
+void log_flush(void) {
+}
+
+
+void log_set_async(int enable) {
+  (void)enable;
+}
+#endif
+
+
+void log_log(int level, const char *file, int line, const char *fmt, ...) {
+  char msg[LOG_MSG_LEN];
+  va_list args;
+
+  if (level < log_level) {
+    return;
+  }
+
+  /* awesie: cut off everything besides file name */
+  size_t slash;
+  while (slash = strcspn(file, "/\\"), file[slash] != 0) {
+    file += slash + 1;
+  }
+
+#ifdef USE_THREADS
+  if (atomic_load_explicit(&async, memory_order_relaxed)) {
+    if (level < LOG_FATAL) {
+      int buffered;
+      va_start(args, fmt);
+      buffered = log_async(level, file, line, fmt, args);
+      va_end(args);
+      if (buffered) {
+        return;
+      }
+    } else {
+      /* keep the order of everything logged before it */
+      log_flush();
+    }
+  }
+#endif
+
+  va_start(args, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, args);
+  va_end(args);
+
+  /* Acquire lock */
+  lock();
+  write_message(level, file, line, time(NULL), msg);
   /* Release lock */
   unlock();
 }
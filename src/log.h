@@ -17,18 +17,29 @@ typedef void (*log_LockFn)(void *udata, int lock);
 
 enum { LOG_TRACE, LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_FATAL };
 
-#define log_trace(...) log_log(LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
-#define log_debug(...) log_log(LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define log_info(...)  log_log(LOG_INFO,  __FILE__, __LINE__, __VA_ARGS__)
-#define log_warn(...)  log_log(LOG_WARN,  __FILE__, __LINE__, __VA_ARGS__)
-#define log_error(...) log_log(LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define log_fatal(...) log_log(LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__)
+/* Messages below the level are dropped before their arguments are formatted */
+#define LOG_IF(level, ...) \
+  ((level) < log_level ? (void)0 : log_log(level, __FILE__, __LINE__, __VA_ARGS__))
+
+#define log_trace(...) LOG_IF(LOG_TRACE, __VA_ARGS__)
+#define log_debug(...) LOG_IF(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...)  LOG_IF(LOG_INFO,  __VA_ARGS__)
+#define log_warn(...)  LOG_IF(LOG_WARN,  __VA_ARGS__)
+#define log_error(...) LOG_IF(LOG_ERROR, __VA_ARGS__)
+#define log_fatal(...) LOG_IF(LOG_FATAL, __VA_ARGS__)
+
+extern int log_level;
 
 void log_set_udata(void *udata);
 void log_set_lock(log_LockFn fn);
 void log_set_fp(FILE *fp);
 void log_set_level(int level);
 void log_set_quiet(int enable);
+/* Format messages into per-thread buffers that a background thread writes
+ * out, so that logging never blocks. Fatal messages are still written
+ * synchronously, after everything logged before them. */
+void log_set_async(int enable);
+void log_flush(void);
 
 void log_log(int level, const char *file, int line, const char *fmt, ...);
 
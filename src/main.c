@@ -18,10 +18,14 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <complex.h>
+#include <dirent.h>
+#include <getopt.h>
 #include <limits.h>
 #include <math.h>
+#include <signal.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #ifdef USE_THREADS
 #include <pthread.h>
@@ -29,59 +33,156 @@
 
 #include <rtl-sdr.h>
 
+#include "affinity.h"
+#include "capture.h"
+#include "channelizer.h"
+#include "conv.h"
 #include "defines.h"
+#include "fft.h"
+#include "gain.h"
 #include "input.h"
+#include "profile.h"
+#include "scan.h"
+#include "trace.h"
 
-#define RADIO_BUFCNT (8)
-#define RADIO_BUFFER (512 * 1024)
+// bytes of rtl-sdr transfers in flight, in buffers sized by the profile
+#define RADIO_QUEUE (8 * 512 * 1024)
+// bytes per read while scanning, and bytes dropped after tuning while the
+// tuner settles
+#define SCAN_BUFFER (128 * 1024)
+#define SCAN_SETTLE (2 * SCAN_BUFFER)
+// stations of a wideband capture
+#define MAX_STATIONS 8
 
-static int gain_list[128];
-static int gain_index, gain_count;
+enum
+{
+    OPT_WISDOM = 256,
+    OPT_FAST_START,
+    OPT_PLAN_EXHAUSTIVE,
+    OPT_FIXED_POINT,
+    OPT_STATS,
+    OPT_STATS_INTERVAL,
+    OPT_OUTPUT_FLUSH,
+    OPT_RECORD_FORMAT,
+    OPT_SCAN,
+    OPT_PROFILE,
+    OPT_DEVICE,
+    OPT_CPUS,
+    OPT_NUMA,
+    OPT_REALTIME,
+    OPT_VITERBI_SEGMENTS,
+    OPT_VITERBI_WINDOW,
+    OPT_VITERBI_BATCH,
+    OPT_TRACE,
+    OPT_BATCH,
+    OPT_JOBS
+};
+
+static const struct option long_options[] = {
+    { "wisdom", required_argument, NULL, OPT_WISDOM },
+    { "fast-start", no_argument, NULL, OPT_FAST_START },
+    { "plan-exhaustive", no_argument, NULL, OPT_PLAN_EXHAUSTIVE },
+    { "fixed-point", no_argument, NULL, OPT_FIXED_POINT },
+    { "stats", required_argument, NULL, OPT_STATS },
+    { "stats-interval", required_argument, NULL, OPT_STATS_INTERVAL },
+    { "output-flush", required_argument, NULL, OPT_OUTPUT_FLUSH },
+    { "record-format", required_argument, NULL, OPT_RECORD_FORMAT },
+    { "scan", required_argument, NULL, OPT_SCAN },
+    { "profile", required_argument, NULL, OPT_PROFILE },
+    { "device", required_argument, NULL, OPT_DEVICE },
+    { "cpus", required_argument, NULL, OPT_CPUS },
+    { "numa", no_argument, NULL, OPT_NUMA },
+    { "realtime", no_argument, NULL, OPT_REALTIME },
+    { "viterbi-segments", required_argument, NULL, OPT_VITERBI_SEGMENTS },
+    { "viterbi-window", required_argument, NULL, OPT_VITERBI_WINDOW },
+    { "viterbi-batch", required_argument, NULL, OPT_VITERBI_BATCH },
+    { "trace", required_argument, NULL, OPT_TRACE },
+    { "batch", required_argument, NULL, OPT_BATCH },
+    { "jobs", required_argument, NULL, OPT_JOBS },
+    { NULL, 0, NULL, 0 }
+};
+
+typedef struct
+{
+    unsigned int frequency;
+    unsigned int program;
+    // name of the capture for %n in the output names, with --batch
+    const char *capture;
+    input_t input;
+    output_t output[MAX_PROGRAMS];
+} station_t;
+
+static station_t stations[MAX_STATIONS];
+static unsigned int station_count;
+// splits a wideband capture into stations
+static channelizer chan;
+static record wide_rec;
+// ADTS and HDC output is buffered for this many milliseconds
+static unsigned int output_flush_ms;
+
+// an rtl-sdr device, and the station it feeds
+typedef struct
+{
+    unsigned int index;
+    rtlsdr_dev_t *dev;
+    station_t *station;
+    // input_cb, or wideband_cb to channelize the samples
+    void (*feed)(uint8_t *, uint32_t, void *);
+
+    int gain_list[GAIN_MAX];
+    int gain_index, gain_count;
+    // auto-gain search over gain_list
+    gain_search_t gain_search;
 
 #ifdef USE_THREADS
-pthread_mutex_t rtlsdr_usb_mutex;
+    pthread_t thread;
+    // auto gain retunes from the decoder threads between sync reads
+    pthread_mutex_t usb_mutex;
 #endif
+} radio_t;
+
+static radio_t radios[MAX_STATIONS];
+static unsigned int radio_count;
+// SCHED_FIFO for the threads that read the devices and filter the samples
+static int realtime;
+// set on SIGINT or SIGTERM while tracing
+static volatile sig_atomic_t stopping;
 
 // signal and noise are squared magnitudes
 static int snr_callback(void *arg, float snr, float signal, float noise)
 {
-    static int best_gain;
-    static float best_snr;
     int result = 0;
-    rtlsdr_dev_t *dev = arg;
+    radio_t *r = arg;
 
-    if (gain_count == 0)
+    if (r->gain_count == 0)
         return result;
 
-    // choose the best gain level
-    if (snr >= best_snr)
-    {
-        best_gain = gain_index;
-        best_snr = snr;
-    }
-
-    log_info("Gain: %0.1f dB, CNR: %f dB", gain_list[gain_index] / 10.0, 10 * log10f(snr));
+    log_info("Gain: %0.1f dB, CNR: %f dB", r->gain_list[r->gain_index] / 10.0, 10 * log10f(snr));
+    r->gain_search.snr[r->gain_index] = snr;
 
-    if (gain_index + 1 >= gain_count || snr < best_snr * 0.5)
+    r->gain_index = gain_search_next(&r->gain_search);
+    if (r->gain_index < 0)
     {
-        log_debug("Best gain: %d", gain_list[best_gain]);
-        gain_index = best_gain;
-        gain_count = 0;
+        // choose the best gain level among the ones measured
+        int best_gain = gain_search_best(&r->gain_search);
+
+        log_debug("Best gain: %d", r->gain_list[best_gain]);
+        r->gain_index = best_gain;
+        r->gain_count = 0;
     }
     else
     {
-        gain_index++;
         // continue searching
         result = 1;
     }
 
 #ifdef USE_THREADS
-    pthread_mutex_lock(&rtlsdr_usb_mutex);
+    pthread_mutex_lock(&r->usb_mutex);
 #endif
-    rtlsdr_set_tuner_gain(dev, gain_list[gain_index]);
-    rtlsdr_reset_buffer(dev);
+    rtlsdr_set_tuner_gain(r->dev, r->gain_list[r->gain_index]);
+    rtlsdr_reset_buffer(r->dev);
 #ifdef USE_THREADS
-    pthread_mutex_unlock(&rtlsdr_usb_mutex);
+    pthread_mutex_unlock(&r->usb_mutex);
 #endif
     return result;
 }
@@ -99,19 +200,691 @@ static void log_lock(void *udata, int lock)
 
 static void help(const char *progname)
 {
-    fprintf(stderr, "Usage: %s [-q] [-l log-level] [-d device-index] [-g gain] [-p ppm-error] [-r samples-input] [-w samples-output] [-o audio-output -f adts|hdc|wav] frequency program\n", progname);
+    fprintf(stderr, "Usage: %s [-q] [-l log-level] [-d device-index] [-g gain] [-p ppm-error] [-r samples-input] [-w samples-output [--record-format u8|q15|bfp8|bfp4]] [-o audio-output -f adts|hdc|wav] [--wisdom file] [--fast-start] [--fixed-point] [--stats file [--stats-interval seconds]] [--output-flush ms] [--profile name] [--cpus list] [--numa] [--realtime] [--viterbi-segments n] [--viterbi-window n] [--viterbi-batch ms] [--trace file] frequency program\n", progname);
+    fprintf(stderr, "       %s --batch directory|list [--jobs n] -o audio-output -f adts|hdc|wav [options] program\n", progname);
+    fprintf(stderr, "       %s -s sample-rate [-c center-frequency] [options] frequency program [frequency program ...]\n", progname);
+    fprintf(stderr, "       %s --device index:frequency:program [--device index:frequency:program ...] [options]\n", progname);
+    fprintf(stderr, "       %s [-d device-index] [-g gain] [-p ppm-error] [-r samples-input] --scan frequencies\n", progname);
+    fprintf(stderr, "       %s [--wisdom file] --plan-exhaustive\n", progname);
+}
+
+// Plan every transform with maximum effort and save the wisdom.
+static int plan_exhaustive(const char *wisdom_name)
+{
+    input_t input;
+
+    log_info("Planning, this may take several minutes...");
+    fft_set_effort(FFT_PLAN_EXHAUSTIVE);
+    math_init();
+    input_init(&input, NULL, 0, 0, NULL);
+    // the auto-gain transforms are planned along with the callback
+    input_set_snr_callback(&input, snr_callback, NULL);
+    input_set_snr_callback(&input, NULL, NULL);
+    input_free(&input);
+
+    if (fft_save_wisdom(wisdom_name) != 0)
+    {
+        log_fatal("Unable to save FFTW wisdom.");
+        return 1;
+    }
+    return 0;
+}
+
+static unsigned int parse_program(const char *str)
+{
+    unsigned int program;
+
+    if (strcmp(str, "all") == 0)
+        return NRSC5_PROGRAM_ALL;
+
+    program = strtoul(str, NULL, 0);
+    if (program >= MAX_PROGRAMS)
+        FATAL_EXIT("Program must be 0 to %d, or all.", MAX_PROGRAMS - 1);
+    return program;
+}
+
+static void init_output(output_t *output, const char *format_name, const char *audio_name)
+{
+    if (audio_name == NULL)
+    {
+#ifdef HAVE_FAAD2
+        output_init_live(output);
+#else
+        FATAL_EXIT("Live output requires FAAD2.");
+#endif
+    }
+    else if (format_name == NULL)
+    {
+        FATAL_EXIT("Must specify an output format.");
+    }
+    else if (strcmp(format_name, "wav") == 0)
+    {
+        if (net_is_url(audio_name))
+            FATAL_EXIT("Network output requires adts or hdc format.");
+#ifdef HAVE_FAAD2
+        output_init_wav(output, audio_name);
+#else
+        FATAL_EXIT("WAV output requires FAAD2.");
+#endif
+    }
+    else if (strcmp(format_name, "adts") == 0)
+    {
+        output_init_adts(output, audio_name);
+        output_set_flush(output, output_flush_ms);
+    }
+    else if (strcmp(format_name, "hdc") == 0)
+    {
+        output_init_hdc(output, audio_name);
+        output_set_flush(output, output_flush_ms);
+    }
+    else
+    {
+        FATAL_EXIT("Unknown output format.");
+    }
+}
+
+// Expand %f to the frequency, %d to the program and %n to the capture
+// name, if given, in an output name.
+static void expand_name(char *name, size_t size, const char *template, unsigned int frequency, unsigned int program, const char *capture)
+{
+    size_t n = 0;
+
+    for (const char *p = template; *p && n + 1 < size; p++)
+    {
+        if (p[0] == '%' && (p[1] == 'f' || p[1] == 'd'))
+        {
+            int len = snprintf(&name[n], size - n, "%u", p[1] == 'f' ? frequency : program);
+            n = len < 0 || (size_t)len >= size - n ? size - 1 : n + len;
+            p++;
+        }
+        else if (p[0] == '%' && p[1] == 'n' && capture)
+        {
+            int len = snprintf(&name[n], size - n, "%s", capture);
+            n = len < 0 || (size_t)len >= size - n ? size - 1 : n + len;
+            p++;
+        }
+        else
+        {
+            name[n++] = *p;
+        }
+    }
+    name[n] = 0;
+}
+
+static void init_station(station_t *st, const char *format_name, const char *audio_name)
+{
+    char name[1024];
+
+    if (st->program == NRSC5_PROGRAM_ALL)
+    {
+        // one output per program, named from a template such as prog%d.adts
+        if (audio_name == NULL || strstr(audio_name, "%d") == NULL)
+            FATAL_EXIT("Decoding all programs requires an audio output name containing %%d.");
+        for (unsigned int i = 0; i < MAX_PROGRAMS; ++i)
+        {
+            expand_name(name, sizeof(name), audio_name, st->frequency, i, st->capture);
+            init_output(&st->output[i], format_name, name);
+        }
+    }
+    else if (audio_name == NULL)
+    {
+        init_output(&st->output[0], format_name, NULL);
+    }
+    else
+    {
+        expand_name(name, sizeof(name), audio_name, st->frequency, st->program, st->capture);
+        init_output(&st->output[0], format_name, name);
+    }
+}
+
+typedef struct
+{
+    rtlsdr_dev_t *dev;
+    capture cap;
+    uint8_t *buf;
+} scan_source_t;
+
+static size_t scan_read(void *arg, const uint8_t **buf)
+{
+    scan_source_t *src = arg;
+    int len = SCAN_BUFFER;
+
+    if (src->cap)
+        return capture_read(src->cap, buf);
+    if (rtlsdr_read_sync(src->dev, src->buf, len, &len) != 0)
+        return 0;
+    *buf = src->buf;
+    return len & ~3;
+}
+
+// Scan a list of frequencies, or the whole of a capture, and print a table
+// of the results.
+static int scan(const char *list, const char *input_name, unsigned int device_index, int gain, int ppm_error)
+{
+    scan_source_t src = { NULL, NULL, NULL };
+    scan_result_t *results;
+    unsigned int *freqs, count;
+    int err;
+
+    if (input_name)
+    {
+        src.cap = capture_open(input_name);
+        if (src.cap == NULL)
+        {
+            log_fatal("Unable to open input file.");
+            return 1;
+        }
+        if (capture_format(src.cap) != RECORD_U8)
+        {
+            log_fatal("Only u8 captures can be scanned.");
+            return 1;
+        }
+        // a capture holds a single frequency
+        freqs = malloc(sizeof(*freqs));
+        freqs[0] = 0;
+        count = 1;
+    }
+    else
+    {
+        count = scan_parse(list, &freqs);
+        if (count == 0)
+        {
+            log_fatal("Invalid frequency list: %s", list);
+            return 1;
+        }
+        if (device_index >= rtlsdr_get_device_count())
+        {
+            log_fatal("Selected device does not exist.");
+            return 1;
+        }
+
+        err = rtlsdr_open(&src.dev, device_index);
+        if (err) FATAL_EXIT("rtlsdr_open error: %d", err);
+        err = rtlsdr_set_sample_rate(src.dev, NRSC5_SAMPLE_RATE);
+        if (err) FATAL_EXIT("rtlsdr_set_sample_rate error: %d", err);
+        // there is no time for the auto-gain search at each frequency
+        err = rtlsdr_set_tuner_gain_mode(src.dev, gain != INT_MIN);
+        if (err) FATAL_EXIT("rtlsdr_set_tuner_gain_mode error: %d", err);
+        if (gain != INT_MIN)
+        {
+            err = rtlsdr_set_tuner_gain(src.dev, gain);
+            if (err) FATAL_EXIT("rtlsdr_set_tuner_gain error: %d", err);
+        }
+        err = rtlsdr_set_freq_correction(src.dev, ppm_error);
+        if (err && err != -2) FATAL_EXIT("rtlsdr_set_freq_correction error: %d", err);
+        src.buf = malloc(SCAN_BUFFER);
+    }
+
+    math_init();
+    results = calloc(count, sizeof(*results));
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        if (src.dev)
+        {
+            const uint8_t *buf;
+
+            err = rtlsdr_set_center_freq(src.dev, freqs[i]);
+            if (err) FATAL_EXIT("rtlsdr_set_center_freq error: %d", err);
+            err = rtlsdr_reset_buffer(src.dev);
+            if (err) FATAL_EXIT("rtlsdr_reset_buffer error: %d", err);
+            for (unsigned int n = 0; n < SCAN_SETTLE; n += SCAN_BUFFER)
+                scan_read(&src, &buf);
+        }
+
+        scan_station(scan_read, &src, freqs[i], &results[i]);
+        log_info("%u Hz: CNR %.1f dB, CP ratio %.1f, %s", freqs[i], results[i].cnr, results[i].cp_ratio,
+                 results[i].found ? "HD" : "no HD");
+    }
+    scan_print(stdout, results, count);
+
+    if (src.dev)
+        rtlsdr_close(src.dev);
+    if (src.cap)
+        capture_close(src.cap);
+    free(src.buf);
+    free(results);
+    free(freqs);
+    return 0;
+}
+
+static void channel_cb(void *arg, unsigned int c, const cint16_t *x, unsigned int n)
+{
+    input_push_q15(&stations[c].input, x, n);
+}
+
+static void wideband_cb(uint8_t *buf, uint32_t len, void *arg)
+{
+    if (wide_rec)
+        record_push_u8(wide_rec, buf, len);
+    channelizer_execute(chan, buf, len / 2);
+}
+
+static void radio_open(radio_t *r, unsigned int sample_rate, unsigned int center, int gain, int ppm_error)
+{
+    int err;
+
+    err = rtlsdr_open(&r->dev, r->index);
+    if (err) FATAL_EXIT("rtlsdr_open error: %d", err);
+    err = rtlsdr_set_sample_rate(r->dev, sample_rate ? sample_rate : NRSC5_SAMPLE_RATE);
+    if (err) FATAL_EXIT("rtlsdr_set_sample_rate error: %d", err);
+    // auto gain measures a single station at baseband, so wideband
+    // captures use the tuner AGC instead
+    err = rtlsdr_set_tuner_gain_mode(r->dev, sample_rate && gain == INT_MIN ? 0 : 1);
+    if (err) FATAL_EXIT("rtlsdr_set_tuner_gain_mode error: %d", err);
+    err = rtlsdr_set_freq_correction(r->dev, ppm_error);
+    if (err && err != -2) FATAL_EXIT("rtlsdr_set_freq_correction error: %d", err);
+    err = rtlsdr_set_center_freq(r->dev, sample_rate ? center : r->station->frequency);
+    if (err) FATAL_EXIT("rtlsdr_set_center_freq error: %d", err);
+
+    if (gain == INT_MIN && !sample_rate)
+    {
+        r->gain_count = rtlsdr_get_tuner_gains(r->dev, r->gain_list);
+        if (r->gain_count > 0)
+        {
+            gain_search_init(&r->gain_search, r->gain_count);
+            r->gain_index = gain_search_next(&r->gain_search);
+            input_set_snr_callback(&r->station->input, snr_callback, r);
+            err = rtlsdr_set_tuner_gain(r->dev, r->gain_list[r->gain_index]);
+            if (err) FATAL_EXIT("rtlsdr_set_tuner_gain error: %d", err);
+        }
+    }
+    else if (gain != INT_MIN)
+    {
+        err = rtlsdr_set_tuner_gain(r->dev, gain);
+        if (err) FATAL_EXIT("rtlsdr_set_tuner_gain error: %d", err);
+    }
+
+    err = rtlsdr_reset_buffer(r->dev);
+    if (err) FATAL_EXIT("rtlsdr_reset_buffer error: %d", err);
+
+#ifdef USE_THREADS
+    pthread_mutex_init(&r->usb_mutex, NULL);
+#endif
+}
+
+// Read from the device until it fails or is unplugged, then close it.
+static void radio_run(radio_t *r)
+{
+    uint8_t *buf = malloc(128 * 1024);
+    unsigned int radio_buffer = profile_get()->radio_buffer;
+    int err;
+
+#ifdef USE_THREADS
+    // a late read loses samples, which the decoder cannot make up for
+    if (realtime && affinity_set_realtime(pthread_self()) != 0)
+        log_warn("Unable to use realtime scheduling for device %u.", r->index);
+#endif
+
+    // special loop for modifying gain (we can't use async transfers)
+    while (r->gain_count && !stopping)
+    {
+        // use a smaller buffer during auto gain
+        int len = 128 * 1024;
+
+#ifdef USE_THREADS
+        pthread_mutex_lock(&r->usb_mutex);
+#endif
+        err = rtlsdr_read_sync(r->dev, buf, len, &len);
+        if (err) FATAL_EXIT("rtlsdr_read_sync error: %d", err);
+#ifdef USE_THREADS
+        pthread_mutex_unlock(&r->usb_mutex);
+#endif
+
+        input_cb(buf, len, &r->station->input);
+    }
+    free(buf);
+
+    if (!stopping)
+    {
+        err = rtlsdr_read_async(r->dev, r->feed, &r->station->input, RADIO_QUEUE / radio_buffer, radio_buffer);
+        if (err) FATAL_EXIT("rtlsdr_read_async error: %d", err);
+    }
+    err = rtlsdr_close(r->dev);
+    if (err) FATAL_EXIT("rtlsdr error: %d", err);
+}
+
+// Stop reading the devices, so that main returns and writes the trace. A
+// second signal exits at once.
+static void stop_handler(int sig)
+{
+    stopping = 1;
+    for (unsigned int i = 0; i < radio_count; ++i)
+    {
+        if (radios[i].dev)
+            rtlsdr_cancel_async(radios[i].dev);
+    }
+    signal(sig, SIG_DFL);
+}
+
+#ifdef USE_THREADS
+static void *radio_worker(void *arg)
+{
+    radio_run(arg);
+    return NULL;
+}
+
+static void radio_start(radio_t *r)
+{
+#ifdef HAVE_PTHREAD_SETNAME_NP
+    char name[16];
+#endif
+
+    if (pthread_create(&r->thread, NULL, radio_worker, r) != 0)
+        FATAL_EXIT("pthread_create failed");
+#ifdef HAVE_PTHREAD_SETNAME_NP
+    snprintf(name, sizeof(name), "rtlsdr%u", r->index);
+    pthread_setname_np(r->thread, name);
+#endif
+}
+#endif
+
+// Split cpus among the stations, or with numa, spread the stations over the
+// nodes and split the CPUs of each node among the stations on it.
+static void place_stations(const cpus_t *cpus, int numa, cpus_t *placement)
+{
+    cpus_t nodes[AFFINITY_MAX_NODES];
+    unsigned int count = 1;
+
+    nodes[0] = *cpus;
+    if (numa)
+        count = affinity_nodes(cpus, nodes);
+    for (unsigned int i = 0; i < station_count; ++i)
+    {
+        unsigned int node = i % count;
+        unsigned int on_node = (station_count - node + count - 1) / count;
+
+        affinity_share(&nodes[node], i / count, on_node, &placement[i]);
+        log_debug("Station %u: %u CPUs on node %u", stations[i].frequency, affinity_count(&placement[i]), node);
+    }
+}
+
+static void report_footprint()
+{
+    const profile_t *profile = profile_get();
+    size_t total = 0;
+
+    for (unsigned int i = 0; i < station_count; ++i)
+    {
+        size_t bytes = stations[i].input.footprint;
+        for (unsigned int p = 0; p < MAX_PROGRAMS; ++p)
+            bytes += stations[i].output[p].footprint;
+        log_debug("Station %u: %zu KiB", stations[i].frequency, bytes / 1024);
+        total += bytes;
+    }
+    log_info("Buffers: %.1f MiB for %u station%s (input %u KiB, %u sync blocks, %u decode frames, %u audio frames)",
+             total / 1048576.0, station_count, station_count == 1 ? "" : "s",
+             (unsigned int)(profile->input_len * sizeof(cint16_t) / 1024),
+             profile->sync_depth, profile->decode_depth, profile->audio_depth);
+}
+
+static void wait_stations(int flush)
+{
+    for (unsigned int i = 0; i < station_count; ++i)
+        input_wait(&stations[i].input, flush);
+}
+
+// a capture of --batch, and the program to decode from it
+typedef struct
+{
+    char *path;
+    unsigned int program;
+    // path without its directory and extensions, for %n
+    char name[256];
+} batch_job_t;
+
+static batch_job_t *batch_jobs;
+static unsigned int batch_count;
+static atomic_uint batch_next;
+static atomic_uint batch_failed;
+static const char *batch_format, *batch_audio;
+#ifdef USE_THREADS
+// The FFTW planner is not thread-safe, so decoders are set up and torn
+// down one at a time. They share the tables built by the first one, and
+// plan their transforms from the wisdom it leaves in memory.
+static pthread_mutex_t batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void batch_add(const char *path, unsigned int program)
+{
+    batch_job_t *job;
+    const char *base = strrchr(path, '/');
+    char *ext;
+
+    if ((batch_count & (batch_count - 1)) == 0)
+    {
+        batch_jobs = realloc(batch_jobs, sizeof(*batch_jobs) * (batch_count ? batch_count * 2 : 1));
+        if (batch_jobs == NULL)
+            FATAL_EXIT("Unable to allocate batch.");
+    }
+    job = &batch_jobs[batch_count++];
+    job->path = strdup(path);
+    job->program = program;
+
+    // sample.raw.xz is named sample
+    snprintf(job->name, sizeof(job->name), "%s", base ? base + 1 : path);
+    for (int i = 0; i < 2 && (ext = strrchr(job->name, '.')) != NULL && ext != job->name; ++i)
+    {
+        int compressed = strcmp(ext, ".xz") == 0 || strcmp(ext, ".zst") == 0;
+        *ext = 0;
+        if (!compressed)
+            break;
+    }
+}
+
+static int compare_jobs(const void *a, const void *b)
+{
+    return strcmp(((const batch_job_t *)a)->path, ((const batch_job_t *)b)->path);
+}
+
+// Queue the files of a directory, or the captures listed in a file, one
+// per line and optionally followed by the program to decode from it.
+static void batch_load(const char *list, unsigned int program)
+{
+    char line[PATH_MAX + 16], path[PATH_MAX + 16];
+    struct stat sb;
+    FILE *fp;
+
+    if (stat(list, &sb) != 0)
+        FATAL_EXIT("Unable to open %s.", list);
+
+    if (S_ISDIR(sb.st_mode))
+    {
+        DIR *dir = opendir(list);
+        struct dirent *ent;
+
+        if (dir == NULL)
+            FATAL_EXIT("Unable to open %s.", list);
+        while ((ent = readdir(dir)) != NULL)
+        {
+            if (ent->d_name[0] == '.')
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", list, ent->d_name);
+            if (stat(path, &sb) == 0 && S_ISREG(sb.st_mode))
+                batch_add(path, program);
+        }
+        closedir(dir);
+        // in a predictable order, whatever readdir returns
+        qsort(batch_jobs, batch_count, sizeof(*batch_jobs), compare_jobs);
+        return;
+    }
+
+    fp = fopen(list, "r");
+    if (fp == NULL)
+        FATAL_EXIT("Unable to open %s.", list);
+    while (fgets(line, sizeof(line), fp))
+    {
+        unsigned int p = program;
+        size_t len = strcspn(line, "\r\n");
+        char *last;
+
+        line[len] = 0;
+        while (len && (line[len - 1] == ' ' || line[len - 1] == '\t'))
+            line[--len] = 0;
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        // a trailing program, as "capture.raw 1" or "capture.raw all"
+        last = strrchr(line, ' ');
+        if (last == NULL)
+            last = strrchr(line, '\t');
+        if (last && (strcmp(last + 1, "all") == 0 || strspn(last + 1, "0123456789") == strlen(last + 1)))
+        {
+            p = parse_program(last + 1);
+            while (last > line && (last[-1] == ' ' || last[-1] == '\t'))
+                last--;
+            *last = 0;
+        }
+        batch_add(line, p);
+    }
+    fclose(fp);
+}
+
+static void batch_lock(void)
+{
+#ifdef USE_THREADS
+    pthread_mutex_lock(&batch_mutex);
+#endif
+}
+
+static void batch_unlock(void)
+{
+#ifdef USE_THREADS
+    pthread_mutex_unlock(&batch_mutex);
+#endif
+}
+
+// Decode one capture with a decoder of its own. The decoder threads are
+// started and joined for every job, and free their log and trace buffers
+// as they exit, after writing their spans to an open trace, so a batch of
+// any length runs in the memory of one job.
+static int batch_decode(station_t *st, const batch_job_t *job)
+{
+    uint64_t start = timing_clock();
+    unsigned int outputs = job->program == NRSC5_PROGRAM_ALL ? MAX_PROGRAMS : 1;
+    const uint8_t *buf;
+    capture cap;
+    size_t cnt;
+    int decimated;
+
+    cap = capture_open(job->path);
+    if (cap == NULL)
+    {
+        log_error("Unable to open %s.", job->path);
+        return 1;
+    }
+    decimated = capture_format(cap) != RECORD_U8;
+
+    batch_lock();
+    st->frequency = 0;
+    st->program = job->program;
+    st->capture = job->name;
+    init_station(st, batch_format, batch_audio);
+    input_init(&st->input, &st->output[0], 0, st->program, NULL);
+    if (st->program == NRSC5_PROGRAM_ALL)
+    {
+        for (unsigned int p = 0; p < MAX_PROGRAMS; ++p)
+            input_set_output(&st->input, p, &st->output[p]);
+    }
+    input_set_backpressure(&st->input, 1);
+    batch_unlock();
+
+    while ((cnt = capture_read(cap, &buf)) > 0)
+    {
+        if (decimated)
+            input_push_decimated(&st->input, (const cint16_t *)buf, cnt / 4);
+        else
+            input_cb((uint8_t *)buf, cnt, &st->input);
+    }
+    input_wait(&st->input, 1);
+    capture_close(cap);
+
+    batch_lock();
+    input_free(&st->input);
+    for (unsigned int p = 0; p < outputs; ++p)
+        output_free(&st->output[p]);
+    batch_unlock();
+
+    log_info("Decoded %s in %.1f s", job->path, (timing_clock() - start) / 1e9);
+    return 0;
+}
+
+// Decode captures until none are left.
+static void *batch_worker(void *arg)
+{
+    station_t *st = arg;
+    unsigned int i;
+
+    while (!stopping && (i = atomic_fetch_add(&batch_next, 1)) < batch_count)
+    {
+        if (batch_decode(st, &batch_jobs[i]) != 0)
+            atomic_fetch_add(&batch_failed, 1);
+    }
+    return NULL;
+}
+
+// Decode the captures of the batch on jobs workers. Returns the number of
+// captures that could not be decoded.
+static unsigned int batch_run(unsigned int jobs)
+{
+    station_t *workers;
+
+    if (jobs > batch_count)
+        jobs = batch_count;
+    workers = calloc(jobs, sizeof(*workers));
+    if (workers == NULL)
+        FATAL_EXIT("Unable to allocate batch.");
+    log_info("Decoding %u captures, %u at a time", batch_count, jobs);
+
+#ifdef USE_THREADS
+    pthread_t *threads = malloc(sizeof(*threads) * jobs);
+    if (threads == NULL)
+        FATAL_EXIT("Unable to allocate batch.");
+    for (unsigned int i = 0; i < jobs; ++i)
+    {
+        if (pthread_create(&threads[i], NULL, batch_worker, &workers[i]) != 0)
+            FATAL_EXIT("pthread_create failed");
+#ifdef HAVE_PTHREAD_SETNAME_NP
+        char name[16];
+        snprintf(name, sizeof(name), "batch%u", i);
+        pthread_setname_np(threads[i], name);
+#endif
+    }
+    for (unsigned int i = 0; i < jobs; ++i)
+        pthread_join(threads[i], NULL);
+    free(threads);
+#else
+    batch_worker(&workers[0]);
+#endif
+
+    free(workers);
+    for (unsigned int i = 0; i < batch_count; ++i)
+        free(batch_jobs[i].path);
+    free(batch_jobs);
+    return atomic_load(&batch_failed);
 }
 
 int main(int argc, char *argv[])
 {
     int err, opt, gain = INT_MIN, ppm_error = 0;
-    unsigned int count, i, frequency = 0, program = 0, device_index = 0;
+    unsigned int count, i, device_index = 0;
+    unsigned int sample_rate = 0, center = 0;
     char *input_name = NULL, *output_name = NULL, *audio_name = NULL, *format_name = NULL;
-    FILE *infp = NULL, *outfp = NULL;
-    input_t input;
-    output_t output;
+    char *wisdom_name = NULL, *stats_name = NULL, *trace_name = NULL, *batch_list = NULL;
+    unsigned int jobs = 0;
+    int fast_start = 0, exhaustive = 0;
+    unsigned int stats_interval = 10;
+    FILE *stats_fp = NULL;
+    capture cap = NULL;
+    record rec = NULL;
+    int record_fmt = RECORD_U8, decimated = 0, profile;
+    char *scan_list = NULL, *p, *q;
+    cpus_t cpus, placement[MAX_STATIONS];
+    int place = 0, numa = 0;
+    unsigned int segments, window, batch_ms = 0;
+    void (*feed)(uint8_t *, uint32_t, void *) = input_cb;
 
-    while ((opt = getopt(argc, argv, "r:w:d:p:o:f:g:ql:")) != -1)
+    affinity_all(&cpus);
+    while ((opt = getopt_long(argc, argv, "r:w:d:p:o:f:g:ql:s:c:", long_options, NULL)) != -1)
     {
         switch (opt)
         {
@@ -142,6 +915,98 @@ int main(int argc, char *argv[])
         case 'l':
             log_set_level(atoi(optarg));
             break;
+        case 's':
+            sample_rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            center = strtoul(optarg, NULL, 0);
+            break;
+        case OPT_WISDOM:
+            wisdom_name = optarg;
+            break;
+        case OPT_FAST_START:
+            fast_start = 1;
+            break;
+        case OPT_PLAN_EXHAUSTIVE:
+            exhaustive = 1;
+            break;
+        case OPT_FIXED_POINT:
+            acquire_set_fixed_point(1);
+            break;
+        case OPT_STATS:
+            stats_name = optarg;
+            break;
+        case OPT_STATS_INTERVAL:
+            stats_interval = strtoul(optarg, NULL, 0);
+            break;
+        case OPT_OUTPUT_FLUSH:
+            output_flush_ms = strtoul(optarg, NULL, 0);
+            break;
+        case OPT_RECORD_FORMAT:
+            record_fmt = record_parse_format(optarg);
+            if (record_fmt < 0)
+                FATAL_EXIT("Unknown recording format: %s", optarg);
+            break;
+        case OPT_SCAN:
+            scan_list = optarg;
+            break;
+        case OPT_PROFILE:
+            profile = profile_parse(optarg);
+            if (profile < 0)
+                FATAL_EXIT("Unknown profile: %s", optarg);
+            profile_set(profile);
+            break;
+        case OPT_DEVICE:
+            if (radio_count == MAX_STATIONS)
+                FATAL_EXIT("At most %d devices.", MAX_STATIONS);
+            if ((p = strchr(optarg, ':')) == NULL || (q = strchr(p + 1, ':')) == NULL)
+                FATAL_EXIT("Devices are given as index:frequency:program.");
+            radios[radio_count].index = strtoul(optarg, NULL, 0);
+            stations[radio_count].frequency = strtoul(p + 1, NULL, 0);
+            stations[radio_count].program = parse_program(q + 1);
+            radio_count++;
+            break;
+        case OPT_CPUS:
+            if (affinity_parse(optarg, &cpus) != 0)
+                FATAL_EXIT("Invalid CPU list: %s", optarg);
+            place = 1;
+            break;
+        case OPT_NUMA:
+            numa = 1;
+            place = 1;
+            break;
+        case OPT_REALTIME:
+            realtime = 1;
+            break;
+        case OPT_VITERBI_SEGMENTS:
+            segments = strtoul(optarg, NULL, 0);
+            if (segments < 1 || segments > CONV_MAX_SEGMENTS)
+                FATAL_EXIT("Viterbi segments must be 1 to %d.", CONV_MAX_SEGMENTS);
+            decode_set_segments(segments);
+            break;
+        case OPT_VITERBI_WINDOW:
+            window = strtoul(optarg, NULL, 0);
+            if (window > FRAME_LEN)
+                FATAL_EXIT("Viterbi window must be 0 to %d.", FRAME_LEN);
+            decode_set_window(window);
+            break;
+        case OPT_VITERBI_BATCH:
+            batch_ms = strtoul(optarg, NULL, 0);
+            if (batch_ms < 1 || batch_ms > 1000)
+                FATAL_EXIT("Viterbi batch wait must be 1 to 1000 ms.");
+            decode_set_batch(batch_ms);
+            break;
+        case OPT_TRACE:
+            trace_name = optarg;
+            break;
+        case OPT_BATCH:
+            batch_list = optarg;
+            break;
+        case OPT_JOBS:
+            jobs = strtoul(optarg, NULL, 0);
+            if (jobs == 0)
+                FATAL_EXIT("Jobs must be at least 1.");
+            break;
         default:
             help(argv[0]);
             return 0;
@@ -149,37 +1014,123 @@ int main(int argc, char *argv[])
     }
 
 #ifdef USE_THREADS
-    pthread_mutex_t log_mutex;
-    pthread_mutex_init(&log_mutex, NULL);
+    // static, as the log drainer and log_flush at exit lock it after main
+    // has returned
+    static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
     log_set_lock(log_lock);
     log_set_udata(&log_mutex);
+    // the decoder threads must not wait for the terminal
+    log_set_async(1);
+#else
+    if (realtime)
+        log_warn("Realtime scheduling requires multithreading.");
+    if (batch_ms)
+        log_warn("Viterbi batching requires multithreading.");
 #endif
 
-    if (input_name == NULL)
+    if (trace_name != NULL)
     {
-        if (optind + 2 != argc)
+        if (trace_open(trace_name) != 0)
+        {
+            log_fatal("Unable to open trace file.");
+            return 1;
+        }
+        signal(SIGINT, stop_handler);
+        signal(SIGTERM, stop_handler);
+    }
+
+    // load wisdom from earlier runs, so measuring is quick
+    fft_load_wisdom(wisdom_name);
+    if (exhaustive)
+        return plan_exhaustive(wisdom_name);
+    if (fast_start)
+        fft_set_effort(FFT_PLAN_FAST);
+
+    if (scan_list)
+    {
+        if (optind != argc || sample_rate)
         {
             help(argv[0]);
             return 0;
         }
-        frequency = strtoul(argv[optind], NULL, 0);
-        program = strtoul(argv[optind+1], NULL, 0);
+        err = scan(scan_list, input_name, device_index, gain, ppm_error);
+        fft_save_wisdom(wisdom_name);
+        return err;
+    }
 
-        count = rtlsdr_get_device_count();
-        if (count == 0)
+    if (batch_list)
+    {
+        if (optind + 1 != argc || radio_count || sample_rate || input_name || output_name || stats_name)
         {
-            log_fatal("No devices found!");
-            return 1;
+            help(argv[0]);
+            return 0;
         }
+        if (audio_name == NULL || net_is_url(audio_name))
+            FATAL_EXIT("Batch decoding requires an audio output file name.");
+        batch_load(batch_list, parse_program(argv[optind]));
+        if (batch_count == 0)
+            FATAL_EXIT("No captures in %s.", batch_list);
+        if (batch_count > 1 && strstr(audio_name, "%n") == NULL)
+            FATAL_EXIT("Decoding several captures requires an audio output name containing %%n.");
+        batch_format = format_name;
+        batch_audio = audio_name;
 
-        for (i = 0; i < count; ++i)
-            log_info("[%d] %s", i, rtlsdr_get_device_name(i));
+#ifdef USE_THREADS
+        // the decoders of jobs running at once mostly wait for each other
+        // between stages, so one per CPU keeps them all busy
+        if (jobs == 0)
+            jobs = affinity_count(&cpus);
+#else
+        jobs = 1;
+#endif
+        if (place && affinity_set_current(&cpus) != 0)
+            log_warn("Unable to set thread affinity.");
+        math_init();
+        err = batch_run(jobs) != 0;
+        fft_save_wisdom(wisdom_name);
+        trace_close();
+        return err;
+    }
 
-        if (device_index >= count)
+    if (radio_count)
+    {
+        // one station per device, given with --device
+        if (optind != argc || sample_rate || input_name || output_name)
         {
-            log_fatal("Selected device does not exist.");
-            return 1;
+            help(argv[0]);
+            return 0;
         }
+#ifndef USE_THREADS
+        if (radio_count > 1)
+            FATAL_EXIT("Several devices require multithreading.");
+#endif
+        station_count = radio_count;
+    }
+    else if (sample_rate)
+    {
+        // wideband: frequency and program of each station
+        if (optind == argc || (argc - optind) % 2 != 0 || (argc - optind) / 2 > MAX_STATIONS)
+        {
+            help(argv[0]);
+            return 0;
+        }
+        for (i = optind; i < argc; i += 2)
+        {
+            stations[station_count].frequency = strtoul(argv[i], NULL, 0);
+            stations[station_count].program = parse_program(argv[i + 1]);
+            station_count++;
+        }
+    }
+    else if (input_name == NULL)
+    {
+        if (optind + 2 != argc)
+        {
+            help(argv[0]);
+            return 0;
+        }
+        stations[0].frequency = strtoul(argv[optind], NULL, 0);
+        stations[0].program = parse_program(argv[optind+1]);
+        station_count = 1;
     }
     else
     {
@@ -188,149 +1139,226 @@ int main(int argc, char *argv[])
             help(argv[0]);
             return 0;
         }
-        program = strtoul(argv[optind], NULL, 0);
-
-        if (strcmp(input_name, "-") == 0)
-            infp = stdin;
-        else
-            infp = fopen(input_name, "rb");
+        stations[0].frequency = 0;
+        stations[0].program = parse_program(argv[optind]);
+        station_count = 1;
+    }
 
-        if (infp == NULL)
+    if (input_name == NULL)
+    {
+        count = rtlsdr_get_device_count();
+        if (count == 0)
         {
-            log_fatal("Unable to open input file.");
+            log_fatal("No devices found!");
             return 1;
         }
-    }
 
-    if (output_name != NULL)
-    {
-        outfp = fopen(output_name, "wb");
-        if (outfp == NULL)
+        for (i = 0; i < count; ++i)
+            log_info("[%d] %s", i, rtlsdr_get_device_name(i));
+
+        if (radio_count == 0)
+            radios[radio_count++].index = device_index;
+        for (i = 0; i < radio_count; ++i)
         {
-            log_fatal("Unable to open output file.");
-            return 1;
+            if (radios[i].index >= count)
+            {
+                log_fatal("Selected device does not exist.");
+                return 1;
+            }
+            for (unsigned int j = 0; j < i; ++j)
+                if (radios[j].index == radios[i].index)
+                    FATAL_EXIT("Device %u is given more than once.", radios[i].index);
+            radios[i].station = &stations[i];
+            radios[i].feed = input_cb;
         }
     }
-
-    if (audio_name != NULL)
+    else
     {
-        if (format_name == NULL)
+        cap = capture_open(input_name);
+        if (cap == NULL)
         {
-            log_fatal("Must specify an output format.");
+            log_fatal("Unable to open input file.");
             return 1;
         }
-        else if (strcmp(format_name, "wav") == 0)
+        // decimated recordings skip the input filter
+        decimated = capture_format(cap) != RECORD_U8;
+        if (decimated && sample_rate)
         {
-#ifdef HAVE_FAAD2
-            output_init_wav(&output, audio_name);
-#else
-            log_fatal("WAV output requires FAAD2.");
+            log_fatal("Decimated recordings hold a single station.");
             return 1;
-#endif
         }
-        else if (strcmp(format_name, "adts") == 0)
+    }
+
+    if (output_name != NULL)
+    {
+        if (record_fmt != RECORD_U8 && sample_rate)
         {
-            output_init_adts(&output, audio_name);
+            log_fatal("Wideband captures can only be recorded as u8.");
+            return 1;
         }
-        else if (strcmp(format_name, "hdc") == 0)
+        // u8 recordings have no header, so the rate is only for the others
+        rec = record_open(output_name, record_fmt, NRSC5_SAMPLE_RATE / 2.0, stations[0].frequency);
+        if (rec == NULL)
         {
-            output_init_hdc(&output, audio_name);
+            log_fatal("Unable to open output file.");
+            return 1;
         }
-        else
+    }
+
+    if (stats_name != NULL)
+    {
+        stats_fp = fopen(stats_name, "w");
+        if (stats_fp == NULL)
         {
-            log_fatal("Unknown output format.");
+            log_fatal("Unable to open stats file.");
             return 1;
         }
+        if (stats_interval == 0)
+            stats_interval = 1;
     }
-    else
+
+    if (station_count > 1 && (audio_name == NULL || strstr(audio_name, "%f") == NULL))
     {
-#ifdef HAVE_FAAD2
-        output_init_live(&output);
-#else
-        log_fatal("Live output requires FAAD2.");
+        log_fatal("Decoding several stations requires an audio output name containing %%f.");
         return 1;
-#endif
     }
 
-    math_init();
-    input_init(&input, &output, frequency, program, outfp);
+    // devices read concurrently get a share of the CPUs each, even when
+    // not asked to, so that they do not compete for caches
+    if (radio_count > 1)
+        place = 1;
+    if (place)
+        place_stations(&cpus, numa, placement);
 
-    if (infp)
+    math_init();
+    for (i = 0; i < station_count; ++i)
     {
-        while (!feof(infp))
+        station_t *st = &stations[i];
+
+        // the outputs and the decoder start their threads, and touch their
+        // buffers, on the CPUs of the station
+        if (place && affinity_set_current(&placement[i]) != 0)
+            log_warn("Unable to set thread affinity.");
+        init_station(st, format_name, audio_name);
+        // in wideband mode the capture is written before channelizing
+        input_init(&st->input, &st->output[0], st->frequency, st->program, sample_rate ? NULL : rec);
+        if (stats_fp)
+            input_set_stats(&st->input, stats_fp, stats_interval);
+        if (st->program == NRSC5_PROGRAM_ALL)
         {
-            uint8_t tmp[RADIO_BUFFER];
-            size_t cnt;
-            cnt = fread(tmp, 1, sizeof(tmp), infp);
-            if (cnt > 0)
-                input_cb(tmp, cnt, &input);
-            input_wait(&input, 0);
+            for (unsigned int p = 0; p < MAX_PROGRAMS; ++p)
+                input_set_output(&st->input, p, &st->output[p]);
         }
-        input_wait(&input, 1);
+#ifdef USE_THREADS
+        if (realtime && affinity_set_realtime(st->input.worker_thread) != 0)
+            log_warn("Unable to use realtime scheduling for station %u.", st->frequency);
+#endif
     }
-    else
+    if (place)
+        affinity_set_current(&cpus);
+    report_footprint();
+
+    if (sample_rate)
     {
-        uint8_t *buf = malloc(128 * 1024);
-        rtlsdr_dev_t *dev;
+        double offsets[MAX_STATIONS];
 
-        err = rtlsdr_open(&dev, 0);
-        if (err) FATAL_EXIT("rtlsdr_open error: %d", err);
-        err = rtlsdr_set_sample_rate(dev, 1488375);
-        if (err) FATAL_EXIT("rtlsdr_set_sample_rate error: %d", err);
-        err = rtlsdr_set_tuner_gain_mode(dev, 1);
-        if (err) FATAL_EXIT("rtlsdr_set_tuner_gain_mode error: %d", err);
-        err = rtlsdr_set_freq_correction(dev, ppm_error);
-        if (err && err != -2) FATAL_EXIT("rtlsdr_set_freq_correction error: %d", err);
-        err = rtlsdr_set_center_freq(dev, frequency);
-        if (err) FATAL_EXIT("rtlsdr_set_center_freq error: %d", err);
+        if (sample_rate < NRSC5_SAMPLE_RATE)
+            FATAL_EXIT("Sample rate must be at least %d.", NRSC5_SAMPLE_RATE);
 
-        if (gain == INT_MIN)
+        if (center == 0)
         {
-            gain_count = rtlsdr_get_tuner_gains(dev, gain_list);
-            if (gain_count > 0)
+            unsigned int lo = stations[0].frequency, hi = stations[0].frequency;
+            for (i = 1; i < station_count; ++i)
             {
-                input_set_snr_callback(&input, snr_callback, dev);
-                err = rtlsdr_set_tuner_gain(dev, gain_list[0]);
-                if (err) FATAL_EXIT("rtlsdr_set_tuner_gain error: %d", err);
+                if (stations[i].frequency < lo)
+                    lo = stations[i].frequency;
+                if (stations[i].frequency > hi)
+                    hi = stations[i].frequency;
             }
+            center = lo + (hi - lo) / 2;
         }
-        else
+
+        for (i = 0; i < station_count; ++i)
         {
-            err = rtlsdr_set_tuner_gain(dev, gain);
-            if (err) FATAL_EXIT("rtlsdr_set_tuner_gain error: %d", err);
+            offsets[i] = (double)stations[i].frequency - center;
+            if (fabs(offsets[i]) + NRSC5_SAMPLE_RATE / 4 > sample_rate / 2.0)
+                FATAL_EXIT("Station %u is outside of the captured band.", stations[i].frequency);
         }
+        log_info("Capturing %u Hz at %u Hz for %u stations", sample_rate, center, station_count);
 
-        err = rtlsdr_reset_buffer(dev);
-        if (err) FATAL_EXIT("rtlsdr_reset_buffer error: %d", err);
+        wide_rec = rec;
+        chan = channelizer_create(sample_rate, offsets, station_count, channel_cb, NULL);
+        feed = wideband_cb;
+        radios[0].feed = wideband_cb;
+    }
 
-#ifdef USE_THREADS
-        pthread_mutex_init(&rtlsdr_usb_mutex, NULL);
-#endif
+    if (cap)
+    {
+        const uint8_t *buf;
+        size_t cnt;
 
-        // special loop for modifying gain (we can't use async transfers)
-        while (gain_count)
-        {
-            // use a smaller buffer during auto gain
-            int len = 128 * 1024;
+        fft_save_wisdom(wisdom_name);
 
-#ifdef USE_THREADS
-            pthread_mutex_lock(&rtlsdr_usb_mutex);
-#endif
-            err = rtlsdr_read_sync(dev, buf, len, &len);
-            if (err) FATAL_EXIT("rtlsdr_read_sync error: %d", err);
-#ifdef USE_THREADS
-            pthread_mutex_unlock(&rtlsdr_usb_mutex);
-#endif
+        // nothing is lost by waiting for the decoder, so push as fast as it
+        // accepts samples and let the capture reader run ahead
+        for (i = 0; i < station_count; ++i)
+            input_set_backpressure(&stations[i].input, 1);
+        while ((cnt = capture_read(cap, &buf)) > 0)
+        {
+            if (decimated)
+                input_push_decimated(&stations[0].input, (const cint16_t *)buf, cnt / 4);
+            else
+                feed((uint8_t *)buf, cnt, &stations[0].input);
+        }
+        wait_stations(1);
 
-            input_cb(buf, len, &input);
+        for (i = 0; i < station_count; ++i)
+        {
+            for (unsigned int p = 0; p < MAX_PROGRAMS; ++p)
+            {
+                // network outputs are closed, to end the HTTP responses
+                if (stations[i].output[p].net)
+                    output_free(&stations[i].output[p]);
+                else
+                    output_flush(&stations[i].output[p]);
+            }
         }
-        free(buf);
+        capture_close(cap);
+    }
+    else
+    {
+        for (i = 0; i < radio_count; ++i)
+            radio_open(&radios[i], sample_rate, center, gain, ppm_error);
+        fft_save_wisdom(wisdom_name);
 
-        err = rtlsdr_read_async(dev, input_cb, &input, RADIO_BUFCNT, RADIO_BUFFER);
-        if (err) FATAL_EXIT("rtlsdr_read_async error: %d", err);
-        err = rtlsdr_close(dev);
-        if (err) FATAL_EXIT("rtlsdr error: %d", err);
+        if (radio_count == 1)
+        {
+            radio_run(&radios[0]);
+        }
+#ifdef USE_THREADS
+        else
+        {
+            // the devices share the static decoder tables; each makes its
+            // own FFT plans, quickly, from the wisdom the first one leaves
+            for (i = 0; i < radio_count; ++i)
+            {
+                // each device is read on the CPUs of its station
+                affinity_set_current(&placement[i]);
+                radio_start(&radios[i]);
+            }
+            affinity_set_current(&cpus);
+            for (i = 0; i < radio_count; ++i)
+                pthread_join(radios[i].thread, NULL);
+        }
+#endif
     }
 
+    if (trace_name)
+    {
+        wait_stations(1);
+        trace_close();
+    }
+    if (rec)
+        record_close(rec);
     return 0;
 }
@@ -5,8 +5,14 @@ float complex cexpf_tbl[4096];
 
 void math_init()
 {
+    static int ready;
+
+    if (ready)
+        return;
+
     for (int i = 0; i < 4096; ++i)
         cexpf_tbl[i] = cexpf(I * 2 * M_PI * i / 4096);
+    ready = 1;
 }
 #else
 void math_init()
@@ -0,0 +1,106 @@
+#pragma once
+
+/*
+ * Helpers for the kernel microbenchmarks. Each benchmark is its own program;
+ * it runs an operation on fixed input for every kernel variant compiled in
+ * and supported by the CPU, and prints ns/op and bytes/s.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cpu.h"
+#include "log.h"
+
+// run each measurement for at least this long
+#define BENCH_MIN_NS 500000000ull
+
+typedef struct
+{
+    const char *name;
+    unsigned int features;
+} bench_variant_t;
+
+static const bench_variant_t bench_variants[] = {
+    { "generic", 0 },
+#ifdef HAVE_X86_KERNELS
+    { "sse", CPU_SSE2 | CPU_SSSE3 },
+    { "avx2", CPU_SSE2 | CPU_SSSE3 | CPU_AVX2 },
+#endif
+#ifdef HAVE_NEON_KERNELS
+    { "neon", CPU_NEON },
+#endif
+};
+
+#define BENCH_VARIANTS (sizeof(bench_variants) / sizeof(bench_variants[0]))
+
+static inline uint64_t bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Select variant i for objects created afterwards. used is the set of
+// features the benchmarked code has kernels for. Returns 0 if the CPU does
+// not support the variant, or it would bind the same kernels as an earlier
+// one.
+static inline int bench_select(unsigned int i, unsigned int used)
+{
+    static unsigned int supported = ~0u;
+
+    if (supported == ~0u)
+    {
+        log_set_level(LOG_WARN);
+        cpu_set_mask(~0u);
+        supported = cpu_features();
+    }
+    if ((bench_variants[i].features & supported) != bench_variants[i].features)
+        return 0;
+    for (unsigned int j = 0; j < i; ++j)
+    {
+        if ((bench_variants[j].features & supported) == bench_variants[j].features &&
+            (bench_variants[j].features & used) == (bench_variants[i].features & used))
+            return 0;
+    }
+    cpu_set_mask(bench_variants[i].features);
+    return 1;
+}
+
+// Run op(arg) until BENCH_MIN_NS has passed, and print the time per call
+// and the throughput for bytes of input per call. Returns the nanoseconds
+// per call.
+static inline double bench_run(const char *name, const char *variant, void (*op)(void *), void *arg, uint64_t bytes)
+{
+    unsigned long ops = 0, n = 1;
+    uint64_t start, elapsed;
+
+    // warm up caches and lazily built tables
+    op(arg);
+
+    start = bench_now();
+    do
+    {
+        for (unsigned long i = 0; i < n; ++i)
+            op(arg);
+        ops += n;
+        n *= 2;
+        elapsed = bench_now() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    printf("%-12s %-8s %12.1f ns/op %10.2f MB/s\n", name, variant,
+           (double)elapsed / ops, (double)bytes * ops / (elapsed / 1e3));
+    return (double)elapsed / ops;
+}
+
+// deterministic input: xorshift32
+static inline uint32_t bench_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
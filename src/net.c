@@ -0,0 +1,521 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// sendmmsg
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "defines.h"
+#include "net.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#ifndef SO_NOSIGPIPE
+// nothing keeps a write to a closed client from raising SIGPIPE
+#define NET_IGNORE_SIGPIPE
+#endif
+#endif
+
+// dynamic payload type; the stream is described out of band
+#define NET_RTP_PAYLOAD 96
+#define NET_RTP_HEADER_LEN 12
+// samples per HDC frame after SBR, at 44100 Hz
+#define NET_RTP_FRAME_SAMPLES 2048
+
+static const struct
+{
+    const char *prefix;
+    net_mode_t mode;
+} schemes[] = {
+    { "udp://", NET_UDP },
+    { "rtp://", NET_RTP },
+    { "http://", NET_HTTP },
+};
+
+static const char *url_scheme(const char *name, net_mode_t *mode)
+{
+    for (unsigned int i = 0; i < sizeof(schemes) / sizeof(schemes[0]); ++i)
+    {
+        size_t len = strlen(schemes[i].prefix);
+        if (strncmp(name, schemes[i].prefix, len) == 0)
+        {
+            if (mode)
+                *mode = schemes[i].mode;
+            return name + len;
+        }
+    }
+    return NULL;
+}
+
+int net_is_url(const char *name)
+{
+    return url_scheme(name, NULL) != NULL;
+}
+
+// Split host:port, [host]:port or :port, ignoring a path or query after the
+// port.
+static int split_address(const char *addr, char *host, size_t host_len, char *port, size_t port_len)
+{
+    const char *colon, *end;
+    size_t len;
+
+    if (addr[0] == '[')
+    {
+        end = strchr(addr, ']');
+        if (end == NULL || end[1] != ':')
+            return -1;
+        addr++;
+        colon = end + 1;
+    }
+    else
+    {
+        colon = strrchr(addr, ':');
+        if (colon == NULL)
+            return -1;
+        end = colon;
+    }
+
+    len = end - addr;
+    if (len >= host_len)
+        return -1;
+    memcpy(host, addr, len);
+    host[len] = 0;
+
+    len = strcspn(colon + 1, "/?");
+    if (len == 0 || len >= port_len)
+        return -1;
+    memcpy(port, colon + 1, len);
+    port[len] = 0;
+    return 0;
+}
+
+// Parse the query of the address, which may only hold ttl=N. Returns the
+// TTL, -1 if none is given, or -2 if the query is invalid.
+static int parse_query(const char *addr)
+{
+    const char *query = strchr(addr, '?');
+    char *end;
+    long ttl;
+
+    if (query == NULL)
+        return -1;
+    if (strncmp(query + 1, "ttl=", 4) != 0)
+        return -2;
+    ttl = strtol(query + 5, &end, 10);
+    if (end == query + 5 || *end != 0 || ttl < 0 || ttl > 255)
+        return -2;
+    return ttl;
+}
+
+static int is_multicast(const struct sockaddr_storage *addr)
+{
+    if (addr->ss_family == AF_INET)
+        return IN_MULTICAST(ntohl(((const struct sockaddr_in *)addr)->sin_addr.s_addr));
+    if (addr->ss_family == AF_INET6)
+        return IN6_IS_ADDR_MULTICAST(&((const struct sockaddr_in6 *)addr)->sin6_addr);
+    return 0;
+}
+
+// Set the TTL, or hop limit, of the datagrams sent to a multicast or
+// unicast destination.
+static int set_ttl(net_t *st, int ttl)
+{
+    int multicast = is_multicast(&st->addr);
+
+    if (st->addr.ss_family == AF_INET6)
+        return setsockopt(st->fd, IPPROTO_IPV6, multicast ? IPV6_MULTICAST_HOPS : IPV6_UNICAST_HOPS, &ttl, sizeof(ttl));
+    if (multicast)
+    {
+        unsigned char c = ttl;
+        return setsockopt(st->fd, IPPROTO_IP, IP_MULTICAST_TTL, &c, sizeof(c));
+    }
+    return setsockopt(st->fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
+}
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+net_t *net_open(const char *url, const char *content_type)
+{
+    struct addrinfo hints, *res;
+    char host[256], port[16];
+    const char *addr;
+    struct timespec ts;
+    net_t *st;
+    int err, ttl;
+
+    st = calloc(1, sizeof(*st));
+    if (st == NULL)
+        FATAL_EXIT("Unable to allocate network output.");
+    for (unsigned int i = 0; i < NET_MAX_CLIENTS; ++i)
+        st->clients[i].fd = -1;
+    st->content_type = content_type;
+
+    addr = url_scheme(url, &st->mode);
+    if (addr == NULL || split_address(addr, host, sizeof(host), port, sizeof(port)) != 0)
+        FATAL_EXIT("Invalid network output %s, expected host:port.", url);
+    if (host[0] == 0 && st->mode != NET_HTTP)
+        FATAL_EXIT("Network output %s needs a host.", url);
+    ttl = parse_query(addr);
+    if (ttl == -2 || (ttl >= 0 && st->mode == NET_HTTP))
+        FATAL_EXIT("Invalid network output %s, expected ?ttl=0-255 after a udp or rtp address.", url);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = st->mode == NET_HTTP ? SOCK_STREAM : SOCK_DGRAM;
+    hints.ai_flags = st->mode == NET_HTTP ? AI_PASSIVE : 0;
+    err = getaddrinfo(host[0] ? host : NULL, port, &hints, &res);
+    if (err != 0)
+        FATAL_EXIT("Unable to resolve %s: %s", url, gai_strerror(err));
+
+    st->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (st->fd < 0)
+        FATAL_EXIT("Unable to create socket: %s", strerror(errno));
+    memcpy(&st->addr, res->ai_addr, res->ai_addrlen);
+    st->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    if (st->mode == NET_HTTP)
+    {
+        int one = 1;
+
+        setsockopt(st->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(st->fd, (struct sockaddr *)&st->addr, st->addr_len) != 0 || listen(st->fd, NET_MAX_CLIENTS) != 0)
+            FATAL_EXIT("Unable to listen on %s: %s", url, strerror(errno));
+        if (set_nonblocking(st->fd) != 0)
+            FATAL_EXIT("Unable to set up %s: %s", url, strerror(errno));
+#ifdef NET_IGNORE_SIGPIPE
+        signal(SIGPIPE, SIG_IGN);
+#endif
+        log_info("Serving audio on %s", url);
+    }
+    else if (ttl >= 0 && set_ttl(st, ttl) != 0)
+    {
+        FATAL_EXIT("Unable to set the TTL of %s: %s", url, strerror(errno));
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    st->ssrc = (uint32_t)ts.tv_nsec ^ ((uint32_t)ts.tv_sec << 10) ^ (uint32_t)(uintptr_t)st;
+    st->timestamp = st->ssrc * 2654435761u;
+    return st;
+}
+
+void net_push(net_t *st, const uint8_t *hdr, unsigned int hdr_len, const uint8_t *pkt, unsigned int len)
+{
+    // rare oversized packets are sent on their own from the caller's buffer
+    int direct = len > NET_PACKET_LEN;
+    unsigned int head_len = 0;
+    uint8_t *head;
+
+    if (st->count == NET_BATCH || (direct && st->count))
+        net_flush(st);
+    head = st->head[st->count];
+
+    if (st->mode == NET_RTP)
+    {
+        head[0] = 0x80;
+        head[1] = NET_RTP_PAYLOAD;
+        head[2] = st->seq >> 8;
+        head[3] = st->seq;
+        head[4] = st->timestamp >> 24;
+        head[5] = st->timestamp >> 16;
+        head[6] = st->timestamp >> 8;
+        head[7] = st->timestamp;
+        head[8] = st->ssrc >> 24;
+        head[9] = st->ssrc >> 16;
+        head[10] = st->ssrc >> 8;
+        head[11] = st->ssrc;
+        head_len = NET_RTP_HEADER_LEN;
+        st->seq++;
+        st->timestamp += NET_RTP_FRAME_SAMPLES;
+    }
+    else if (st->mode == NET_HTTP)
+    {
+        head_len = snprintf((char *)head, NET_HEAD_LEN, "%x\r\n", hdr_len + len);
+    }
+    memcpy(&head[head_len], hdr, hdr_len);
+    head_len += hdr_len;
+
+    st->iov[st->count][0].iov_base = head;
+    st->iov[st->count][0].iov_len = head_len;
+    if (direct)
+    {
+        st->iov[st->count][1].iov_base = (void *)pkt;
+    }
+    else
+    {
+        memcpy(st->data[st->count], pkt, len);
+        st->iov[st->count][1].iov_base = st->data[st->count];
+    }
+    st->iov[st->count][1].iov_len = len;
+    st->iov[st->count][2].iov_base = "\r\n";
+    st->iov[st->count][2].iov_len = st->mode == NET_HTTP ? 2 : 0;
+    st->count++;
+
+    if (direct)
+        net_flush(st);
+}
+
+static void send_datagrams(net_t *st)
+{
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msgs[NET_BATCH];
+    unsigned int sent = 0;
+
+    memset(msgs, 0, sizeof(msgs[0]) * st->count);
+    for (unsigned int i = 0; i < st->count; ++i)
+    {
+        msgs[i].msg_hdr.msg_name = &st->addr;
+        msgs[i].msg_hdr.msg_namelen = st->addr_len;
+        msgs[i].msg_hdr.msg_iov = st->iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+    while (sent < st->count)
+    {
+        int n = sendmmsg(st->fd, &msgs[sent], st->count - sent, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            log_error("Unable to send audio output: %s", strerror(errno));
+            return;
+        }
+        sent += n;
+    }
+#else
+    for (unsigned int i = 0; i < st->count; ++i)
+    {
+        struct msghdr msg;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &st->addr;
+        msg.msg_namelen = st->addr_len;
+        msg.msg_iov = st->iov[i];
+        msg.msg_iovlen = 2;
+        while (sendmsg(st->fd, &msg, 0) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            log_error("Unable to send audio output: %s", strerror(errno));
+            return;
+        }
+    }
+#endif
+}
+
+static void close_client(net_t *st, unsigned int i)
+{
+    close(st->clients[i].fd);
+    st->clients[i].fd = -1;
+}
+
+// Send all of len bytes without waiting, or close the client, as a
+// partial chunk would corrupt the rest of its stream.
+static void send_client(net_t *st, unsigned int i, struct msghdr *msg, size_t len)
+{
+    ssize_t n;
+
+    do
+        n = sendmsg(st->clients[i].fd, msg, MSG_NOSIGNAL);
+    while (n < 0 && errno == EINTR);
+
+    if (n < 0 || (size_t)n != len)
+    {
+        log_info("Closing HTTP client: %s", n < 0 ? strerror(errno) : "too slow");
+        close_client(st, i);
+    }
+}
+
+static void accept_clients(net_t *st)
+{
+    int fd;
+
+    while ((fd = accept(st->fd, NULL, NULL)) >= 0)
+    {
+        unsigned int i;
+
+        for (i = 0; i < NET_MAX_CLIENTS && st->clients[i].fd >= 0; ++i)
+            ;
+        if (i == NET_MAX_CLIENTS)
+        {
+            log_warn("Refusing HTTP client, %d already connected", NET_MAX_CLIENTS);
+            close(fd);
+            continue;
+        }
+        if (set_nonblocking(fd) != 0)
+        {
+            close(fd);
+            continue;
+        }
+#ifdef SO_NOSIGPIPE
+        // where send has no MSG_NOSIGNAL, a closed client must not kill us
+        {
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+        }
+#endif
+        st->clients[i].fd = fd;
+        st->clients[i].received = 0;
+        st->clients[i].matched = 0;
+        st->clients[i].streaming = 0;
+        st->clients[i].accepted = time(NULL);
+    }
+}
+
+// Read what has arrived of the request of client i. Returns 1 once the
+// blank line ending it has been read. The request itself is ignored, as
+// every client gets the same stream.
+static int read_request(net_t *st, unsigned int i)
+{
+    static const char end[] = "\r\n\r\n";
+    net_client_t *c = &st->clients[i];
+    char request[512];
+    ssize_t n;
+
+    while ((n = recv(c->fd, request, sizeof(request), 0)) > 0)
+    {
+        for (ssize_t j = 0; j < n; ++j)
+        {
+            if (request[j] == end[c->matched])
+                c->matched++;
+            else
+                c->matched = request[j] == end[0];
+            if (c->matched == sizeof(end) - 1)
+                return 1;
+        }
+        c->received += n;
+        if (c->received > NET_REQUEST_LEN)
+        {
+            log_info("Closing HTTP client: request too long");
+            close_client(st, i);
+            return 0;
+        }
+    }
+
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+    {
+        close_client(st, i);
+    }
+    else if (time(NULL) - c->accepted > NET_REQUEST_TIMEOUT)
+    {
+        log_info("Closing HTTP client: no request");
+        close_client(st, i);
+    }
+    return 0;
+}
+
+// Clients are answered between frames once their request has arrived, and
+// get the stream from then on, whatever they asked for.
+static void answer_clients(net_t *st)
+{
+    static const char fmt[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: %s\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+    char response[256];
+    struct iovec iov;
+    struct msghdr msg;
+
+    for (unsigned int i = 0; i < NET_MAX_CLIENTS; ++i)
+    {
+        if (st->clients[i].fd < 0 || st->clients[i].streaming || !read_request(st, i))
+            continue;
+
+        iov.iov_base = response;
+        iov.iov_len = snprintf(response, sizeof(response), fmt, st->content_type);
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        send_client(st, i, &msg, iov.iov_len);
+        if (st->clients[i].fd >= 0)
+        {
+            st->clients[i].streaming = 1;
+            log_info("HTTP client connected");
+        }
+    }
+}
+
+static void send_clients(net_t *st)
+{
+    struct msghdr msg;
+    size_t len = 0;
+
+    if (st->count == 0)
+        return;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &st->iov[0][0];
+    msg.msg_iovlen = st->count * 3;
+    for (unsigned int i = 0; i < st->count * 3; ++i)
+        len += msg.msg_iov[i].iov_len;
+
+    for (unsigned int i = 0; i < NET_MAX_CLIENTS; ++i)
+        if (st->clients[i].fd >= 0 && st->clients[i].streaming)
+            send_client(st, i, &msg, len);
+}
+
+void net_flush(net_t *st)
+{
+    if (st->mode == NET_HTTP)
+    {
+        accept_clients(st);
+        answer_clients(st);
+        send_clients(st);
+    }
+    else if (st->count)
+    {
+        send_datagrams(st);
+    }
+    st->count = 0;
+}
+
+void net_close(net_t *st)
+{
+    // the last chunk, empty, tells streaming clients the response is complete
+    struct iovec iov = { "0\r\n\r\n", 5 };
+    struct msghdr msg;
+
+    net_flush(st);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    for (unsigned int i = 0; i < NET_MAX_CLIENTS; ++i)
+    {
+        if (st->clients[i].fd >= 0 && st->clients[i].streaming)
+            send_client(st, i, &msg, iov.iov_len);
+        if (st->clients[i].fd >= 0)
+            close_client(st, i);
+    }
+    close(st->fd);
+    free(st);
+}
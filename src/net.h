@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+
+/*
+ * Network audio output, selected by giving one of these as the output name:
+ *
+ *   udp://host:port    each packet as a datagram, to a unicast or multicast
+ *                      address; ?ttl=N after the port sets the TTL of the
+ *                      datagrams, which is 1 by default for multicast
+ *   rtp://host:port    the same with an RTP header (payload type 96, 44100 Hz
+ *                      clock, one 2048-sample AAC frame per packet)
+ *   http://[host]:port serve the packets to any number of clients as a
+ *                      chunked HTTP response
+ *
+ * A P1 frame carries a burst of audio packets, which are queued and sent
+ * together with sendmmsg where available when the frame ends.
+ */
+#define NET_BATCH 64
+#define NET_PACKET_LEN 2048
+#define NET_HEAD_LEN 32
+#define NET_MAX_CLIENTS 16
+// longest request, and how long a client has to send it, in seconds
+#define NET_REQUEST_LEN 4096
+#define NET_REQUEST_TIMEOUT 5
+
+typedef enum
+{
+    NET_UDP,
+    NET_RTP,
+    NET_HTTP
+} net_mode_t;
+
+typedef struct
+{
+    int fd;                 // -1 for free slots
+    unsigned int received;  // request bytes read
+    unsigned int matched;   // of the blank line ending the request
+    int streaming;          // answered, and sent the packets
+    time_t accepted;
+} net_client_t;
+
+typedef struct
+{
+    net_mode_t mode;
+    int fd;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    const char *content_type;
+
+    // RTP
+    uint16_t seq;
+    uint32_t timestamp;
+    uint32_t ssrc;
+
+    // HTTP clients
+    net_client_t clients[NET_MAX_CLIENTS];
+
+    // queued packets: framing in head, payload in data
+    unsigned int count;
+    uint8_t head[NET_BATCH][NET_HEAD_LEN];
+    uint8_t data[NET_BATCH][NET_PACKET_LEN];
+    struct iovec iov[NET_BATCH][3];
+} net_t;
+
+// Whether name is the address of a network output.
+int net_is_url(const char *name);
+// Open a network output, or exit if the address is invalid or cannot be
+// used. content_type is sent to HTTP clients.
+net_t *net_open(const char *url, const char *content_type);
+// Queue a packet made of hdr and pkt, sending the queue first if it is full.
+void net_push(net_t *st, const uint8_t *hdr, unsigned int hdr_len, const uint8_t *pkt, unsigned int len);
+// Send the queued packets.
+void net_flush(net_t *st);
+// Send the queued packets and the last chunk to HTTP clients, then close
+// the socket and the clients.
+void net_close(net_t *st);
@@ -0,0 +1,199 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "conv.h"
+#include "defines.h"
+#include "input.h"
+#include "nrsc5.h"
+#include "profile.h"
+
+struct nrsc5_t
+{
+    input_t input;
+};
+
+#ifdef USE_THREADS
+// the FFTW planner and the shared tables are not thread-safe
+static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+int nrsc5_set_profile(const char *name)
+{
+    int profile = profile_parse(name);
+
+    if (profile < 0)
+        return 1;
+#ifdef USE_THREADS
+    pthread_mutex_lock(&init_mutex);
+#endif
+    profile_set(profile);
+#ifdef USE_THREADS
+    pthread_mutex_unlock(&init_mutex);
+#endif
+    return 0;
+}
+
+int nrsc5_set_viterbi_segments(unsigned int segments)
+{
+    if (segments < 1 || segments > CONV_MAX_SEGMENTS)
+        return 1;
+#ifdef USE_THREADS
+    pthread_mutex_lock(&init_mutex);
+#endif
+    decode_set_segments(segments);
+#ifdef USE_THREADS
+    pthread_mutex_unlock(&init_mutex);
+#endif
+    return 0;
+}
+
+void nrsc5_set_fixed_point(int on)
+{
+#ifdef USE_THREADS
+    pthread_mutex_lock(&init_mutex);
+#endif
+    acquire_set_fixed_point(on);
+#ifdef USE_THREADS
+    pthread_mutex_unlock(&init_mutex);
+#endif
+}
+
+int nrsc5_set_viterbi_window(unsigned int window)
+{
+    if (window > FRAME_LEN)
+        return 1;
+#ifdef USE_THREADS
+    pthread_mutex_lock(&init_mutex);
+#endif
+    decode_set_window(window);
+#ifdef USE_THREADS
+    pthread_mutex_unlock(&init_mutex);
+#endif
+    return 0;
+}
+
+int nrsc5_set_viterbi_batch(unsigned int ms)
+{
+    if (ms > 1000)
+        return 1;
+#ifdef USE_THREADS
+    pthread_mutex_lock(&init_mutex);
+#endif
+    decode_set_batch(ms);
+#ifdef USE_THREADS
+    pthread_mutex_unlock(&init_mutex);
+#endif
+    return 0;
+}
+
+int nrsc5_open(nrsc5_t **result, unsigned int program)
+{
+    nrsc5_t *st;
+
+    if (program >= MAX_PROGRAMS && program != NRSC5_PROGRAM_ALL)
+        return 1;
+
+    st = malloc(sizeof(*st));
+    if (st == NULL)
+        return 1;
+
+#ifdef USE_THREADS
+    pthread_mutex_lock(&init_mutex);
+#endif
+    math_init();
+    input_init(&st->input, NULL, 0, program, NULL);
+#ifdef USE_THREADS
+    pthread_mutex_unlock(&init_mutex);
+#endif
+
+    *result = st;
+    return 0;
+}
+
+void nrsc5_close(nrsc5_t *st)
+{
+    if (st == NULL)
+        return;
+
+    input_wait(&st->input, 1);
+
+#ifdef USE_THREADS
+    pthread_mutex_lock(&init_mutex);
+#endif
+    input_free(&st->input);
+#ifdef USE_THREADS
+    pthread_mutex_unlock(&init_mutex);
+#endif
+
+    free(st);
+}
+
+size_t nrsc5_get_footprint(nrsc5_t *st)
+{
+    return st->input.footprint;
+}
+
+void nrsc5_set_callback(nrsc5_t *st, nrsc5_callback_t callback, void *opaque)
+{
+    input_set_event_callback(&st->input, callback, opaque);
+}
+
+void nrsc5_push_iq(nrsc5_t *st, const uint8_t *buf, unsigned int len)
+{
+    // Four bytes make a sample of the ring, so a chunk is at most a quarter
+    // of it. After input_wait at most half the ring is queued, and the next
+    // chunk always fits.
+    unsigned int chunk = st->input.buf_len / 4 * 4;
+
+    for (unsigned int i = 0, n; i < len; i += n)
+    {
+        n = len - i < chunk ? len - i : chunk;
+        // input_cb does not modify the samples
+        input_cb((uint8_t *)&buf[i], n, &st->input);
+        input_wait(&st->input, 0);
+    }
+}
+
+void nrsc5_flush(nrsc5_t *st)
+{
+    input_wait(&st->input, 1);
+}
+
+void nrsc5_get_stats(nrsc5_t *st, nrsc5_stats_t *stats)
+{
+#ifdef USE_THREADS
+    stats->sync_stalls = atomic_load(&st->input.sync.ring.stalls);
+    stats->decode_stalls = atomic_load(&st->input.decode.ring.stalls);
+#else
+    stats->sync_stalls = 0;
+    stats->decode_stalls = 0;
+#endif
+    stats->input_overruns = st->input.overruns;
+    stats->dropped_samples = st->input.stats.dropped_samples;
+
+    stats->synced = st->input.stats.synced;
+    stats->mer_lower = st->input.stats.mer_lower;
+    stats->mer_upper = st->input.stats.mer_upper;
+    stats->ber = st->input.stats.ber;
+    stats->cfo = st->input.stats.cfo;
+    stats->timing_offset = st->input.stats.timing_offset;
+    stats->sync_losses = st->input.stats.sync_losses;
+    stats->reacquire_time = st->input.stats.reacquire_time;
+    stats->latency = st->input.stats.latency;
+
+    stats->rs_corrected = st->input.stats.rs_corrected;
+    stats->rs_failed = st->input.stats.rs_failed;
+    stats->crc_errors = st->input.stats.crc_errors;
+}
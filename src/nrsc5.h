@@ -0,0 +1,153 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// sample rate expected by nrsc5_push_iq
+#define NRSC5_SAMPLE_RATE 1488375
+
+// decode every audio program of the station
+#define NRSC5_PROGRAM_ALL (~0u)
+
+typedef struct nrsc5_t nrsc5_t;
+
+enum
+{
+    NRSC5_EVENT_BER,
+    NRSC5_EVENT_MER,
+    NRSC5_EVENT_SYNC,
+    NRSC5_EVENT_LOST_SYNC,
+    NRSC5_EVENT_AUDIO,
+    NRSC5_EVENT_PSD,
+    NRSC5_EVENT_ID3
+};
+
+typedef struct
+{
+    unsigned int event;
+    union
+    {
+        struct {
+            float cber;
+        } ber;
+        struct {
+            float lower;
+            float upper;
+        } mer;
+        // HDC audio packet
+        struct {
+            unsigned int program;
+            const uint8_t *data;
+            unsigned int len;
+        } audio;
+        // program service data: port, sequence number and ID3 tag
+        struct {
+            unsigned int program;
+            const uint8_t *data;
+            unsigned int len;
+        } psd;
+        // text of the ID3 tag in PSD, UTF-8 and empty for missing frames;
+        // sent when the tag changes
+        struct {
+            unsigned int program;
+            const char *title;
+            const char *artist;
+            const char *album;
+            const char *genre;
+            const char *comment;
+        } id3;
+    };
+} nrsc5_event_t;
+
+// Events are delivered from the decoder threads. Pointers in the event are
+// only valid for the duration of the callback.
+typedef void (*nrsc5_callback_t) (const nrsc5_event_t *evt, void *opaque);
+
+// Size the buffers of the decoders opened afterwards: "default",
+// "low-latency", "low-memory" or "high-throughput". Returns 0 on success.
+int nrsc5_set_profile(const char *name);
+// Split the Viterbi decoding of each frame over segments threads, 1 to 16,
+// in the decoders opened afterwards. Returns 0 on success.
+int nrsc5_set_viterbi_segments(unsigned int segments);
+// Transform the OFDM symbols of the decoders opened afterwards with a
+// fixed-point FFT, if on is set, instead of FFTW, for processors with a slow
+// FPU. The audio is the same but for rare bit errors on weak signals.
+void nrsc5_set_fixed_point(int on);
+// Estimate the starting state of each frame in the Viterbi decoders opened
+// afterwards from its last window bits, at most 146176, the frame length;
+// 96 by default, and 0 decodes each frame twice instead. Returns 0 on
+// success.
+int nrsc5_set_viterbi_window(unsigned int window);
+// Decode the frames of all decoders opened afterwards together in batches
+// of up to 16, each frame waiting up to ms milliseconds, at most 1000, for
+// its batch to fill; 0, the default, decodes each frame alone. Returns 0 on
+// success.
+int nrsc5_set_viterbi_batch(unsigned int ms);
+// program is 0 to 3, or NRSC5_PROGRAM_ALL
+int nrsc5_open(nrsc5_t **result, unsigned int program);
+// Bytes of buffers held by the decoder.
+size_t nrsc5_get_footprint(nrsc5_t *st);
+void nrsc5_close(nrsc5_t *st);
+void nrsc5_set_callback(nrsc5_t *st, nrsc5_callback_t callback, void *opaque);
+// Push interleaved unsigned 8-bit IQ samples, len is in bytes and must be a
+// multiple of 4. Any len is decoded whole: the samples are fed in chunks of
+// a quarter of the input ring, about 1 MiB for the default profile and
+// 512 KiB for the low-memory and low-latency ones, and each call blocks
+// until the decoder has caught up with its chunk.
+void nrsc5_push_iq(nrsc5_t *st, const uint8_t *buf, unsigned int len);
+// Wait until all pushed samples have been processed.
+void nrsc5_flush(nrsc5_t *st);
+
+typedef struct
+{
+    // times a pipeline stage waited for the next one to free a buffer
+    unsigned long sync_stalls;
+    unsigned long decode_stalls;
+    // input buffers dropped
+    unsigned long input_overruns;
+    unsigned long dropped_samples;
+
+    // latest measurements
+    int synced;
+    float mer_lower;
+    float mer_upper;
+    float ber;
+    float cfo;
+    float timing_offset;
+    // times sync was lost, and the signal time it took to regain it last
+    unsigned long sync_losses;
+    float reacquire_time;
+    // seconds from the arrival of the last sample of a P1 frame until its
+    // audio reached the callback
+    float latency;
+
+    // audio frame headers corrected and lost, audio packets with bad CRC
+    unsigned long rs_corrected;
+    unsigned long rs_failed;
+    unsigned long crc_errors;
+} nrsc5_stats_t;
+
+void nrsc5_get_stats(nrsc5_t *st, nrsc5_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
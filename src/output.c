@@ -14,17 +14,22 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "bitreader.h"
 #include "bitwriter.h"
 #include "defines.h"
 #include "output.h"
+#include "profile.h"
+#include "stats.h"
+#include "trace.h"
 
-#ifdef HAVE_ID3V2LIB
-#include <id3v2lib.h>
-#endif
 
 #ifdef HAVE_FAAD2
 static ao_sample_format sample_format = {
@@ -36,34 +41,121 @@ static ao_sample_format sample_format = {
 };
 #endif
 
+void hdc_to_aac_init(void);
 void hdc_to_aac(bitreader_t *br, bitwriter_t *bw);
 
-static void write_adts_header(FILE *fp, unsigned int len)
+#define ADTS_HEADER_LEN 7
+
+static void adts_header(uint8_t hdr[ADTS_HEADER_LEN], unsigned int len)
 {
-    uint8_t hdr[7];
-    bitwriter_t bw;
+    unsigned int frame_len = len + ADTS_HEADER_LEN;
+
+    // sync word, MPEG-4, layer 0, no CRC
+    hdr[0] = 0xFF;
+    hdr[1] = 0xF1;
+    // AAC-LC, 22050 Hz, no private bit, 2-channel configuration
+    hdr[2] = (1 << 6) | (7 << 2) | (2 >> 2);
+    hdr[3] = ((2 & 3) << 6) | (frame_len >> 11);
+    hdr[4] = frame_len >> 3;
+    // buffer fullness 0x7FF (VBR), 1 AAC frame per ADTS frame
+    hdr[5] = ((frame_len & 7) << 5) | (0x7FF >> 6);
+    hdr[6] = (0x7FF & 0x3F) << 2;
+}
+
+static uint64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void write_all(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            log_error("Unable to write audio output: %s", strerror(errno));
+            return;
+        }
+
+        // skip what was written, for short writes
+        for (; iovcnt > 0 && (size_t)n >= iov->iov_len; iov++, iovcnt--)
+            n -= iov->iov_len;
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+void output_flush(output_t *st)
+{
+    struct iovec iov;
+
+    if (st->net)
+    {
+        net_flush(st->net);
+        return;
+    }
 
-    bw_init(&bw, hdr);
-    bw_addbits(&bw, 0xFFF, 12); // sync word
-    bw_addbits(&bw, 0, 1); // MPEG-4
-    bw_addbits(&bw, 0, 2); // Layer
-    bw_addbits(&bw, 1, 1); // no CRC
-    bw_addbits(&bw, 1, 2); // AAC-LC
-    bw_addbits(&bw, 7, 4); // 22050 HZ
-    bw_addbits(&bw, 0, 1); // private bit
-    bw_addbits(&bw, 2, 3); // 2-channel configuration
-    bw_addbits(&bw, 0, 1);
-    bw_addbits(&bw, 0, 1);
-    bw_addbits(&bw, 0, 1);
-    bw_addbits(&bw, 0, 1);
-    bw_addbits(&bw, len + 7, 13); // frame length
-    bw_addbits(&bw, 0x7FF, 11); // buffer fullness (VBR)
-    bw_addbits(&bw, 0, 2); // 1 AAC frame per ADTS frame
-
-    fwrite(hdr, 7, 1, fp);
+    if (st->outbuf == NULL || st->outbuf_used == 0)
+        return;
+
+    iov.iov_base = st->outbuf;
+    iov.iov_len = st->outbuf_used;
+    write_all(st->fd, &iov, 1);
+    st->outbuf_used = 0;
 }
 
-static void dump_adts(FILE *fp, uint8_t *pkt, unsigned int len)
+// Write a packet with an ADTS header, or buffer it for output_flush().
+static void write_packet(output_t *st, const uint8_t *pkt, unsigned int len)
+{
+    uint8_t hdr[ADTS_HEADER_LEN];
+    struct iovec iov[2];
+
+    adts_header(hdr, len);
+
+    if (st->net)
+    {
+        net_push(st->net, hdr, ADTS_HEADER_LEN, pkt, len);
+        return;
+    }
+
+    if (st->outbuf && st->outbuf_used + ADTS_HEADER_LEN + len > st->outbuf_len)
+        output_flush(st);
+
+    if (st->outbuf == NULL || ADTS_HEADER_LEN + len > st->outbuf_len)
+    {
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = ADTS_HEADER_LEN;
+        iov[1].iov_base = (void *)pkt;
+        iov[1].iov_len = len;
+        write_all(st->fd, iov, 2);
+        return;
+    }
+
+    if (st->outbuf_used == 0)
+        st->flush_deadline = now_ms() + st->flush_ms;
+    memcpy(&st->outbuf[st->outbuf_used], hdr, ADTS_HEADER_LEN);
+    memcpy(&st->outbuf[st->outbuf_used + ADTS_HEADER_LEN], pkt, len);
+    st->outbuf_used += ADTS_HEADER_LEN + len;
+
+    if (now_ms() >= st->flush_deadline)
+        output_flush(st);
+}
+
+void output_frame_end(output_t *st)
+{
+    if (st->net)
+        net_flush(st->net);
+}
+
+static void dump_adts(output_t *st, uint8_t *pkt, unsigned int len)
 {
     uint8_t tmp[1024];
     bitreader_t br;
@@ -74,56 +166,65 @@ static void dump_adts(FILE *fp, uint8_t *pkt, unsigned int len)
     hdc_to_aac(&br, &bw);
     len = bw_flush(&bw);
 
-    write_adts_header(fp, len);
-    fwrite(tmp, len, 1, fp);
-    fflush(fp);
+    write_packet(st, tmp, len);
 }
 
-static void dump_hdc(FILE *fp, uint8_t *pkt, unsigned int len)
+static void dump_hdc(output_t *st, uint8_t *pkt, unsigned int len)
 {
-    write_adts_header(fp, len);
-    fwrite(pkt, len, 1, fp);
-    fflush(fp);
+    write_packet(st, pkt, len);
 }
 
-void output_reset_buffers(output_t *st)
+#if defined(HAVE_FAAD2) && defined(USE_THREADS)
+// Wait for a free audio slot. Returns 0 if live output is still behind
+// after a couple of frames, so that decoding does not stall.
+static int output_wait_slot(output_t *st)
 {
-#ifdef USE_THREADS
-    output_buffer_t *ob;
+    struct timespec ts;
 
-    // find the end of the head list
-    for (ob = st->head; ob && ob->next; ob = ob->next) { }
+    if (ring_has_space(&st->ring))
+        return 1;
+    if (st->method == OUTPUT_WAV)
+        return ring_wait_space(&st->ring, NULL) == 0;
 
-    // if the head list is non-empty, prepend to free list
-    if (ob != NULL)
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 100000000;
+    if (ts.tv_nsec >= 1000000000)
     {
-        ob->next = st->free;
-        st->free = st->head;
+        ts.tv_nsec -= 1000000000;
+        ts.tv_sec += 1;
     }
-
-    st->head = NULL;
-    st->tail = NULL;
-#endif
+    return ring_wait_space(&st->ring, &ts) == 0;
 }
+#endif
 
 void output_push(output_t *st, uint8_t *pkt, unsigned int len)
 {
     if (st->method == OUTPUT_ADTS)
     {
-        dump_adts(st->outfp, pkt, len);
+        dump_adts(st, pkt, len);
         return;
     }
     else if (st->method == OUTPUT_HDC)
     {
-        dump_hdc(st->outfp, pkt, len);
+        dump_hdc(st, pkt, len);
         return;
     }
 
 #ifdef HAVE_FAAD2
-    void *buffer;
+    void *buffer = NULL;
     NeAACDecFrameInfo info;
 
-    buffer = NeAACDecDecode(st->handle, &info, pkt, len);
+#ifdef USE_THREADS
+    // decode into the next slot, or into the decoder's own buffer to keep
+    // its state if the frame has to be dropped
+    int slot = output_wait_slot(st);
+    if (slot)
+        buffer = &st->audio[ring_head(&st->ring) * AUDIO_FRAME_BYTES];
+#endif
+    if (buffer)
+        NeAACDecDecode2(st->handle, &info, pkt, len, &buffer, AUDIO_FRAME_BYTES);
+    else
+        buffer = NeAACDecDecode(st->handle, &info, pkt, len);
     if (info.error > 0)
     {
         log_error("Decode error: %s", NeAACDecGetErrorMessage(info.error));
@@ -132,46 +233,19 @@ void output_push(output_t *st, uint8_t *pkt, unsigned int len)
     if (info.error == 0 && info.samples > 0)
     {
         unsigned int bytes = info.samples * sample_format.bits / 8;
-        output_buffer_t *ob;
 
         assert(bytes == AUDIO_FRAME_BYTES);
 
 #ifdef USE_THREADS
-        struct timespec ts;
-        clock_gettime(CLOCK_REALTIME, &ts);
-        ts.tv_nsec += 100000000;
-        if (ts.tv_nsec >= 1000000000)
-        {
-            ts.tv_nsec -= 1000000000;
-            ts.tv_sec += 1;
-        }
-
-        pthread_mutex_lock(&st->mutex);
-        while (st->free == NULL)
+        if (!slot)
         {
-            if (pthread_cond_timedwait(&st->cond, &st->mutex, &ts) == ETIMEDOUT)
-            {
-                log_warn("Audio output timed out, dropping samples");
-                output_reset_buffers(st);
-            }
+            log_warn("Audio output overflow, dropping samples");
+            stats_add(&st->overruns, 1);
+            return;
         }
-        ob = st->free;
-        st->free = ob->next;
-        pthread_mutex_unlock(&st->mutex);
-
-        memcpy(ob->data, buffer, bytes);
-
-        pthread_mutex_lock(&st->mutex);
-        ob->next = NULL;
-        if (st->tail)
-            st->tail->next = ob;
-        else
-            st->head = ob;
-        st->tail = ob;
-        pthread_mutex_unlock(&st->mutex);
-        pthread_cond_signal(&st->cond);
+        ring_push(&st->ring);
 #else
-        ao_play(st->dev, (void *)buffer, AUDIO_FRAME_BYTES);
+        ao_play(st->dev, buffer, AUDIO_FRAME_BYTES);
 #endif
     }
 #endif
@@ -180,30 +254,32 @@ void output_push(output_t *st, uint8_t *pkt, unsigned int len)
 #if defined(HAVE_FAAD2) && defined(USE_THREADS)
 static void *output_worker(void *arg)
 {
+    static char silence[AUDIO_FRAME_BYTES];
     output_t *st = arg;
+    int playing = 0;
 
-    while (1)
+    while (ring_wait_data(&st->ring))
     {
-        output_buffer_t *ob;
-
-        pthread_mutex_lock(&st->mutex);
-        while (st->head == NULL)
-            pthread_cond_wait(&st->cond, &st->mutex);
-        // unlink from head list
-        ob = st->head;
-        st->head = ob->next;
-        if (st->head == NULL)
-            st->tail = NULL;
-        pthread_mutex_unlock(&st->mutex);
-
-        ao_play(st->dev, (void *)ob->data, AUDIO_FRAME_BYTES);
-
-        pthread_mutex_lock(&st->mutex);
-        // add to free list
-        ob->next = st->free;
-        st->free = ob;
-        pthread_mutex_unlock(&st->mutex);
-        pthread_cond_signal(&st->cond);
+        // Audio comes in bursts, one P1 frame at a time. Starting a little
+        // late with silence lets a burst arrive up to target frames late
+        // without a gap.
+        if (!playing && st->method == OUTPUT_LIVE)
+        {
+            for (unsigned int i = 0; i < st->target; ++i)
+                ao_play(st->dev, silence, AUDIO_FRAME_BYTES);
+            playing = 1;
+        }
+
+        uint64_t span = trace_begin();
+        ao_play(st->dev, (void *)&st->audio[ring_tail(&st->ring) * AUDIO_FRAME_BYTES], AUDIO_FRAME_BYTES);
+        trace_end(TRACE_PLAY, span);
+        ring_pop(&st->ring);
+
+        if (playing && ring_is_empty(&st->ring) && !atomic_load(&st->ring.stop))
+        {
+            stats_add(&st->underruns, 1);
+            playing = 0;
+        }
     }
 
     return NULL;
@@ -222,40 +298,75 @@ void output_reset(output_t *st)
         NeAACDecClose(st->handle);
 
     NeAACDecInitHDC(&st->handle, &samprate);
-
-    output_reset_buffers(st);
 #endif
 }
 
+static int open_file(output_t *st, const char *name, const char *content_type)
+{
+    st->outbuf = NULL;
+    st->outbuf_used = 0;
+    st->footprint = 0;
+    st->net = NULL;
+    if (net_is_url(name))
+    {
+        st->net = net_open(name, content_type);
+        st->footprint += sizeof(*st->net);
+        st->fd = -1;
+        return 0;
+    }
+    if (strcmp(name, "-") == 0)
+        st->fd = STDOUT_FILENO;
+    else
+        st->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    return st->fd;
+}
+
+void output_set_flush(output_t *st, unsigned int ms)
+{
+    // network output is sent a frame at a time
+    if ((st->method != OUTPUT_ADTS && st->method != OUTPUT_HDC) || st->net)
+        return;
+
+    output_flush(st);
+    if (st->outbuf)
+        st->footprint -= st->outbuf_len;
+    free(st->outbuf);
+    st->outbuf = NULL;
+    st->flush_ms = ms;
+    if (ms)
+    {
+        st->outbuf_len = profile_get()->output_len;
+        st->outbuf = malloc(st->outbuf_len);
+        if (st->outbuf == NULL)
+            FATAL_EXIT("Unable to allocate output buffer.");
+        st->footprint += st->outbuf_len;
+    }
+}
+
 void output_init_adts(output_t *st, const char *name)
 {
     st->method = OUTPUT_ADTS;
+    atomic_init(&st->overruns, 0);
+    atomic_init(&st->underruns, 0);
+    hdc_to_aac_init();
 
-    if (strcmp(name, "-") == 0)
-        st->outfp = stdout;
-    else
-        st->outfp = fopen(name, "wb");
-    if (st->outfp == NULL)
+    if (open_file(st, name, "audio/aac") < 0)
         FATAL_EXIT("Unable to open output adts file.");
 }
 
 void output_init_hdc(output_t *st, const char *name)
 {
     st->method = OUTPUT_HDC;
+    atomic_init(&st->overruns, 0);
+    atomic_init(&st->underruns, 0);
 
-    if (strcmp(name, "-") == 0)
-        st->outfp = stdout;
-    else
-        st->outfp = fopen(name, "wb");
-    if (st->outfp == NULL)
+    if (open_file(st, name, "application/octet-stream") < 0)
         FATAL_EXIT("Unable to open output adts-hdc file.");
 }
 
 #ifdef HAVE_FAAD2
 static void output_init_ao(output_t *st, int driver, const char *name)
 {
-    unsigned int i;
-
     if (name)
         st->dev = ao_open_file(driver, name, 1, &sample_format, NULL);
     else
@@ -263,20 +374,15 @@ static void output_init_ao(output_t *st, int driver, const char *name)
     if (st->dev == NULL)
         FATAL_EXIT("Unable to open output wav file.");
 
+    st->footprint = 0;
 #ifdef USE_THREADS
-    st->head = NULL;
-    st->tail = NULL;
-    st->free = NULL;
-
-    for (i = 0; i < 32; ++i)
-    {
-        output_buffer_t *ob = malloc(sizeof(output_buffer_t));
-        ob->next = st->free;
-        st->free = ob;
-    }
-
-    pthread_cond_init(&st->cond, NULL);
-    pthread_mutex_init(&st->mutex, NULL);
+    unsigned int depth = profile_get()->audio_depth;
+    st->target = profile_get()->audio_target;
+    st->audio = malloc(AUDIO_FRAME_BYTES * depth);
+    if (st->audio == NULL)
+        FATAL_EXIT("Unable to allocate audio buffer.");
+    st->footprint += AUDIO_FRAME_BYTES * depth;
+    ring_init(&st->ring, depth);
     pthread_create(&st->worker_thread, NULL, output_worker, st);
 #ifdef HAVE_PTHREAD_SETNAME_NP
     pthread_setname_np(st->worker_thread, "output");
@@ -290,6 +396,8 @@ static void output_init_ao(output_t *st, int driver, const char *name)
 void output_init_wav(output_t *st, const char *name)
 {
     st->method = OUTPUT_WAV;
+    atomic_init(&st->overruns, 0);
+    atomic_init(&st->underruns, 0);
 
     ao_initialize();
     output_init_ao(st, ao_driver_id("wav"), name);
@@ -298,63 +406,58 @@ void output_init_wav(output_t *st, const char *name)
 void output_init_live(output_t *st)
 {
     st->method = OUTPUT_LIVE;
+    atomic_init(&st->overruns, 0);
+    atomic_init(&st->underruns, 0);
 
     ao_initialize();
     output_init_ao(st, ao_default_driver_id(), NULL);
 }
 #endif
 
-#ifdef HAVE_ID3V2LIB
-static void display_text_content(const char *header, ID3v2_frame *frame)
-{
-    if (frame == NULL)
-        return;
-
-    ID3v2_frame_text_content *content = parse_text_frame_content(frame);
-
-    char temp[content->size + 1];
-    memcpy(temp, content->data, content->size);
-    temp[content->size] = '\0';
-    log_info("%s: %s", header, temp);
-
-    free(content);
-}
-#endif
-
-void output_psd_push(uint8_t *psd, unsigned int len)
+void output_free(output_t *st)
 {
-#ifdef HAVE_ID3V2LIB
-    uint16_t port = *(uint16_t *)psd;
-    uint16_t seq = *(uint16_t *)(psd + 2);
-    if (port != 0x5100)
-    {
-        log_warn("unknown PSD port %x %x\n", port, seq);
-        return;
-    }
-
-    ID3v2_tag *tag = load_tag_with_buffer((char *)(psd + 4), len - 4);
-    if (tag == NULL)
+    if (st->method == OUTPUT_ADTS || st->method == OUTPUT_HDC)
     {
-        log_info("invalid psd");
+        if (st->net)
+        {
+            net_close(st->net);
+            st->net = NULL;
+        }
+        else
+        {
+            output_flush(st);
+            if (st->fd != STDOUT_FILENO)
+                close(st->fd);
+        }
+        free(st->outbuf);
+        st->outbuf = NULL;
         return;
     }
 
-    ID3v2_frame *title_frame = tag_get_title(tag);
-    display_text_content("Title", title_frame);
-    free(title_frame);
-
-    ID3v2_frame *artist_frame = tag_get_artist(tag);
-    display_text_content("Artist", artist_frame);
-    free(artist_frame);
-
-    ID3v2_frame *genre_frame = tag_get_genre(tag);
-    display_text_content("Genre", genre_frame);
-    free(genre_frame);
-
-    ID3v2_frame *comment_frame = tag_get_comment(tag);
-    display_text_content("Comment", comment_frame);
-    free(comment_frame);
-
-    free(tag);
+#ifdef HAVE_FAAD2
+#ifdef USE_THREADS
+    // the worker plays the remaining frames before it exits
+    ring_stop(&st->ring);
+    pthread_join(st->worker_thread, NULL);
+    ring_destroy(&st->ring);
+    free(st->audio);
+#endif
+    ao_close(st->dev);
+    if (st->handle)
+        NeAACDecClose(st->handle);
 #endif
 }
+
+void output_id3_push(output_t *st, const id3_t *tag)
+{
+    if (tag->title[0])
+        log_info("Title: %s", tag->title);
+    if (tag->artist[0])
+        log_info("Artist: %s", tag->artist);
+    if (tag->album[0])
+        log_info("Album: %s", tag->album);
+    if (tag->genre[0])
+        log_info("Genre: %s", tag->genre);
+    if (tag->comment[0])
+        log_info("Comment: %s", tag->comment);
+}
@@ -5,9 +5,13 @@
 #include <neaacdec.h>
 #endif
 
-#ifdef USE_THREADS
-#include <pthread.h>
-#endif
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "id3.h"
+#include "net.h"
+#include "ring.h"
 
 #define AUDIO_FRAME_BYTES 8192
 
@@ -19,36 +23,61 @@ typedef enum
     OUTPUT_LIVE
 } output_method_t;
 
-typedef struct output_buffer_t
-{
-    struct output_buffer_t *next;
-    uint8_t data[AUDIO_FRAME_BYTES];
-} output_buffer_t;
-
 typedef struct
 {
     output_method_t method;
 
-    FILE *outfp;
+    // ADTS and HDC file, or network output instead if net is set
+    int fd;
+    net_t *net;
+    // packets buffered by output_set_flush(), outbuf_len bytes
+    uint8_t *outbuf;
+    unsigned int outbuf_len;
+    unsigned int outbuf_used;
+    unsigned int flush_ms;
+    uint64_t flush_deadline;
 
 #ifdef HAVE_FAAD2
     ao_device *dev;
     NeAACDecHandle handle;
 #endif
 #ifdef USE_THREADS
-    output_buffer_t *head, *tail, *free;
+    // frames of PCM queued for the output worker, as many as the ring has
+    // slots, which FAAD2 decodes into
+    uint8_t *audio;
+    ring_t ring;
     pthread_t worker_thread;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
+    // frames of silence played when live audio starts or resumes
+    unsigned int target;
 #endif
+    // audio frames dropped because the output could not keep up, and times
+    // live audio ran out
+    atomic_ulong overruns;
+    atomic_ulong underruns;
+    // bytes of buffers
+    size_t footprint;
 } output_t;
 
 void output_push(output_t *st, uint8_t *pkt, unsigned int len);
 void output_reset(output_t *st);
 void output_init_adts(output_t *st, const char *name);
 void output_init_hdc(output_t *st, const char *name);
+/*
+ * Buffer ADTS and HDC packets instead of writing each one as it arrives.
+ * Buffered packets are written once the buffer, sized by the profile (see
+ * profile.h), is full, when a packet arrives ms or more after the oldest
+ * pending one, and by output_flush(). A ms of 0 writes every packet.
+ */
+void output_set_flush(output_t *st, unsigned int ms);
+void output_flush(output_t *st);
+// Write what is pending, wait for the audio queued for playback, and close
+// the output.
+void output_free(output_t *st);
+// Called after the packets of a P1 frame, to send them to a network output
+// in one go.
+void output_frame_end(output_t *st);
 #ifdef HAVE_FAAD2
 void output_init_wav(output_t *st, const char *name);
 void output_init_live(output_t *st);
 #endif
-void output_psd_push(uint8_t *psd, unsigned int len);
+void output_id3_push(output_t *st, const id3_t *tag);
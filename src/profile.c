@@ -0,0 +1,61 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "defines.h"
+#include "profile.h"
+
+// The input ring holds an acquisition window of 140400 samples besides
+// the samples of the largest push, 131072 for a 512 KiB rtl-sdr buffer, so
+// it cannot be smaller than 1 << 19. The audio ring takes the 32 frames of
+// a P1 frame on top of the playout delay.
+//
+// Low latency transfers 22 ms of samples at a time instead of 88 ms, and
+// hands the OFDM symbols to sync in groups of 8 instead of 64, which saves
+// up to 250 ms before a P1 frame is decoded.
+static const profile_t profiles[] = {
+    [PROFILE_DEFAULT] = { 512 * 1024, 1 << 20, 0, SYNC_DEPTH, DECODE_DEPTH, AUDIO_DEPTH, AUDIO_TARGET, 64 * 1024, 0 },
+    [PROFILE_LOW_LATENCY] = { 128 * 1024, 1 << 19, BLKSZ / 4, 2, 1, 36, 2, 16 * 1024, 0 },
+    [PROFILE_LOW_MEMORY] = { 512 * 1024, 1 << 19, 0, 2, 1, 36, 2, 16 * 1024, 1 },
+    [PROFILE_HIGH_THROUGHPUT] = { 512 * 1024, 1 << 21, 0, 16, 4, 64, 16, 256 * 1024, 0 },
+};
+
+static const char *const names[] = {
+    [PROFILE_DEFAULT] = "default",
+    [PROFILE_LOW_LATENCY] = "low-latency",
+    [PROFILE_LOW_MEMORY] = "low-memory",
+    [PROFILE_HIGH_THROUGHPUT] = "high-throughput",
+};
+
+static int current = PROFILE_DEFAULT;
+
+void profile_set(int profile)
+{
+    current = profile;
+}
+
+const profile_t *profile_get(void)
+{
+    return &profiles[current];
+}
+
+int profile_parse(const char *name)
+{
+    for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    return -1;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+/*
+ * Buffer sizes, chosen at run time for the decoders created afterwards.
+ *
+ * The default profile matches the compile-time SYNC_DEPTH, DECODE_DEPTH,
+ * AUDIO_DEPTH and AUDIO_TARGET. The others trade memory and queueing delay
+ * against tolerance to scheduling hiccups.
+ */
+enum
+{
+    PROFILE_DEFAULT,
+    // shallow queues, for the shortest delay from antenna to speaker
+    PROFILE_LOW_LATENCY,
+    // smallest buffers, for packing many decoders into little memory
+    PROFILE_LOW_MEMORY,
+    // deep queues, for busy machines and offline decoding
+    PROFILE_HIGH_THROUGHPUT
+};
+
+typedef struct
+{
+    // bytes per rtl-sdr transfer, used by the nrsc5 program
+    unsigned int radio_buffer;
+    // input ring in samples at NRSC5_SAMPLE_RATE / 2, a power of two
+    unsigned int input_len;
+    // OFDM symbols transformed at a time once the symbol timing is locked,
+    // or 0 to keep the whole acquisition window (see acquire.h)
+    unsigned int acq_group;
+    // slots of the sync (OFDM blocks), decode (P1 frames) and audio
+    // (PCM frames) rings
+    unsigned int sync_depth;
+    unsigned int decode_depth;
+    unsigned int audio_depth;
+    // PCM frames of silence played before live audio starts, see output.h
+    unsigned int audio_target;
+    // bytes of ADTS and HDC output buffered by output_set_flush()
+    unsigned int output_len;
+    // transform the acquisition window in place, instead of into a
+    // separate buffer of the same size
+    int fft_in_place;
+} profile_t;
+
+// Not thread-safe, set it before creating decoders.
+void profile_set(int profile);
+const profile_t *profile_get(void);
+// Profile named default, low-latency, low-memory or high-throughput, or
+// -1 if unknown.
+int profile_parse(const char *name);
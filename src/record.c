@@ -0,0 +1,489 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "log.h"
+#include "record.h"
+#include "ring.h"
+
+// bytes per slot, one chunk of decimated samples
+#define RECORD_SLOT_LEN (RECORD_CHUNK_MAX * 4)
+// slots queued for the writer, about 2.8 s at the u8 input rate
+#define RECORD_DEPTH 64
+// zstd level, the fastest setting still halves a u8 capture
+#define RECORD_ZSTD_LEVEL 1
+
+typedef struct
+{
+    unsigned int len;
+    uint64_t index;
+    int64_t time_ns;
+} record_slot_t;
+
+struct record
+{
+    int fd;
+    int format;
+
+    uint8_t *slot[RECORD_DEPTH];
+    record_slot_t meta[RECORD_DEPTH];
+    // producer: the head slot is being filled
+    int filling;
+    unsigned int fill;
+    uint64_t index;
+    int dropping;
+    unsigned long dropped;
+
+    // writer: chunk header and encoded payload
+    uint8_t *chunk;
+#ifdef HAVE_ZSTD
+    ZSTD_CStream *zs;
+    uint8_t *zout;
+    size_t zout_len;
+#endif
+#ifdef USE_THREADS
+    ring_t ring;
+    pthread_t writer_thread;
+#endif
+};
+
+static const char *format_names[] = { "u8", "q15", "bfp8", "bfp4" };
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, v);
+    put_le16(p + 2, v >> 16);
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+    put_le32(p, v);
+    put_le32(p + 4, v >> 32);
+}
+
+static void put_double(uint8_t *p, double v)
+{
+    uint64_t u;
+    memcpy(&u, &v, sizeof(u));
+    put_le64(p, u);
+}
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int16_t sat16(int v)
+{
+    return v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+}
+
+static int quantize(int v, int shift, int max)
+{
+    if (shift)
+        v = (v + (1 << (shift - 1))) >> shift;
+    return v > max ? max : v < -max ? -max : v;
+}
+
+static unsigned int encode_bfp(int bits, const cint16_t *x, unsigned int n, uint8_t *out)
+{
+    int max = (1 << (bits - 1)) - 1;
+    uint8_t *p = out;
+
+    for (unsigned int i = 0; i < n; i += RECORD_BFP_BLOCK)
+    {
+        unsigned int m = n - i < RECORD_BFP_BLOCK ? n - i : RECORD_BFP_BLOCK;
+        int peak = 0, shift = 0;
+
+        for (unsigned int j = 0; j < m; ++j)
+        {
+            int r = abs(x[i + j].r), q = abs(x[i + j].i);
+            if (r > peak)
+                peak = r;
+            if (q > peak)
+                peak = q;
+        }
+        while ((peak >> shift) > max)
+            shift++;
+
+        *p++ = shift;
+        for (unsigned int j = 0; j < m; ++j)
+        {
+            int r = quantize(x[i + j].r, shift, max);
+            int q = quantize(x[i + j].i, shift, max);
+            if (bits == 8)
+            {
+                *p++ = (uint8_t)r;
+                *p++ = (uint8_t)q;
+            }
+            else
+            {
+                *p++ = (r & 15) | (q << 4);
+            }
+        }
+    }
+    return p - out;
+}
+
+unsigned int record_payload_len(int format, unsigned int block, unsigned int n)
+{
+    unsigned int blocks = (n + block - 1) / block;
+
+    switch (format)
+    {
+    case RECORD_Q15:
+        return n * 4;
+    case RECORD_BFP8:
+        return blocks + n * 2;
+    case RECORD_BFP4:
+        return blocks + n;
+    }
+    return n * 2;
+}
+
+void record_decode(int format, unsigned int block, const uint8_t *in, unsigned int n, cint16_t *out)
+{
+    if (format == RECORD_Q15)
+    {
+        for (unsigned int i = 0; i < n; ++i, in += 4)
+        {
+            out[i].r = (int16_t)(in[0] | (in[1] << 8));
+            out[i].i = (int16_t)(in[2] | (in[3] << 8));
+        }
+        return;
+    }
+
+    for (unsigned int i = 0; i < n; i += block)
+    {
+        unsigned int m = n - i < block ? n - i : block;
+        int shift = *in++;
+
+        for (unsigned int j = 0; j < m; ++j)
+        {
+            int r, q;
+            if (format == RECORD_BFP8)
+            {
+                r = (int8_t)in[0];
+                q = (int8_t)in[1];
+                in += 2;
+            }
+            else
+            {
+                r = (int8_t)(in[0] << 4) >> 4;
+                q = (int8_t)in[0] >> 4;
+                in += 1;
+            }
+            out[i + j].r = sat16(r * (1 << shift));
+            out[i + j].i = sat16(q * (1 << shift));
+        }
+    }
+}
+
+int record_parse_format(const char *name)
+{
+    for (unsigned int i = 0; i < sizeof(format_names) / sizeof(format_names[0]); ++i)
+    {
+        if (strcmp(name, format_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static void write_all(record r, const uint8_t *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(r->fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            log_error("Unable to write samples: %s", strerror(errno));
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+static void emit(record r, const uint8_t *buf, size_t len)
+{
+#ifdef HAVE_ZSTD
+    if (r->zs)
+    {
+        ZSTD_inBuffer in = { buf, len, 0 };
+        while (in.pos < in.size)
+        {
+            ZSTD_outBuffer out = { r->zout, r->zout_len, 0 };
+            size_t ret = ZSTD_compressStream(r->zs, &out, &in);
+            if (ZSTD_isError(ret))
+            {
+                log_error("zstd encoder error: %s", ZSTD_getErrorName(ret));
+                return;
+            }
+            write_all(r, r->zout, out.pos);
+        }
+        return;
+    }
+#endif
+    write_all(r, buf, len);
+}
+
+static void write_slot(record r, unsigned int i)
+{
+    const record_slot_t *meta = &r->meta[i];
+    unsigned int n = meta->len / 4, len;
+    const cint16_t *x = (const cint16_t *)r->slot[i];
+    uint8_t *p = r->chunk + RECORD_CHUNK_HEADER_LEN;
+
+    if (r->format == RECORD_U8)
+    {
+        emit(r, r->slot[i], meta->len);
+        return;
+    }
+
+    put_le32(r->chunk, n);
+    put_le32(r->chunk + 4, 0);
+    put_le64(r->chunk + 8, meta->index);
+    put_le64(r->chunk + 16, meta->time_ns);
+
+    if (r->format == RECORD_Q15)
+    {
+        for (unsigned int j = 0; j < n; ++j, p += 4)
+        {
+            put_le16(p, x[j].r);
+            put_le16(p + 2, x[j].i);
+        }
+        len = n * 4;
+    }
+    else
+    {
+        len = encode_bfp(r->format == RECORD_BFP8 ? 8 : 4, x, n, p);
+    }
+    emit(r, r->chunk, RECORD_CHUNK_HEADER_LEN + len);
+}
+
+#ifdef USE_THREADS
+static void *record_worker(void *arg)
+{
+    record r = arg;
+
+    while (ring_wait_data(&r->ring))
+    {
+        write_slot(r, ring_tail(&r->ring));
+        ring_pop(&r->ring);
+    }
+    return NULL;
+}
+#endif
+
+static int start_slot(record r)
+{
+#ifdef USE_THREADS
+    if (!ring_has_space(&r->ring))
+    {
+        if (!r->dropping)
+            log_warn("recording buffer overflow!");
+        r->dropping = 1;
+        return -1;
+    }
+    r->dropping = 0;
+    unsigned int slot = ring_head(&r->ring);
+#else
+    unsigned int slot = 0;
+#endif
+    r->meta[slot].index = r->index;
+    r->meta[slot].time_ns = now_ns();
+    r->filling = 1;
+    r->fill = 0;
+    return 0;
+}
+
+static void finish_slot(record r)
+{
+#ifdef USE_THREADS
+    r->meta[ring_head(&r->ring)].len = r->fill;
+    ring_push(&r->ring);
+#else
+    r->meta[0].len = r->fill;
+    write_slot(r, 0);
+#endif
+    r->filling = 0;
+}
+
+// Append len bytes of samples of size bytes each.
+static void append(record r, const uint8_t *buf, unsigned int len, unsigned int size)
+{
+    while (len > 0)
+    {
+        uint8_t *slot;
+        unsigned int n;
+
+        if (!r->filling && start_slot(r) != 0)
+        {
+            r->index += len / size;
+            r->dropped += len / size;
+            return;
+        }
+#ifdef USE_THREADS
+        slot = r->slot[ring_head(&r->ring)];
+#else
+        slot = r->slot[0];
+#endif
+        n = RECORD_SLOT_LEN - r->fill < len ? RECORD_SLOT_LEN - r->fill : len;
+        memcpy(slot + r->fill, buf, n);
+        r->fill += n;
+        r->index += n / size;
+        buf += n;
+        len -= n;
+
+        if (r->fill == RECORD_SLOT_LEN)
+            finish_slot(r);
+    }
+}
+
+void record_push_u8(record r, const uint8_t *buf, unsigned int len)
+{
+    if (r->format == RECORD_U8)
+        append(r, buf, len, 2);
+}
+
+void record_push_iq(record r, const cint16_t *x, unsigned int n)
+{
+    if (r->format != RECORD_U8)
+        append(r, (const uint8_t *)x, n * sizeof(cint16_t), sizeof(cint16_t));
+}
+
+int record_format(record r)
+{
+    return r->format;
+}
+
+record record_open(const char *name, int format, double sample_rate, double center)
+{
+    size_t n = strlen(name);
+    int compress = n >= 4 && strcmp(name + n - 4, ".zst") == 0;
+    record r;
+
+#ifndef HAVE_ZSTD
+    if (compress)
+    {
+        log_error("zstd support not compiled in");
+        return NULL;
+    }
+#endif
+
+    r = calloc(1, sizeof(*r));
+    r->format = format;
+    r->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (r->fd < 0)
+    {
+        free(r);
+        return NULL;
+    }
+
+#ifdef HAVE_ZSTD
+    if (compress)
+    {
+        r->zs = ZSTD_createCStream();
+        ZSTD_initCStream(r->zs, RECORD_ZSTD_LEVEL);
+        r->zout_len = ZSTD_CStreamOutSize();
+        r->zout = malloc(r->zout_len);
+    }
+#endif
+
+    r->chunk = malloc(RECORD_CHUNK_HEADER_LEN + RECORD_SLOT_LEN);
+    if (format != RECORD_U8)
+    {
+        uint8_t *h = r->chunk;
+
+        memset(h, 0, RECORD_HEADER_LEN);
+        memcpy(h, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+        h[8] = 1;
+        h[9] = format;
+        put_le16(h + 10, RECORD_BFP_BLOCK);
+        put_double(h + 16, sample_rate);
+        put_double(h + 24, center);
+        put_le64(h + 32, now_ns());
+        emit(r, h, RECORD_HEADER_LEN);
+    }
+
+#ifdef USE_THREADS
+    for (int i = 0; i < RECORD_DEPTH; ++i)
+        r->slot[i] = malloc(RECORD_SLOT_LEN);
+    ring_init(&r->ring, RECORD_DEPTH);
+    pthread_create(&r->writer_thread, NULL, record_worker, r);
+#ifdef HAVE_PTHREAD_SETNAME_NP
+    pthread_setname_np(r->writer_thread, "record");
+#endif
+#else
+    r->slot[0] = malloc(RECORD_SLOT_LEN);
+#endif
+    return r;
+}
+
+void record_close(record r)
+{
+    if (r->filling && r->fill > 0)
+        finish_slot(r);
+#ifdef USE_THREADS
+    ring_stop(&r->ring);
+    pthread_join(r->writer_thread, NULL);
+    ring_destroy(&r->ring);
+#endif
+
+#ifdef HAVE_ZSTD
+    if (r->zs)
+    {
+        size_t left;
+        do
+        {
+            ZSTD_outBuffer out = { r->zout, r->zout_len, 0 };
+            left = ZSTD_endStream(r->zs, &out);
+            if (ZSTD_isError(left))
+                break;
+            write_all(r, r->zout, out.pos);
+        } while (left > 0);
+        ZSTD_freeCStream(r->zs);
+        free(r->zout);
+    }
+#endif
+
+    if (r->dropped)
+        log_warn("Recording dropped %lu samples.", r->dropped);
+    close(r->fd);
+    for (int i = 0; i < RECORD_DEPTH; ++i)
+        free(r->slot[i]);
+    free(r->chunk);
+    free(r);
+}
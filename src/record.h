@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "defines.h"
+
+/*
+ * IQ recording, written on a separate thread.
+ *
+ * RECORD_U8 stores the input unchanged, without a header. The other
+ * formats store the output of the input filter at NRSC5_SAMPLE_RATE / 2,
+ * little-endian:
+ *
+ *   file header (40 bytes)
+ *     0  "NRSC5IQ\0"
+ *     8  u8 version (1), u8 format, u16 samples per BFP block
+ *    12  u32 reserved
+ *    16  f64 sample rate, Hz
+ *    24  f64 center frequency, Hz
+ *    32  i64 start time, ns since the epoch
+ *
+ *   chunks of at most RECORD_CHUNK_MAX samples
+ *     0  u32 samples
+ *     4  u32 reserved
+ *     8  u64 index of the first sample, gaps are dropped samples
+ *    16  i64 time of the first sample, ns since the epoch
+ *    24  payload
+ *
+ * The Q15 payload is the I and Q values as i16. Block floating point
+ * payloads split the chunk into blocks with one shift s each, followed by
+ * I and Q as i8 (BFP8) or as the low and high nibble of one byte (BFP4),
+ * and the sample is the mantissa << s.
+ *
+ * Names ending in .zst are compressed with zstd, if available.
+ */
+enum
+{
+    RECORD_U8,
+    RECORD_Q15,
+    RECORD_BFP8,
+    RECORD_BFP4
+};
+
+#define RECORD_MAGIC "NRSC5IQ"
+#define RECORD_HEADER_LEN 40
+#define RECORD_CHUNK_HEADER_LEN 24
+#define RECORD_CHUNK_MAX 32768
+#define RECORD_BFP_BLOCK 64
+
+typedef struct record * record;
+
+// Returns NULL if the file cannot be created.
+record record_open(const char *name, int format, double sample_rate, double center);
+void record_close(record r);
+int record_format(record r);
+// Only the input matching the format of the recording is kept, so the
+// caller can offer both. len is in bytes, n in samples.
+void record_push_u8(record r, const uint8_t *buf, unsigned int len);
+void record_push_iq(record r, const cint16_t *x, unsigned int n);
+
+// Format named u8, q15, bfp8 or bfp4, or -1 if unknown.
+int record_parse_format(const char *name);
+
+// Bytes of payload for n samples.
+unsigned int record_payload_len(int format, unsigned int block, unsigned int n);
+// Decode the payload of n samples.
+void record_decode(int format, unsigned int block, const uint8_t *in, unsigned int n, cint16_t *out);
@@ -57,6 +57,8 @@
 
 static gf_t field;
 static uint8_t gen[D+1];
+/* Multiplication by the roots of the generator, alpha ^ (i + 1). */
+static uint8_t root_mul[D][GF_MAX];
 
 static void rs_generate_generator_polynomial();
 static uint32_t rs_calculate_syndromes(const uint8_t msg[N], uint8_t syndromes[D]);
@@ -70,11 +72,23 @@ static uint32_t rs_generate_error_evaluator_polynomial(const uint8_t syndromes[D
 int32_t
 rs_init(void)
 {
+    static int ready;
+    uint32_t i;
+
+    // tables are shared by all decoders
+    if (ready)
+        return 0;
+
     if(gf_generate_field(&field, M, GF_PRIMPOLY_2_8)) {
 		return -1;
     }
 
     rs_generate_generator_polynomial();
+    for(i = 0; i < D; i++)
+    {
+        gf_generate_mul_table(&field, field.exp[i + 1], root_mul[i]);
+    }
+    ready = 1;
 
     return 0;
 }
@@ -229,6 +243,167 @@ rs_decode(uint8_t msg[N])
     return cnt;
 }
 
+/* Decode a message shortened to len bytes, as if it were zero-padded to N.
+ * The syndromes are computed over the len bytes only, and an error-free
+ * message, the common case, returns before anything else is done. Errors are
+ * only searched for within the len bytes.
+ * msg is only modified if all of the errors could be corrected.
+ * Returns the number of errors in the message or -1 if it was unrecoverable.
+ */
+int32_t
+rs_decode_short(uint8_t *msg, uint32_t len)
+{
+    int32_t i, j, n, m, el, cnt;
+    uint8_t syndromes[D];
+    uint8_t errpoly[D + 1], b[D + 1], t[D + 1];
+    uint8_t evalpoly[D];
+    uint8_t locs[E], vals[E];
+    uint8_t discr, last, q, num, den, err;
+
+    /* Horner's rule with a multiplication table for each root. */
+    for(j = 0; j < D; j++)
+    {
+        syndromes[j] = 0;
+    }
+    for(i = len - 1; i >= 0; i--)
+    {
+        for(j = 0; j < D; j++)
+        {
+            syndromes[j] = root_mul[j][syndromes[j]] ^ msg[i];
+        }
+    }
+
+    err = 0;
+    for(j = 0; j < D; j++)
+    {
+        err |= syndromes[j];
+    }
+    if(!err)
+    {
+        return 0;
+    }
+
+    /* Berlekamp-Massey */
+    for(i = 0; i <= D; i++)
+    {
+        errpoly[i] = b[i] = 0;
+    }
+    errpoly[0] = b[0] = 1;
+    el = 0;
+    m = 1;
+    last = 1;
+    for(n = 0; n < D; n++)
+    {
+        discr = syndromes[n];
+        for(i = 1; i <= el; i++)
+        {
+            discr ^= gf_mul(&field, errpoly[i], syndromes[n - i]);
+        }
+
+        if(!discr)
+        {
+            m++;
+            continue;
+        }
+
+        q = gf_div(&field, discr, last);
+        for(i = 0; i <= D; i++)
+        {
+            t[i] = errpoly[i];
+        }
+        for(i = 0; i + m <= D; i++)
+        {
+            errpoly[i + m] ^= gf_mul(&field, q, b[i]);
+        }
+        if(2 * el <= n)
+        {
+            el = n + 1 - el;
+            for(i = 0; i <= D; i++)
+            {
+                b[i] = t[i];
+            }
+            last = discr;
+            m = 1;
+        }
+        else
+        {
+            m++;
+        }
+    }
+    if(el > E)
+    {
+        return -1;
+    }
+
+    /* Error evaluator, syndromes * errpoly mod x ^ D */
+    for(i = 0; i < D; i++)
+    {
+        evalpoly[i] = 0;
+        for(j = 0; j <= MIN(i, el); j++)
+        {
+            evalpoly[i] ^= gf_mul(&field, errpoly[j], syndromes[i - j]);
+        }
+    }
+
+    /* Chien search over the valid positions, with Forney's algorithm for
+     * the error values. An error at position i is a root at alpha ^ -i. */
+    cnt = 0;
+    for(i = 0; i < len; i++)
+    {
+        uint8_t x = field.exp[(N - i) % N], xp = 1;
+
+        /* the odd terms are x times the formal derivative */
+        q = 0;
+        den = 0;
+        for(j = 0; j <= el; j++)
+        {
+            uint8_t term = gf_mul(&field, errpoly[j], xp);
+            q ^= term;
+            if(j & 1)
+            {
+                den ^= term;
+            }
+            xp = gf_mul(&field, xp, x);
+        }
+        if(q)
+        {
+            continue;
+        }
+        den = gf_div(&field, den, x);
+        if(!den)
+        {
+            return -1;
+        }
+
+        num = 0;
+        xp = 1;
+        for(j = 0; j < D; j++)
+        {
+            num ^= gf_mul(&field, evalpoly[j], xp);
+            xp = gf_mul(&field, xp, x);
+        }
+        locs[cnt] = i;
+        vals[cnt] = gf_div(&field, num, den);
+        if(++cnt == el)
+        {
+            break;
+        }
+    }
+
+    /* Some roots are outside of the message, or repeated. */
+    if(cnt != el)
+    {
+        return -1;
+    }
+
+    for(i = 0; i < cnt; i++)
+    {
+        msg[locs[i]] ^= vals[i];
+    }
+
+    return cnt;
+}
+
 /* Calculate the syndromes of the message.
  * Returns zero if there are no errors in the message.
  */
@@ -28,6 +28,8 @@
 #include <stdint.h>
 
 int32_t rs_init(void);
+int32_t rs_encode(const uint8_t msg[], uint32_t len, uint8_t parity[8]);
 int32_t rs_decode(uint8_t *msg);
+int32_t rs_decode_short(uint8_t *msg, uint32_t len);
 
 #endif /* REED_SOLOMON_H */
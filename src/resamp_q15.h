@@ -2,8 +2,23 @@
 
 #include "defines.h"
 
+// Taps of each filter of the polyphase bank, 2 * m of resamp_q15_create().
+// Kernels are specialized on this count.
+#ifdef USE_FAST_MATH
+#define RESAMP_NUM_TAPS 8
+#else
+#define RESAMP_NUM_TAPS 16
+#endif
+
 typedef struct resamp_q15 * resamp_q15;
 
 resamp_q15 resamp_q15_create(unsigned int m, float fc, float As, unsigned npfb);
+void resamp_q15_destroy(resamp_q15 q);
 void resamp_q15_set_rate(resamp_q15 q, float rate);
-void resamp_q15_execute(resamp_q15 q, const cint16_t * x, float complex * y, unsigned int * pn);
+// Multiply successive outputs by tbl[i % len], len must be a power of two.
+// The table is read while executing, NULL disables the rotation.
+void resamp_q15_set_rotation(resamp_q15 q, const float complex * tbl, unsigned int len);
+// Outputs are rounded to Q15 and saturated.
+void resamp_q15_execute(resamp_q15 q, const cint16_t * x, cint16_t * y, unsigned int * pn);
+// resample nx input samples, the number of outputs is returned in pn
+void resamp_q15_execute_block(resamp_q15 q, const cint16_t * x, unsigned int nx, cint16_t * y, unsigned int * pn);
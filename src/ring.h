@@ -0,0 +1,163 @@
+#pragma once
+
+#ifdef USE_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/*
+ * Single-producer single-consumer ring of slots.
+ *
+ * head and tail count slots pushed and popped. The producer fills slot
+ * ring_head() and publishes it with ring_push(), the consumer processes
+ * slot ring_tail() and releases it with ring_pop(). Neither side takes a
+ * lock unless the ring is full or empty; then it sleeps on the condition
+ * variable, and the other side only signals when someone is asleep.
+ */
+typedef struct
+{
+    atomic_uint head;
+    atomic_uint tail;
+    unsigned int size;
+
+    atomic_int sleeping;
+    atomic_int stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    // times the producer had to wait for a free slot
+    atomic_ulong stalls;
+} ring_t;
+
+static inline void ring_init(ring_t *r, unsigned int size)
+{
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->size = size;
+    atomic_init(&r->sleeping, 0);
+    atomic_init(&r->stop, 0);
+    atomic_init(&r->stalls, 0);
+    pthread_mutex_init(&r->mutex, NULL);
+    pthread_cond_init(&r->cond, NULL);
+}
+
+static inline void ring_destroy(ring_t *r)
+{
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->mutex);
+}
+
+static inline unsigned int ring_head(ring_t *r)
+{
+    return atomic_load(&r->head) % r->size;
+}
+
+static inline unsigned int ring_tail(ring_t *r)
+{
+    return atomic_load(&r->tail) % r->size;
+}
+
+static inline unsigned int ring_count(ring_t *r)
+{
+    // load tail first so a concurrent pop cannot make the count wrap
+    unsigned int tail = atomic_load(&r->tail);
+    return atomic_load(&r->head) - tail;
+}
+
+static inline void ring_wake(ring_t *r)
+{
+    if (atomic_load(&r->sleeping))
+    {
+        pthread_mutex_lock(&r->mutex);
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->mutex);
+    }
+}
+
+// Sleep until test(r) holds. Returns -1 if abstime passed first.
+static inline int ring_sleep(ring_t *r, int (*test)(ring_t *), const struct timespec *abstime)
+{
+    int result = 0;
+
+    atomic_fetch_add(&r->sleeping, 1);
+    pthread_mutex_lock(&r->mutex);
+    while (!test(r))
+    {
+        if (abstime == NULL)
+            pthread_cond_wait(&r->cond, &r->mutex);
+        else if (pthread_cond_timedwait(&r->cond, &r->mutex, abstime) != 0 && !test(r))
+        {
+            result = -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&r->mutex);
+    atomic_fetch_sub(&r->sleeping, 1);
+
+    return result;
+}
+
+static inline int ring_has_space(ring_t *r)
+{
+    return ring_count(r) < r->size;
+}
+
+static inline int ring_has_data(ring_t *r)
+{
+    return ring_count(r) > 0 || atomic_load(&r->stop);
+}
+
+static inline int ring_is_empty(ring_t *r)
+{
+    return ring_count(r) == 0;
+}
+
+// Producer: wait until slot ring_head() is free, abstime may be NULL.
+// Returns -1 on timeout.
+static inline int ring_wait_space(ring_t *r, const struct timespec *abstime)
+{
+    if (ring_has_space(r))
+        return 0;
+    atomic_fetch_add(&r->stalls, 1);
+    return ring_sleep(r, ring_has_space, abstime);
+}
+
+// Producer: publish slot ring_head().
+static inline void ring_push(ring_t *r)
+{
+    atomic_fetch_add(&r->head, 1);
+    ring_wake(r);
+}
+
+// Consumer: wait until slot ring_tail() is ready. Returns 0 once the ring
+// is stopped and empty.
+static inline int ring_wait_data(ring_t *r)
+{
+    if (!ring_has_data(r))
+        ring_sleep(r, ring_has_data, NULL);
+    return ring_count(r) > 0;
+}
+
+// Consumer: release slot ring_tail().
+static inline void ring_pop(ring_t *r)
+{
+    atomic_fetch_add(&r->tail, 1);
+    ring_wake(r);
+}
+
+// Wait until the consumer has released every slot.
+static inline void ring_wait_empty(ring_t *r)
+{
+    if (!ring_is_empty(r))
+        ring_sleep(r, ring_is_empty, NULL);
+}
+
+// Let the consumer exit once the remaining slots are processed.
+static inline void ring_stop(ring_t *r)
+{
+    atomic_store(&r->stop, 1);
+    pthread_mutex_lock(&r->mutex);
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->mutex);
+}
+#endif
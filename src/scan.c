@@ -0,0 +1,179 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+#include "input.h"
+#include "scan.h"
+
+// sideband CNR below which there is no digital signal, in dB
+#define SCAN_MIN_CNR 3.0f
+// the correlation peak is about 20 times the mean with a signal, and
+// below 8 on noise
+#define SCAN_MIN_CP_RATIO 11.0f
+// input samples before the correlation is judged, two acquisition windows
+#define SCAN_CP_SAMPLES (2 * 2 * ACQ_WINDOW)
+// input samples to find the reference subcarriers in
+#define SCAN_MAX_SAMPLES (2 * NRSC5_SAMPLE_RATE)
+
+#define FM_START 87900000
+#define FM_STOP 107900000
+#define FM_STEP 200000
+
+static int add_freq(unsigned int **freqs, unsigned int *count, unsigned int freq)
+{
+    if ((*count & (*count - 1)) == 0)
+    {
+        unsigned int *p = realloc(*freqs, sizeof(**freqs) * (*count ? *count * 2 : 1));
+        if (p == NULL)
+            return -1;
+        *freqs = p;
+    }
+    (*freqs)[(*count)++] = freq;
+    return 0;
+}
+
+static int add_range(unsigned int **freqs, unsigned int *count, unsigned int start, unsigned int stop, unsigned int step)
+{
+    if (step == 0 || stop < start)
+        return -1;
+    for (unsigned int f = start; f <= stop && f >= start; f += step)
+        if (add_freq(freqs, count, f) != 0)
+            return -1;
+    return 0;
+}
+
+unsigned int scan_parse(const char *list, unsigned int **freqs)
+{
+    unsigned int count = 0;
+    const char *p = list;
+
+    *freqs = NULL;
+    while (*p)
+    {
+        unsigned long v[3];
+        unsigned int n = 0;
+        char *end;
+        int err;
+
+        if (strncmp(p, "fm", 2) == 0 && (p[2] == ',' || p[2] == 0))
+        {
+            err = add_range(freqs, &count, FM_START, FM_STOP, FM_STEP);
+            p += 2;
+        }
+        else
+        {
+            do
+            {
+                if (n > 0)
+                    p++;
+                v[n++] = strtoul(p, &end, 0);
+                if (end == p)
+                    goto fail;
+                p = end;
+            } while (*p == ':' && n < 3);
+
+            if (n == 1)
+                err = add_freq(freqs, &count, v[0]);
+            else if (n == 3)
+                err = add_range(freqs, &count, v[0], v[1], v[2]);
+            else
+                err = -1;
+        }
+        if (err != 0 || (*p != ',' && *p != 0))
+            goto fail;
+        if (*p == ',')
+            p++;
+    }
+    return count;
+
+fail:
+    free(*freqs);
+    *freqs = NULL;
+    return 0;
+}
+
+static int snr_cb(void *arg, float snr, float signal, float noise)
+{
+    *(float *)arg = snr;
+    return 0;
+}
+
+void scan_station(scan_read_t read, void *arg, unsigned int frequency, scan_result_t *result)
+{
+    input_t input;
+    const uint8_t *buf;
+    size_t len;
+    float snr = -1;
+    unsigned long samples = 0;
+
+    result->frequency = frequency;
+    result->cnr = NAN;
+    result->cp_ratio = NAN;
+    result->cfo = NAN;
+    result->found = 0;
+
+    input_init(&input, NULL, frequency, 0, NULL);
+    input_set_scan(&input, 1);
+    // nothing is gained by dropping samples, as each station has its own
+    input_set_backpressure(&input, 1);
+    input_set_snr_callback(&input, snr_cb, &snr);
+
+    // the callback is cleared once the SNR is measured, after which the
+    // samples go to acquisition
+    while (snr < 0 && (len = read(arg, &buf)) > 0)
+        input_cb((uint8_t *)buf, len, &input);
+    if (snr < 0)
+        goto done;
+    result->cnr = 10 * log10f(snr);
+    if (result->cnr < SCAN_MIN_CNR)
+        goto done;
+
+    while (samples < SCAN_MAX_SAMPLES && (len = read(arg, &buf)) > 0)
+    {
+        input_cb((uint8_t *)buf, len, &input);
+        input_wait(&input, 1);
+        samples += len / 2;
+
+        if (atomic_load(&input.stats.ref_blocks) > 0)
+        {
+            result->found = 1;
+            break;
+        }
+        if (samples >= SCAN_CP_SAMPLES && input.stats.cp_ratio < SCAN_MIN_CP_RATIO)
+            break;
+    }
+    if (samples >= SCAN_CP_SAMPLES || result->found)
+        result->cp_ratio = input.stats.cp_ratio;
+    if (result->found)
+        result->cfo = input.stats.cfo;
+
+done:
+    input_free(&input);
+}
+
+void scan_print(FILE *fp, const scan_result_t *results, unsigned int count)
+{
+    fprintf(fp, "%-11s %7s %8s %8s %s\n", "frequency", "cnr_db", "cp_ratio", "cfo_hz", "hd");
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        const scan_result_t *r = &results[i];
+        fprintf(fp, "%-11u %7.1f %8.1f %8.0f %s\n", r->frequency, r->cnr, r->cp_ratio, r->cfo, r->found ? "yes" : "no");
+    }
+    fflush(fp);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Quick detection of HD stations, without decoding.
+ *
+ * Each frequency goes through the cheap front of the decoder, and stops at
+ * the first stage that finds nothing: the power of the digital sidebands
+ * against the noise beside them, the peak of the cyclic prefix correlation,
+ * and the reference subcarrier pattern.
+ */
+typedef struct
+{
+    unsigned int frequency;
+    // sideband CNR in dB, cyclic prefix correlation peak to mean ratio,
+    // and carrier frequency offset in Hz, NAN if not measured
+    float cnr;
+    float cp_ratio;
+    float cfo;
+    int found;
+} scan_result_t;
+
+// Next block of unsigned 8-bit IQ samples at NRSC5_SAMPLE_RATE, or 0 at
+// the end of the input.
+typedef size_t (*scan_read_t) (void *arg, const uint8_t **buf);
+
+// Parse a comma-separated list of frequencies in Hz, or start:stop:step
+// ranges, or "fm" for the FM band. Returns the number of frequencies, or
+// 0 if the list is invalid.
+unsigned int scan_parse(const char *list, unsigned int **freqs);
+// Scan the samples returned by read, which are already tuned to frequency.
+void scan_station(scan_read_t read, void *arg, unsigned int frequency, scan_result_t *result);
+void scan_print(FILE *fp, const scan_result_t *results, unsigned int count);
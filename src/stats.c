@@ -0,0 +1,105 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include "input.h"
+#include "stats.h"
+
+void stats_reset(stats_t *s)
+{
+    atomic_init(&s->synced, 0);
+    atomic_init(&s->sync_losses, 0);
+    atomic_init(&s->reacquire_time, 0);
+    atomic_init(&s->mer_lower, 0);
+    atomic_init(&s->mer_upper, 0);
+    atomic_init(&s->timing_offset, 0);
+    atomic_init(&s->cp_ratio, 0);
+    atomic_init(&s->cfo, 0);
+    atomic_init(&s->ref_blocks, 0);
+    atomic_init(&s->ber, 0);
+    atomic_init(&s->ber_avg, 0);
+    atomic_init(&s->rs_corrected, 0);
+    atomic_init(&s->rs_failed, 0);
+    atomic_init(&s->crc_errors, 0);
+    atomic_init(&s->latency, 0);
+    atomic_init(&s->dropped_samples, 0);
+}
+
+void stats_write_json(input_t *input, FILE *fp)
+{
+    stats_t *s = &input->stats;
+    unsigned long audio_overruns = 0, audio_underruns = 0;
+    unsigned int queue_sync = 0, queue_decode = 0, queue_audio = 0, queue_live = 0;
+    // used never passes avail, so load it first
+    unsigned int used = atomic_load(&input->used);
+    unsigned int queue_input = atomic_load(&input->avail) - used;
+    struct timespec ts;
+
+    for (int p = 0; p < MAX_PROGRAMS; ++p)
+    {
+        output_t *output = input->output[p];
+        if (output == NULL)
+            continue;
+        audio_overruns += output->overruns;
+        audio_underruns += output->underruns;
+#ifdef USE_THREADS
+        if (output->method == OUTPUT_WAV || output->method == OUTPUT_LIVE)
+            queue_audio += ring_count(&output->ring);
+        if (output->method == OUTPUT_LIVE && ring_count(&output->ring) > queue_live)
+            queue_live = ring_count(&output->ring);
+#endif
+    }
+#ifdef USE_THREADS
+    queue_sync = ring_count(&input->sync.ring);
+    queue_decode = ring_count(&input->decode.ring);
+#endif
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    // stations on separate devices share the file, and write from their
+    // own threads
+    flockfile(fp);
+    fprintf(fp, "{\"time\":%ld.%03ld,\"frequency\":%.0f,\"synced\":%d", (long)ts.tv_sec, ts.tv_nsec / 1000000, input->center, s->synced);
+    fprintf(fp, ",\"mer_lower\":%.2f,\"mer_upper\":%.2f,\"ber\":%.6f,\"ber_avg\":%.6f", (double)s->mer_lower, (double)s->mer_upper, (double)s->ber, (double)s->ber_avg);
+    fprintf(fp, ",\"cfo\":%.1f,\"timing_offset\":%.1f,\"cp_ratio\":%.1f", (double)s->cfo, (double)s->timing_offset, (double)s->cp_ratio);
+    fprintf(fp, ",\"sync_losses\":%lu,\"reacquire_s\":%.2f", s->sync_losses, (double)s->reacquire_time);
+    // the audio queued for playback adds to the latency of live output
+    fprintf(fp, ",\"latency_s\":%.3f,\"playout_s\":%.3f", (double)s->latency, queue_live * (AUDIO_FRAME_BYTES / 4) / 44100.0);
+    fprintf(fp, ",\"rs_corrected\":%lu,\"rs_failed\":%lu,\"crc_errors\":%lu", s->rs_corrected, s->rs_failed, s->crc_errors);
+    fprintf(fp, ",\"input_overruns\":%lu,\"dropped_samples\":%lu,\"audio_overruns\":%lu,\"audio_underruns\":%lu",
+            input->overruns, s->dropped_samples, audio_overruns, audio_underruns);
+#ifdef USE_THREADS
+    fprintf(fp, ",\"sync_stalls\":%lu,\"decode_stalls\":%lu", input->sync.ring.stalls, input->decode.ring.stalls);
+#endif
+    // input in samples, sync in OFDM blocks, decode and audio in frames
+    fprintf(fp, ",\"queues\":{\"input\":%u,\"sync\":%u,\"decode\":%u,\"audio\":%u}",
+            queue_input, queue_sync, queue_decode, queue_audio);
+
+    if (input->timing.enabled)
+    {
+        fprintf(fp, ",\"stages\":{");
+        for (int i = 0; i < TIMING_STAGES; ++i)
+        {
+            const timing_stage_t *t = &input->timing.stage[i];
+            fprintf(fp, "%s\"%s\":{\"count\":%lu,\"busy\":%.6f,\"p50_us\":%.1f,\"p99_us\":%.1f}",
+                    i ? "," : "", timing_name(i), t->count, t->total_ns / 1e9,
+                    timing_percentile(t, 0.5) / 1e3, timing_percentile(t, 0.99) / 1e3);
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "}\n");
+    fflush(fp);
+    funlockfile(fp);
+}
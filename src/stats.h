@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+struct input_t;
+
+/*
+ * Decoder statistics, updated on the hot path and read while it runs.
+ *
+ * Every field has a single writer, so stats_add() and stats_set() use
+ * relaxed loads and stores instead of locked read-modify-write
+ * instructions. Readers may see values from slightly different moments.
+ */
+typedef struct
+{
+    // sync thread
+    atomic_int synced;
+    atomic_ulong sync_losses;
+    // seconds of signal from the last loss of sync to lock
+    _Atomic float reacquire_time;
+    _Atomic float mer_lower;
+    _Atomic float mer_upper;
+    // input worker: timing offset within the symbol, in samples, and the
+    // peak to mean ratio of the cyclic prefix correlation
+    _Atomic float timing_offset;
+    _Atomic float cp_ratio;
+    // sync thread, Hz, and blocks in which the reference subcarriers were
+    // found while not synchronized
+    _Atomic float cfo;
+    atomic_ulong ref_blocks;
+
+    // decode thread
+    _Atomic float ber;
+    _Atomic float ber_avg;
+    atomic_ulong rs_corrected;
+    atomic_ulong rs_failed;
+    atomic_ulong crc_errors;
+    // seconds from the arrival of the last sample of a P1 frame until its
+    // audio was handed to the outputs
+    _Atomic float latency;
+
+    // input_cb: samples dropped because the input ring was full
+    atomic_ulong dropped_samples;
+} stats_t;
+
+static inline void stats_add(atomic_ulong *c, unsigned long n)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline void stats_set(_Atomic float *v, float x)
+{
+    atomic_store_explicit(v, x, memory_order_relaxed);
+}
+
+void stats_reset(stats_t *s);
+// Write one JSON object on a line with the statistics of the input.
+void stats_write_json(struct input_t *input, FILE *fp);
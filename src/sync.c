@@ -14,14 +14,48 @@
  */
 
 #include <math.h>
+#include <string.h>
+#include <time.h>
 
 #include "defines.h"
 #include "input.h"
+#include "profile.h"
 #include "sync.h"
+#include "trace.h"
 
-#define BUFS 4
 
-float prev_slope[FFT];
+// Only the subcarriers read by sync_process are kept: a window around each
+// sideband wide enough for the +/-300 bin CFO search on the outermost
+// reference subcarriers. The buffer is symbol-major, so sync_push copies
+// each window with a memcpy.
+#define CFO_RANGE 300
+#define LB_WIN_START (LB_START + BAND_LENGTH - 1 - CFO_RANGE)
+#define UB_WIN_START (UB_START - CFO_RANGE)
+#define WIN_LEN (2 * CFO_RANGE)
+#define CARRIERS (2 * WIN_LEN)
+
+// column of a subcarrier in the compact buffer
+static inline unsigned int column(unsigned int carrier)
+{
+    return carrier < UB_WIN_START ? carrier - LB_WIN_START : carrier - UB_WIN_START + WIN_LEN;
+}
+
+#define BUF(buf, carrier, n) ((buf)[(n) * CARRIERS + column(carrier)])
+#define PHASE(phases, carrier, n) ((phases)[column(carrier) * BLKSZ + (n)])
+
+// After losing sync, blocks (of about 93 ms) during which the CFO search
+// stays within WARM_CFO_RANGE bins of the last lock. A short fade should
+// not let a false match on noise move the CFO or the block alignment.
+#define WARM_BLOCKS 64
+#define WARM_CFO_RANGE 8
+// Latest block of a frame to resume at. The earlier blocks are erased, and
+// the frame still decodes with up to about half of it missing.
+#define WARM_MAX_BLOCK 8
+
+// partitions of 18 data subcarriers between two reference subcarriers
+#define PARTITIONS ((BAND_LENGTH - 1) / 19)
+// int8 soft bits per unit of LLR
+#define LLR_SCALE 4.0f
 
 static void dump_ref(uint8_t *ref_buf)
 {
@@ -38,13 +72,13 @@ static void calc_phase(float complex *buf, unsigned int ref, float *out_phase, f
 
     sum = 0;
     for (int r = 0; r < BLKSZ; r++)
-        sum += buf[ref * BLKSZ + r] * buf[ref * BLKSZ + r];
+        sum += BUF(buf, ref, r) * BUF(buf, ref, r);
     phase = cargf(sum) * 0.5;
 
     sum = 0;
     for (int r = 1; r < BLKSZ; r++)
     {
-        float complex tmp = conjf(buf[ref * BLKSZ + r - 1]) * buf[ref * BLKSZ + r];
+        float complex tmp = conjf(BUF(buf, ref, r - 1)) * BUF(buf, ref, r);
         sum += tmp * tmp;
     }
     slope = cargf(sum) * 0.5;
@@ -53,103 +87,157 @@ static void calc_phase(float complex *buf, unsigned int ref, float *out_phase, f
     *out_slope = slope;
 }
 
-static void adjust_ref(float complex *buf, float *phases, unsigned int ref)
+static void adjust_ref(sync_t *st, float complex *buf, unsigned int ref)
 {
     // sync bits (after DBPSK)
     static const signed char sync[] = {
         -1, 1, -1, -1, -1, 1, 1
     };
+    float *phases = st->phases;
+    float *prev_slope = &st->prev_slope[column(ref)];
     float phase, slope;
     calc_phase(buf, ref, &phase, &slope);
 
-    if (prev_slope[ref])
-        slope = slope * 0.1 + prev_slope[ref] * 0.9;
-    prev_slope[ref] = slope;
+    if (*prev_slope)
+        slope = slope * 0.1 + *prev_slope * 0.9;
+    *prev_slope = slope;
 
     for (int n = 0; n < BLKSZ; n++)
     {
         float item_phase = phase + slope * (n - ((BLKSZ-1)/2));
-        phases[ref * BLKSZ + n] = item_phase;
-        buf[ref * BLKSZ + n] *= cexpf(-I * item_phase);
+        PHASE(phases, ref, n) = item_phase;
+        BUF(buf, ref, n) *= cexpf(-I * item_phase);
     }
 
     // compare to sync bits
     float x = 0;
     for (unsigned int n = 0; n < sizeof(sync); n++)
-        x += crealf(buf[ref * BLKSZ + n]) * sync[n];
+        x += crealf(BUF(buf, ref, n)) * sync[n];
     if (x < 0)
     {
         // adjust phase by pi to compensate
         for (int n = 0; n < BLKSZ; n++)
         {
-            phases[ref * BLKSZ + n] += M_PI;
-            buf[ref * BLKSZ + n] *= -1;
+            PHASE(phases, ref, n) += M_PI;
+            BUF(buf, ref, n) *= -1;
         }
     }
 }
 
-static int find_first_block (float complex *buf, unsigned int ref)
+static inline uint32_t rotl32(uint32_t x, unsigned int n)
 {
-    static const signed char needle[] = {
-        0, 1, 1, 0, 0, 1, 0, -1, -1, 1, 1, 0, 0, 1, 0, -1, 0, 0, 0, 0, -1, 1, 1, 1
-    };
-    unsigned char data[BLKSZ], prev = 0;
-    for (int n = 0; n < BLKSZ; n++)
+    return n ? (x << n) | (x >> (32 - n)) : x;
+}
+
+// Convert a needle into bit masks. Bit i of value is needle[i], bit i of
+// care is set unless needle[i] is a don't care.
+static void needle_masks(const signed char *needle, unsigned int len, uint32_t *value, uint32_t *care)
+{
+    *value = 0;
+    *care = 0;
+    for (unsigned int i = 0; i < len; i++)
     {
-        unsigned char bit = crealf(buf[ref * BLKSZ + n]) <= 0 ? 0 : 1;
-        data[n] = bit ^ prev;
-        prev = bit;
+        if (needle[i] < 0) continue;
+        *care |= 1u << i;
+        *value |= (uint32_t)needle[i] << i;
     }
+}
 
+// Returns the first rotation of the needle that matches data with at most
+// max_errors wrong bits, or -1.
+static int match_needle(uint32_t data, uint32_t value, uint32_t care, int max_errors)
+{
     for (int n = 0; n < BLKSZ; n++)
     {
-        unsigned int i;
-        for (i = 0; i < sizeof(needle); i++)
-        {
-            // first bit of data may be wrong, so ignore
-            if ((n + i) % BLKSZ == 0) continue;
-            // ignore don't care bits
-            if (needle[i] < 0) continue;
-            // test if bit is correct
-            if (needle[i] != data[(n + i) % BLKSZ])
-                break;
-        }
-        if (i == sizeof(needle))
+        // first bit of data may be wrong, so ignore
+        uint32_t mask = rotl32(care, n) & ~1u;
+        if (__builtin_popcount((data ^ rotl32(value, n)) & mask) <= max_errors)
             return n;
     }
     return -1;
 }
 
-static int find_ref (float complex *buf, unsigned int ref, unsigned int rsid)
+// DBPSK decoded bits of a phase corrected reference subcarrier, bit n = data[n]
+static uint32_t ref_bits(float complex *buf, unsigned int ref)
 {
-    signed char needle[] = {
-        0, 1, 1, 0, 0, 1, 0, -1, -1, 1, rsid >> 1, rsid & 1, 0, (rsid >> 1) ^ (rsid & 1), 0, -1, -1, -1, -1, -1, -1, 1, 1, 1
-    };
-    unsigned char data[BLKSZ], prev = 0;
+    uint32_t data = 0;
+    unsigned char prev = 0;
     for (int n = 0; n < BLKSZ; n++)
     {
-        unsigned char bit = crealf(buf[ref * BLKSZ + n]) <= 0 ? 0 : 1;
-        data[n] = bit ^ prev;
+        unsigned char bit = crealf(BUF(buf, ref, n)) <= 0 ? 0 : 1;
+        data |= (uint32_t)(bit ^ prev) << n;
         prev = bit;
     }
+    return data;
+}
 
-    for (int n = 0; n < BLKSZ; n++)
+static int find_first_block (float complex *buf, unsigned int ref)
+{
+    static const signed char needle[] = {
+        0, 1, 1, 0, 0, 1, 0, -1, -1, 1, 1, 0, 0, 1, 0, -1, 0, 0, 0, 0, -1, 1, 1, 1
+    };
+    uint32_t value, care;
+    needle_masks(needle, sizeof(needle), &value, &care);
+    return match_needle(ref_bits(buf, ref), value, care, 0);
+}
+
+// Block count of a block that starts at the first symbol, from the first
+// and last reference subcarriers, which must agree. Bits 16 to 19 hold the
+// count, most significant first, and bit 20 their parity. Returns -1 if
+// the block is not aligned or the count is unreliable.
+static int find_block_count (float complex *buf)
+{
+    static const signed char needle[] = {
+        0, 1, 1, 0, 0, 1, 0, -1, -1, 1, 1, 0, 0, 1, 0, -1, -1, -1, -1, -1, -1, 1, 1, 1
+    };
+    uint32_t value, care, lb, ub;
+    needle_masks(needle, sizeof(needle), &value, &care);
+    lb = ref_bits(buf, LB_START);
+    ub = ref_bits(buf, UB_START + BAND_LENGTH - 1);
+    if (match_needle(lb, value, care, 0) != 0 || match_needle(ub, value, care, 0) != 0)
+        return -1;
+    if ((((lb ^ ub) >> 16) & 0x1f) || __builtin_parity((lb >> 16) & 0x1f))
+        return -1;
+    return ((lb >> 16) & 1) << 3 | ((lb >> 17) & 1) << 2 | ((lb >> 18) & 1) << 1 | ((lb >> 19) & 1);
+}
+
+static void ref_masks(unsigned int rsid, uint32_t *value, uint32_t *care)
+{
+    signed char needle[] = {
+        0, 1, 1, 0, 0, 1, 0, -1, -1, 1, rsid >> 1, rsid & 1, 0, (rsid >> 1) ^ (rsid & 1), 0, -1, -1, -1, -1, -1, -1, 1, 1, 1
+    };
+    needle_masks(needle, sizeof(needle), value, care);
+}
+
+static int find_ref (float complex *buf, unsigned int ref, unsigned int rsid)
+{
+    uint32_t value, care;
+    ref_masks(rsid, &value, &care);
+    return match_needle(ref_bits(buf, ref), value, care, 0);
+}
+
+// Cheap test for the reference pattern on an uncorrected subcarrier, used
+// to skip CFO candidates before the full adjust_ref/find_ref check. The
+// differential bits come directly from the products of consecutive symbols,
+// rotated by the average slope, so no per-symbol phase correction is needed.
+// A few bit errors are tolerated as this detector is noisier.
+#define CFO_PREFILTER_ERRORS 1
+static int maybe_ref(float complex *buf, unsigned int ref, uint32_t value, uint32_t care)
+{
+    float complex d[BLKSZ];
+    float complex sum = 0;
+    for (int n = 1; n < BLKSZ; n++)
     {
-        unsigned int i;
-        for (i = 0; i < sizeof(needle); i++)
-        {
-            // first bit of data may be wrong, so ignore
-            if ((n + i) % BLKSZ == 0) continue;
-            // ignore don't care bits
-            if (needle[i] < 0) continue;
-            // test if bit is correct
-            if (needle[i] != data[(n + i) % BLKSZ])
-                break;
-        }
-        if (i == sizeof(needle))
-            return n;
+        d[n] = conjf(BUF(buf, ref, n - 1)) * BUF(buf, ref, n);
+        sum += d[n] * d[n];
     }
-    return -1;
+    float complex rot = fast_cexpf(-0.5f * cargf(sum));
+
+    uint32_t data = 0;
+    for (int n = 1; n < BLKSZ; n++)
+        if (crealf(d[n] * rot) < 0)
+            data |= 1u << n;
+    return match_needle(data, value, care, CFO_PREFILTER_ERRORS) >= 0;
 }
 
 static float calc_smag(float complex *buf, unsigned int ref)
@@ -157,7 +245,7 @@ static float calc_smag(float complex *buf, unsigned int ref)
     float sum = 0;
     // phase was already corrected, so imaginary component is zero
     for (int n = 0; n < BLKSZ; n++)
-        sum += fabsf(crealf(buf[ref * BLKSZ + n]));
+        sum += fabsf(crealf(BUF(buf, ref, n)));
     return sum / BLKSZ;
 }
 
@@ -172,21 +260,78 @@ static void adjust_data(float complex *buf, float *phases, unsigned int lower, u
         for (int k = 1; k < 19; k++)
         {
             // average phase difference
-            float complex C = CMPLXF(19,19) / (k * smag19 * fast_cexpf(phases[upper * BLKSZ + n]) + (19 - k) * smag0 * fast_cexpf(phases[lower * BLKSZ + n]));
+            float complex C = CMPLXF(19,19) / (k * smag19 * fast_cexpf(PHASE(phases, upper, n)) + (19 - k) * smag0 * fast_cexpf(PHASE(phases, lower, n)));
             // adjust sample
-            buf[(lower + k) * BLKSZ + n] *= C;
+            BUF(buf, lower + k, n) *= C;
         }
     }
 }
 
-void sync_process(sync_t *st, float complex *buffer)
+/*
+ * LLR weights of the data subcarriers lower + 1 .. lower + 18, given the
+ * summed squared error of the partition after equalization. For QPSK with
+ * noise variance s2 per dimension the LLR is 2 x / s2. The noise at the
+ * input of the equalizer is about the same on every subcarrier, so after
+ * dividing by the channel gain |H| it is s2 / |H|^2: the partition error
+ * sets the level, and the reference subcarriers on either side give the
+ * shape of |H|^2 within the partition.
+ */
+static void channel_weights(float complex *buf, unsigned int lower, float error, float *weight)
+{
+    float smag0 = calc_smag(buf, lower), smag19 = calc_smag(buf, lower + 19);
+    float h2[19], mean = 0;
+
+    for (int k = 1; k < 19; k++)
+    {
+        float h = ((19 - k) * smag0 + k * smag19) / 19;
+        h2[k] = h * h;
+        mean += h2[k];
+    }
+    mean /= 18;
+
+    // error is the complex error, twice the variance per dimension
+    float s2 = fmaxf(error / (BLKSZ * 18 * 2), 1e-6f);
+    for (int k = 1; k < 19; k++)
+        weight[k] = LLR_SCALE * 2 / s2 * (mean > 0 ? h2[k] / mean : 1);
+}
+
+static inline int8_t soft_bit(float x, float weight)
+{
+    float v = x * weight;
+    if (v >= 127)
+        return 127;
+    if (v <= -127)
+        return -127;
+    return (int8_t)lrintf(v);
+}
+
+static void sync_event(sync_t *st, unsigned int event)
 {
+    nrsc5_event_t evt;
+
+    atomic_store_explicit(&st->input->stats.synced, event == NRSC5_EVENT_SYNC, memory_order_relaxed);
+    evt.event = event;
+    input_event(st->input, &evt);
+}
+
+static void sync_lock_start(sync_t *st)
+{
+    st->lock_blocks = 0;
+    clock_gettime(CLOCK_MONOTONIC, &st->lock_start);
+}
+
+static void sync_process(sync_t *st, float complex *buffer, uint64_t arrival)
+{
+    uint64_t t = timing_now(&st->input->timing), span = trace_begin();
     int i;
 
+    if (!st->ready)
+        st->lock_blocks++;
+
     for (i = 0; i < BAND_LENGTH; i += 19)
     {
-        adjust_ref(buffer, st->phases, LB_START + i);
-        adjust_ref(buffer, st->phases, UB_START + i);
+        adjust_ref(st, buffer, LB_START + i);
+        adjust_ref(st, buffer, UB_START + i);
     }
 
     // check if we lost synchronization or now have it
@@ -198,53 +343,91 @@ void sync_process(sync_t *st, float complex *buffer)
             {
                 log_debug("lost sync (%d, %d)!", find_first_block(buffer, LB_START), find_first_block(buffer, UB_START + 19*10));
                 st->ready = 0;
+                st->warm_blocks = WARM_BLOCKS;
+                st->cfo_wait = 0;
+                stats_add(&st->input->stats.sync_losses, 1);
+                sync_lock_start(st);
+                sync_event(st, NRSC5_EVENT_LOST_SYNC);
             }
         }
     }
     else
     {
-        for (i = 0; i < FFT; i++)
-            prev_slope[i] = 0;
+        int warm = st->warm_blocks > 0;
+        int range = warm ? WARM_CFO_RANGE : CFO_RANGE;
+
+        if (warm)
+            st->warm_blocks--;
+        for (i = 0; i < CARRIERS; i++)
+            st->prev_slope[i] = 0;
 
         // First and last reference subcarriers have the same data. Try both
         // in case one of the sidebands is too corrupted.
         int offset = find_first_block(buffer, LB_START + 0);
         if (offset < 0)
             offset = find_first_block(buffer, UB_START + BAND_LENGTH - 1);
+        // keep the block alignment of the last lock unless both sidebands
+        // agree that it moved
+        if (warm && offset > 0 && (find_first_block(buffer, LB_START + 0) != offset
+                                   || find_first_block(buffer, UB_START + BAND_LENGTH - 1) != offset))
+            offset = -1;
+        // the timing and CFO of the last lock are likely still right, so
+        // resume within the frame instead of waiting for its first block
+        int block = warm && offset < 0 ? find_block_count(buffer) : -1;
+        if (offset >= 0 || block > 0)
+            stats_add(&st->input->stats.ref_blocks, 1);
 
         if (offset > 0)
         {
             log_debug("First block @ %d", offset);
             input_set_skip(st->input, offset * FFTCP);
         }
-        else if (offset == 0)
+        else if (offset == 0 || (block > 0 && block <= WARM_MAX_BLOCK))
         {
-            log_info("Synchronized!");
-            decode_reset(&st->input->decode);
+            struct timespec now;
+            float lock_s = (float)st->lock_blocks * BLKSZ * FFTCP / 744187.5;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            log_info("Synchronized! (time to lock: %.2f s of signal, %.2f s elapsed%s)",
+                     lock_s, (now.tv_sec - st->lock_start.tv_sec) + (now.tv_nsec - st->lock_start.tv_nsec) / 1e9,
+                     warm ? ", warm" : "");
+            if (atomic_load_explicit(&st->input->stats.sync_losses, memory_order_relaxed))
+                stats_set(&st->input->stats.reacquire_time, lock_s);
+            st->warm_blocks = 0;
+            if (offset == 0)
+                decode_reset(&st->input->decode);
+            else
+                decode_resume(&st->input->decode, block);
             st->ready = 1;
+            sync_event(st, NRSC5_EVENT_SYNC);
         }
         else if (st->cfo_wait == 0)
         {
-            for (i = -300; i < 300; ++i)
+            uint32_t value, care;
+            ref_masks(0, &value, &care);
+
+            for (i = -range; i < range; ++i)
             {
                 int offset2;
-                adjust_ref(buffer, st->phases, LB_START + i + BAND_LENGTH - 1);
+                if (!maybe_ref(buffer, LB_START + i + BAND_LENGTH - 1, value, care))
+                    continue;
+                adjust_ref(st, buffer, LB_START + i + BAND_LENGTH - 1);
                 offset = find_ref(buffer, LB_START + i + BAND_LENGTH - 1, 0);
                 if (offset < 0)
                     continue;
                 // We think we found the start. Check upperband to confirm.
-                adjust_ref(buffer, st->phases, UB_START + i);
+                adjust_ref(st, buffer, UB_START + i);
                 offset2 = find_ref(buffer, UB_START + i, 0);
                 if (offset2 == offset)
                 {
                     // The offsets matched, so 'i' is likely the CFO.
+                    stats_add(&st->input->stats.ref_blocks, 1);
                     input_set_skip(st->input, offset * FFTCP);
                     input_cfo_adjust(st->input, i);
 
                     log_debug("First block @ %d", offset);
 
                     // Wait until the buffers have cleared before measuring again.
-                    st->cfo_wait = 2 * BUFS;
+                    st->cfo_wait = 2 * st->depth;
                     break;
                 }
             }
@@ -265,8 +448,9 @@ void sync_process(sync_t *st, float complex *buffer)
             adjust_data(buffer, st->phases, UB_START + i, UB_START + i + 19);
         }
 
-        // Calculate modulation error
+        // Calculate modulation error, for each partition
         float error_lb = 0, error_ub = 0;
+        float part_lb[PARTITIONS] = { 0 }, part_ub[PARTITIONS] = { 0 };
         for (int n = 0; n < BLKSZ; n++)
         {
             float complex c, ideal;
@@ -275,16 +459,21 @@ void sync_process(sync_t *st, float complex *buffer)
                 unsigned int j;
                 for (j = 1; j < 19; j++)
                 {
-                    c = buffer[(LB_START + i + j) * BLKSZ + n];
+                    c = BUF(buffer, LB_START + i + j, n);
                     ideal = CMPLXF(crealf(c) >= 0 ? 1 : -1, cimagf(c) >= 0 ? 1 : -1);
-                    error_lb += normf(ideal - c);
+                    part_lb[i / 19] += normf(ideal - c);
 
-                    c = buffer[(UB_START + i + j) * BLKSZ + n];
+                    c = BUF(buffer, UB_START + i + j, n);
                     ideal = CMPLXF(crealf(c) >= 0 ? 1 : -1, cimagf(c) >= 0 ? 1 : -1);
-                    error_ub += normf(ideal - c);
+                    part_ub[i / 19] += normf(ideal - c);
                 }
             }
         }
+        for (i = 0; i < PARTITIONS; i++)
+        {
+            error_lb += part_lb[i];
+            error_ub += part_ub[i];
+        }
 
         st->error_lb += error_lb;
         st->error_ub += error_ub;
@@ -296,18 +485,29 @@ void sync_process(sync_t *st, float complex *buffer)
             float mer_db_lb = 10 * log10f(signal / st->error_lb);
             float mer_db_ub = 10 * log10f(signal / st->error_ub);
             log_info("MER: %f dB (lower), %f dB (upper)", mer_db_lb, mer_db_ub);
+            stats_set(&st->input->stats.mer_lower, mer_db_lb);
+            stats_set(&st->input->stats.mer_upper, mer_db_ub);
+
+            nrsc5_event_t evt;
+            evt.event = NRSC5_EVENT_MER;
+            evt.mer.lower = mer_db_lb;
+            evt.mer.upper = mer_db_ub;
+            input_event(st->input, &evt);
             st->mer_cnt = 0;
             st->error_lb = 0;
             st->error_ub = 0;
         }
 
-        // Soft demod based on MER for each sideband
-        float mer_lb = 2 * BLKSZ * DATA_PER_BAND / error_lb;
-        float mer_ub = 2 * BLKSZ * DATA_PER_BAND / error_ub;
-        float mult_lb = fmaxf(fminf(mer_lb * 10, 127), 1);
-        float mult_ub = fmaxf(fminf(mer_ub * 10, 127), 1);
+        // Soft demod: the LLR weight of each data subcarrier
+        float weight_lb[PARTITIONS][19], weight_ub[PARTITIONS][19];
+        for (i = 0; i < BAND_LENGTH - 1; i += 19)
+        {
+            channel_weights(buffer, LB_START + i, part_lb[i / 19], weight_lb[i / 19]);
+            channel_weights(buffer, UB_START + i, part_ub[i / 19], weight_ub[i / 19]);
+        }
 
-#define DEMOD(x) ((x) >= 0 ? 1 : -1)
+        // a frame completed by this block is timed from its arrival
+        st->input->decode.arrival = arrival;
         for (int n = 0; n < BLKSZ; n++)
         {
             float complex c;
@@ -316,9 +516,9 @@ void sync_process(sync_t *st, float complex *buffer)
                 unsigned int j;
                 for (j = 1; j < 19; j++)
                 {
-                    c = buffer[(LB_START + i + j) * BLKSZ + n];
-                    decode_push(&st->input->decode, DEMOD(crealf(c)) * mult_lb);
-                    decode_push(&st->input->decode, DEMOD(cimagf(c)) * mult_lb);
+                    c = BUF(buffer, LB_START + i + j, n);
+                    decode_push(&st->input->decode, soft_bit(crealf(c), weight_lb[i / 19][j]));
+                    decode_push(&st->input->decode, soft_bit(cimagf(c), weight_lb[i / 19][j]));
                 }
             }
             for (i = 0; i < BAND_LENGTH - 1; i += 19)
@@ -326,61 +526,80 @@ void sync_process(sync_t *st, float complex *buffer)
                 unsigned int j;
                 for (j = 1; j < 19; j++)
                 {
-                    c = buffer[(UB_START + i + j) * BLKSZ + n];
-                    decode_push(&st->input->decode, DEMOD(crealf(c)) * mult_ub);
-                    decode_push(&st->input->decode, DEMOD(cimagf(c)) * mult_ub);
+                    c = BUF(buffer, UB_START + i + j, n);
+                    decode_push(&st->input->decode, soft_bit(crealf(c), weight_ub[i / 19][j]));
+                    decode_push(&st->input->decode, soft_bit(cimagf(c), weight_ub[i / 19][j]));
                 }
             }
 
-            c = buffer[LB_START + n];
+            c = BUF(buffer, LB_START, n);
             st->ref_buf[n] = crealf(c) <= 0 ? 0 : 1;
             if (n == 0) dump_ref(st->ref_buf);
         }
     }
+    timing_end(&st->input->timing, TIMING_SYNC, t);
+    trace_end(TRACE_SYNC, span);
 }
 
-void sync_push(sync_t *st, float complex *fftout)
+static inline unsigned int sync_slot(sync_t *st)
 {
-    unsigned int i;
-    for (i = 0; i < FFT; ++i)
-        st->buffer[i * BLKSZ + st->idx + st->buf_idx * BLKSZ * FFT] = fftout[i];
+#ifdef USE_THREADS
+    return ring_head(&st->ring);
+#else
+    return 0;
+#endif
+}
+
+// The symbol was copied into the slot: hand a completed block on.
+static void sync_next(sync_t *st, unsigned int slot, uint64_t arrival)
+{
+    st->arrival[slot] = arrival;
 
     if (++st->idx == BLKSZ)
     {
         st->idx = 0;
 
 #ifdef USE_THREADS
-        pthread_mutex_lock(&st->mutex);
-        while ((st->buf_idx + 1) % BUFS == st->used)
-            pthread_cond_wait(&st->cond, &st->mutex);
-        st->buf_idx = (st->buf_idx + 1) % BUFS;
-        pthread_mutex_unlock(&st->mutex);
-
-        pthread_cond_signal(&st->cond);
+        ring_push(&st->ring);
+        ring_wait_space(&st->ring, NULL);
 #else
-        sync_process(st, st->buffer);
+        sync_process(st, st->buffer, st->arrival[0]);
 #endif
     }
 }
 
+void sync_push(sync_t *st, float complex *fftout, uint64_t arrival)
+{
+    unsigned int slot = sync_slot(st);
+    float complex *dst = &st->buffer[(slot * BLKSZ + st->idx) * CARRIERS];
+
+    memcpy(dst, &fftout[LB_WIN_START], sizeof(float complex) * WIN_LEN);
+    memcpy(dst + WIN_LEN, &fftout[UB_WIN_START], sizeof(float complex) * WIN_LEN);
+    sync_next(st, slot, arrival);
+}
+
+void sync_push_q15(sync_t *st, const cint16_t *fftout, float complex scale, uint64_t arrival)
+{
+    unsigned int slot = sync_slot(st);
+    float complex *dst = &st->buffer[(slot * BLKSZ + st->idx) * CARRIERS];
+
+    for (unsigned int i = 0; i < WIN_LEN; ++i)
+    {
+        dst[i] = scale * CMPLXF(fftout[LB_WIN_START + i].r, fftout[LB_WIN_START + i].i);
+        dst[WIN_LEN + i] = scale * CMPLXF(fftout[UB_WIN_START + i].r, fftout[UB_WIN_START + i].i);
+    }
+    sync_next(st, slot, arrival);
+}
+
 #ifdef USE_THREADS
 static void *sync_worker(void *arg)
 {
     sync_t *st = arg;
-    while(1)
+    while (ring_wait_data(&st->ring))
     {
-        pthread_mutex_lock(&st->mutex);
-        while (st->buf_idx == st->used)
-            pthread_cond_wait(&st->cond, &st->mutex);
-        pthread_mutex_unlock(&st->mutex);
-
-        sync_process(st, &st->buffer[st->used * BLKSZ * FFT]);
-
-        pthread_mutex_lock(&st->mutex);
-        st->used = (st->used + 1) % BUFS;
-        pthread_mutex_unlock(&st->mutex);
-
-        pthread_cond_signal(&st->cond);
+        unsigned int slot = ring_tail(&st->ring);
+        sync_process(st, &st->buffer[slot * BLKSZ * CARRIERS], st->arrival[slot]);
+        ring_pop(&st->ring);
     }
 
     return NULL;
@@ -390,34 +609,49 @@ static void *sync_worker(void *arg)
 void sync_wait(sync_t *st)
 {
 #ifdef USE_THREADS
-    pthread_mutex_lock(&st->mutex);
-    while (st->buf_idx != st->used)
-        pthread_cond_wait(&st->cond, &st->mutex);
-    pthread_mutex_unlock(&st->mutex);
+    ring_wait_empty(&st->ring);
 #endif
 }
 
 void sync_init(sync_t *st, input_t *input)
 {
     st->input = input;
-    st->buffer = malloc(sizeof(float complex) * BLKSZ * FFT * BUFS);
-    st->phases = malloc(sizeof(float) * BLKSZ * FFT);
-    st->ref_buf = malloc(BLKSZ);
+    st->depth = profile_get()->sync_depth;
+    st->buffer = input_alloc(input, sizeof(float complex) * BLKSZ * CARRIERS * st->depth);
+    st->arrival = input_alloc(input, sizeof(uint64_t) * st->depth);
+    st->phases = input_alloc(input, sizeof(float) * BLKSZ * CARRIERS);
+    st->prev_slope = input_alloc(input, sizeof(float) * CARRIERS);
+    st->ref_buf = input_alloc(input, BLKSZ);
     st->ready = 0;
-    st->buf_idx = 0;
     st->idx = 0;
-    st->used = 0;
     st->cfo_wait = 0;
+    st->warm_blocks = 0;
+    sync_lock_start(st);
     st->mer_cnt = 0;
     st->error_lb = 0;
     st->error_ub = 0;
 
 #ifdef USE_THREADS
-    pthread_cond_init(&st->cond, NULL);
-    pthread_mutex_init(&st->mutex, NULL);
+    ring_init(&st->ring, st->depth);
     pthread_create(&st->worker_thread, NULL, sync_worker, st);
 #ifdef HAVE_PTHREAD_SETNAME_NP
     pthread_setname_np(st->worker_thread, "sync_worker");
 #endif
 #endif
 }
+
+void sync_free(sync_t *st)
+{
+#ifdef USE_THREADS
+    // the worker drains the remaining blocks before it exits
+    ring_stop(&st->ring);
+    pthread_join(st->worker_thread, NULL);
+    ring_destroy(&st->ring);
+#endif
+
+    free(st->buffer);
+    free(st->arrival);
+    free(st->phases);
+    free(st->prev_slope);
+    free(st->ref_buf);
+}
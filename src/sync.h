@@ -1,21 +1,33 @@
 #pragma once
 
 #include <complex.h>
-#ifdef USE_THREADS
-#include <pthread.h>
-#endif
+#include <stdint.h>
+#include <time.h>
+
+#include "defines.h"
+#include "ring.h"
 
 typedef struct
 {
     struct input_t *input;
+    // depth blocks of the carriers in use
     float complex *buffer;
+    unsigned int depth;
+    // when the last sample of each block arrived, see input_arrival()
+    uint64_t *arrival;
     float *phases;
+    float *prev_slope;
     uint8_t *ref_buf;
     unsigned int idx;
-    unsigned int buf_idx;
-    unsigned int used;
     int ready;
     int cfo_wait;
+    // blocks left to search near the last lock before searching the full
+    // CFO range
+    int warm_blocks;
+
+    // time to lock, counted from startup or the last loss of sync
+    unsigned int lock_blocks;
+    struct timespec lock_start;
 
     int mer_cnt;
     float error_lb;
@@ -23,11 +35,14 @@ typedef struct
 
 #ifdef USE_THREADS
     pthread_t worker_thread;
-    pthread_cond_t cond;
-    pthread_mutex_t mutex;
+    ring_t ring;
 #endif
 } sync_t;
 
-void sync_push(sync_t *st, float complex *fft);
+// arrival is when the last sample of the symbol arrived, or 0 if unknown.
+void sync_push(sync_t *st, float complex *fft, uint64_t arrival);
+// The same for the output of fft_q15, whose values are multiplied by scale.
+void sync_push_q15(sync_t *st, const cint16_t *fft, float complex scale, uint64_t arrival);
 void sync_wait(sync_t *st);
 void sync_init(sync_t *st, struct input_t *input);
+void sync_free(sync_t *st);
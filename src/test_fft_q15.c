@@ -0,0 +1,114 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Transform random noise of several levels, a tone and an impulse with
+ * fft_q15, and compare each output, scaled by its exponent, with a DFT in
+ * double precision. The error must stay far below the signal at every
+ * level, as the block floating point scaling only shifts what would
+ * overflow.
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include "fft_q15.h"
+#include "microbench.h"
+
+static double cos_tbl[FFT], sin_tbl[FFT];
+
+// Signal to error ratio in dB of x, with exponent exp, against the DFT of in.
+static double snr_db(const cint16_t *in, const cint16_t *x, int exp)
+{
+    double signal = 0, error = 0;
+
+    for (unsigned int k = 0; k < FFT; ++k)
+    {
+        double re = 0, im = 0;
+        for (unsigned int n = 0; n < FFT; ++n)
+        {
+            unsigned int a = (k * n) % FFT;
+            re += in[n].r * cos_tbl[a] + in[n].i * sin_tbl[a];
+            im += in[n].i * cos_tbl[a] - in[n].r * sin_tbl[a];
+        }
+        double dr = ldexp(x[k].r, exp) - re, di = ldexp(x[k].i, exp) - im;
+        signal += re * re + im * im;
+        error += dr * dr + di * di;
+    }
+    return error > 0 ? 10 * log10(signal / error) : INFINITY;
+}
+
+static unsigned int check(const char *what, const cint16_t *in, double min_db)
+{
+    cint16_t x[FFT];
+    double db;
+    int exp;
+
+    for (unsigned int n = 0; n < FFT; ++n)
+        x[n] = in[n];
+    exp = fft_q15(x);
+    db = snr_db(in, x, exp);
+    printf("fft_q15 %-24s exponent %2d, %.1f dB\n", what, exp, db);
+    if (db < min_db)
+    {
+        printf("FAIL: %s below %.0f dB\n", what, min_db);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static const int levels[] = { 64, 1024, FFT_Q15_MAX, 32767 };
+    unsigned int failed = 0;
+    uint32_t seed = 1;
+    cint16_t in[FFT];
+    char what[32];
+
+    for (unsigned int k = 0; k < FFT; ++k)
+    {
+        cos_tbl[k] = cos(2 * M_PI * k / FFT);
+        sin_tbl[k] = sin(2 * M_PI * k / FFT);
+    }
+    fft_q15_init();
+
+    for (unsigned int l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l)
+    {
+        for (unsigned int n = 0; n < FFT; ++n)
+        {
+            in[n].r = (int32_t)(bench_random(&seed) % (2 * levels[l] + 1)) - levels[l];
+            in[n].i = (int32_t)(bench_random(&seed) % (2 * levels[l] + 1)) - levels[l];
+        }
+        snprintf(what, sizeof(what), "noise of +/-%d", levels[l]);
+        failed += check(what, in, l == 0 ? 40 : 60);
+    }
+
+    for (unsigned int n = 0; n < FFT; ++n)
+    {
+        in[n].r = lrint(8000 * cos(2 * M_PI * 300 * n / FFT));
+        in[n].i = lrint(8000 * sin(2 * M_PI * 300 * n / FFT));
+    }
+    failed += check("tone", in, 60);
+
+    for (unsigned int n = 0; n < FFT; ++n)
+        in[n].r = in[n].i = 0;
+    in[0].r = 32767;
+    in[0].i = -32768;
+    failed += check("impulse", in, 60);
+
+    if (!failed)
+        printf("fft_q15: all checks passed\n");
+    return failed != 0;
+}
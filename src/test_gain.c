@@ -0,0 +1,73 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Run the gain search over every list length and peak position, for CNR
+ * curves of several slopes, and check that it finds the peak.
+ */
+
+#include <stdio.h>
+
+#include "gain.h"
+
+static const struct
+{
+    // CNR lost per gain step below and above the peak
+    float rise, fall;
+} shapes[] = {
+    { 1, 1 },
+    { 1, 5 },
+    { 5, 1 },
+    { 0.1f, 3 },
+};
+
+static float cnr(int i, int peak, float rise, float fall)
+{
+    return 1000 - (i < peak ? rise * (peak - i) : fall * (i - peak));
+}
+
+int main(void)
+{
+    unsigned int failed = 0;
+    gain_search_t s;
+
+    for (int count = 1; count <= GAIN_MAX; count++)
+    {
+        for (int peak = 0; peak < count; peak++)
+        {
+            for (unsigned int k = 0; k < sizeof(shapes) / sizeof(shapes[0]); k++)
+            {
+                int i, measured = 0;
+
+                gain_search_init(&s, count);
+                while ((i = gain_search_next(&s)) >= 0)
+                {
+                    if (s.snr[i] >= 0 || ++measured > count)
+                        break;
+                    s.snr[i] = cnr(i, peak, shapes[k].rise, shapes[k].fall);
+                }
+
+                if (i >= 0 || gain_search_best(&s) != peak)
+                {
+                    printf("FAIL: %d gains, peak at %d, shape %u: found %d\n", count, peak, k, gain_search_best(&s));
+                    failed++;
+                }
+            }
+        }
+    }
+
+    printf("%s\n", failed ? "FAIL" : "ok");
+    return failed != 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Parse well-formed ID3 tags, and malformed ones as a station or a bad
+ * signal could send them: sizes past the end of the tag, extended headers
+ * that would wrap the read position, and every truncation of a valid tag,
+ * each copied to a buffer of its exact length.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "id3.h"
+
+#define TAG_MAX 512
+
+typedef struct
+{
+    uint8_t buf[TAG_MAX];
+    unsigned int len;
+    int version;
+} tag_t;
+
+static void put32(uint8_t *p, unsigned int v, int syncsafe)
+{
+    unsigned int shift = syncsafe ? 7 : 8;
+
+    for (int i = 0; i < 4; i++)
+        p[i] = (v >> (shift * (3 - i))) & (syncsafe ? 0x7f : 0xff);
+}
+
+static void tag_begin(tag_t *t, int version, int extended)
+{
+    memset(t, 0, sizeof(*t));
+    memcpy(t->buf, "ID3", 3);
+    t->buf[3] = version;
+    t->buf[5] = extended ? 0x40 : 0;
+    t->len = 10;
+    t->version = version;
+}
+
+// a text frame of encoding enc, whose size claims extra bytes more
+static void tag_frame(tag_t *t, const char *id, int enc, const char *text, unsigned int extra)
+{
+    unsigned int n = strlen(text) + 1;
+
+    memcpy(&t->buf[t->len], id, 4);
+    put32(&t->buf[t->len + 4], n + extra, t->version == 4);
+    t->buf[t->len + 10] = enc;
+    memcpy(&t->buf[t->len + 11], text, n - 1);
+    t->len += 10 + n;
+}
+
+static void tag_end(tag_t *t)
+{
+    put32(&t->buf[6], t->len - 10, 1);
+}
+
+// Parse the first len bytes of t from a buffer of exactly that length.
+static int parse(const tag_t *t, unsigned int len, id3_t *tag)
+{
+    uint8_t *copy = malloc(len ? len : 1);
+    int ret;
+
+    memcpy(copy, t->buf, len);
+    ret = id3_parse(copy, len, tag);
+    free(copy);
+    return ret;
+}
+
+static unsigned int expect(const char *what, int ok)
+{
+    if (!ok)
+        printf("FAIL: %s\n", what);
+    return !ok;
+}
+
+int main(void)
+{
+    unsigned int failed = 0;
+    id3_t tag;
+    tag_t t;
+
+    tag_begin(&t, 3, 0);
+    tag_frame(&t, "TIT2", 0, "Title", 0);
+    tag_frame(&t, "TPE1", 3, "Artist", 0);
+    tag_end(&t);
+    failed += expect("v2.3 tag parses", parse(&t, t.len, &tag) == 0);
+    failed += expect("v2.3 title", strcmp(tag.title, "Title") == 0);
+    failed += expect("v2.3 artist", strcmp(tag.artist, "Artist") == 0);
+    for (unsigned int n = 0; n < t.len; n++)
+        parse(&t, n, &tag);
+
+    // v2.4 extended header of 6 bytes, counting its size field
+    tag_begin(&t, 4, 1);
+    put32(&t.buf[10], 6, 1);
+    t.len += 6;
+    tag_frame(&t, "TALB", 3, "Album", 0);
+    tag_end(&t);
+    failed += expect("v2.4 tag with extended header parses", parse(&t, t.len, &tag) == 0);
+    failed += expect("v2.4 album", strcmp(tag.album, "Album") == 0);
+    for (unsigned int n = 0; n < t.len; n++)
+        parse(&t, n, &tag);
+
+    // extended header sizes that reach past the tag, or wrap the position
+    tag_begin(&t, 3, 1);
+    put32(&t.buf[10], 0xffffffea, 0);
+    t.len += 16;
+    tag_end(&t);
+    failed += expect("v2.3 wrapping extended header is rejected", parse(&t, t.len, &tag) == -1);
+    put32(&t.buf[10], 13, 0);
+    failed += expect("v2.3 long extended header is rejected", parse(&t, t.len, &tag) == -1);
+    put32(&t.buf[10], 12, 0);
+    failed += expect("v2.3 extended header filling the tag parses", parse(&t, t.len, &tag) == 0);
+
+    tag_begin(&t, 4, 1);
+    put32(&t.buf[10], 0x0fffffff, 1);
+    t.len += 16;
+    tag_end(&t);
+    failed += expect("v2.4 long extended header is rejected", parse(&t, t.len, &tag) == -1);
+
+    // a frame claiming more bytes than the tag has is dropped
+    tag_begin(&t, 3, 0);
+    tag_frame(&t, "TIT2", 0, "Title", 0);
+    tag_frame(&t, "TCON", 0, "Genre", 1);
+    tag_end(&t);
+    failed += expect("tag with a long frame parses", parse(&t, t.len, &tag) == 0);
+    failed += expect("frames before a long frame are kept", strcmp(tag.title, "Title") == 0);
+    failed += expect("long frame is dropped", tag.genre[0] == 0);
+
+    // a tag size beyond the buffer is cut to the buffer
+    tag_begin(&t, 3, 0);
+    tag_frame(&t, "TIT2", 0, "Title", 0);
+    put32(&t.buf[6], 0x0fffffff, 1);
+    failed += expect("oversized tag parses", parse(&t, t.len, &tag) == 0);
+    failed += expect("oversized tag title", strcmp(tag.title, "Title") == 0);
+
+    tag_begin(&t, 2, 0);
+    tag_end(&t);
+    failed += expect("v2.2 tag is rejected", parse(&t, t.len, &tag) == -1);
+    failed += expect("short header is rejected", parse(&t, 9, &tag) == -1);
+
+    if (!failed)
+        printf("id3: all checks passed\n");
+    return failed != 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Run the Viterbi decoder, alone and on a batch of frames, the front-end
+ * filter and the resampler with every kernel variant compiled in that the
+ * CPU supports, and check them against the generic code. The integer
+ * kernels must match it bit for bit, and a batch must decode each frame as
+ * the decoder does alone; the resampler sums in another order or in fixed
+ * point, so its outputs may be rounded one step apart.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "conv.h"
+#include "firdecim_q15.h"
+#include "firdes.h"
+#include "microbench.h"
+#include "resamp_q15.h"
+
+// decimated samples per block, as in input.c
+#define BLOCK 1024
+#define BLOCKS 4
+// Q15 steps the resampler outputs may differ by
+#define RESAMP_TOLERANCE 1
+// a full batch and one frame of the next
+#define BATCH_FRAMES (CONV_BATCH + 1)
+
+typedef struct
+{
+    uint8_t conv[FRAME_LEN / 8];
+    uint8_t batch[BATCH_FRAMES][FRAME_LEN / 8];
+    int batch_ret[BATCH_FRAMES];
+    cint16_t firdecim[BLOCKS][BLOCK];
+    cint16_t resamp[BLOCKS][BLOCK + 16];
+    unsigned int resamp_count[BLOCKS];
+} outputs_t;
+
+static int8_t soft[FRAME_LEN * 3];
+static int8_t batch_soft[BATCH_FRAMES][FRAME_LEN * 3];
+static uint8_t raw[BLOCKS][BLOCK * 4];
+static cint16_t tone[BLOCKS][BLOCK];
+
+static void run(outputs_t *o)
+{
+    struct vdecoder *dec = nrsc5_conv_alloc();
+    float taps[FIRDECIM_NUM_TAPS];
+    firdecim_q15 filter;
+    resamp_q15 resamp;
+    const int8_t *in[BATCH_FRAMES];
+    uint8_t *out[BATCH_FRAMES];
+
+    nrsc5_conv_decode(dec, soft, o->conv);
+    for (unsigned int f = 0; f < BATCH_FRAMES; ++f)
+    {
+        in[f] = batch_soft[f];
+        out[f] = o->batch[f];
+    }
+    nrsc5_conv_decode_batch(dec, in, out, o->batch_ret, BATCH_FRAMES);
+    nrsc5_conv_free(dec);
+
+    firdes_kaiser(FIRDECIM_NUM_TAPS, 0.2f, 60.0f, 0.0f, taps);
+    filter = firdecim_q15_create(2, taps, FIRDECIM_NUM_TAPS);
+    for (unsigned int i = 0; i < BLOCKS; ++i)
+        firdecim_q15_execute_block(filter, raw[i], BLOCK, o->firdecim[i]);
+    firdecim_q15_destroy(filter);
+
+    resamp = resamp_q15_create(RESAMP_NUM_TAPS / 2, 0.45f, 60.0f, 16);
+    resamp_q15_set_rate(resamp, 1.00002f);
+    for (unsigned int i = 0; i < BLOCKS; ++i)
+        resamp_q15_execute_block(resamp, tone[i], BLOCK, o->resamp[i], &o->resamp_count[i]);
+    resamp_q15_destroy(resamp);
+}
+
+// Returns the number of frames of the batch in o that the decoder of the
+// selected variant decodes otherwise alone.
+static unsigned int check_batch(const outputs_t *o)
+{
+    struct vdecoder *dec = nrsc5_conv_alloc();
+    uint8_t out[FRAME_LEN / 8];
+    unsigned int differ = 0;
+
+    for (unsigned int f = 0; f < BATCH_FRAMES; ++f)
+    {
+        if (nrsc5_conv_decode(dec, batch_soft[f], out) != o->batch_ret[f] ||
+            memcmp(out, o->batch[f], sizeof(out)) != 0)
+            differ++;
+    }
+    nrsc5_conv_free(dec);
+    return differ;
+}
+
+// Returns the number of failed checks of o against the generic ref.
+static unsigned int compare(const char *variant, const outputs_t *ref, const outputs_t *o)
+{
+    unsigned int failed = 0;
+    int worst = 0;
+
+    if (memcmp(ref->conv, o->conv, sizeof(o->conv)) != 0)
+    {
+        printf("FAIL: %s conv_decode output differs from generic\n", variant);
+        failed++;
+    }
+    if (memcmp(ref->batch, o->batch, sizeof(o->batch)) != 0 ||
+        memcmp(ref->batch_ret, o->batch_ret, sizeof(o->batch_ret)) != 0)
+    {
+        printf("FAIL: %s conv_decode_batch output differs from generic\n", variant);
+        failed++;
+    }
+    if (memcmp(ref->firdecim, o->firdecim, sizeof(o->firdecim)) != 0)
+    {
+        printf("FAIL: %s firdecim output differs from generic\n", variant);
+        failed++;
+    }
+    for (unsigned int i = 0; i < BLOCKS; ++i)
+    {
+        if (o->resamp_count[i] != ref->resamp_count[i])
+        {
+            printf("FAIL: %s resamp block %u has %u outputs, generic %u\n", variant, i,
+                   o->resamp_count[i], ref->resamp_count[i]);
+            return failed + 1;
+        }
+        for (unsigned int j = 0; j < o->resamp_count[i]; ++j)
+        {
+            int dr = abs(o->resamp[i][j].r - ref->resamp[i][j].r);
+            int di = abs(o->resamp[i][j].i - ref->resamp[i][j].i);
+            if (dr > worst)
+                worst = dr;
+            if (di > worst)
+                worst = di;
+        }
+    }
+    if (worst > RESAMP_TOLERANCE)
+    {
+        printf("FAIL: %s resamp output is %d steps from generic\n", variant, worst);
+        failed++;
+    }
+
+    printf("%-8s %s\n", variant, failed ? "FAIL" : "ok");
+    return failed;
+}
+
+int main()
+{
+    static outputs_t ref, o;
+    unsigned int failed = 0;
+    uint32_t seed = 1;
+
+    // soft bits of random strength, every sixth one punctured
+    for (unsigned int i = 0; i < FRAME_LEN * 3; ++i)
+        soft[i] = i % 6 == 5 ? 0 : (int8_t)(bench_random(&seed) % 255 - 127);
+    // frames of a batch, each weaker than the last, down to noise
+    for (unsigned int f = 0; f < BATCH_FRAMES; ++f)
+    {
+        for (unsigned int i = 0; i < FRAME_LEN * 3; ++i)
+        {
+            int bit = soft[i] < 0 ? -128 : 127;
+            int noise = (int)(bench_random(&seed) % 255) - 127;
+            int v = (bit * (int)(BATCH_FRAMES - f) + noise * (int)f) / (int)BATCH_FRAMES;
+            batch_soft[f][i] = i % 6 == 5 ? 0 : (int8_t)v;
+        }
+    }
+    for (unsigned int i = 0; i < BLOCKS; ++i)
+        for (unsigned int j = 0; j < BLOCK * 4; ++j)
+            raw[i][j] = bench_random(&seed);
+    // a tone at a tenth of the sample rate
+    for (unsigned int i = 0; i < BLOCKS; ++i)
+    {
+        for (unsigned int j = 0; j < BLOCK; ++j)
+        {
+            unsigned int n = i * BLOCK + j;
+            tone[i][j].r = 16384 * cosf(2 * M_PI * n / 10);
+            tone[i][j].i = 16384 * sinf(2 * M_PI * n / 10);
+        }
+    }
+
+    for (unsigned int v = 0; v < BENCH_VARIANTS; ++v)
+    {
+        if (!bench_select(v, CPU_SSE2 | CPU_SSSE3 | CPU_AVX2 | CPU_NEON))
+        {
+            printf("%-8s skipped\n", bench_variants[v].name);
+            continue;
+        }
+        run(v == 0 ? &ref : &o);
+        if (v == 0)
+        {
+            unsigned int differ = check_batch(&ref);
+
+            if (differ)
+            {
+                printf("FAIL: %u of %u frames of the generic batch differ from conv_decode\n",
+                       differ, BATCH_FRAMES);
+                failed++;
+            }
+            printf("%-8s reference\n", bench_variants[v].name);
+        }
+        else
+        {
+            failed += compare(bench_variants[v].name, &ref, &o);
+        }
+    }
+
+    return failed != 0;
+}
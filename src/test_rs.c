@@ -0,0 +1,140 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Decode random audio frame headers, shortened codewords as in frame.c,
+ * with errors in random bytes, with rs_decode_short. Up to four errors must
+ * be corrected. With more, the header must be left unchanged with -1
+ * returned, unless the errors make it closer to another codeword, which is
+ * then decoded.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "microbench.h"
+#include "reed-solomon.h"
+
+#define RS_HEADER 96
+#define RS_PARITY 8
+#define RS_N 255
+#define TRIALS 2000
+
+static uint32_t seed = 1;
+
+static void random_header(uint8_t *codeword)
+{
+    memset(codeword, 0, RS_N);
+    for (unsigned int i = RS_PARITY; i < RS_HEADER; ++i)
+        codeword[i] = bench_random(&seed);
+    rs_encode(&codeword[RS_PARITY], RS_HEADER - RS_PARITY, codeword);
+}
+
+// Change count distinct bytes of the header.
+static void add_errors(uint8_t *codeword, unsigned int count)
+{
+    unsigned int pos[RS_HEADER];
+
+    for (unsigned int i = 0; i < RS_HEADER; ++i)
+        pos[i] = i;
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        unsigned int j = i + bench_random(&seed) % (RS_HEADER - i), p = pos[j];
+
+        pos[j] = pos[i];
+        codeword[p] ^= 1 + bench_random(&seed) % 255;
+    }
+}
+
+static unsigned int distance(const uint8_t *a, const uint8_t *b)
+{
+    unsigned int d = 0;
+    for (unsigned int i = 0; i < RS_HEADER; ++i)
+        d += a[i] != b[i];
+    return d;
+}
+
+int main(void)
+{
+    unsigned int failed = 0, rejected = 0, miscorrected = 0;
+    uint8_t clean[RS_N], received[RS_N], msg[RS_N];
+
+    rs_init();
+
+    for (unsigned int errors = 0; errors <= 4; ++errors)
+    {
+        for (unsigned int t = 0; t < TRIALS; ++t)
+        {
+            random_header(clean);
+            memcpy(received, clean, RS_N);
+            add_errors(received, errors);
+
+            memcpy(msg, received, RS_N);
+            if (rs_decode_short(msg, RS_HEADER) != (int)errors || memcmp(msg, clean, RS_HEADER) != 0)
+            {
+                printf("FAIL: rs_decode_short did not correct %u errors\n", errors);
+                failed++;
+                break;
+            }
+        }
+    }
+
+    for (unsigned int errors = 5; errors <= 16; errors += 11)
+    {
+        for (unsigned int t = 0; t < TRIALS; ++t)
+        {
+            int ret;
+
+            random_header(clean);
+            memcpy(received, clean, RS_N);
+            add_errors(received, errors);
+            memcpy(msg, received, RS_N);
+            ret = rs_decode_short(msg, RS_HEADER);
+
+            if (ret < 0)
+            {
+                rejected++;
+                if (memcmp(msg, received, RS_HEADER) != 0)
+                {
+                    printf("FAIL: rs_decode_short changed a header it could not decode\n");
+                    failed++;
+                    break;
+                }
+            }
+            else
+            {
+                // only another codeword within four bytes may be decoded
+                uint8_t check[RS_N];
+
+                memcpy(check, msg, RS_N);
+                miscorrected++;
+                if (ret > 4 || (int)distance(msg, received) != ret || rs_decode_short(check, RS_HEADER) != 0)
+                {
+                    printf("FAIL: rs_decode_short decoded %u errors to a non-codeword\n", errors);
+                    failed++;
+                    break;
+                }
+            }
+        }
+    }
+    if (rejected == 0)
+    {
+        printf("FAIL: rs_decode_short rejected no uncorrectable header\n");
+        failed++;
+    }
+
+    printf("rs: %u uncorrectable headers rejected, %u decoded to another codeword\n", rejected, miscorrected);
+    return failed != 0;
+}
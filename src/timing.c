@@ -0,0 +1,105 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+#include "timing.h"
+
+static const char *names[TIMING_STAGES] = {
+    "frontend", "acquire", "fft", "sync", "viterbi", "frame", "output"
+};
+
+// values below 8 have their own bucket, then 8 buckets per octave
+static unsigned int bucket(uint64_t ns)
+{
+    unsigned int e;
+
+    if (ns < 8)
+        return ns;
+    e = 63 - __builtin_clzll(ns);
+    return 8 * (e - 2) + ((ns >> (e - 3)) & 7);
+}
+
+// middle of the bucket
+static uint64_t bucket_value(unsigned int b)
+{
+    unsigned int e;
+
+    if (b < 8)
+        return b;
+    e = b / 8 + 2;
+    return ((uint64_t)(8 + b % 8) << (e - 3)) + ((uint64_t)1 << (e - 3)) / 2;
+}
+
+void timing_add(timing_t *t, int stage, uint64_t ns)
+{
+    timing_stage_t *s = &t->stage[stage];
+    unsigned int b;
+
+    // clock skew between cores can make a held interval look too long
+    if ((int64_t)ns < 0)
+        ns = 0;
+
+    // single writer, see stats.h
+    stats_add(&s->count, 1);
+    atomic_store_explicit(&s->total_ns, atomic_load_explicit(&s->total_ns, memory_order_relaxed) + ns, memory_order_relaxed);
+    if (ns > atomic_load_explicit(&s->max_ns, memory_order_relaxed))
+        atomic_store_explicit(&s->max_ns, ns, memory_order_relaxed);
+    b = bucket(ns);
+    atomic_store_explicit(&s->hist[b], atomic_load_explicit(&s->hist[b], memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+void timing_reset(timing_t *t)
+{
+    for (int i = 0; i < TIMING_STAGES; ++i)
+    {
+        timing_stage_t *s = &t->stage[i];
+
+        atomic_init(&s->count, 0);
+        atomic_init(&s->total_ns, 0);
+        atomic_init(&s->max_ns, 0);
+        for (int b = 0; b < TIMING_BUCKETS; ++b)
+            atomic_init(&s->hist[b], 0);
+        t->held_ns[i] = 0;
+    }
+}
+
+const char *timing_name(int stage)
+{
+    return names[stage];
+}
+
+uint64_t timing_percentile(const timing_stage_t *s, double p)
+{
+    unsigned long target = (unsigned long)(p * s->count + 0.5), sum = 0;
+    unsigned int b;
+
+    if (s->count == 0)
+        return 0;
+    if (target < 1)
+        target = 1;
+
+    for (b = 0; b < TIMING_BUCKETS; ++b)
+    {
+        sum += s->hist[b];
+        if (sum >= target)
+            break;
+    }
+    if (b == TIMING_BUCKETS)
+        return s->max_ns;
+
+    // the last occupied bucket is bounded by the maximum
+    uint64_t v = bucket_value(b);
+    return v > s->max_ns ? s->max_ns : v;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+// pipeline stages, in processing order
+enum
+{
+    TIMING_FRONTEND,    // firdecim and resampler
+    TIMING_ACQUIRE,
+    TIMING_FFT,
+    TIMING_SYNC,
+    TIMING_VITERBI,
+    TIMING_FRAME,       // Reed-Solomon and frame parsing
+    TIMING_OUTPUT,      // hdc_to_aac or FAAD2
+    TIMING_STAGES
+};
+
+// Latencies are binned with 8 buckets per octave, so percentiles are
+// within about 6% of the true value.
+#define TIMING_BUCKETS 496
+
+typedef struct
+{
+    atomic_ulong count;
+    _Atomic uint64_t total_ns;
+    _Atomic uint64_t max_ns;
+    atomic_uint hist[TIMING_BUCKETS];
+} timing_stage_t;
+
+/*
+ * Per-stage processing time. Each stage is only written by the thread that
+ * runs it, with relaxed stores, so it can be read at any time.
+ *
+ * Time spent in a downstream stage, or waiting for it, is handed back with
+ * timing_hold() so that it is not charged to the calling stage.
+ */
+typedef struct
+{
+    int enabled;
+    timing_stage_t stage[TIMING_STAGES];
+    uint64_t held_ns[TIMING_STAGES];
+} timing_t;
+
+// CLOCK_MONOTONIC in nanoseconds.
+static inline uint64_t timing_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Returns 0 if timing is disabled.
+static inline uint64_t timing_now(const timing_t *t)
+{
+    if (!t->enabled)
+        return 0;
+    return timing_clock();
+}
+
+void timing_add(timing_t *t, int stage, uint64_t ns);
+
+// Record the stage since start, returns the current time.
+static inline uint64_t timing_end(timing_t *t, int stage, uint64_t start)
+{
+    uint64_t now;
+
+    if (start == 0)
+        return 0;
+    now = timing_now(t);
+    timing_add(t, stage, now - start - t->held_ns[stage]);
+    t->held_ns[stage] = 0;
+    return now;
+}
+
+// Exclude the time since start from the current run of stage.
+static inline void timing_hold(timing_t *t, int stage, uint64_t start)
+{
+    if (start)
+        t->held_ns[stage] += timing_now(t) - start;
+}
+
+void timing_reset(timing_t *t);
+const char *timing_name(int stage);
+// Latency at or below which a fraction p of the runs completed.
+uint64_t timing_percentile(const timing_stage_t *s, double p);
@@ -0,0 +1,219 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+#include "defines.h"
+#include "trace.h"
+
+typedef struct
+{
+    uint64_t begin;
+    uint32_t dur;
+    uint32_t name;
+} trace_event_t;
+
+typedef struct trace_thread_t
+{
+    struct trace_thread_t *next;
+    unsigned int tid;
+    char name[16];
+    // spans recorded, written by the thread after each span
+    atomic_uint count;
+    trace_event_t events[TRACE_EVENTS];
+} trace_thread_t;
+
+static const char *names[TRACE_NAMES] = {
+    "frontend", "acquire", "fft", "sync", "decode", "viterbi", "segment",
+    "frame", "output", "play"
+};
+
+int trace_enabled;
+
+static FILE *trace_fp;
+static uint64_t trace_start;
+// written so far, under trace_mutex
+static unsigned long trace_spans, trace_lost;
+static int trace_first;
+static trace_thread_t *threads;
+static atomic_uint thread_count;
+static __thread trace_thread_t *self;
+
+#ifdef USE_THREADS
+// guards threads, and trace_fp against a thread exiting during trace_close
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t trace_key;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+
+static void trace_lock(void)
+{
+    pthread_mutex_lock(&trace_mutex);
+}
+
+static void trace_unlock(void)
+{
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+static void trace_unlink(trace_thread_t *t)
+{
+    trace_thread_t **p;
+
+    for (p = &threads; *p != t; p = &(*p)->next)
+        ;
+    *p = t->next;
+}
+
+static void write_thread(const trace_thread_t *t);
+
+// A thread that exits while tracing writes its spans then, so that its
+// buffer is freed as it exits.
+static void trace_exit(void *arg)
+{
+    trace_thread_t *t = arg;
+
+    trace_lock();
+    if (trace_fp)
+        write_thread(t);
+    trace_unlink(t);
+    trace_unlock();
+    free(t);
+    self = NULL;
+}
+
+static void trace_make_key(void)
+{
+    pthread_key_create(&trace_key, trace_exit);
+}
+#else
+static void trace_lock(void)
+{
+}
+
+static void trace_unlock(void)
+{
+}
+#endif
+
+// Threads join the list on their first span. The events are written before
+// they are read, so the buffer is not cleared, which would make all of it
+// resident at once.
+static trace_thread_t *trace_register(void)
+{
+    trace_thread_t *t = malloc(sizeof(*t));
+
+    if (t == NULL)
+        FATAL_EXIT("Unable to allocate trace buffer.");
+    t->tid = atomic_fetch_add(&thread_count, 1) + 1;
+#ifdef HAVE_PTHREAD_SETNAME_NP
+    if (pthread_getname_np(pthread_self(), t->name, sizeof(t->name)) != 0)
+#endif
+        snprintf(t->name, sizeof(t->name), "thread %u", t->tid);
+    atomic_init(&t->count, 0);
+
+    trace_lock();
+    t->next = threads;
+    threads = t;
+    trace_unlock();
+#ifdef USE_THREADS
+    pthread_once(&trace_once, trace_make_key);
+    pthread_setspecific(trace_key, t);
+#endif
+    self = t;
+    return t;
+}
+
+void trace_record(int name, uint64_t begin, uint64_t end)
+{
+    trace_thread_t *t = self ? self : trace_register();
+    unsigned int count = atomic_load_explicit(&t->count, memory_order_relaxed);
+    trace_event_t *e = &t->events[count % TRACE_EVENTS];
+    uint64_t dur = end - begin;
+
+    e->begin = begin;
+    e->dur = dur > UINT32_MAX ? UINT32_MAX : dur;
+    e->name = name;
+    atomic_store_explicit(&t->count, count + 1, memory_order_release);
+}
+
+int trace_open(const char *path)
+{
+    trace_fp = fopen(path, "w");
+    if (trace_fp == NULL)
+        return -1;
+    fprintf(trace_fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    trace_spans = 0;
+    trace_lost = 0;
+    trace_first = 1;
+    trace_start = timing_clock();
+    trace_enabled = 1;
+    return 0;
+}
+
+// Write the spans of t, with trace_mutex held.
+static void write_thread(const trace_thread_t *t)
+{
+    unsigned int count = atomic_load_explicit(&t->count, memory_order_acquire);
+    unsigned int i = count > TRACE_EVENTS ? count - TRACE_EVENTS : 0;
+    int pid = getpid();
+
+    fprintf(trace_fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            trace_first ? "" : ",", pid, t->tid, t->name);
+    trace_first = 0;
+    trace_spans += count - i;
+    trace_lost += i;
+
+    for (; i < count; ++i)
+    {
+        const trace_event_t *e = &t->events[i % TRACE_EVENTS];
+        uint64_t ts = e->begin - trace_start;
+
+        // microseconds, with nanosecond precision
+        fprintf(trace_fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%llu.%03u,\"dur\":%u.%03u}",
+                names[e->name], pid, t->tid, (unsigned long long)(ts / 1000), (unsigned int)(ts % 1000),
+                e->dur / 1000, e->dur % 1000);
+    }
+}
+
+void trace_close(void)
+{
+    unsigned long spans, lost;
+
+    if (trace_fp == NULL)
+        return;
+    trace_enabled = 0;
+
+    trace_lock();
+    for (trace_thread_t *t = threads; t; t = t->next)
+        write_thread(t);
+    fprintf(trace_fp, "\n]}\n");
+    fclose(trace_fp);
+    trace_fp = NULL;
+    spans = trace_spans;
+    lost = trace_lost;
+    trace_unlock();
+
+    if (lost)
+        log_info("Trace: %lu spans of %u threads, the %lu oldest were overwritten", spans, atomic_load(&thread_count), lost);
+    else
+        log_info("Trace: %lu spans of %u threads", spans, atomic_load(&thread_count));
+}
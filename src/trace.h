@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "timing.h"
+
+/*
+ * Timeline of the pipeline stages on every thread, written as Chrome trace
+ * JSON for chrome://tracing or ui.perfetto.dev.
+ *
+ * Each thread records into a ring of its own last TRACE_EVENTS spans, so
+ * recording takes no lock. A span started while tracing is off costs a
+ * load and a branch.
+ */
+#define TRACE_EVENTS 65536
+
+// spans, which nest when one stage runs another inline
+enum
+{
+    TRACE_FRONTEND,     // firdecim and resampler, in input_cb
+    TRACE_ACQUIRE,
+    TRACE_FFT,
+    TRACE_SYNC,
+    TRACE_DECODE,
+    TRACE_VITERBI,      // nrsc5_conv_decode
+    TRACE_SEGMENT,      // a Viterbi segment on a worker
+    TRACE_FRAME,
+    TRACE_OUTPUT,       // output_push
+    TRACE_PLAY,         // ao_play on the output worker
+    TRACE_NAMES
+};
+
+extern int trace_enabled;
+
+// Returns 0 if tracing is off.
+static inline uint64_t trace_begin(void)
+{
+    if (!trace_enabled)
+        return 0;
+    return timing_clock();
+}
+
+void trace_record(int name, uint64_t begin, uint64_t end);
+
+// Record span name since begin.
+static inline void trace_end(int name, uint64_t begin)
+{
+    if (begin)
+        trace_record(name, begin, timing_clock());
+}
+
+// Start tracing, before the decoder threads are started. Returns -1 if
+// path cannot be written.
+int trace_open(const char *path);
+// Write the spans recorded so far, once decoding has ended, and stop.
+void trace_close(void);